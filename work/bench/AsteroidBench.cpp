@@ -0,0 +1,58 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "Bench.hpp"
+#include "AsteroidBelt.hpp"
+
+void benchAsteroids(Bench &bench) {
+	// From just outside the belt, looking across the sun, so some of it is out of view
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 15.0f, 60.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+	for (int count : { 100000, 1000000 }) {
+		AsteroidBelt::Settings settings;
+		settings.count = count;
+		settings.seed = Bench::BENCH_SEED;
+		AsteroidBelt belt(settings);
+		std::vector<AsteroidBelt::Instance> instances(count);
+		double time = 0.0;
+
+		// Every rock one at a time with the library sin and cos, and no culling
+		std::string name = "asteroids/scalar/rocks=" + std::to_string(count);
+		if (bench.selected(name)) {
+			std::vector<float> radius(count), phase(count), speed(count);
+			for (int i = 0; i < count; i++) {
+				radius[i] = settings.innerRadius + (settings.outerRadius - settings.innerRadius) * (i % 1000) / 1000.0f;
+				phase[i] = (i % 6283) / 1000.0f;
+				speed[i] = std::sqrt(settings.centralMass / (radius[i] * radius[i] * radius[i]));
+			}
+			bench.run(name, [&]() {
+				time += 1.0 / 60.0;
+				for (int i = 0; i < count; i++) {
+					float angle = phase[i] + speed[i] * float(time);
+					instances[i].positionScale = glm::vec4(radius[i] * std::cos(angle), 0.0f, -radius[i] * std::sin(angle), 0.03f);
+					instances[i].axisAngle = glm::vec4(0.0f, 1.0f, 0.0f, float(time));
+					instances[i].colour = 0xffffffffu;
+				}
+				doNotOptimize(instances);
+			});
+			bench.counter("rocks_per_s", count / (bench.results().back().medianMs / 1000.0));
+		}
+
+		// Four at a time across the pool, then only the chunks in view written out
+		name = "asteroids/belt/rocks=" + std::to_string(count);
+		if (bench.selected(name)) {
+			bench.run(name, [&]() {
+				time += 1.0 / 60.0;
+				belt.prepare(time, glm::vec3(0.0f), projection * view);
+				belt.writeInstances(instances.data());
+				doNotOptimize(instances);
+			});
+			bench.counter("rocks_per_s", count / (bench.results().back().medianMs / 1000.0));
+			bench.counter("visible", double(belt.visibleCount()) / count);
+		}
+	}
+}
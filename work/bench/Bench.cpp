@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "Bench.hpp"
+
+void Bench::run(const std::string &name, const std::function<void()> &body, const std::function<void()> &setup) {
+	if (!selected(name)) {
+		return;
+	}
+	for (int i = 0; i < m_options.warmup; i++) {
+		if (setup) setup();
+		body();
+	}
+	std::vector<double> times;
+	for (int i = 0; i < m_options.samples; i++) {
+		if (setup) setup();
+		auto start = std::chrono::steady_clock::now();
+		body();
+		auto end = std::chrono::steady_clock::now();
+		times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+
+	Result result;
+	result.name = name;
+	result.samples = (int)times.size();
+	if (!times.empty()) {
+		std::sort(times.begin(), times.end());
+		double sum = 0.0;
+		for (double t : times) {
+			sum += t;
+		}
+		result.meanMs = sum / times.size();
+		double squares = 0.0;
+		for (double t : times) {
+			squares += (t - result.meanMs) * (t - result.meanMs);
+		}
+		result.stddevMs = std::sqrt(squares / times.size());
+		result.minMs = times.front();
+		result.medianMs = (times.size() % 2) ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) * 0.5;
+		// Nearest rank
+		size_t rank = (size_t)std::ceil(0.95 * times.size());
+		result.p95Ms = times.at(std::max<size_t>(rank, 1) - 1);
+	}
+	m_results.push_back(result);
+
+	std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(4)
+		<< " median " << std::setw(10) << result.medianMs << " ms"
+		<< "  min " << std::setw(10) << result.minMs << " ms"
+		<< "  p95 " << std::setw(10) << result.p95Ms << " ms"
+		<< "  sd " << std::setw(8) << result.stddevMs << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+}
+
+void Bench::counter(const std::string &name, double value) {
+	if (m_results.empty()) {
+		return;
+	}
+	m_results.back().counters.push_back(std::make_pair(name, value));
+	std::cout << "    " << name << ": " << value << std::endl;
+}
+
+bool Bench::selected(const std::string &name) const {
+	return m_options.filter.empty() || name.find(m_options.filter) != std::string::npos;
+}
+
+// Names are made by the cases themselves, but quote them properly anyway
+static std::string jsonString(const std::string &s) {
+	std::string out = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+		}
+		out += c;
+	}
+	return out + "\"";
+}
+
+bool Bench::writeJson(const std::string &filename) const {
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		return false;
+	}
+	file << std::setprecision(9);
+	file << "{\n  \"seed\": " << BENCH_SEED << ",\n  \"warmup\": " << m_options.warmup
+		<< ",\n  \"samples\": " << m_options.samples << ",\n  \"benchmarks\": [\n";
+	for (size_t i = 0; i < m_results.size(); i++) {
+		const Result &r = m_results[i];
+		file << "    {\"name\": " << jsonString(r.name) << ", \"samples\": " << r.samples
+			<< ", \"min_ms\": " << r.minMs << ", \"median_ms\": " << r.medianMs
+			<< ", \"mean_ms\": " << r.meanMs << ", \"stddev_ms\": " << r.stddevMs
+			<< ", \"p95_ms\": " << r.p95Ms;
+		for (const auto &c : r.counters) {
+			file << ", " << jsonString(c.first) << ": " << c.second;
+		}
+		file << "}" << (i + 1 < m_results.size() ? "," : "") << "\n";
+	}
+	file << "  ]\n}\n";
+	return file.good();
+}
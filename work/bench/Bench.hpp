@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A small microbenchmark runner. Each case is run for some warm up samples that are thrown
+// away, then timed sample by sample. Anything random inside a case should use BENCH_SEED so
+// that runs can be compared
+class Bench {
+public:
+	static const unsigned int BENCH_SEED = 12345;
+
+	struct Options {
+		int warmup = 3;
+		int samples = 20;
+		std::string filter; // Only run cases whose name contains this
+		std::string jsonFile; // Results are also written here as JSON
+	};
+
+	struct Result {
+		std::string name;
+		int samples = 0;
+		double minMs = 0.0;
+		double medianMs = 0.0;
+		double meanMs = 0.0;
+		double stddevMs = 0.0;
+		double p95Ms = 0.0;
+		// Extra numbers a case wants reported, e.g. vertices per second
+		std::vector<std::pair<std::string, double>> counters;
+	};
+
+	explicit Bench(const Options &options) : m_options(options) { }
+
+	// Times `body`. `setup` runs before every sample and isn't timed
+	void run(const std::string &name, const std::function<void()> &body,
+		const std::function<void()> &setup = std::function<void()>());
+
+	// Adds a number to the last case run, e.g. throughput
+	void counter(const std::string &name, double value);
+
+	bool selected(const std::string &name) const;
+	const std::vector<Result> &results() const { return m_results; }
+	const Options &options() const { return m_options; }
+
+	// Returns false if the file couldn't be written
+	bool writeJson(const std::string &filename) const;
+
+private:
+	Options m_options;
+	std::vector<Result> m_results;
+};
+
+// Keeps the compiler from throwing away a result that is never used
+template <typename T>
+inline void doNotOptimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "g"(&value) : "memory");
+#else
+	static volatile const void *sink;
+	sink = &value;
+#endif
+}
+
+// Benchmarks for planet and tree generation and resource loading
+void benchGeneration(Bench &bench);
+
+// Benchmarks for sorting point lights into clusters
+void benchLighting(Bench &bench);
+
+// Benchmarks for working out the shader matrices of every draw
+void benchTransforms(Bench &bench);
+
+// Benchmarks for stepping the N-body gravity simulation
+void benchGravity(Bench &bench);
+
+// Benchmarks for moving the asteroid belt and writing out the rocks in view
+void benchAsteroids(Bench &bench);
+
+// Benchmarks for placing bodies on their Kepler orbits from a catalogue
+void benchKepler(Bench &bench);
+
+// Benchmarks for finding every pair of bodies that touch
+void benchCollisions(Bench &bench);
+
+// Benchmarks for building a planets picking tree and firing rays at it
+void benchPicking(Bench &bench);
+
+// Benchmarks for eroding a planets surface at each subdivision level
+void benchErosion(Bench &bench);
+
+// Benchmarks for picking the stars of a galaxy to draw as the camera flies through it
+void benchGalaxy(Bench &bench);
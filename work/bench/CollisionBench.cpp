@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Bench.hpp"
+#include "CollisionSystem.hpp"
+
+/*
+* A wide belt of rocks with a handful of planets in it, every rock on its own circular orbit
+*/
+struct CollisionBelt {
+	std::vector<float> orbitRadius, phase, speed, height;
+	std::vector<float> x, y, z, radius;
+
+	explicit CollisionBelt(int count) {
+		std::mt19937 random(Bench::BENCH_SEED);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		for (int i = 0; i < count; i++) {
+			float r = 20.0f + 40.0f * unit(random);
+			orbitRadius.push_back(r);
+			phase.push_back(6.2831853f * unit(random));
+			speed.push_back(std::sqrt(100.0f / (r * r * r)));
+			height.push_back(2.0f * unit(random) - 1.0f);
+			// Mostly small, a few planets
+			float size = unit(random);
+			radius.push_back(i % 100000 == 0 ? 1.0f + 2.0f * unit(random) : 0.02f + 0.08f * size * size * size);
+		}
+		x.resize(count);
+		y = height;
+		z.resize(count);
+	}
+
+	void move(double time) {
+		for (size_t i = 0; i < x.size(); i++) {
+			float angle = phase[i] + speed[i] * float(time);
+			x[i] = orbitRadius[i] * std::cos(angle);
+			z[i] = -orbitRadius[i] * std::sin(angle);
+		}
+	}
+};
+
+void benchCollisions(Bench &bench) {
+	for (int count : { 100000, 1000000 }) {
+		CollisionBelt belt(count);
+		double time = 0.0;
+
+		// Sort along x and sweep, every body against everything that overlaps it along x
+		std::string name = "collisions/sweep-x/bodies=" + std::to_string(count);
+		if (bench.selected(name)) {
+			std::vector<std::pair<float, uint32_t>> order(count);
+			size_t pairs = 0;
+			bench.run(name, [&]() {
+				time += 0.01;
+				belt.move(time);
+				for (int i = 0; i < count; i++) {
+					order[i] = std::make_pair(belt.x[i] - belt.radius[i], uint32_t(i));
+				}
+				std::sort(order.begin(), order.end());
+				pairs = 0;
+				for (int i = 0; i < count; i++) {
+					uint32_t a = order[i].second;
+					float right = belt.x[a] + belt.radius[a];
+					for (int j = i + 1; j < count && order[j].first < right; j++) {
+						uint32_t b = order[j].second;
+						float dx = belt.x[a] - belt.x[b], dy = belt.y[a] - belt.y[b], dz = belt.z[a] - belt.z[b];
+						float reach = belt.radius[a] + belt.radius[b];
+						pairs += dx * dx + dy * dy + dz * dz < reach * reach;
+					}
+				}
+				doNotOptimize(pairs);
+			});
+			bench.counter("bodies_per_s", count / (bench.results().back().medianMs / 1000.0));
+			bench.counter("pairs", double(pairs));
+		}
+
+		// Cells sorted along a Morton curve, across the pool
+		name = "collisions/grid/bodies=" + std::to_string(count);
+		if (bench.selected(name)) {
+			CollisionSystem collisions;
+			bench.run(name, [&]() {
+				time += 0.01;
+				belt.move(time);
+				collisions.detect(belt.x.data(), belt.y.data(), belt.z.data(), belt.radius.data(), count);
+				doNotOptimize(collisions.pairs());
+			});
+			const CollisionSystem::Stats &stats = collisions.stats();
+			bench.counter("bodies_per_s", count / (bench.results().back().medianMs / 1000.0));
+			bench.counter("pairs", double(stats.pairs));
+			bench.counter("tests_per_body", double(stats.candidates) / count);
+			bench.counter("sort_ms", stats.sortMs);
+			bench.counter("sweep_ms", stats.sweepMs);
+		}
+	}
+}
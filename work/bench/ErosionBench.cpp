@@ -0,0 +1,80 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Bench.hpp"
+#include "Planet.hpp"
+#include "TerrainErosion.hpp"
+
+// Iterations of each kind of erosion in a sample
+static const int ITERATIONS = 20;
+
+void benchErosion(Bench &bench) {
+	PlanetInfo pi;
+	pi.location = glm::vec3(5.0f, 0.0f, 0.0f);
+	pi.rotationSpeed = 1.0f;
+	pi.seed = Bench::BENCH_SEED;
+	for (int i = 0; i < 6; i++) {
+		pi.colorSet1.push_back(glm::vec3(i / 6.0f));
+	}
+	Planet planet(pi, 0, 4, 1.0f, 2.0f, 3);
+
+	for (int level : { 4, 5, 6, 7 }) {
+		std::string graph = "erosion/graph/level=" + std::to_string(level);
+		std::string thermal = "erosion/thermal/level=" + std::to_string(level);
+		std::string hydraulic = "erosion/hydraulic/level=" + std::to_string(level);
+		if (!bench.selected(graph) && !bench.selected(thermal) && !bench.selected(hydraulic)) continue;
+
+		// The noise at this level, as the planet would have it before eroding
+		planet.subdivisions = level;
+		planet.generateIcosahedron();
+		planet.subdivideIcosahedron();
+		planet.modifiedVerticies.clear();
+		std::vector<float> noise;
+		for (size_t i = 0; i < planet.originalVerticies.size(); i++) {
+			noise.push_back(glm::length(planet.surfacePoint(int(i))));
+		}
+		double vertices = double(noise.size());
+
+		std::unique_ptr<TerrainErosion> erosion;
+		bench.run(graph, [&]() {
+			erosion.reset(new TerrainErosion(planet.originalVerticies, planet.lodAdjacency.back()));
+		});
+		if (bench.selected(graph)) {
+			bench.counter("vertices_per_s", vertices / (bench.results().back().medianMs / 1000.0));
+			bench.counter("edges", double(erosion->stats().edges));
+		}
+		if (!erosion) {
+			erosion.reset(new TerrainErosion(planet.originalVerticies, planet.lodAdjacency.back()));
+		}
+
+		std::vector<float> heights;
+		TerrainErosion::Settings settings;
+		settings.thermalIterations = ITERATIONS;
+		bench.run(thermal, [&]() {
+			heights = noise;
+			erosion->erode(heights, settings);
+			doNotOptimize(heights[0]);
+		});
+		if (bench.selected(thermal)) {
+			bench.counter("vertex_iterations_per_s", vertices * ITERATIONS / (bench.results().back().medianMs / 1000.0));
+			bench.counter("ms_per_iteration", bench.results().back().medianMs / ITERATIONS);
+			bench.counter("mean_change", erosion->stats().meanChange);
+		}
+
+		settings.thermalIterations = 0;
+		settings.hydraulicIterations = ITERATIONS;
+		bench.run(hydraulic, [&]() {
+			heights = noise;
+			erosion->erode(heights, settings);
+			doNotOptimize(heights[0]);
+		});
+		if (bench.selected(hydraulic)) {
+			bench.counter("vertex_iterations_per_s", vertices * ITERATIONS / (bench.results().back().medianMs / 1000.0));
+			bench.counter("ms_per_iteration", bench.results().back().medianMs / ITERATIONS);
+			bench.counter("mean_change", erosion->stats().meanChange);
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Bench.hpp"
+#include "Galaxy.hpp"
+
+// Frames of a flight in each sample, and how far the camera goes each frame
+static const int FRAMES = 60;
+static const double FRAME_DISTANCE = 500.0;
+// Places the nearest system is looked for around
+static const int LOOKUPS = 100;
+
+// Nothing is entered, so no planets are ever made
+static std::vector<Planet> noPlanets(const Galaxy::StarSystem &) {
+	return std::vector<Planet>();
+}
+
+void benchGalaxy(Bench &bench) {
+	Galaxy::Settings settings;
+	settings.seed = Bench::BENCH_SEED;
+	// Out along the disc, across the plane
+	glm::dvec3 start(settings.discLength, 0.0, -0.5 * FRAMES * FRAME_DISTANCE);
+	glm::dvec3 step(0.0, 0.0, FRAME_DISTANCE);
+
+	for (size_t points : { 4000, 16000, 64000 }) {
+		std::string cold = "galaxy/first-frame/points=" + std::to_string(points);
+		std::string flight = "galaxy/flight/points=" + std::to_string(points);
+		if (!bench.selected(cold) && !bench.selected(flight)) continue;
+		settings.maxPoints = points;
+
+		// Splitting everything in view from just the root
+		std::unique_ptr<Galaxy> galaxy;
+		bench.run(cold, [&]() {
+			galaxy->prepare(start, 0.002);
+			doNotOptimize(galaxy->points().size());
+		}, [&]() {
+			galaxy.reset(new Galaxy(settings, noPlanets));
+		});
+		if (bench.selected(cold)) {
+			bench.counter("nodes", double(galaxy->nodeCount()));
+			bench.counter("near_systems", double(galaxy->nearSystems()));
+		}
+
+		// A frame at a time from where the last sample stopped, splitting what comes into
+		// view and trimming what's left behind
+		galaxy.reset(new Galaxy(settings, noPlanets));
+		size_t maxNodes = 0;
+		int frame = 0;
+		bench.run(flight, [&]() {
+			for (int i = 0; i < FRAMES; i++, frame++) {
+				galaxy->prepare(start + double(frame % (FRAMES * 4)) * step, 0.002);
+				maxNodes = std::max(maxNodes, galaxy->nodeCount());
+			}
+			doNotOptimize(galaxy->points().size());
+		});
+		if (bench.selected(flight)) {
+			bench.counter("ms_per_frame", bench.results().back().medianMs / FRAMES);
+			bench.counter("max_nodes", double(maxNodes));
+		}
+	}
+
+	if (bench.selected("galaxy/nearest")) {
+		Galaxy galaxy(settings, noPlanets);
+		size_t found = 0;
+		bench.run("galaxy/nearest", [&]() {
+			found = 0;
+			for (int i = 0; i < LOOKUPS; i++) {
+				Galaxy::StarSystem system;
+				found += galaxy.nearest(start + double(i) * step, 3000.0, system);
+			}
+		});
+		bench.counter("lookups_per_s", LOOKUPS / (bench.results().back().medianMs / 1000.0));
+		bench.counter("found", double(found));
+	}
+}
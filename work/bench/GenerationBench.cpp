@@ -0,0 +1,315 @@
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "cgra/matrix.hpp"
+#include "cgra/mesh.hpp"
+#include "cgra/meshadjacency.hpp"
+#include "cgra/shader.hpp"
+#include "cgra/wavefront.hpp"
+
+#include "Bench.hpp"
+#include "LSystem.hpp"
+#include "Planet.hpp"
+
+// Finest level the subdivision benchmark goes to, each level has four times the triangles
+static const int MAX_BENCH_LEVEL = 6;
+// Level used where a case needs a planet to work on
+static const int PLANET_LEVEL = 5;
+// Strings grow exponentially, past this some rule sets take seconds per generation
+static const int MAX_TREE_GENERATION = 5;
+
+/*
+* A planet built from a fixed seed, like SolarSystem makes them
+*/
+static PlanetInfo benchPlanetInfo(int numColours) {
+	PlanetInfo pi;
+	pi.location = glm::vec3(5.0f, 0.0f, 0.0f);
+	pi.rotationSpeed = 1.0f;
+	for (int i = 0; i < numColours; i++) {
+		pi.colorSet1.push_back(glm::vec3(float(i) / numColours));
+	}
+	return pi;
+}
+
+static void benchSubdivision(Bench &bench, Planet &planet) {
+	for (int level = 0; level <= MAX_BENCH_LEVEL; level++) {
+		bench.run("subdivide/level=" + std::to_string(level), [&]() {
+			planet.subdivisions = level;
+			planet.generateIcosahedron();
+			planet.subdivideIcosahedron();
+		});
+		if (bench.selected("subdivide/level=" + std::to_string(level))) {
+			bench.counter("vertices", (double)planet.originalVerticies.size());
+		}
+	}
+}
+
+static void benchNoise(Bench &bench, const std::vector<glm::vec3> &points) {
+	const char *types[] = { "perlin", "simplex" };
+	for (int type = 0; type < 2; type++) {
+		for (int octaves = 1; octaves <= 8; octaves++) {
+			std::string name = std::string("noise/") + types[type] + "/octaves=" + std::to_string(octaves);
+			bench.run(name, [&]() {
+				float sum = 0.0f;
+				for (const glm::vec3 &p : points) {
+					sum += Planet::fractalNoise(p, octaves, 1.0f, 2.0f, type == 0, type == 1);
+				}
+				doNotOptimize(sum);
+			});
+			if (bench.selected(name) && !bench.results().empty()) {
+				bench.counter("points_per_s", points.size() / (bench.results().back().medianMs / 1000.0));
+			}
+		}
+	}
+}
+
+static void benchVoronoi(Bench &bench) {
+	for (int sites : { 5, 10, 20, 40, 80 }) {
+		std::string name = "voronoi/sites=" + std::to_string(sites);
+		if (!bench.selected(name)) {
+			continue;
+		}
+		Planet planet(benchPlanetInfo(sites + 1), 0, 4, 1.0f, 2.0f, PLANET_LEVEL);
+		planet.seed = Bench::BENCH_SEED;
+		planet.numberOfSites = sites;
+		planet.generateTerrain();
+		bench.run(name, [&]() {
+			planet.voronoiCells();
+		});
+		bench.counter("vertices", (double)planet.modifiedVerticies.size());
+	}
+}
+
+static void benchMeshSetData(Bench &bench, Planet &planet) {
+	for (int level = 2; level <= MAX_BENCH_LEVEL; level++) {
+		std::string name = "mesh_setData/level=" + std::to_string(level);
+		if (!bench.selected(name)) {
+			continue;
+		}
+		planet.subdivisions = level;
+		planet.generateIcosahedron();
+		planet.subdivideIcosahedron();
+		cgra::Matrix<double> vertices(planet.originalVerticies.size(), 3);
+		std::vector<glm::vec3> colours;
+		for (unsigned int i = 0; i < planet.originalVerticies.size(); i++) {
+			glm::vec3 v = planet.originalVerticies[i];
+			vertices.setRow(i, { v.x, v.y, v.z });
+			colours.push_back(glm::vec3(0.5f));
+		}
+		cgra::Matrix<unsigned int> triangles(planet.originalTriangles.size(), 3);
+		for (unsigned int i = 0; i < planet.originalTriangles.size(); i++) {
+			const std::vector<unsigned int> &t = planet.originalTriangles[i];
+			triangles.setRow(i, { t[0], t[1], t[2] });
+		}
+		// setData doesn't touch OpenGL, the buffers are only made when drawing
+		cgra::Mesh mesh;
+		bench.run(name, [&]() {
+			mesh.setData(vertices, triangles, colours);
+		});
+		bench.counter("triangles", (double)triangles.numRows());
+	}
+}
+
+/*
+* Building the one-ring of a level on its own, and the vertex normals gathered round it, to set
+* against subdivide and mesh_setData at the same level
+*/
+static void benchAdjacency(Bench &bench, Planet &planet) {
+	for (int level = 2; level <= MAX_BENCH_LEVEL; level++) {
+		std::string build = "adjacency/level=" + std::to_string(level);
+		std::string normals = "adjacency_normals/level=" + std::to_string(level);
+		if (!bench.selected(build) && !bench.selected(normals)) {
+			continue;
+		}
+		planet.subdivisions = level;
+		planet.generateIcosahedron();
+		planet.subdivideIcosahedron();
+		cgra::MeshAdjacency adjacency;
+		bench.run(build, [&]() {
+			adjacency = cgra::MeshAdjacency(planet.originalVerticies.size(), planet.originalTriangles);
+		});
+		if (bench.selected(build)) {
+			bench.counter("vertices_per_s", planet.originalVerticies.size() / (bench.results().back().medianMs / 1000.0));
+			bench.counter("edges", (double)planet.lodAdjacency.back()->edges());
+		}
+		std::vector<glm::vec3> vertexNormals;
+		bench.run(normals, [&]() {
+			planet.lodAdjacency.back()->normals(planet.originalVerticies, vertexNormals);
+			doNotOptimize(vertexNormals[0]);
+		});
+		if (bench.selected(normals)) {
+			bench.counter("vertices_per_s", planet.originalVerticies.size() / (bench.results().back().medianMs / 1000.0));
+		}
+	}
+}
+
+/*
+* A full rebuild of the surface against the edits the staged pipeline only partly reruns for
+*/
+static void benchPipeline(Bench &bench) {
+	for (int level : { PLANET_LEVEL, MAX_BENCH_LEVEL }) {
+		std::string suffix = "/level=" + std::to_string(level);
+		const char *cases[] = { "pipeline/full", "pipeline/amplitude", "pipeline/octaves", "pipeline/biomes", "pipeline/colours" };
+		bool any = false;
+		for (const char *name : cases) {
+			any = any || bench.selected(name + suffix);
+		}
+		if (!any) {
+			continue;
+		}
+		PlanetInfo pi = benchPlanetInfo(6);
+		pi.seed = Bench::BENCH_SEED;
+		Planet planet(pi, 0, 4, 1.0f, 2.0f, level);
+		double vertices = (double)planet.originalVerticies.size();
+		auto edit = [&](const std::string &name, Planet::TerrainStage stage, const std::function<void()> &change) {
+			bench.run(name + suffix, [&]() {
+				change();
+				planet.invalidate(stage);
+				planet.updateTerrain();
+			});
+			if (bench.selected(name + suffix)) {
+				bench.counter("vertices_per_s", vertices / (bench.results().back().medianMs / 1000.0));
+			}
+		};
+		bench.run("pipeline/full" + suffix, [&]() {
+			planet.generateTerrain();
+		});
+		if (bench.selected("pipeline/full" + suffix)) {
+			bench.counter("vertices_per_s", vertices / (bench.results().back().medianMs / 1000.0));
+		}
+		edit("pipeline/amplitude", Planet::STAGE_DISPLACEMENT, [&]() {
+			planet.amplitude = planet.amplitude == 2.0f ? 2.5f : 2.0f;
+		});
+		edit("pipeline/octaves", Planet::STAGE_DISPLACEMENT, [&]() {
+			planet.octaves = planet.octaves == 4 ? 5 : 4;
+		});
+		edit("pipeline/biomes", Planet::STAGE_BIOMES, [&]() {
+			planet.seed++;
+		});
+		edit("pipeline/colours", Planet::STAGE_COLOURS, [&]() {
+			planet.cs1[1] = glm::vec3(1.0f) - planet.cs1[1];
+		});
+	}
+}
+
+static void benchLSystems(Bench &bench) {
+	const char *files[] = { "Basic", "Basic2", "ProbTree3", "Test", "Tree1", "Tree2", "Tree4", "Tree5" };
+	for (const char *file : files) {
+		std::string prefix = std::string("lsystem/") + file;
+		if (!bench.selected(prefix)) {
+			continue;
+		}
+		LSystem tree;
+		tree.readRules(std::string(CGRA_SRCDIR "/res/TreeFiles/") + file + ".txt");
+		int generations = glm::min(glm::max(tree.generations, 1), MAX_TREE_GENERATION);
+		for (int gen = 1; gen <= generations; gen++) {
+			// Only the last generation is timed, the ones before it are setup
+			bench.run(prefix + "/gen=" + std::to_string(gen), [&]() {
+				tree.generate();
+			}, [&]() {
+				tree.setSeed(Bench::BENCH_SEED);
+				tree.resetTree();
+				for (int g = 1; g < gen; g++) {
+					tree.generate();
+				}
+			});
+			if (bench.selected(prefix + "/gen=" + std::to_string(gen))) {
+				bench.counter("length", (double)tree.currentTree.size());
+			}
+		}
+	}
+}
+
+/*
+* Writes copies of a subdivided sphere as one big OBJ, standing in for a model library
+*/
+static size_t writeSyntheticObj(const std::string &filename, Planet &planet, int copies) {
+	std::ofstream file(filename);
+	unsigned int base = 0;
+	for (int copy = 0; copy < copies; copy++) {
+		file << "o sphere" << copy << "\n";
+		for (const glm::vec3 &v : planet.originalVerticies) {
+			glm::vec3 p = v + glm::vec3(copy * 3.0f, 0.0f, 0.0f);
+			file << "v " << p.x << " " << p.y << " " << p.z << "\n";
+			file << "vn " << v.x << " " << v.y << " " << v.z << "\n";
+		}
+		for (const std::vector<unsigned int> &t : planet.originalTriangles) {
+			file << "f " << base + t[0] + 1 << "//" << base + t[0] + 1
+				<< " " << base + t[1] + 1 << "//" << base + t[1] + 1
+				<< " " << base + t[2] + 1 << "//" << base + t[2] + 1 << "\n";
+		}
+		base += (unsigned int)planet.originalVerticies.size();
+	}
+	return (size_t)file.tellp();
+}
+
+static void benchResources(Bench &bench, Planet &planet) {
+	bench.run("wavefront/Ring.obj", []() {
+		cgra::Wavefront obj = cgra::Wavefront::load(CGRA_SRCDIR "/res/Ring.obj");
+		doNotOptimize(obj.m_faces.size());
+	});
+	bench.run("wavefront_indexed/Ring.obj", []() {
+		cgra::Wavefront::IndexedMesh obj = cgra::Wavefront::loadIndexed(CGRA_SRCDIR "/res/Ring.obj");
+		doNotOptimize(obj.m_indices.size());
+	});
+
+	if (bench.selected("wavefront/synthetic") || bench.selected("wavefront_indexed/synthetic")) {
+		planet.subdivisions = MAX_BENCH_LEVEL;
+		planet.generateIcosahedron();
+		planet.subdivideIcosahedron();
+		std::string filename = "bench_synthetic.obj";
+		double megabytes = writeSyntheticObj(filename, planet, 8) / (1024.0 * 1024.0);
+		bench.run("wavefront/synthetic", [&]() {
+			cgra::Wavefront obj = cgra::Wavefront::load(filename.c_str());
+			doNotOptimize(obj.m_faces.size());
+		});
+		if (bench.selected("wavefront/synthetic")) {
+			bench.counter("mb_per_s", megabytes / (bench.results().back().medianMs / 1000.0));
+		}
+		bench.run("wavefront_indexed/synthetic", [&]() {
+			cgra::Wavefront::IndexedMesh obj = cgra::Wavefront::loadIndexed(filename.c_str());
+			doNotOptimize(obj.m_indices.size());
+		});
+		if (bench.selected("wavefront_indexed/synthetic")) {
+			bench.counter("mb_per_s", megabytes / (bench.results().back().medianMs / 1000.0));
+		}
+		std::remove(filename.c_str());
+	}
+
+	// Same tables the light scene loads, a program with no GL object is enough to parse them
+	struct { const char *name; const char *path; int size; } tables[] = {
+		{ "airlight/F.csv", CGRA_SRCDIR "/res/lookups/F.csv", 512 },
+		{ "airlight/G0.csv", CGRA_SRCDIR "/res/lookups/G0.csv", 64 },
+		{ "airlight/G20.csv", CGRA_SRCDIR "/res/lookups/G20.csv", 64 },
+	};
+	cgra::Program program;
+	for (const auto &table : tables) {
+		std::vector<GLubyte> data;
+		bench.run(table.name, [&]() {
+			program.buildAirlightData(table.path, data, table.size, table.size);
+			doNotOptimize(data[0]);
+		});
+	}
+}
+
+void benchGeneration(Bench &bench) {
+	Planet planet(benchPlanetInfo(6), 0, 4, 1.0f, 2.0f, PLANET_LEVEL);
+	planet.seed = Bench::BENCH_SEED;
+	planet.generateTerrain();
+	// Points on the unit sphere to sample the noise at
+	std::vector<glm::vec3> points(planet.originalVerticies.begin(), planet.originalVerticies.end());
+
+	benchSubdivision(bench, planet);
+	benchNoise(bench, points);
+	benchVoronoi(bench);
+	benchMeshSetData(bench, planet);
+	benchAdjacency(bench, planet);
+	benchPipeline(bench);
+	benchLSystems(bench);
+	benchResources(bench, planet);
+}
@@ -0,0 +1,61 @@
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#include "glm/glm.hpp"
+
+#include "Bench.hpp"
+#include "GravitySystem.hpp"
+
+// Mass of the body every other body orbits
+static const float CENTRE_MASS = 1.0f;
+// Time step, about a thousandth of an orbit at the inner edge of the disc
+static const float STEP = 0.002f;
+
+/*
+* A thin disc of light bodies on circular orbits around one heavy one, like an asteroid belt
+*/
+static void benchDisc(GravitySystem &system, int count) {
+	std::srand(Bench::BENCH_SEED);
+	system.clear();
+	system.addBody(glm::vec3(0.0f), glm::vec3(0.0f), CENTRE_MASS);
+	float bodyMass = 0.01f * CENTRE_MASS / count;
+	for (int i = 0; i < count; i++) {
+		float radius = 1.0f + 4.0f * (rand() % 1000) / 1000.0f;
+		float angle = (rand() % 6283) / 1000.0f;
+		float height = 0.05f * ((rand() % 1000) / 500.0f - 1.0f);
+		glm::vec3 position(radius * std::cos(angle), height, radius * std::sin(angle));
+		float speed = std::sqrt(system.settings().G * CENTRE_MASS / radius);
+		glm::vec3 velocity = speed * glm::vec3(-std::sin(angle), 0.0f, std::cos(angle));
+		system.addBody(position, velocity, bodyMass);
+	}
+}
+
+void benchGravity(Bench &bench) {
+	struct Case {
+		int bodies;
+		GravitySystem::Integrator integrator;
+	};
+	for (Case c : { Case{ 1000, GravitySystem::LEAPFROG }, Case{ 10000, GravitySystem::LEAPFROG },
+		Case{ 100000, GravitySystem::LEAPFROG }, Case{ 10000, GravitySystem::YOSHIDA } }) {
+		std::string name = std::string("gravity/step/") + (c.integrator == GravitySystem::YOSHIDA ? "yoshida" : "leapfrog") +
+			"/bodies=" + std::to_string(c.bodies);
+		if (!bench.selected(name)) continue;
+
+		GravitySystem::Settings settings;
+		settings.integrator = c.integrator;
+		GravitySystem system(settings);
+		benchDisc(system, c.bodies);
+		double startEnergy = system.energy();
+		uint64_t interactions = 0;
+		bench.run(name, [&]() {
+			system.step(STEP);
+			interactions = system.interactions();
+			doNotOptimize(system.x());
+		});
+		// Every step keeps going from where the last left off, so the drift is over all of them
+		double evaluations = c.integrator == GravitySystem::YOSHIDA ? 3.0 : 1.0;
+		bench.counter("interactions_per_s", interactions * evaluations / (bench.results().back().medianMs / 1000.0));
+		bench.counter("energy_drift", std::abs(system.energy() - startEnergy) / std::abs(startEnergy));
+	}
+}
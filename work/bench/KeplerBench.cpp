@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Bench.hpp"
+#include "KeplerOrbits.hpp"
+
+/*
+* Orbits like the main asteroid belt, mostly near circular with a few eccentric ones
+*/
+static void benchCatalogue(KeplerOrbits &orbits, int count) {
+	std::mt19937 random(Bench::BENCH_SEED);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	orbits.clear();
+	for (int i = 0; i < count; i++) {
+		double e = unit(random);
+		KeplerOrbits::Elements elements;
+		elements.semiMajorAxis = 2.1 + 1.2 * unit(random);
+		elements.eccentricity = i % 100 == 0 ? 0.5 + 0.45 * e : 0.3 * e * e;
+		elements.inclination = 30.0 * unit(random) * unit(random);
+		elements.ascendingNode = 360.0 * unit(random);
+		elements.periapsis = 360.0 * unit(random);
+		elements.meanAnomaly = 360.0 * unit(random);
+		orbits.add(elements);
+	}
+}
+
+void benchKepler(Bench &bench) {
+	for (int count : { 100000, 1000000 }) {
+		KeplerOrbits orbits;
+		benchCatalogue(orbits, count);
+		std::vector<float> x(count), y(count), z(count);
+		// A day a frame, from a century on so the phases are big
+		double time = 36525.0;
+
+		// Every body one at a time in double, Newton until it stops changing
+		std::string name = "kepler/scalar/bodies=" + std::to_string(count);
+		if (bench.selected(name)) {
+			// Axes of each orbit worked out up front, as the batched solver does
+			std::vector<glm::dvec3> p(count), q(count);
+			for (int i = 0; i < count; i++) {
+				const KeplerOrbits::Elements &body = orbits.elements(i);
+				double cosI = std::cos(glm::radians(body.inclination)), sinI = std::sin(glm::radians(body.inclination));
+				double cosN = std::cos(glm::radians(body.ascendingNode)), sinN = std::sin(glm::radians(body.ascendingNode));
+				double cosW = std::cos(glm::radians(body.periapsis)), sinW = std::sin(glm::radians(body.periapsis));
+				p[i] = glm::dvec3(cosW * cosN - sinW * sinN * cosI, cosW * sinN + sinW * cosN * cosI, sinW * sinI);
+				q[i] = glm::dvec3(-sinW * cosN - cosW * sinN * cosI, -sinW * sinN + cosW * cosN * cosI, cosW * sinI);
+			}
+			double mu = orbits.settings().mu;
+			bench.run(name, [&]() {
+				time += 1.0;
+				for (int i = 0; i < count; i++) {
+					const KeplerOrbits::Elements &body = orbits.elements(i);
+					double a = body.semiMajorAxis, e = body.eccentricity;
+					double m = std::fmod(glm::radians(body.meanAnomaly) + std::sqrt(mu / (a * a * a)) * time, 6.283185307179586);
+					double anomaly = m;
+					for (int step = 0; step < 50; step++) {
+						double change = (anomaly - e * std::sin(anomaly) - m) / (1.0 - e * std::cos(anomaly));
+						anomaly -= change;
+						if (std::abs(change) < 1e-12) break;
+					}
+					glm::dvec3 position = a * (std::cos(anomaly) - e) * p[i] + a * std::sqrt(1.0 - e * e) * std::sin(anomaly) * q[i];
+					x[i] = float(position.x);
+					y[i] = float(position.y);
+					z[i] = float(position.z);
+				}
+				doNotOptimize(x);
+			});
+			bench.counter("bodies_per_s", count / (bench.results().back().medianMs / 1000.0));
+		}
+
+		// Four at a time with fixed Newton steps, across the pool
+		name = "kepler/batched/bodies=" + std::to_string(count);
+		if (bench.selected(name)) {
+			bench.run(name, [&]() {
+				time += 1.0;
+				orbits.positions(time, glm::vec3(0.0f), x, y, z);
+				doNotOptimize(x);
+			});
+			bench.counter("bodies_per_s", count / (bench.results().back().medianMs / 1000.0));
+			// Furthest any body is from the double precision solve, in AU
+			double worst = 0.0;
+			for (int i = 0; i < count; i += 97) {
+				glm::dvec3 exact = orbits.position(i, time);
+				worst = std::max(worst, glm::length(exact - glm::dvec3(x[i], y[i], z[i])));
+			}
+			bench.counter("max_error_au", worst / orbits.settings().scale);
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "Bench.hpp"
+#include "LightClusters.hpp"
+
+/*
+* Lights scattered through the scene box the same way SolarSystem adds its extra lights
+*/
+static std::vector<PointLight> benchLights(int count) {
+	std::srand(Bench::BENCH_SEED);
+	std::vector<PointLight> lights;
+	for (int i = 0; i < count; i++) {
+		glm::vec3 colour = glm::vec3(rand() % 100, rand() % 100, rand() % 100) / 100.0f;
+		glm::vec3 pos = glm::vec3(rand() % 90 - 45, rand() % 90 - 45, rand() % 90 - 45);
+		lights.push_back(PointLight(colour, 0.05f + (rand() % 100) / 400.0f, pos));
+	}
+	return lights;
+}
+
+// Same fog and viewer position as the app starts with
+static const float FOG_BETA = 0.04f;
+static const glm::vec3 VIEWER = glm::vec3(0, 0, -9);
+
+void benchLighting(Bench &bench) {
+	// The default camera, looking at the sun from outside the planets
+	glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 10), glm::vec3(0, 0, 9), glm::vec3(0, 1, 0));
+	for (int count : { 6, 64, 256, 1024, 4096 }) {
+		std::string name = "lights/cluster/lights=" + std::to_string(count);
+		if (!bench.selected(name)) {
+			continue;
+		}
+		std::vector<PointLight> lights = benchLights(count);
+		LightClusters clusters;
+		bench.run(name, [&]() {
+			clusters.build(lights, view, glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f, FOG_BETA, VIEWER);
+			doNotOptimize(clusters.indices().size());
+		});
+		bench.counter("per_cluster", clusters.indices().size() / double(LightClusters::NUM_CLUSTERS));
+		bench.counter("max_per_cluster", clusters.maxLightsPerCluster());
+	}
+}
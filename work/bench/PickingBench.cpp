@@ -0,0 +1,98 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Bench.hpp"
+#include "Planet.hpp"
+#include "TriangleBVH.hpp"
+
+// Rays fired at the planet for each timing of the tree, and for the brute force test
+static const int RAYS = 10000;
+static const int BRUTE_FORCE_RAYS = 20;
+
+/*
+* Rays from a sphere well outside the planet at points spread over it, about as many
+* missing as a click near the edge of a planet would
+*/
+static void benchRays(std::vector<glm::vec3> &origins, std::vector<glm::vec3> &directions) {
+	std::mt19937 random(Bench::BENCH_SEED);
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+	for (int i = 0; i < RAYS; i++) {
+		glm::vec3 from = glm::normalize(glm::vec3(normal(random), normal(random), normal(random))) * 10.0f;
+		glm::vec3 to = glm::vec3(normal(random), normal(random), normal(random)) * 0.8f;
+		origins.push_back(from);
+		directions.push_back(to - from);
+	}
+}
+
+void benchPicking(Bench &bench) {
+	PlanetInfo pi;
+	pi.location = glm::vec3(5.0f, 0.0f, 0.0f);
+	pi.rotationSpeed = 1.0f;
+	for (int i = 0; i < 6; i++) {
+		pi.colorSet1.push_back(glm::vec3(i / 6.0f));
+	}
+	Planet planet(pi, 0, 4, 1.0f, 2.0f, 3);
+	std::vector<glm::vec3> origins, directions;
+	benchRays(origins, directions);
+
+	for (int level : { 6, 7, 8 }) {
+		std::string build = "picking/build/level=" + std::to_string(level);
+		std::string rays = "picking/bvh/level=" + std::to_string(level);
+		std::string bruteForce = "picking/brute-force/level=" + std::to_string(level);
+		if (!bench.selected(build) && !bench.selected(rays) && !bench.selected(bruteForce)) continue;
+
+		// The surface at this level, as the planet would have it after the noise
+		planet.subdivisions = level;
+		planet.generateIcosahedron();
+		planet.subdivideIcosahedron();
+		planet.modifiedVerticies.clear();
+		std::vector<glm::vec3> vertices;
+		for (size_t i = 0; i < planet.originalVerticies.size(); i++) {
+			vertices.push_back(planet.surfacePoint(int(i)));
+		}
+		double triangles = double(planet.originalTriangles.size());
+
+		TriangleBVH tree;
+		bench.run(build, [&]() {
+			tree.build(vertices, planet.originalTriangles);
+		});
+		if (bench.selected(build)) {
+			bench.counter("triangles_per_s", triangles / (bench.results().back().medianMs / 1000.0));
+			bench.counter("nodes", double(tree.stats().nodes));
+			bench.counter("depth", double(tree.stats().depth));
+		}
+		if (tree.empty()) {
+			tree.build(vertices, planet.originalTriangles);
+		}
+
+		int hits = 0;
+		bench.run(rays, [&]() {
+			hits = 0;
+			for (int i = 0; i < RAYS; i++) {
+				hits += tree.intersect(origins[i], directions[i]).triangle >= 0;
+			}
+			doNotOptimize(hits);
+		});
+		if (bench.selected(rays)) {
+			bench.counter("rays_per_s", RAYS / (bench.results().back().medianMs / 1000.0));
+			bench.counter("us_per_ray", bench.results().back().medianMs * 1000.0 / RAYS);
+			bench.counter("hits", double(hits));
+		}
+
+		// Every triangle against a few of the same rays
+		bench.run(bruteForce, [&]() {
+			hits = 0;
+			for (int i = 0; i < BRUTE_FORCE_RAYS; i++) {
+				hits += tree.intersectAll(origins[i], directions[i]).triangle >= 0;
+			}
+			doNotOptimize(hits);
+		});
+		if (bench.selected(bruteForce)) {
+			bench.counter("rays_per_s", BRUTE_FORCE_RAYS / (bench.results().back().medianMs / 1000.0));
+			bench.counter("us_per_ray", bench.results().back().medianMs * 1000.0 / BRUTE_FORCE_RAYS);
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "Bench.hpp"
+#include "cgra/transformbatch.hpp"
+
+/*
+* Model matrices built the way drawScene builds a planet or moon, spin then move then scale
+*/
+static std::vector<glm::mat4> benchModels(int count) {
+	std::srand(Bench::BENCH_SEED);
+	std::vector<glm::mat4> models;
+	for (int i = 0; i < count; i++) {
+		glm::mat4 model = glm::rotate(glm::mat4(1.0f), (rand() % 628) / 100.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+		model = glm::translate(model, glm::vec3(rand() % 90 - 45, rand() % 90 - 45, rand() % 90 - 45));
+		model = glm::scale(model, glm::vec3(0.1f + (rand() % 100) / 50.0f));
+		models.push_back(model);
+	}
+	return models;
+}
+
+void benchTransforms(Bench &bench) {
+	glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 10), glm::vec3(0, 0, 9), glm::vec3(0, 1, 0));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+	for (int count : { 64, 1024, 16384 }) {
+		std::vector<glm::mat4> models = benchModels(count);
+
+		// One object at a time with a general inverse for the normal matrix, like the shader used to
+		std::string name = "transforms/single/models=" + std::to_string(count);
+		if (bench.selected(name)) {
+			std::vector<cgra::TransformBatch::Transform> out(models.size());
+			bench.run(name, [&]() {
+				for (size_t i = 0; i < models.size(); i++) {
+					out[i].modelView = view * models[i];
+					out[i].modelViewProjection = projection * view * models[i];
+					glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(out[i].modelView)));
+					for (int c = 0; c < 3; c++) {
+						out[i].normal[c] = glm::vec4(normal[c], 0.0f);
+					}
+				}
+				doNotOptimize(out);
+			});
+			bench.counter("models_per_s", count / (bench.results().back().medianMs / 1000.0));
+		}
+
+		name = "transforms/batch/models=" + std::to_string(count);
+		if (bench.selected(name)) {
+			cgra::TransformBatch batch;
+			for (const glm::mat4 &model : models) {
+				batch.add(model);
+			}
+			bench.run(name, [&]() {
+				batch.compute(view, projection);
+				doNotOptimize(batch.transforms());
+			});
+			bench.counter("models_per_s", count / (bench.results().back().medianMs / 1000.0));
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <string>
+
+#include "Bench.hpp"
+
+static void printUsage(const char *program) {
+	std::cout << "Usage: " << program << " [options]\n"
+		<< "  --samples N    Timed samples per case (default 20)\n"
+		<< "  --warmup N     Untimed runs before sampling (default 3)\n"
+		<< "  --filter TEXT  Only run cases with TEXT in their name\n"
+		<< "  --json FILE    Also write the results as JSON\n";
+}
+
+/*
+* Runs every benchmark, no window or OpenGL context needed
+*/
+int main(int argc, const char **argv) {
+	Bench::Options options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h") {
+			printUsage(argv[0]);
+			return 0;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "Error: " << arg << " needs a value" << std::endl;
+			printUsage(argv[0]);
+			return 1;
+		}
+		std::string value = argv[++i];
+		try {
+			if (arg == "--samples") {
+				options.samples = std::stoi(value);
+			} else if (arg == "--warmup") {
+				options.warmup = std::stoi(value);
+			} else if (arg == "--filter") {
+				options.filter = value;
+			} else if (arg == "--json") {
+				options.jsonFile = value;
+			} else {
+				std::cerr << "Error: Unknown option '" << arg << "'" << std::endl;
+				printUsage(argv[0]);
+				return 1;
+			}
+		} catch (std::exception &) {
+			std::cerr << "Error: Bad value '" << value << "' for " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (options.samples <= 0 || options.warmup < 0) {
+		std::cerr << "Error: Need at least one sample" << std::endl;
+		return 1;
+	}
+
+	Bench bench(options);
+	try {
+		benchGeneration(bench);
+		benchLighting(bench);
+		benchTransforms(bench);
+		benchGravity(bench);
+		benchAsteroids(bench);
+		benchKepler(bench);
+		benchCollisions(bench);
+		benchPicking(bench);
+		benchErosion(bench);
+		benchGalaxy(bench);
+	} catch (std::exception &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	if (!options.jsonFile.empty()) {
+		if (!bench.writeJson(options.jsonFile)) {
+			std::cerr << "Error: Could not write '" << options.jsonFile << "'" << std::endl;
+			return 1;
+		}
+		std::cout << "Wrote " << bench.results().size() << " results to " << options.jsonFile << std::endl;
+	}
+	return 0;
+}
@@ -6,11 +6,13 @@ in vec2 UV;
 // Ouput data
 out vec4 color;
 
-uniform sampler2D myTextureSampler;
+uniform sampler2DArray myTextureSampler;
+// Which leaf layer (biome) to use
+uniform int leafLayer;
 
 void main(){
 	// Output color = color of the texture at the specified UV
-	color = texture( myTextureSampler, UV );
+	color = texture( myTextureSampler, vec3(UV, leafLayer) );
 	 if(color.a < 0.1)
         discard;
 	// Hardcoded life level, should be in a separate texture.
@@ -0,0 +1,18 @@
+#version 330 core
+
+out vec4 color;
+
+in vec3 fragPosition;
+in vec3 fragNormal;
+in vec3 fragmentColor;
+
+uniform vec3 sunPosition; // View space
+
+const vec3 ambientColor = vec3(0.05, 0.05, 0.1);
+
+void main() {
+    // Lit by the sun alone, the rocks are too small for the fog lighting to matter
+    vec3 toSun = normalize(sunPosition - fragPosition);
+    float lambertian = max(dot(normalize(fragNormal), toSun), 0.0);
+    color = vec4(ambientColor + lambertian * fragmentColor, 1.0);
+}
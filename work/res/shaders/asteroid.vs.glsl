@@ -0,0 +1,33 @@
+#version 330 core
+
+layout (location=0) in vec3 vertPosition;
+layout (location=1) in vec3 vertNormal;
+// One of each per rock, see AsteroidBelt::Instance
+layout (location=5) in vec4 instancePositionScale;
+layout (location=6) in vec4 instanceAxisAngle; // Spin axis and how far it has turned
+layout (location=7) in vec4 instanceColor;
+
+out vec3 fragPosition;
+out vec3 fragNormal;
+out vec3 fragmentColor;
+
+uniform mat4 viewMat;
+uniform mat4 projectionMat;
+
+// Turns v about a unit axis (Rodrigues' formula)
+vec3 spin(vec3 v, vec3 axis, float angle) {
+    float c = cos(angle);
+    float s = sin(angle);
+    return v * c + cross(axis, v) * s + axis * dot(axis, v) * (1.0 - c);
+}
+
+void main() {
+    vec3 world = instancePositionScale.xyz + spin(vertPosition, instanceAxisAngle.xyz, instanceAxisAngle.w) * instancePositionScale.w;
+    vec4 pos = viewMat * vec4(world, 1.0);
+    gl_Position = projectionMat * pos;
+
+    fragPosition = pos.xyz;
+    // Rocks are only scaled evenly, so the view rotation is enough for the normal
+    fragNormal = mat3(viewMat) * spin(vertNormal, instanceAxisAngle.xyz, instanceAxisAngle.w);
+    fragmentColor = instanceColor.rgb;
+}
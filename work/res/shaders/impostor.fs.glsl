@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec2 UV;
+
+out vec4 color;
+
+// The picture of every body, rendered with the scenes shader. Clear where there's no body
+uniform sampler2D atlas;
+
+void main() {
+    color = texture(atlas, UV);
+    if (color.a < 0.5)
+        discard;
+    // The edge is filtered towards the clear black around it
+    color = vec4(color.rgb / color.a, 1.0);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+// Corners of the quads, already facing the camera, see ImpostorAtlas::draw
+layout (location=0) in vec3 vertPosition;
+layout (location=2) in vec2 vertUV;
+
+uniform mat4 viewMat;
+uniform mat4 projectionMat;
+
+out vec2 UV;
+
+void main() {
+    gl_Position = projectionMat * viewMat * vec4(vertPosition, 1.0);
+    UV = vertUV;
+}
@@ -3,28 +3,36 @@
 in vec3 vertPosition;
 in vec3 vertNormal;
 layout (location=3) in vec3 vertColor;
+layout (location=4) in vec3 vertMorphTarget;
 
 out vec3 fragPosition;
 out vec3 fragNormal;
 out vec3 fragmentColor;
-out mat4 view;
 
 
-uniform mat4 modelMat;
-uniform mat4 viewMat;
-uniform mat4 projectionMat;
+// Matrices of every draw this frame, worked out on the CPU (see TransformBatch).
+// Each draw is 11 texels: model view, model view projection, normal matrix
+uniform samplerBuffer transforms;
+uniform int drawIndex;
+uniform float morphFactor; // 0 = full detail, 1 = coarser level's shape
 
 
 void main() {
-    gl_Position = projectionMat * viewMat * modelMat * vec4(vertPosition, 1.0);
-
-    vec4 pos = viewMat * modelMat * vec4(vertPosition, 1.0);
+    int base = drawIndex * 11;
+    mat4 modelView = mat4(texelFetch(transforms, base), texelFetch(transforms, base + 1),
+        texelFetch(transforms, base + 2), texelFetch(transforms, base + 3));
+    mat4 modelViewProjection = mat4(texelFetch(transforms, base + 4), texelFetch(transforms, base + 5),
+        texelFetch(transforms, base + 6), texelFetch(transforms, base + 7));
+    mat3 normalMat = mat3(texelFetch(transforms, base + 8).xyz, texelFetch(transforms, base + 9).xyz,
+        texelFetch(transforms, base + 10).xyz);
+
+    vec3 position = mix(vertPosition, vertMorphTarget, morphFactor);
+    gl_Position = modelViewProjection * vec4(position, 1.0);
+
+    vec4 pos = modelView * vec4(position, 1.0);
     fragPosition = vec3(pos) / pos.w;
 
-    mat3 normalMat = transpose(inverse(mat3(viewMat * modelMat)));
     fragNormal = normalMat * vertNormal;
 
 	fragmentColor = vertColor;
-	
-    view = viewMat;
 }
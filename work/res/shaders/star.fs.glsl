@@ -0,0 +1,12 @@
+#version 330 core
+
+out vec4 color;
+
+in vec3 fragmentColor;
+
+void main() {
+    // Round, fading out to the edge
+    vec2 offset = gl_PointCoord * 2.0 - 1.0;
+    float fade = max(1.0 - dot(offset, offset), 0.0);
+    color = vec4(fragmentColor * fade, 1.0);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+// One of each per point, see Galaxy::Point. Positions are from the eye, so the
+// view matrix is only a rotation
+layout (location=0) in vec3 vertPosition;
+layout (location=3) in vec3 vertColor;
+layout (location=5) in float vertLuminosity;
+
+uniform mat4 viewMat;
+uniform mat4 projectionMat;
+// Pixels across a star as bright as the sun, one unit away
+uniform float pointScale;
+
+out vec3 fragmentColor;
+
+void main() {
+    gl_Position = projectionMat * viewMat * vec4(vertPosition, 1.0);
+
+    // How bright the point looks falls off with distance squared, its size with distance
+    float size = sqrt(vertLuminosity) / max(length(vertPosition), 1.0) * pointScale;
+    gl_PointSize = clamp(size, 1.0, 6.0);
+    // Points too faint to fill a pixel are dimmed instead
+    fragmentColor = vertColor * min(size, 1.0);
+}
@@ -0,0 +1,292 @@
+#version 430 core
+
+// Planet terrain on the GPU. Does the same work as Planet::generateTerrain, writing straight
+// into a level of detail meshes vertex buffer. Run twice per level:
+//   pass 0 displaces each vertex by the noise and picks its colour from the biome sites
+//   pass 1 (after a barrier) works out the normals and geomorph targets from the new positions
+// The noise is a copy of glms perlin (periodic) and simplex so both paths give the same planet.
+
+layout(local_size_x = 64) in;
+
+// The meshes vertices, 12 floats each: position, normal, colour, morph target
+layout(std430, binding = 0) buffer VertexBuffer { float vertexData[]; };
+// The meshes triangles
+layout(std430, binding = 1) readonly buffer IndexBuffer { uint indices[]; };
+// Vertices on the unit sphere
+layout(std430, binding = 2) readonly buffer UnitPositions { vec4 unitPositions[]; };
+// The two vertices a vertex was made between, (-1, -1) for the icosahedron
+layout(std430, binding = 3) readonly buffer Parents { ivec2 parents[]; };
+// Triangles touching each vertex, faceList[faceOffsets[i]] to faceList[faceOffsets[i + 1]]
+layout(std430, binding = 4) readonly buffer FaceOffsets { uint faceOffsets[]; };
+layout(std430, binding = 5) readonly buffer FaceList { uint faceList[]; };
+// Biome sites, then the sea colour and one colour per biome
+layout(std430, binding = 6) readonly buffer Biomes { vec4 biomes[]; };
+
+uniform int pass;
+uniform uint numVertices;
+uniform uint firstNewVertex; // Vertices from here on were added by this level
+uniform int numSites;
+
+uniform int octaves;
+uniform float frequency;
+uniform float amplitude;
+uniform int noiseType; // 0 = perlin, 1 = simplex, 2 = random
+
+const uint VERTEX_FLOATS = 12u;
+
+vec4 mod289(vec4 x) {
+	return x - floor(x * (1.0 / 289.0)) * 289.0;
+}
+
+vec3 mod289(vec3 x) {
+	return x - floor(x * (1.0 / 289.0)) * 289.0;
+}
+
+vec4 permute(vec4 x) {
+	return mod289(((x * 34.0) + 1.0) * x);
+}
+
+vec4 taylorInvSqrt(vec4 r) {
+	return 1.79284291400159 - 0.85373472095314 * r;
+}
+
+vec3 fade(vec3 t) {
+	return (t * t * t) * (t * (t * 6.0 - 15.0) + 10.0);
+}
+
+// glm::perlin(Position, rep)
+float perlin(vec3 Position, vec3 rep) {
+	vec3 Pi0 = mod(floor(Position), rep);
+	vec3 Pi1 = mod(Pi0 + vec3(1.0), rep);
+	Pi0 = mod(Pi0, vec3(289.0));
+	Pi1 = mod(Pi1, vec3(289.0));
+	vec3 Pf0 = fract(Position);
+	vec3 Pf1 = Pf0 - vec3(1.0);
+	vec4 ix = vec4(Pi0.x, Pi1.x, Pi0.x, Pi1.x);
+	vec4 iy = vec4(Pi0.y, Pi0.y, Pi1.y, Pi1.y);
+	vec4 iz0 = vec4(Pi0.z);
+	vec4 iz1 = vec4(Pi1.z);
+
+	vec4 ixy = permute(permute(ix) + iy);
+	vec4 ixy0 = permute(ixy + iz0);
+	vec4 ixy1 = permute(ixy + iz1);
+
+	vec4 gx0 = ixy0 / 7.0;
+	vec4 gy0 = fract(floor(gx0) / 7.0) - 0.5;
+	gx0 = fract(gx0);
+	vec4 gz0 = vec4(0.5) - abs(gx0) - abs(gy0);
+	vec4 sz0 = step(gz0, vec4(0.0));
+	gx0 -= sz0 * (step(0.0, gx0) - 0.5);
+	gy0 -= sz0 * (step(0.0, gy0) - 0.5);
+
+	vec4 gx1 = ixy1 / 7.0;
+	vec4 gy1 = fract(floor(gx1) / 7.0) - 0.5;
+	gx1 = fract(gx1);
+	vec4 gz1 = vec4(0.5) - abs(gx1) - abs(gy1);
+	vec4 sz1 = step(gz1, vec4(0.0));
+	gx1 -= sz1 * (step(0.0, gx1) - 0.5);
+	gy1 -= sz1 * (step(0.0, gy1) - 0.5);
+
+	vec3 g000 = vec3(gx0.x, gy0.x, gz0.x);
+	vec3 g100 = vec3(gx0.y, gy0.y, gz0.y);
+	vec3 g010 = vec3(gx0.z, gy0.z, gz0.z);
+	vec3 g110 = vec3(gx0.w, gy0.w, gz0.w);
+	vec3 g001 = vec3(gx1.x, gy1.x, gz1.x);
+	vec3 g101 = vec3(gx1.y, gy1.y, gz1.y);
+	vec3 g011 = vec3(gx1.z, gy1.z, gz1.z);
+	vec3 g111 = vec3(gx1.w, gy1.w, gz1.w);
+
+	vec4 norm0 = taylorInvSqrt(vec4(dot(g000, g000), dot(g010, g010), dot(g100, g100), dot(g110, g110)));
+	g000 *= norm0.x;
+	g010 *= norm0.y;
+	g100 *= norm0.z;
+	g110 *= norm0.w;
+	vec4 norm1 = taylorInvSqrt(vec4(dot(g001, g001), dot(g011, g011), dot(g101, g101), dot(g111, g111)));
+	g001 *= norm1.x;
+	g011 *= norm1.y;
+	g101 *= norm1.z;
+	g111 *= norm1.w;
+
+	float n000 = dot(g000, Pf0);
+	float n100 = dot(g100, vec3(Pf1.x, Pf0.y, Pf0.z));
+	float n010 = dot(g010, vec3(Pf0.x, Pf1.y, Pf0.z));
+	float n110 = dot(g110, vec3(Pf1.x, Pf1.y, Pf0.z));
+	float n001 = dot(g001, vec3(Pf0.x, Pf0.y, Pf1.z));
+	float n101 = dot(g101, vec3(Pf1.x, Pf0.y, Pf1.z));
+	float n011 = dot(g011, vec3(Pf0.x, Pf1.y, Pf1.z));
+	float n111 = dot(g111, Pf1);
+
+	vec3 fade_xyz = fade(Pf0);
+	vec4 n_z = mix(vec4(n000, n100, n010, n110), vec4(n001, n101, n011, n111), fade_xyz.z);
+	vec2 n_yz = mix(n_z.xy, n_z.zw, fade_xyz.y);
+	float n_xyz = mix(n_yz.x, n_yz.y, fade_xyz.x);
+	return 2.2 * n_xyz;
+}
+
+// glm::simplex(v)
+float simplex(vec3 v) {
+	const vec2 C = vec2(1.0 / 6.0, 1.0 / 3.0);
+	const vec4 D = vec4(0.0, 0.5, 1.0, 2.0);
+
+	// First corner
+	vec3 i = floor(v + dot(v, vec3(C.y)));
+	vec3 x0 = v - i + dot(i, vec3(C.x));
+
+	// Other corners
+	vec3 g = step(x0.yzx, x0);
+	vec3 l = 1.0 - g;
+	vec3 i1 = min(g, l.zxy);
+	vec3 i2 = max(g, l.zxy);
+
+	vec3 x1 = x0 - i1 + C.x;
+	vec3 x2 = x0 - i2 + C.y;
+	vec3 x3 = x0 - D.y;
+
+	// Permutations
+	i = mod289(i);
+	vec4 p = permute(permute(permute(
+		i.z + vec4(0.0, i1.z, i2.z, 1.0)) +
+		i.y + vec4(0.0, i1.y, i2.y, 1.0)) +
+		i.x + vec4(0.0, i1.x, i2.x, 1.0));
+
+	float n_ = 0.142857142857; // 1.0/7.0
+	vec3 ns = n_ * D.wyz - D.xzx;
+
+	vec4 j = p - 49.0 * floor(p * ns.z * ns.z);
+
+	vec4 x_ = floor(j * ns.z);
+	vec4 y_ = floor(j - 7.0 * x_);
+
+	vec4 x = x_ * ns.x + ns.y;
+	vec4 y = y_ * ns.x + ns.y;
+	vec4 h = 1.0 - abs(x) - abs(y);
+
+	vec4 b0 = vec4(x.xy, y.xy);
+	vec4 b1 = vec4(x.zw, y.zw);
+
+	vec4 s0 = floor(b0) * 2.0 + 1.0;
+	vec4 s1 = floor(b1) * 2.0 + 1.0;
+	vec4 sh = -step(h, vec4(0.0));
+
+	vec4 a0 = b0.xzyw + s0.xzyw * sh.xxyy;
+	vec4 a1 = b1.xzyw + s1.xzyw * sh.zzww;
+
+	vec3 p0 = vec3(a0.xy, h.x);
+	vec3 p1 = vec3(a0.zw, h.y);
+	vec3 p2 = vec3(a1.xy, h.z);
+	vec3 p3 = vec3(a1.zw, h.w);
+
+	// Normalise gradients
+	vec4 norm = taylorInvSqrt(vec4(dot(p0, p0), dot(p1, p1), dot(p2, p2), dot(p3, p3)));
+	p0 *= norm.x;
+	p1 *= norm.y;
+	p2 *= norm.z;
+	p3 *= norm.w;
+
+	// Mix final noise value
+	vec4 m = max(0.6 - vec4(dot(x0, x0), dot(x1, x1), dot(x2, x2), dot(x3, x3)), vec4(0.0));
+	m = m * m;
+	return 42.0 * dot(m * m, vec4(dot(p0, x0), dot(p1, x1), dot(p2, x2), dot(p3, x3)));
+}
+
+// Same as hashNoise in Planet.cpp
+float hashNoise(vec3 p) {
+	ivec3 q = ivec3(floor(p * 4096.0));
+	uint h = uint(q.x) * 73856093u ^ uint(q.y) * 19349663u ^ uint(q.z) * 83492791u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return (float(h) / 4294967295.0) * 2.0 - 1.0;
+}
+
+// Same as Planet::fractalNoise
+float fractalNoise(vec3 p) {
+	float sum = 0.0;
+	float freq = frequency;
+	float amp = amplitude;
+	for (int octs = 0; octs < octaves; octs++) {
+		vec3 pf = p * freq;
+		float value;
+		if (noiseType == 0) {
+			value = perlin(pf, vec3(freq)) / amp;
+		} else if (noiseType == 1) {
+			value = simplex(pf) / amp;
+		} else {
+			value = hashNoise(pf);
+		}
+		sum += value;
+		freq *= 2.0;
+		amp *= 2.0;
+	}
+	return sum;
+}
+
+vec3 readVec3(uint vertex, uint offset) {
+	uint base = vertex * VERTEX_FLOATS + offset;
+	return vec3(vertexData[base], vertexData[base + 1u], vertexData[base + 2u]);
+}
+
+void writeVec3(uint vertex, uint offset, vec3 v) {
+	uint base = vertex * VERTEX_FLOATS + offset;
+	vertexData[base] = v.x;
+	vertexData[base + 1u] = v.y;
+	vertexData[base + 2u] = v.z;
+}
+
+void displace(uint i) {
+	vec3 unit = unitPositions[i].xyz;
+	vec3 position = unit * (length(unit) + fractalNoise(unit));
+
+	// Nearest site, ties go to the later site
+	float shortestDistance = 3.402823466e+38;
+	int closest = 0;
+	for (int j = 0; j < numSites; j++) {
+		float dis = distance(unit, biomes[j].xyz);
+		if (dis <= shortestDistance) {
+			shortestDistance = dis;
+			closest = j;
+		}
+	}
+	// Anything at or under the original surface is sea
+	vec3 colour = (length(position) <= 1.0) ? biomes[numSites].rgb : biomes[numSites + 1 + closest].rgb;
+
+	writeVec3(i, 0u, position);
+	writeVec3(i, 6u, colour);
+}
+
+void shade(uint i) {
+	vec3 position = readVec3(i, 0u);
+
+	// Area weighted sum of the face normals, in the same order as Mesh::setData
+	vec3 normal = vec3(0.0);
+	for (uint f = faceOffsets[i]; f < faceOffsets[i + 1u]; f++) {
+		uint tri = faceList[f] * 3u;
+		vec3 v0 = readVec3(indices[tri], 0u);
+		vec3 v1 = readVec3(indices[tri + 1u], 0u);
+		vec3 v2 = readVec3(indices[tri + 2u], 0u);
+		normal += cross(v1 - v0, v2 - v0);
+	}
+	writeVec3(i, 3u, normalize(normal));
+
+	// New vertices start out halfway between their parents
+	vec3 morph = position;
+	if (i >= firstNewVertex) {
+		ivec2 p = parents[i];
+		morph = (readVec3(uint(p.x), 0u) + readVec3(uint(p.y), 0u)) * 0.5;
+	}
+	writeVec3(i, 9u, morph);
+}
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= numVertices) {
+		return;
+	}
+	if (pass == 0) {
+		displace(i);
+	} else {
+		shade(i);
+	}
+}
@@ -8,8 +8,6 @@ out vec4 color;
 in vec3 fragPosition;
 in vec3 fragNormal;
 in vec3 fragmentColor;
-in mat4 model;
-in mat4 view;
 
 struct BaseLight {
     vec3 color;
@@ -21,23 +19,35 @@ struct DirectionalLight {
     vec3 direction;
 };
 
-struct PointLight {
-    BaseLight base;
-    vec3 position;
-};
-
 // Light Related Uniforms
-uniform int numPointLights;
 uniform DirectionalLight directionalLight;
-uniform PointLight pointLights[6];
+
+// Point lights are sorted into clusters (a grid of screen tiles by depth slices)
+// on the CPU, so each fragment only loops over the lights that reach its cluster.
+// See LightClusters.hpp, the grid size has to match it.
+const int TILES_X = 16;
+const int TILES_Y = 9;
+const int SLICES = 24;
+uniform samplerBuffer lightData;     // Four texels per light, see LightClusters::Light
+uniform usamplerBuffer clusterData;  // Offset and count in lightIndices for each cluster
+uniform usamplerBuffer lightIndices; // Lights of each cluster, one after another
+
+// Everything that's the same for the whole frame, filled in by LightScene::update
+layout(std140) uniform LightFrame {
+    vec3 viewerPos;             // Position of the viewer
+    float beta;                 // Coefficient representing thickness of fog
+    vec3 directAirlight;        // Light straight from every point light to the viewer
+    vec2 viewportSize;
+    float sliceScale;           // slice = log(depth) * sliceScale + sliceBias
+    float sliceBias;
+};
 
 // Lighting Related Uniforms
-uniform float beta;                 // Coefficient representing thickness of fog
-uniform vec3 viewerPos;             // Position of the viewer
 uniform sampler2D airlightLookup;   // Airlight lookup table
 uniform sampler2D G0;               // Lamberitan surface radiance lookup table
 uniform sampler2D G20;              // Specular surface radiance lookup table
 uniform bool onlyPointLights;       // Determine whether only point light contribution should be added.
+uniform ivec2 clusterTile = ivec2(-1); // Screen tile to light with instead of the fragment's, see ImpostorAtlas
 
 // Object color attributes
 const vec3 objectSpecColor    = vec3(0.2, 0.1, 0.1);
@@ -53,61 +63,71 @@ const float conversion = 1.5708;
 
 void main() {
 
-    vec3 cumulativeColor = vec3(0, 0, 0);
+    vec3 cumulativeColor = directAirlight;
     vec3 surfaceNormal = normalize(fragNormal);
     
 
     /*****************************************
                     Point Lights
     ******************************************/
-    for(int i = 0; i < numPointLights; i++){
-        PointLight p = pointLights[i]; // Current Point Light
-
-        // Move the light based on view of the camera
-        vec4 pos = view * vec4(p.position, 1.0f);
-
-        vec3 lightPos = vec3(pos) / pos.w; // Transformed light position
-        vec3 viewerToLight = lightPos - viewerPos; // Vector from the viewer to the light source
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / viewportSize * vec2(TILES_X, TILES_Y)), ivec2(0), ivec2(TILES_X - 1, TILES_Y - 1));
+    if (clusterTile.x >= 0) {
+        tile = clusterTile;
+    }
+    int slice = clamp(int(log(max(-fragPosition.z, 1e-4)) * sliceScale + sliceBias), 0, SLICES - 1);
+    uvec2 cluster = texelFetch(clusterData, (slice * TILES_Y + tile.y) * TILES_X + tile.x).rg;
+
+    // The parts that only depend on the fragment, shared by every light
+    vec3 viewerToSurface = fragPosition - viewerPos;
+    float dvp = length(viewerToSurface); // Distance between surface point and viewer
+    float tvp = beta * dvp; // Optical thickness between surface point and viewer
+    vec3 viewRay = viewerToSurface / dvp;
+    vec3 reflectedRay = reflect(viewRay, surfaceNormal);
+    vec3 viewDirection = normalize(-fragPosition);
+
+    for(uint c = 0u; c < cluster.y; c++){
+        int index = int(texelFetch(lightIndices, int(cluster.x + c)).r);
+        // Anything that only depends on the light was worked out on the CPU
+        vec4 positionRange = texelFetch(lightData, index * 4);       // View space position, range
+        vec4 airlightThickness = texelFetch(lightData, index * 4 + 1); // Airlight scale, optical thickness to the viewer
+        vec4 directionDistance = texelFetch(lightData, index * 4 + 2); // Direction from the viewer, distance to it
+        vec4 surfaceScales = texelFetch(lightData, index * 4 + 3);     // Direct and scattered surface light scales
+
+        vec3 lightPos = positionRange.xyz;
         vec3 lightToSurface = fragPosition - lightPos; // Vector from the light source to the surface point
-        vec3 viewerToSurface = fragPosition - viewerPos;
-        float dsv = length(viewerToLight); // Distance between light source and viewer
         float dsp = length(lightToSurface); // Distance between light source and surface point
-        float dvp = length(viewerToSurface); //Distance between surface point and viewer
-        float tsv = beta * dsv; // Optical thickness between light source and viewer
+        float tsv = airlightThickness.w; // Optical thickness between light source and viewer
         float tsp = beta * dsp; // Optical thickness between light source and surface point
-        float tvp = beta * dvp; // Optical thickness between light source and surface point
-        float gamma = acos(dot(normalize(viewerToLight), normalize(viewerToSurface))); // Angle between light source and viewing ray
-        float thetaS = acos(dot(surfaceNormal, -normalize(lightToSurface))); // Direction of light source to surface
-        float thetaSPrime = acos(dot(-normalize(lightToSurface), reflect(normalize(viewerToSurface), surfaceNormal)));
-
-        if(acos(dot(surfaceNormal, normalize(viewerToLight))) < 0) {
-            continue;
-        }
+        vec3 lightDirection = -lightToSurface / dsp;
+        float cosGamma = dot(directionDistance.xyz, viewRay);
+        float sinGamma = sqrt(max(1.0 - cosGamma * cosGamma, 0.0));
+        float gamma = acos(cosGamma); // Angle between light source and viewing ray
+        float thetaS = acos(dot(surfaceNormal, lightDirection)); // Direction of light source to surface
+        float thetaSPrime = acos(dot(lightDirection, reflectedRay));
 
         /****************** Airlight - Radiance coming from Light Source ***********************/
 
-        // The light coming from the direct transmission of the light source.
-        vec3 Ld = ((p.base.color) / (dsv * dsv)) * exp(-tsv);
+        // The light coming from the direct transmission of the light source
+        // doesn't depend on the fragment, it's summed for all lights in directAirlight
 
         // Calculating Airlight Integral
-        vec3 A0 = (beta * p.base.color * exp(-tsv * cos(gamma))) / (2 * M_PI * dsv * sin(gamma));
-        float A1 = tsv * sin(gamma);
-        float v = (M_PI / 4) + (0.5 * atan((tvp - tsv * cos(gamma)) / (tsv * sin(gamma)))); 
+        vec3 A0 = airlightThickness.rgb * exp(-tsv * cosGamma) / sinGamma;
+        float A1 = tsv * sinGamma;
+        float v = (M_PI / 4) + (0.5 * atan((tvp - tsv * cosGamma) / (tsv * sinGamma))); 
 
         float f1 = texture(airlightLookup, vec2(A1/maxU, v/maxV)).r;
         float f2 = texture(airlightLookup, vec2(A1/maxU, (gamma/2) / maxV)).r;
 
         vec3 La = A0;// * (f1 - f2);
-        vec3 totalAirlight = Ld + La * 5;
+        vec3 totalAirlight = La; // Already scaled up by 5 on the CPU
 
         /******************* Diffuse ***********************/
         vec3 totalLambertian = vec3(0, 0, 0); 
         // Regular diffuse shading attenuated due to optical thickness
-        vec3 lightDirection = normalize(-lightToSurface);
         float lambertian = max(dot(lightDirection, surfaceNormal), 0.0);
         if(!onlyPointLights) {
-            vec3 LpdDiffuse = lambertian * objectDiffuseColor * exp(-tsp) * ((p.base.intensity * 4 * M_PI) / (dsp * dsp));
-            vec3 LpaDiffuse = (objectDiffuseColor * p.base.intensity * beta * texture(G0, vec2(tsp/10, thetaS / (M_PI/2))).r / (2 * M_PI * dsp));  
+            vec3 LpdDiffuse = lambertian * objectDiffuseColor * exp(-tsp) * (surfaceScales.x / (dsp * dsp));
+            vec3 LpaDiffuse = (objectDiffuseColor * surfaceScales.y * texture(G0, vec2(tsp/10, thetaS / (M_PI/2))).r / dsp);
             totalLambertian = LpdDiffuse + LpaDiffuse;
         }
         /******************* Specular **********************/
@@ -116,15 +136,13 @@ void main() {
         vec3 totalSpecular = vec3(0, 0, 0);
         if(!onlyPointLights) {
             if (lambertian > 0.0) {
-                vec3 viewDirection = normalize(-fragPosition);
-
                 vec3 halfDir = normalize(lightDirection + viewDirection);
                 float specAngle = max(dot(halfDir, surfaceNormal), 0.0);
 
                 specular = pow(specAngle, shininess);
             }
-            vec3 LpdSpecular = specular * objectSpecColor * exp(-tsp) * ((p.base.intensity * 4 * M_PI) / (dsp * dsp));
-            vec3 LpaSpecular = (objectSpecColor * p.base.intensity * beta * texture(G20, vec2(tsp/10, thetaSPrime / (M_PI/2))).r) / (2 * M_PI * dsp); 
+            vec3 LpdSpecular = specular * objectSpecColor * exp(-tsp) * (surfaceScales.x / (dsp * dsp));
+            vec3 LpaSpecular = (objectSpecColor * surfaceScales.y * texture(G20, vec2(tsp/10, thetaSPrime / (M_PI/2))).r) / dsp;
             totalSpecular = LpdSpecular + LpaSpecular;
         }
         /*************** Combine Components ****************/
@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+
+#include "glm/gtc/constants.hpp"
+
+#include "cgra/simd.hpp"
+#include "cgra/threadpool.hpp"
+#include "AsteroidBelt.hpp"
+#include "Planet.hpp"
+
+// Instance attribute locations, after the ones cgra::Mesh uses
+static const GLuint INSTANCE_POSITION_SCALE = 5;
+static const GLuint INSTANCE_AXIS_ANGLE = 6;
+static const GLuint INSTANCE_COLOUR = 7;
+
+static uint32_t packColour(const glm::vec3 &colour) {
+	glm::uvec3 c = glm::uvec3(glm::clamp(colour, 0.0f, 1.0f) * 255.0f + 0.5f);
+	return c.r | c.g << 8 | c.b << 16 | 0xffu << 24;
+}
+
+AsteroidBelt::AsteroidBelt(const Settings &settings) : m_settings(settings) {
+	generateShapes();
+	generateRocks();
+}
+
+AsteroidBelt::AsteroidBelt(const Settings &settings, std::shared_ptr<const KeplerOrbits> orbits)
+	: m_settings(settings), m_orbits(orbits) {
+	generateShapes();
+	generateRocks();
+}
+
+AsteroidBelt::~AsteroidBelt() {
+	if (m_vao != 0) {
+		glDeleteVertexArrays(1, &m_vao);
+		GLuint buffers[3] = { m_vertexBuffer, m_indexBuffer, m_instanceBuffer };
+		glDeleteBuffers(3, buffers);
+	}
+}
+
+/*
+* Lumpy rocks from the planets icosahedron. Half of them are subdivided once, then every
+* vertex is pushed in or out by noise and the whole rock is squashed a little. Flat shaded,
+* so every triangle has its own vertices
+*/
+void AsteroidBelt::generateShapes() {
+	std::mt19937 random(m_settings.seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	Planet sphere;
+	m_shapeRadius = 0.0f;
+	for (int v = 0; v < VARIANTS; v++) {
+		sphere.generateIcosahedron();
+		if (v % 2 == 1) {
+			sphere.subdivideIcosahedron();
+		}
+		glm::vec3 offset(unit(random) * 100.0f, unit(random) * 100.0f, unit(random) * 100.0f);
+		glm::vec3 squash(1.0f, 0.6f + 0.4f * unit(random), 0.5f + 0.5f * unit(random));
+		std::vector<glm::vec3> points;
+		for (const glm::vec3 &p : sphere.originalVerticies) {
+			float lump = Planet::fractalNoise(p + offset, 3, 1.5f, 2.0f, false, true);
+			glm::vec3 point = p * squash * glm::clamp(1.0f + 0.3f * lump, 0.6f, 1.4f);
+			points.push_back(point);
+			m_shapeRadius = glm::max(m_shapeRadius, glm::length(point));
+		}
+
+		size_t firstIndex = m_indices.size();
+		for (const std::vector<unsigned int> &tri : sphere.originalTriangles) {
+			glm::vec3 a = points[tri[0]], b = points[tri[1]], c = points[tri[2]];
+			glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+			for (const glm::vec3 &corner : { a, b, c }) {
+				m_indices.push_back((unsigned int)m_vertices.size());
+				m_vertices.push_back(Vertex{ corner, normal });
+			}
+		}
+		m_variantIndexOffset[v] = firstIndex * sizeof(unsigned int);
+		m_variantIndexCount[v] = GLsizei(m_indices.size() - firstIndex);
+	}
+}
+
+/*
+* Fills each chunk with rocks in its band and sector, or with the next run of the catalogue.
+* Within a chunk the rocks are in order of variant, so a chunk's rocks of one variant are
+* always next to each other
+*/
+void AsteroidBelt::generateRocks() {
+	int chunkCount = BANDS * SECTORS;
+	size_t count = m_orbits ? m_orbits->size() : size_t(std::max(m_settings.count, 0));
+	if (!m_orbits) {
+		m_radius.resize(count);
+		m_phase.resize(count);
+		m_angularSpeed.resize(count);
+		m_height.resize(count);
+	}
+	m_x.resize(count);
+	m_y.resize(count);
+	m_z.resize(count);
+	m_rocks.resize(count);
+	m_chunks.resize(chunkCount);
+
+	float bandWidth = (m_settings.outerRadius - m_settings.innerRadius) / BANDS;
+	float sectorWidth = glm::two_pi<float>() / SECTORS;
+	std::mt19937 random(m_settings.seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	size_t next = 0;
+	for (int c = 0; c < chunkCount; c++) {
+		Chunk &chunk = m_chunks[c];
+		size_t chunkEnd = count * (c + 1) / chunkCount;
+		for (int v = 0; v <= VARIANTS; v++) {
+			chunk.variantBegin[v] = uint32_t(next + (chunkEnd - next) * v / VARIANTS);
+		}
+		float band = m_settings.innerRadius + (c / SECTORS) * bandWidth;
+		float sector = (c % SECTORS) * sectorWidth;
+		for (; next < chunkEnd; next++) {
+			if (!m_orbits) {
+				float radius = band + unit(random) * bandWidth;
+				m_radius[next] = radius;
+				m_phase[next] = sector + unit(random) * sectorWidth;
+				m_angularSpeed[next] = std::sqrt(m_settings.centralMass / (radius * radius * radius));
+				m_height[next] = (unit(random) - 0.5f) * m_settings.thickness;
+			}
+
+			Rock &rock = m_rocks[next];
+			// Plenty of small ones, a few big ones
+			float size = unit(random);
+			rock.scale = m_settings.minScale + (m_settings.maxScale - m_settings.minScale) * size * size * size;
+			glm::vec3 axis(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f);
+			rock.axis = glm::length(axis) > 1e-3f ? glm::normalize(axis) : glm::vec3(0.0f, 1.0f, 0.0f);
+			rock.spinPhase = unit(random) * glm::two_pi<float>();
+			rock.spinSpeed = (unit(random) - 0.5f) * 2.0f;
+			glm::vec3 colour = glm::mix(glm::vec3(0.35f, 0.33f, 0.31f), glm::vec3(0.45f, 0.35f, 0.26f), unit(random));
+			rock.colour = packColour(colour * (0.6f + 0.6f * unit(random)));
+		}
+	}
+}
+
+/*
+* Moves the rocks of one chunk along their orbits and fits its box around them. A catalogue
+* works out its own positions, it only needs the box fitted after
+*/
+void AsteroidBelt::updateChunk(Chunk &chunk, double time, const glm::vec3 &centre) {
+	uint32_t begin = chunk.variantBegin[0], end = chunk.variantBegin[VARIANTS];
+	glm::vec3 lo(INFINITY), hi(-INFINITY);
+	// Room for the rocks themselves
+	float margin = m_settings.maxScale * m_shapeRadius;
+	if (m_orbits) {
+		m_orbits->positions(begin, end, time, centre, &m_x[begin], &m_y[begin], &m_z[begin]);
+		for (uint32_t i = begin; i < end; i++) {
+			glm::vec3 p(m_x[i], m_y[i], m_z[i]);
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+		chunk.boxMin = lo - glm::vec3(margin);
+		chunk.boxMax = hi + glm::vec3(margin);
+		return;
+	}
+
+	uint32_t i = begin;
+#ifdef CGRA_SSE2
+	__m128 t = _mm_set1_ps(float(time));
+	__m128 cx = _mm_set1_ps(centre.x), cy = _mm_set1_ps(centre.y), cz = _mm_set1_ps(centre.z);
+	__m128 minX = _mm_set1_ps(INFINITY), minY = minX, minZ = minX;
+	__m128 maxX = _mm_set1_ps(-INFINITY), maxY = maxX, maxZ = maxX;
+	for (; i + 4 <= end; i += 4) {
+		__m128 angle = _mm_add_ps(_mm_loadu_ps(&m_phase[i]), _mm_mul_ps(_mm_loadu_ps(&m_angularSpeed[i]), t));
+		__m128 s, c;
+		cgra::sinCos(angle, s, c);
+		__m128 radius = _mm_loadu_ps(&m_radius[i]);
+		// Same way round as the planets, a turn about +y
+		__m128 x = _mm_add_ps(cx, _mm_mul_ps(radius, c));
+		__m128 z = _mm_sub_ps(cz, _mm_mul_ps(radius, s));
+		// The belt follows the sun up and down
+		__m128 y = _mm_add_ps(cy, _mm_loadu_ps(&m_height[i]));
+		_mm_storeu_ps(&m_x[i], x);
+		_mm_storeu_ps(&m_y[i], y);
+		_mm_storeu_ps(&m_z[i], z);
+		minX = _mm_min_ps(minX, x);
+		minY = _mm_min_ps(minY, y);
+		minZ = _mm_min_ps(minZ, z);
+		maxX = _mm_max_ps(maxX, x);
+		maxY = _mm_max_ps(maxY, y);
+		maxZ = _mm_max_ps(maxZ, z);
+	}
+	float lanes[6][4];
+	_mm_storeu_ps(lanes[0], minX);
+	_mm_storeu_ps(lanes[1], minY);
+	_mm_storeu_ps(lanes[2], minZ);
+	_mm_storeu_ps(lanes[3], maxX);
+	_mm_storeu_ps(lanes[4], maxY);
+	_mm_storeu_ps(lanes[5], maxZ);
+	for (int l = 0; l < 4; l++) {
+		lo = glm::min(lo, glm::vec3(lanes[0][l], lanes[1][l], lanes[2][l]));
+		hi = glm::max(hi, glm::vec3(lanes[3][l], lanes[4][l], lanes[5][l]));
+	}
+#endif
+	for (; i < end; i++) {
+		float angle = m_phase[i] + m_angularSpeed[i] * float(time);
+		m_x[i] = centre.x + m_radius[i] * std::cos(angle);
+		m_y[i] = centre.y + m_height[i];
+		m_z[i] = centre.z - m_radius[i] * std::sin(angle);
+		glm::vec3 p(m_x[i], m_y[i], m_z[i]);
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	chunk.boxMin = lo - glm::vec3(margin);
+	chunk.boxMax = hi + glm::vec3(margin);
+}
+
+void AsteroidBelt::prepare(double time, const glm::vec3 &centre, const glm::mat4 &viewProjection) {
+	m_time = float(time);
+	cgra::ThreadPool::shared().parallelFor(0, m_chunks.size(), [&](size_t begin, size_t end) {
+		for (size_t c = begin; c < end; c++) {
+			updateChunk(m_chunks[c], time, centre);
+		}
+	});
+
+	// Frustum planes, each one keeps the side where a x + b y + c z + d >= 0
+	glm::vec4 planes[6];
+	glm::mat4 m = glm::transpose(viewProjection);
+	for (int axis = 0; axis < 3; axis++) {
+		planes[axis * 2] = m[3] + m[axis];
+		planes[axis * 2 + 1] = m[3] - m[axis];
+	}
+
+	// Chunks that can be seen, then where each of their variant ranges goes
+	m_visibleChunks = 0;
+	uint32_t counts[VARIANTS] = {};
+	for (Chunk &chunk : m_chunks) {
+		chunk.visible = chunk.variantBegin[VARIANTS] > chunk.variantBegin[0];
+		for (int p = 0; p < 6 && chunk.visible; p++) {
+			// The corner of the box furthest along the planes normal
+			glm::vec3 corner = glm::mix(chunk.boxMin, chunk.boxMax, glm::step(glm::vec3(0.0f), glm::vec3(planes[p])));
+			chunk.visible = glm::dot(glm::vec3(planes[p]), corner) + planes[p].w >= 0.0f;
+		}
+		if (!chunk.visible) continue;
+		m_visibleChunks++;
+		for (int v = 0; v < VARIANTS; v++) {
+			chunk.instanceOffset[v] = counts[v];
+			counts[v] += chunk.variantBegin[v + 1] - chunk.variantBegin[v];
+		}
+	}
+	m_visibleCount = 0;
+	for (int v = 0; v < VARIANTS; v++) {
+		m_variantFirst[v] = uint32_t(m_visibleCount);
+		m_variantCount[v] = counts[v];
+		m_visibleCount += counts[v];
+	}
+}
+
+void AsteroidBelt::writeInstances(Instance *out) const {
+	cgra::ThreadPool::shared().parallelFor(0, m_chunks.size(), [&](size_t begin, size_t end) {
+		for (size_t c = begin; c < end; c++) {
+			const Chunk &chunk = m_chunks[c];
+			if (!chunk.visible) continue;
+			for (int v = 0; v < VARIANTS; v++) {
+				Instance *instance = out + m_variantFirst[v] + chunk.instanceOffset[v];
+				for (uint32_t i = chunk.variantBegin[v]; i < chunk.variantBegin[v + 1]; i++, instance++) {
+					const Rock &rock = m_rocks[i];
+					instance->positionScale = glm::vec4(m_x[i], m_y[i], m_z[i], rock.scale);
+					instance->axisAngle = glm::vec4(rock.axis, rock.spinPhase + rock.spinSpeed * m_time);
+					instance->colour = rock.colour;
+				}
+			}
+		}
+	});
+}
+
+/*
+* Creates the buffers of the shapes, and the vertex array that reads them with the instances
+*/
+void AsteroidBelt::upload() {
+	glGenVertexArrays(1, &m_vao);
+	glBindVertexArray(m_vao);
+
+	glGenBuffers(1, &m_vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(Vertex), m_vertices.data(), GL_STATIC_DRAW);
+	// Same attribute locations as cgra::Mesh
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void *>(offsetof(Vertex, position)));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void *>(offsetof(Vertex, normal)));
+	glEnableVertexAttribArray(1);
+
+	glGenBuffers(1, &m_indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), m_indices.data(), GL_STATIC_DRAW);
+
+	// Pointed at each variants instances when it's drawn
+	glGenBuffers(1, &m_instanceBuffer);
+	for (GLuint attribute : { INSTANCE_POSITION_SCALE, INSTANCE_AXIS_ANGLE, INSTANCE_COLOUR }) {
+		glEnableVertexAttribArray(attribute);
+		glVertexAttribDivisor(attribute, 1);
+	}
+	glBindVertexArray(0);
+}
+
+void AsteroidBelt::draw(cgra::Program &program) {
+	m_drawCalls = 0;
+	if (m_visibleCount == 0) return;
+	if (m_vao == 0) {
+		upload();
+	}
+
+	// Orphan last frames instances and write this frames straight into the buffer
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+	size_t bytes = m_visibleCount * sizeof(Instance);
+	if (bytes > m_instanceCapacity) {
+		m_instanceCapacity = bytes + bytes / 4;
+	}
+	glBufferData(GL_ARRAY_BUFFER, m_instanceCapacity, nullptr, GL_STREAM_DRAW);
+	void *mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!mapped) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+	writeInstances(static_cast<Instance *>(mapped));
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+
+	program.use();
+	glBindVertexArray(m_vao);
+	for (int v = 0; v < VARIANTS; v++) {
+		if (m_variantCount[v] == 0) continue;
+		// No base instance before OpenGL 4.2, so the instance attributes start at the variant instead
+		size_t first = m_variantFirst[v] * sizeof(Instance);
+		glVertexAttribPointer(INSTANCE_POSITION_SCALE, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			reinterpret_cast<void *>(first + offsetof(Instance, positionScale)));
+		glVertexAttribPointer(INSTANCE_AXIS_ANGLE, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			reinterpret_cast<void *>(first + offsetof(Instance, axisAngle)));
+		glVertexAttribPointer(INSTANCE_COLOUR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance),
+			reinterpret_cast<void *>(first + offsetof(Instance, colour)));
+		glDrawElementsInstanced(GL_TRIANGLES, m_variantIndexCount[v], GL_UNSIGNED_INT,
+			reinterpret_cast<void *>(m_variantIndexOffset[v]), m_variantCount[v]);
+		m_drawCalls++;
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
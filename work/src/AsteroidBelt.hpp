@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "opengl.hpp"
+#include "glm/glm.hpp"
+
+#include "cgra/shader.hpp"
+#include "KeplerOrbits.hpp"
+
+// A ring of small rocks around the sun, up to millions of them. Every rock is one of a few
+// lumpy low-poly shapes, drawn instanced with its own position, size, spin and colour.
+// The rocks are split into chunks, each a sector of a band of the ring. Each frame the orbits
+// are moved on a chunk at a time across the thread pool, four rocks at once, which also gives
+// each chunk's bounds. Chunks outside the view are dropped. The rest are written straight into
+// one instance buffer, grouped by shape, so the whole belt is a draw call per shape.
+// The rocks can follow the orbits of a catalogue instead of made up circles.
+class AsteroidBelt {
+public:
+	struct Settings {
+		int count = 1000000;
+		float innerRadius = 38.0f;
+		float outerRadius = 42.0f;
+		// Rocks are up to half this above or below the plane of the orbits
+		float thickness = 1.2f;
+		float minScale = 0.03f;
+		float maxScale = 0.2f;
+		// G times the mass of the sun, sets how fast the orbits go
+		float centralMass = 125.0f;
+		unsigned int seed = 1;
+	};
+
+	// One rock as the vertex shader reads it
+	struct Instance {
+		glm::vec4 positionScale;
+		// Spin axis and how far it has turned
+		glm::vec4 axisAngle;
+		// RGBA8
+		uint32_t colour;
+	};
+
+	// Different rock shapes, each drawn with one call
+	static const int VARIANTS = 4;
+	// The ring is split into this many bands by radius and sectors around each band
+	static const int BANDS = 4;
+	static const int SECTORS = 64;
+
+	explicit AsteroidBelt(const Settings &settings);
+	// A rock for each body of `orbits`, on its orbit. The count and radii of the settings
+	// aren't used. Chunks are runs of bodies, so the catalogue should be sorted by orbit
+	// into BANDS bands
+	AsteroidBelt(const Settings &settings, std::shared_ptr<const KeplerOrbits> orbits);
+	~AsteroidBelt();
+
+	AsteroidBelt(const AsteroidBelt &) = delete;
+	AsteroidBelt & operator=(const AsteroidBelt &) = delete;
+
+	const Settings &settings() const { return m_settings; }
+	size_t size() const { return m_x.size(); }
+	const std::shared_ptr<const KeplerOrbits> &orbits() const { return m_orbits; }
+
+	// Moves every rock to where it is at `time`, around `centre`, and works out which
+	// chunks `viewProjection` can see. Following a catalogue, `time` is the catalogues
+	// days from its epoch. Doesn't use OpenGL
+	void prepare(double time, const glm::vec3 &centre, const glm::mat4 &viewProjection);
+
+	// Rocks of the chunks that can be seen, grouped by variant, in the order they're drawn.
+	// Space for visibleCount() of them. Doesn't use OpenGL
+	void writeInstances(Instance *out) const;
+
+	// Streams the visible rocks into the instance buffer and draws them with `program`
+	void draw(cgra::Program &program);
+
+	size_t visibleCount() const { return m_visibleCount; }
+	int visibleChunks() const { return m_visibleChunks; }
+	int drawCalls() const { return m_drawCalls; }
+
+private:
+	Settings m_settings;
+	std::shared_ptr<const KeplerOrbits> m_orbits;
+
+	// The orbit of each rock and where that has it, one array per component. There are
+	// no orbits here when the rocks follow a catalogue
+	std::vector<float> m_radius;
+	std::vector<float> m_phase;
+	std::vector<float> m_angularSpeed;
+	std::vector<float> m_height; // Above or below the sun
+	std::vector<float> m_x, m_y, m_z;
+	// Everything else about a rock, only needed for the rocks that are drawn
+	struct Rock {
+		glm::vec3 axis;
+		float scale;
+		float spinPhase;
+		float spinSpeed;
+		uint32_t colour;
+	};
+	std::vector<Rock> m_rocks;
+	float m_time = 0.0f;
+
+	struct Chunk {
+		// The rocks of each variant, one range after another
+		uint32_t variantBegin[VARIANTS + 1];
+		glm::vec3 boxMin;
+		glm::vec3 boxMax;
+		bool visible;
+		// Where the chunks rocks of each variant go in the instances
+		uint32_t instanceOffset[VARIANTS];
+	};
+	std::vector<Chunk> m_chunks;
+
+	// Instances of each variant, first and count
+	uint32_t m_variantFirst[VARIANTS];
+	uint32_t m_variantCount[VARIANTS];
+	size_t m_visibleCount = 0;
+	int m_visibleChunks = 0;
+	int m_drawCalls = 0;
+
+	// The rock shapes, all in one vertex and index buffer. Indices already point at the
+	// right variants vertices
+	struct Vertex {
+		glm::vec3 position;
+		glm::vec3 normal;
+	};
+	std::vector<Vertex> m_vertices;
+	std::vector<unsigned int> m_indices;
+	GLsizei m_variantIndexCount[VARIANTS];
+	size_t m_variantIndexOffset[VARIANTS];
+	// Largest distance from a rock's centre to its surface, at a scale of 1
+	float m_shapeRadius = 1.0f;
+
+	GLuint m_vao = 0;
+	GLuint m_vertexBuffer = 0;
+	GLuint m_indexBuffer = 0;
+	GLuint m_instanceBuffer = 0;
+	size_t m_instanceCapacity = 0;
+
+	void generateShapes();
+	void generateRocks();
+	void updateChunk(Chunk &chunk, double time, const glm::vec3 &centre);
+	void upload();
+};
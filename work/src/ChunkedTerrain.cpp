@@ -0,0 +1,591 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <mutex>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "cgra/threadpool.hpp"
+#include "ChunkedTerrain.hpp"
+
+// Chunks being built at once
+static const size_t MAX_IN_FLIGHT = 16;
+// A chunk splits when the camera is closer than this many chunk widths
+static const double SPLIT_DISTANCE = 2.5;
+
+/*
+* Cube faces as a normal and two axes, chosen so that u x v = normal and
+* counter-clockwise triangles in (u, v) face outwards
+*/
+static const glm::dvec3 FACE_NORMAL[6] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+static const glm::dvec3 FACE_U[6] = { {0, 0, -1}, {0, 0, 1}, {1, 0, 0}, {1, 0, 0}, {1, 0, 0}, {-1, 0, 0} };
+static const glm::dvec3 FACE_V[6] = { {0, 1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}, {0, 1, 0}, {0, 1, 0} };
+
+/*
+* Keys pack a chunk as face (3 bits), level (5 bits), x (28 bits) and y (28 bits)
+*/
+static uint64_t makeKey(int face, int level, uint32_t x, uint32_t y) {
+	return (uint64_t(face) << 61) | (uint64_t(level) << 56) | (uint64_t(x) << 28) | uint64_t(y);
+}
+
+static int keyFace(uint64_t key) { return int(key >> 61); }
+static int keyLevel(uint64_t key) { return int((key >> 56) & 0x1f); }
+static uint32_t keyX(uint64_t key) { return uint32_t((key >> 28) & 0xfffffff); }
+static uint32_t keyY(uint64_t key) { return uint32_t(key & 0xfffffff); }
+
+static uint64_t childKey(uint64_t key, int child) {
+	return makeKey(keyFace(key), keyLevel(key) + 1, keyX(key) * 2 + (child & 1), keyY(key) * 2 + (child >> 1));
+}
+
+static uint64_t parentKey(uint64_t key) {
+	return makeKey(keyFace(key), keyLevel(key) - 1, keyX(key) / 2, keyY(key) / 2);
+}
+
+// Width of a chunk in face coordinates
+static double chunkSize(int level) {
+	return 2.0 / double(1u << level);
+}
+
+/*
+* The edge vertices of a chunk in order round it, counter-clockwise from the bottom left corner
+*/
+static glm::ivec2 ringVertex(int k) {
+	const int n = ChunkedTerrain::CHUNK_QUADS;
+	int t = k % n;
+	switch (k / n) {
+	case 0: return glm::ivec2(t, 0);
+	case 1: return glm::ivec2(n, t);
+	case 2: return glm::ivec2(n - t, n);
+	default: return glm::ivec2(0, n - t);
+	}
+}
+
+// Where an edge vertex is in ringVertex's order
+static int ringIndex(const glm::ivec2 &c) {
+	const int n = ChunkedTerrain::CHUNK_QUADS;
+	if (c.y == 0 && c.x < n) return c.x;
+	if (c.x == n && c.y < n) return n + c.y;
+	if (c.y == n && c.x > 0) return 3 * n - c.x;
+	return 4 * n - c.y;
+}
+
+/*
+* Moves a point given in a faces coordinates, which may have wandered off the face, onto
+* whichever face it actually lies over
+*/
+static void wrapFace(int &face, double &u, double &v) {
+	glm::dvec3 p = FACE_NORMAL[face] + u * FACE_U[face] + v * FACE_V[face];
+	glm::dvec3 a = glm::abs(p);
+	if (a.x >= a.y && a.x >= a.z) {
+		face = p.x > 0 ? 0 : 1;
+	} else if (a.y >= a.z) {
+		face = p.y > 0 ? 2 : 3;
+	} else {
+		face = p.z > 0 ? 4 : 5;
+	}
+	double d = glm::dot(p, FACE_NORMAL[face]);
+	u = glm::dot(p, FACE_U[face]) / d;
+	v = glm::dot(p, FACE_V[face]) / d;
+}
+
+/*
+* Point on the unit sphere for face coordinates in [-1, 1]. Uses the spherified cube mapping,
+* which spreads vertices more evenly than normalising. It only depends on the point on the
+* cube, so chunks on different faces agree along shared edges
+*/
+static glm::dvec3 cubeToSphere(int face, double u, double v) {
+	if (u < -1 || u > 1 || v < -1 || v > 1) {
+		wrapFace(face, u, v);
+	}
+	glm::dvec3 p = FACE_NORMAL[face] + u * FACE_U[face] + v * FACE_V[face];
+	glm::dvec3 p2 = p * p;
+	return glm::dvec3(
+		p.x * std::sqrt(1.0 - p2.y / 2.0 - p2.z / 2.0 + p2.y * p2.z / 3.0),
+		p.y * std::sqrt(1.0 - p2.z / 2.0 - p2.x / 2.0 + p2.z * p2.x / 3.0),
+		p.z * std::sqrt(1.0 - p2.x / 2.0 - p2.y / 2.0 + p2.x * p2.y / 3.0));
+}
+
+/*
+* As many octaves as the quads of a chunk at `level` can show, the finest with a wavelength of
+* about two quads. So each level down adds one. Never fewer than the planet itself uses
+*/
+int ChunkedTerrain::octaves(const TerrainSettings &settings, int level) {
+	double quad = chunkSize(level) / CHUNK_QUADS;
+	double finest = 1.0 / (2.0 * quad * std::max(double(settings.frequency), 1e-3));
+	return std::max(settings.octaves, int(std::floor(std::log2(finest))) + 1);
+}
+
+// How far the skirts hang down, in quads. Shared edges match, so they only cover the rounding
+// where chunks are placed from float centres
+static const double SKIRT_DEPTH = 0.25;
+
+/*
+* Colour of the surface at a point, by the same rules as Planet::voronoiCells
+*/
+static glm::vec3 surfaceColour(const TerrainSettings &settings, const glm::dvec3 &unit, double radius) {
+	if (settings.colours.empty()) return glm::vec3(0.5f);
+	if (radius <= 1.0 || settings.sites.empty()) return settings.colours[0];
+	size_t site = Planet::closestSite(glm::vec3(unit), settings.sites) + 1;
+	return settings.colours[std::min(site, settings.colours.size() - 1)];
+}
+
+// Worker results waiting to be uploaded. Shared so that workers can finish after the terrain is gone
+struct ChunkedTerrain::Results {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ChunkData>> done;
+};
+
+ChunkedTerrain::ChunkedTerrain(const TerrainSettings &settings, size_t maxCachedChunks)
+	: m_settings(std::make_shared<TerrainSettings>(settings)),
+	  m_results(std::make_shared<Results>()),
+	  m_maxCachedChunks(maxCachedChunks) {
+	std::fill(m_indexBuffers, m_indexBuffers + STITCH_MASKS, 0);
+	std::fill(m_indexCounts, m_indexCounts + STITCH_MASKS, 0);
+	// The six roots are always needed, so build them straight away
+	for (int face = 0; face < 6; face++) {
+		upload(*buildChunk(*m_settings, makeKey(face, 0, 0, 0)));
+	}
+}
+
+ChunkedTerrain::~ChunkedTerrain() {
+	for (auto &entry : m_chunks) {
+		glDeleteVertexArrays(1, &entry.second.vao);
+		glDeleteBuffers(1, &entry.second.vbo);
+	}
+	glDeleteBuffers(STITCH_MASKS, m_indexBuffers);
+}
+
+/*
+* Samples the terrain over the chunk plus a one vertex border, so normals along the edges
+* match the neighbouring chunks. The vertices are the grid, the skirt, then the edge again with
+* the octaves of the level above and a skirt under that, both in ringVertex's order
+*/
+std::unique_ptr<ChunkedTerrain::ChunkData> ChunkedTerrain::buildChunk(const TerrainSettings &settings, uint64_t key) {
+	const int n = CHUNK_QUADS;
+	const int side = n + 3; // Samples along each side, including the border
+	int face = keyFace(key);
+	int level = keyLevel(key);
+	int octaves = ChunkedTerrain::octaves(settings, level);
+	int coarseOctaves = ChunkedTerrain::octaves(settings, std::max(level - 1, 0));
+	double size = chunkSize(level);
+	double u0 = -1.0 + keyX(key) * size;
+	double v0 = -1.0 + keyY(key) * size;
+	double step = size / n;
+
+	std::unique_ptr<ChunkData> data(new ChunkData());
+	data->key = key;
+	data->centre = cubeToSphere(face, u0 + size * 0.5, v0 + size * 0.5);
+
+	std::vector<glm::dvec3> positions(side * side);
+	std::vector<glm::vec3> colours(side * side);
+	for (int j = 0; j < side; j++) {
+		for (int i = 0; i < side; i++) {
+			// Edge samples are computed from the exact edge coordinate so neighbours match bit for bit
+			double u = (i - 1 == n) ? u0 + size : u0 + (i - 1) * step;
+			double v = (j - 1 == n) ? v0 + size : v0 + (j - 1) * step;
+			glm::dvec3 unit = cubeToSphere(face, u, v);
+			double radius = 1.0 + Planet::fractalNoise(unit, octaves, double(settings.frequency),
+				double(settings.amplitude), settings.perlin, settings.simplex);
+			positions[j * side + i] = unit * radius;
+			colours[j * side + i] = surfaceColour(settings, unit, radius);
+		}
+	}
+
+	data->vertices.reserve((n + 1) * (n + 1) + 12 * n);
+	for (int j = 1; j <= n + 1; j++) {
+		for (int i = 1; i <= n + 1; i++) {
+			glm::dvec3 du = positions[j * side + i + 1] - positions[j * side + i - 1];
+			glm::dvec3 dv = positions[(j + 1) * side + i] - positions[(j - 1) * side + i];
+			ChunkVertex vert;
+			vert.position = glm::vec3(positions[j * side + i] - data->centre);
+			vert.normal = glm::vec3(glm::normalize(glm::cross(du, dv)));
+			vert.colour = colours[j * side + i];
+			data->vertices.push_back(vert);
+		}
+	}
+
+	// The edge as a coarser neighbour samples it. Normals are kept from the grid, a coarser
+	// neighbour's differ a little anyway as it steps further for them
+	std::vector<glm::dvec3> coarse(4 * n);
+	std::vector<glm::vec3> coarseColours(4 * n);
+	for (int k = 0; k < 4 * n; k++) {
+		glm::ivec2 c = ringVertex(k);
+		double u = (c.x == n) ? u0 + size : u0 + c.x * step;
+		double v = (c.y == n) ? v0 + size : v0 + c.y * step;
+		glm::dvec3 unit = cubeToSphere(face, u, v);
+		double radius = 1.0 + Planet::fractalNoise(unit, coarseOctaves, double(settings.frequency),
+			double(settings.amplitude), settings.perlin, settings.simplex);
+		coarse[k] = unit * radius;
+		coarseColours[k] = surfaceColour(settings, unit, radius);
+	}
+
+	// The skirts, a vertex under each edge vertex
+	double depth = SKIRT_DEPTH * step;
+	for (int k = 0; k < 4 * n; k++) {
+		glm::ivec2 c = ringVertex(k);
+		ChunkVertex vert = data->vertices[c.y * (n + 1) + c.x];
+		glm::dvec3 p = positions[(c.y + 1) * side + c.x + 1];
+		vert.position = glm::vec3(p - glm::normalize(p) * depth - data->centre);
+		data->vertices.push_back(vert);
+	}
+	for (int k = 0; k < 4 * n; k++) {
+		glm::ivec2 c = ringVertex(k);
+		ChunkVertex vert = data->vertices[c.y * (n + 1) + c.x];
+		vert.position = glm::vec3(coarse[k] - data->centre);
+		vert.colour = coarseColours[k];
+		data->vertices.push_back(vert);
+	}
+	for (int k = 0; k < 4 * n; k++) {
+		ChunkVertex vert = data->vertices[(n + 1) * (n + 1) + 4 * n + k];
+		vert.position = glm::vec3(coarse[k] - glm::normalize(coarse[k]) * depth - data->centre);
+		data->vertices.push_back(vert);
+	}
+	return data;
+}
+
+/*
+* Two triangles per quad. Along an edge that borders a coarser chunk, each odd vertex is
+* collapsed onto the even vertex before it, and the even ones come from the edge sampled with
+* the coarser octaves. Those are exactly the coarser chunks vertices, so the edge is the coarser
+* chunks edge and there is no gap. A corner that only touches a coarser chunk diagonally takes
+* the coarser sample too, as that chunk has it. Triangles that collapse to nothing are dropped.
+* The skirts follow the edges the same way
+*/
+std::vector<unsigned short> ChunkedTerrain::buildIndices(int mask) {
+	const int n = CHUNK_QUADS;
+	const int grid = (n + 1) * (n + 1);
+	auto collapse = [mask, n](glm::ivec2 c) {
+		if (c.y == 0 && (mask & EDGE_BOTTOM) && (c.x & 1)) c.x--;
+		if (c.y == n && (mask & EDGE_TOP) && (c.x & 1)) c.x--;
+		if (c.x == 0 && (mask & EDGE_LEFT) && (c.y & 1)) c.y--;
+		if (c.x == n && (mask & EDGE_RIGHT) && (c.y & 1)) c.y--;
+		return c;
+	};
+	auto coarse = [mask, n](const glm::ivec2 &c) {
+		if ((c.y == 0 && (mask & EDGE_BOTTOM)) || (c.y == n && (mask & EDGE_TOP))) return true;
+		if ((c.x == 0 && (mask & EDGE_LEFT)) || (c.x == n && (mask & EDGE_RIGHT))) return true;
+		if (c == glm::ivec2(0, 0)) return (mask & CORNER_BOTTOM_LEFT) != 0;
+		if (c == glm::ivec2(n, 0)) return (mask & CORNER_BOTTOM_RIGHT) != 0;
+		if (c == glm::ivec2(n, n)) return (mask & CORNER_TOP_RIGHT) != 0;
+		if (c == glm::ivec2(0, n)) return (mask & CORNER_TOP_LEFT) != 0;
+		return false;
+	};
+	// Indices of a collapsed vertex and of the skirt under it
+	auto top = [&coarse, n, grid](const glm::ivec2 &c) {
+		return (unsigned short)(coarse(c) ? grid + 4 * n + ringIndex(c) : c.y * (n + 1) + c.x);
+	};
+	auto bottom = [&coarse, n, grid](const glm::ivec2 &c) {
+		return (unsigned short)(grid + (coarse(c) ? 8 * n : 0) + ringIndex(c));
+	};
+	auto index = [&collapse, &top](int i, int j) {
+		return top(collapse(glm::ivec2(i, j)));
+	};
+	std::vector<unsigned short> indices;
+	auto addTriangle = [&indices](unsigned short a, unsigned short b, unsigned short c) {
+		if (a == b || b == c || c == a) return;
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+	};
+	for (int j = 0; j < n; j++) {
+		for (int i = 0; i < n; i++) {
+			addTriangle(index(i, j), index(i + 1, j), index(i + 1, j + 1));
+			addTriangle(index(i, j), index(i + 1, j + 1), index(i, j + 1));
+		}
+	}
+	// Each edge runs with the chunk on its left, so these face out from it
+	for (int k = 0; k < 4 * n; k++) {
+		glm::ivec2 p = collapse(ringVertex(k)), q = collapse(ringVertex((k + 1) % (4 * n)));
+		if (p == q) continue;
+		unsigned short top0 = top(p), top1 = top(q);
+		unsigned short bottom0 = bottom(p), bottom1 = bottom(q);
+		addTriangle(bottom0, bottom1, top1);
+		addTriangle(bottom0, top1, top0);
+	}
+	return indices;
+}
+
+void ChunkedTerrain::upload(const ChunkData &data) {
+	Chunk chunk;
+	chunk.centre = glm::vec3(data.centre);
+	chunk.lastUsed = m_frame;
+
+	glGenVertexArrays(1, &chunk.vao);
+	glBindVertexArray(chunk.vao);
+	glGenBuffers(1, &chunk.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+	glBufferData(GL_ARRAY_BUFFER, data.vertices.size() * sizeof(ChunkVertex), &data.vertices[0], GL_STATIC_DRAW);
+
+	// Same attribute locations as cgra::Mesh
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ChunkVertex), reinterpret_cast<void *>(offsetof(ChunkVertex, position)));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ChunkVertex), reinterpret_cast<void *>(offsetof(ChunkVertex, normal)));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(ChunkVertex), reinterpret_cast<void *>(offsetof(ChunkVertex, colour)));
+	glEnableVertexAttribArray(3);
+	glBindVertexArray(0);
+
+	m_lru.push_front(data.key);
+	chunk.lru = m_lru.begin();
+	m_chunks[data.key] = chunk;
+}
+
+void ChunkedTerrain::collectResults() {
+	std::vector<std::unique_ptr<ChunkData>> done;
+	{
+		std::lock_guard<std::mutex> lock(m_results->mutex);
+		done.swap(m_results->done);
+	}
+	for (std::unique_ptr<ChunkData> &data : done) {
+		m_pending.erase(data->key);
+		if (m_chunks.find(data->key) == m_chunks.end()) {
+			upload(*data);
+		}
+	}
+}
+
+void ChunkedTerrain::request(uint64_t key) {
+	if (m_chunks.count(key) || m_pending.count(key) || m_pending.size() >= MAX_IN_FLIGHT) return;
+	m_pending.insert(key);
+	std::shared_ptr<const TerrainSettings> settings = m_settings;
+	std::shared_ptr<Results> results = m_results;
+	cgra::ThreadPool::shared().submit([settings, results, key] {
+		std::unique_ptr<ChunkData> data = buildChunk(*settings, key);
+		std::lock_guard<std::mutex> lock(results->mutex);
+		results->done.push_back(std::move(data));
+	});
+}
+
+// Marks a chunk as needed this frame
+void ChunkedTerrain::touch(uint64_t key) {
+	Chunk &chunk = m_chunks.at(key);
+	chunk.lastUsed = m_frame;
+	m_lru.splice(m_lru.begin(), m_lru, chunk.lru);
+}
+
+bool ChunkedTerrain::childrenResident(uint64_t key) const {
+	for (int c = 0; c < 4; c++) {
+		if (!m_chunks.count(childKey(key, c))) return false;
+	}
+	return true;
+}
+
+bool ChunkedTerrain::wantsSplit(uint64_t key, const glm::vec3 &cameraLocal) const {
+	int level = keyLevel(key);
+	if (level >= MAX_LEVEL) return false;
+	const Chunk &chunk = m_chunks.at(key);
+	// A face is a quarter of a great circle, so a chunk is roughly its face size * pi/4 across
+	double width = chunkSize(level) * 0.785;
+	double dist = glm::length(glm::dvec3(cameraLocal) - glm::dvec3(chunk.centre));
+	return dist < SPLIT_DISTANCE * width;
+}
+
+/*
+* Walks down the quadtree. A chunk is only replaced by its children once all four are ready,
+* so there are never holes while they are being built
+*/
+void ChunkedTerrain::select(uint64_t key, const glm::vec3 &cameraLocal) {
+	touch(key);
+	if (wantsSplit(key, cameraLocal)) {
+		if (childrenResident(key)) {
+			for (int c = 0; c < 4; c++) {
+				select(childKey(key, c), cameraLocal);
+			}
+			return;
+		}
+		for (int c = 0; c < 4; c++) {
+			request(childKey(key, c));
+		}
+	}
+	m_leaves.insert(key);
+}
+
+void ChunkedTerrain::split(uint64_t key) {
+	m_leaves.erase(key);
+	for (int c = 0; c < 4; c++) {
+		uint64_t child = childKey(key, c);
+		touch(child);
+		m_leaves.insert(child);
+	}
+}
+
+// Replaces every leaf under `key` with `key` itself
+void ChunkedTerrain::merge(uint64_t key) {
+	int level = keyLevel(key);
+	for (auto it = m_leaves.begin(); it != m_leaves.end();) {
+		uint64_t leaf = *it;
+		while (keyLevel(leaf) > level) {
+			leaf = parentKey(leaf);
+		}
+		if (leaf == key) {
+			it = m_leaves.erase(it);
+		} else {
+			++it;
+		}
+	}
+	m_leaves.insert(key);
+}
+
+/*
+* Finds the leaf on the other side of one of a chunks edges, or past a corner when given the
+* two edges that meet there
+*/
+bool ChunkedTerrain::neighbourLeaf(uint64_t key, int edges, uint64_t &neighbour) const {
+	int face = keyFace(key);
+	int level = keyLevel(key);
+	double size = chunkSize(level);
+	double u = -1.0 + (keyX(key) + 0.5) * size;
+	double v = -1.0 + (keyY(key) + 0.5) * size;
+	double out = size * 0.5 + size / (4 * CHUNK_QUADS);
+	if (edges & EDGE_BOTTOM) v -= out;
+	if (edges & EDGE_TOP) v += out;
+	if (edges & EDGE_LEFT) u -= out;
+	if (edges & EDGE_RIGHT) u += out;
+	if (u < -1 || u > 1 || v < -1 || v > 1) {
+		wrapFace(face, u, v);
+	}
+	for (int l = 0; l <= MAX_LEVEL; l++) {
+		double s = chunkSize(l);
+		uint32_t cells = 1u << l;
+		uint32_t x = std::min(cells - 1, uint32_t(std::max(0.0, (u + 1.0) / s)));
+		uint32_t y = std::min(cells - 1, uint32_t(std::max(0.0, (v + 1.0) / s)));
+		uint64_t k = makeKey(face, l, x, y);
+		if (m_leaves.count(k)) {
+			neighbour = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Directions to the leaves around a chunk, edges then corners
+static const int NEIGHBOURS[8] = {
+	ChunkedTerrain::EDGE_BOTTOM, ChunkedTerrain::EDGE_RIGHT, ChunkedTerrain::EDGE_TOP, ChunkedTerrain::EDGE_LEFT,
+	ChunkedTerrain::EDGE_BOTTOM | ChunkedTerrain::EDGE_LEFT, ChunkedTerrain::EDGE_BOTTOM | ChunkedTerrain::EDGE_RIGHT,
+	ChunkedTerrain::EDGE_TOP | ChunkedTerrain::EDGE_RIGHT, ChunkedTerrain::EDGE_TOP | ChunkedTerrain::EDGE_LEFT
+};
+
+/*
+* Makes sure neighbouring leaves, diagonal ones included, are at most one level apart, which is
+* what the stitched index buffers can handle. Coarse neighbours are split where their children are ready, anything
+* left over is fixed by coarsening the finer side, which is always possible as every ancestor
+* of a leaf is resident
+*/
+void ChunkedTerrain::balance() {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		std::vector<uint64_t> leaves(m_leaves.begin(), m_leaves.end());
+		for (uint64_t leaf : leaves) {
+			if (!m_leaves.count(leaf)) continue;
+			for (int edges : NEIGHBOURS) {
+				uint64_t n;
+				if (neighbourLeaf(leaf, edges, n) && keyLevel(n) < keyLevel(leaf) - 1) {
+					if (childrenResident(n)) {
+						split(n);
+						changed = true;
+					} else {
+						for (int c = 0; c < 4; c++) {
+							request(childKey(n, c));
+						}
+					}
+				}
+			}
+		}
+	}
+	changed = true;
+	while (changed) {
+		changed = false;
+		std::vector<uint64_t> leaves(m_leaves.begin(), m_leaves.end());
+		for (uint64_t leaf : leaves) {
+			if (!m_leaves.count(leaf)) continue;
+			for (int edges : NEIGHBOURS) {
+				uint64_t n;
+				if (neighbourLeaf(leaf, edges, n) && keyLevel(n) < keyLevel(leaf) - 1) {
+					merge(parentKey(leaf));
+					changed = true;
+					break;
+				}
+			}
+		}
+	}
+}
+
+/*
+* Which edges and corners of a leaf meet a coarser leaf
+*/
+int ChunkedTerrain::stitchMask(uint64_t key) const {
+	static const int CORNERS[4] = { CORNER_BOTTOM_LEFT, CORNER_BOTTOM_RIGHT, CORNER_TOP_RIGHT, CORNER_TOP_LEFT };
+	int mask = 0;
+	for (int i = 0; i < 4; i++) {
+		uint64_t n;
+		if (neighbourLeaf(key, NEIGHBOURS[i], n) && keyLevel(n) < keyLevel(key)) {
+			mask |= NEIGHBOURS[i];
+		}
+	}
+	for (int i = 0; i < 4; i++) {
+		uint64_t n;
+		int edges = NEIGHBOURS[4 + i];
+		if (!(mask & edges) && neighbourLeaf(key, edges, n) && keyLevel(n) < keyLevel(key)) {
+			mask |= CORNERS[i];
+		}
+	}
+	return mask;
+}
+
+/*
+* Drops the least recently used chunks that weren't needed this frame
+*/
+void ChunkedTerrain::evict() {
+	while (m_chunks.size() > m_maxCachedChunks && !m_lru.empty()) {
+		uint64_t key = m_lru.back();
+		Chunk &chunk = m_chunks.at(key);
+		if (chunk.lastUsed == m_frame || keyLevel(key) == 0) break;
+		glDeleteVertexArrays(1, &chunk.vao);
+		glDeleteBuffers(1, &chunk.vbo);
+		m_lru.pop_back();
+		m_chunks.erase(key);
+	}
+}
+
+void ChunkedTerrain::prepare(cgra::TransformBatch &transforms, const glm::mat4 &planetTransform, const glm::vec3 &cameraLocal) {
+	m_frame++;
+	collectResults();
+
+	m_leaves.clear();
+	for (int face = 0; face < 6; face++) {
+		select(makeKey(face, 0, 0, 0), cameraLocal);
+	}
+	balance();
+
+	m_draws.clear();
+	for (uint64_t key : m_leaves) {
+		const Chunk &chunk = m_chunks.at(key);
+		Draw draw;
+		draw.vao = chunk.vao;
+		draw.mask = stitchMask(key);
+		if (!m_indexBuffers[draw.mask]) {
+			std::vector<unsigned short> indices = buildIndices(draw.mask);
+			glGenBuffers(1, &m_indexBuffers[draw.mask]);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffers[draw.mask]);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+			m_indexCounts[draw.mask] = GLsizei(indices.size());
+		}
+		draw.transform = transforms.add(glm::translate(planetTransform, chunk.centre));
+		m_draws.push_back(draw);
+	}
+}
+
+void ChunkedTerrain::draw(cgra::Program &program) {
+	program.setMorphFactor(0.0f);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	for (const Draw &draw : m_draws) {
+		program.setDrawIndex(draw.transform);
+		glBindVertexArray(draw.vao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffers[draw.mask]);
+		glDrawElements(GL_TRIANGLES, m_indexCounts[draw.mask], GL_UNSIGNED_SHORT, 0);
+	}
+	glBindVertexArray(0);
+
+	evict();
+}
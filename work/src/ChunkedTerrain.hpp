@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "opengl.hpp"
+#include "glm/glm.hpp"
+
+#include "cgra/shader.hpp"
+#include "cgra/transformbatch.hpp"
+#include "Planet.hpp"
+
+// Close-up surface for a planet. The planet is treated as a cube pushed out onto the sphere,
+// with a quadtree on each of the six faces. Chunks near the camera are split, built on worker
+// threads, and kept in an LRU cache once the camera moves away.
+// Neighbouring chunks, diagonal ones included, never differ by more than one level, and the
+// finer side drops its odd edge vertices, so their edges follow the same line. Each level down
+// adds an octave of noise, so every chunk also keeps its edge vertices with the octaves of the
+// level above, and uses those along edges and at corners that meet a coarser chunk. Shared edge
+// vertices then come out the same on both sides, and a shallow skirt only covers the rounding.
+// The noise is worked out in double precision, floats can't place the finest octaves.
+class ChunkedTerrain {
+public:
+	// Quads along each side of a chunk
+	static const int CHUNK_QUADS = 16;
+	// Deepest quadtree level, about a 40000th of the planets radius per quad. Finer quads would
+	// be smaller than a pixel at the near plane, and too small for the float transforms to place
+	static const int MAX_LEVEL = 12;
+
+	// Edges and corners of a chunk, used as bits in a stitching mask. A corner is only set when
+	// neither of its edges is, as the edges already bring it along
+	enum Edge {
+		EDGE_BOTTOM = 1,
+		EDGE_RIGHT = 2,
+		EDGE_TOP = 4,
+		EDGE_LEFT = 8,
+		CORNER_BOTTOM_LEFT = 16,
+		CORNER_BOTTOM_RIGHT = 32,
+		CORNER_TOP_RIGHT = 64,
+		CORNER_TOP_LEFT = 128
+	};
+	static const int STITCH_MASKS = 256;
+
+	ChunkedTerrain(const TerrainSettings &settings, size_t maxCachedChunks = 1024);
+	~ChunkedTerrain();
+
+	ChunkedTerrain(const ChunkedTerrain &) = delete;
+	ChunkedTerrain & operator=(const ChunkedTerrain &) = delete;
+
+	// Picks the chunks needed for a camera at `cameraLocal` (in planet space), asks the workers
+	// for any that are missing and adds the transforms of what is ready to `transforms`
+	void prepare(cgra::TransformBatch &transforms, const glm::mat4 &planetTransform, const glm::vec3 &cameraLocal);
+
+	// Draws the chunks picked by the last prepare, once `transforms` is uploaded
+	void draw(cgra::Program &program);
+
+	size_t residentChunks() const { return m_chunks.size(); }
+	size_t pendingChunks() const { return m_pending.size(); }
+	size_t drawnChunks() const { return m_leaves.size(); }
+
+	// Output of a worker, uploaded on the main thread
+	struct ChunkVertex {
+		glm::vec3 position; // Relative to the chunk centre
+		glm::vec3 normal;
+		glm::vec3 colour;
+	};
+	struct ChunkData {
+		uint64_t key;
+		glm::dvec3 centre;
+		std::vector<ChunkVertex> vertices;
+	};
+	struct Results;
+
+	// Builds the vertices of one chunk. Safe to call from any thread
+	static std::unique_ptr<ChunkData> buildChunk(const TerrainSettings &settings, uint64_t key);
+	// Triangle indices for a chunk whose `mask` edges and corners meet a coarser chunk, skirts
+	// included
+	static std::vector<unsigned short> buildIndices(int mask);
+	// Octaves of noise a chunk at `level` uses
+	static int octaves(const TerrainSettings &settings, int level);
+
+private:
+	// A chunk that has been uploaded to the GPU
+	struct Chunk {
+		glm::vec3 centre;
+		GLuint vao;
+		GLuint vbo;
+		std::list<uint64_t>::iterator lru;
+		unsigned int lastUsed;
+	};
+
+	std::shared_ptr<const TerrainSettings> m_settings;
+	std::shared_ptr<Results> m_results;
+	size_t m_maxCachedChunks;
+	unsigned int m_frame = 0;
+
+	std::unordered_map<uint64_t, Chunk> m_chunks;
+	std::list<uint64_t> m_lru; // Most recently used at the front
+	std::unordered_set<uint64_t> m_pending;
+	std::unordered_set<uint64_t> m_leaves; // Chunks drawn this frame
+
+	// What prepare picked for draw
+	struct Draw {
+		GLuint vao;
+		int mask;
+		int transform;
+	};
+	std::vector<Draw> m_draws;
+
+	// One index buffer per stitching mask, shared by every chunk, made the first time it's used
+	GLuint m_indexBuffers[STITCH_MASKS];
+	GLsizei m_indexCounts[STITCH_MASKS];
+
+	void upload(const ChunkData &data);
+	void collectResults();
+	void request(uint64_t key);
+	void touch(uint64_t key);
+	bool childrenResident(uint64_t key) const;
+	bool wantsSplit(uint64_t key, const glm::vec3 &cameraLocal) const;
+	void select(uint64_t key, const glm::vec3 &cameraLocal);
+	void split(uint64_t key);
+	void merge(uint64_t key);
+	void balance();
+	bool neighbourLeaf(uint64_t key, int edges, uint64_t &neighbour) const;
+	int stitchMask(uint64_t key) const;
+	void evict();
+};
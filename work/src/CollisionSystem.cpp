@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+#include "cgra/threadpool.hpp"
+#include "CollisionSystem.hpp"
+
+// Below this many bodies the sort stays on one thread
+static const size_t PARALLEL_SORT = 8192;
+// Bodies per range for the simple per body loops
+static const size_t BODY_CHUNK = 4096;
+// Most cells along y or z, so a row number fits in the top half of a key
+static const float MAX_CELLS = 65536.0f;
+// Key of the bodies too big for a cell, after every real row
+static const uint64_t LARGE = ~uint64_t(0);
+
+// Half the rows around a row, as y and z steps, so each pair of neighbouring rows is only
+// swept once
+static const int FORWARD_ROWS[4][2] = { { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+
+/*
+* The bits of a float, flipped so they sort as unsigned integers in the same order as the floats
+*/
+static inline uint32_t sortableBits(float f) {
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+/*
+* Sphere test between two bodies, adds them to `out` if they overlap
+*/
+static inline void testPair(float ax, float ay, float az, float ar, uint32_t a,
+	float bx, float by, float bz, float br, uint32_t b, std::vector<CollisionSystem::Pair> &out) {
+	float dx = ax - bx, dy = ay - by, dz = az - bz;
+	float reach = ar + br;
+	float distance2 = dx * dx + dy * dy + dz * dz;
+	if (distance2 < reach * reach) {
+		out.push_back({ std::min(a, b), std::max(a, b), reach - std::sqrt(distance2) });
+	}
+}
+
+CollisionSystem::CollisionSystem(const Settings &settings) : m_settings(settings) {}
+
+std::pair<uint32_t, uint32_t> CollisionSystem::findRow(uint64_t row) const {
+	auto found = std::lower_bound(m_rows.begin(), m_rows.end(), row);
+	if (found == m_rows.end() || *found != row) {
+		return std::make_pair(0u, 0u);
+	}
+	size_t r = size_t(found - m_rows.begin());
+	return std::make_pair(m_rowStarts[r], m_rowStarts[r + 1]);
+}
+
+void CollisionSystem::detect(const std::vector<glm::vec3> &positions, const std::vector<float> &radii) {
+	std::vector<float> x(positions.size()), y(positions.size()), z(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		x[i] = positions[i].x;
+		y[i] = positions[i].y;
+		z[i] = positions[i].z;
+	}
+	detect(x.data(), y.data(), z.data(), radii.data(), std::min(positions.size(), radii.size()));
+}
+
+void CollisionSystem::detect(const float *x, const float *y, const float *z, const float *radius, size_t count) {
+	auto start = std::chrono::steady_clock::now();
+	cgra::ThreadPool &pool = cgra::ThreadPool::shared();
+	m_pairs.clear();
+	m_rows.clear();
+	m_rowStarts.clear();
+	m_stats = Stats();
+	m_stats.bodies = count;
+	if (count < 2) return;
+
+	glm::vec3 lo(INFINITY), hi(-INFINITY);
+	std::mutex boundsMutex;
+	pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+		glm::vec3 rangeLo(INFINITY), rangeHi(-INFINITY);
+		for (size_t i = begin; i < end; i++) {
+			glm::vec3 p(x[i], y[i], z[i]);
+			rangeLo = glm::min(rangeLo, p);
+			rangeHi = glm::max(rangeHi, p);
+		}
+		std::lock_guard<std::mutex> lock(boundsMutex);
+		lo = glm::min(lo, rangeLo);
+		hi = glm::max(hi, rangeHi);
+	}, BODY_CHUNK);
+
+	// Wide enough for every body up to twice the radius most bodies are under, or wider
+	// if there would be too many rows
+	float cell = m_settings.cellSize;
+	if (!(cell > 0.0f)) {
+		std::vector<float> radii(radius, radius + count);
+		auto percentile = radii.begin() + (count - 1) * 99 / 100;
+		std::nth_element(radii.begin(), percentile, radii.end());
+		float limit = 2.0f * *percentile, widest = 0.0f;
+		for (auto r = percentile; r != radii.end(); ++r) {
+			if (*r <= limit) widest = std::max(widest, *r);
+		}
+		cell = 2.0f * widest;
+	}
+	glm::vec3 extent = hi - lo;
+	cell = std::max(cell, std::max(extent.y, extent.z) / (MAX_CELLS - 1.0f));
+	if (!(cell > 0.0f)) {
+		cell = 1.0f;
+	}
+	float halfCell = 0.5f * cell, inverseCell = 1.0f / cell;
+	m_stats.cellSize = cell;
+	auto cellOf = [&](float offset) {
+		return std::min(int64_t(std::max(offset, 0.0f) * inverseCell), int64_t(MAX_CELLS) - 1);
+	};
+	int64_t lastY = cellOf(extent.y), lastZ = cellOf(extent.z);
+	int64_t rowsY = lastY + 1;
+
+	// Bodies only move a little from one step to the next, so in the last step's order
+	// they're already nearly sorted
+	bool reorder = m_order.size() != count;
+	m_order.resize(count);
+	pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			uint32_t body = reorder ? uint32_t(i) : m_order[i].second;
+			uint64_t key = LARGE;
+			if (radius[body] <= halfCell) {
+				uint64_t row = uint64_t(cellOf(z[body] - lo.z) * rowsY + cellOf(y[body] - lo.y));
+				key = row << 32 | sortableBits(x[body]);
+			}
+			m_order[i] = std::make_pair(key, body);
+		}
+	}, BODY_CHUNK);
+	pool.parallelSort(m_order.begin(), m_order.end(), PARALLEL_SORT);
+	size_t small = size_t(std::lower_bound(m_order.begin(), m_order.end(), std::make_pair(LARGE, uint32_t(0))) - m_order.begin());
+	size_t large = count - small;
+	m_stats.largeBodies = large;
+	// The large bodies along x, so they can be swept against each other
+	std::sort(m_order.begin() + small, m_order.end(), [&](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b) {
+		return x[a.second] - radius[a.second] < x[b.second] - radius[b.second];
+	});
+
+	m_sx.resize(small);
+	m_sy.resize(small);
+	m_sz.resize(small);
+	m_sr.resize(small);
+	pool.parallelFor(0, small, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			uint32_t body = m_order[i].second;
+			m_sx[i] = x[body];
+			m_sy[i] = y[body];
+			m_sz[i] = z[body];
+			m_sr[i] = radius[body];
+		}
+	}, BODY_CHUNK);
+
+	for (size_t i = 0; i < small; i++) {
+		uint64_t row = m_order[i].first >> 32;
+		if (m_rows.empty() || m_rows.back() != row) {
+			m_rows.push_back(row);
+			m_rowStarts.push_back(uint32_t(i));
+		}
+	}
+	m_rowStarts.push_back(uint32_t(small));
+	size_t rows = m_rows.size();
+	m_stats.rows = rows;
+	auto sorted = std::chrono::steady_clock::now();
+
+	// Each part sweeps a share of the rows and a share of the large bodies
+	size_t parts = size_t(pool.size() + 1) * 8;
+	std::vector<std::vector<Pair>> found(parts);
+	std::vector<uint64_t> tested(parts, 0);
+	pool.parallelFor(0, parts, [&](size_t partBegin, size_t partEnd) {
+		for (size_t part = partBegin; part < partEnd; part++) {
+			std::vector<Pair> &out = found[part];
+			uint64_t tests = 0;
+
+			for (size_t r = rows * part / parts; r < rows * (part + 1) / parts; r++) {
+				uint32_t begin = m_rowStarts[r], end = m_rowStarts[r + 1];
+				// Within the row, each body against the ones after it less than a cell along
+				for (uint32_t i = begin; i < end; i++) {
+					for (uint32_t j = i + 1; j < end && m_sx[j] < m_sx[i] + cell; j++) {
+						testPair(m_sx[i], m_sy[i], m_sz[i], m_sr[i], m_order[i].second,
+							m_sx[j], m_sy[j], m_sz[j], m_sr[j], m_order[j].second, out);
+						tests++;
+					}
+				}
+
+				int64_t rowY = int64_t(m_rows[r] % rowsY), rowZ = int64_t(m_rows[r] / rowsY);
+				for (const int *step : FORWARD_ROWS) {
+					int64_t nextY = rowY + step[0], nextZ = rowZ + step[1];
+					if (nextY < 0 || nextY > lastY || nextZ > lastZ) continue;
+					std::pair<uint32_t, uint32_t> next = findRow(uint64_t(nextZ * rowsY + nextY));
+					// Both rows go along x, so the window of the other row only moves forward
+					uint32_t window = next.first;
+					for (uint32_t i = begin; i < end && window < next.second; i++) {
+						while (window < next.second && m_sx[window] <= m_sx[i] - cell) window++;
+						for (uint32_t j = window; j < next.second && m_sx[j] < m_sx[i] + cell; j++) {
+							testPair(m_sx[i], m_sy[i], m_sz[i], m_sr[i], m_order[i].second,
+								m_sx[j], m_sy[j], m_sz[j], m_sr[j], m_order[j].second, out);
+							tests++;
+						}
+					}
+				}
+			}
+
+			for (size_t k = small + large * part / parts; k < small + large * (part + 1) / parts; k++) {
+				uint32_t body = m_order[k].second;
+				float bx = x[body], by = y[body], bz = z[body], br = radius[body];
+				// Every small body it could reach has its centre in one of these rows, and
+				// this close along x
+				float reach = br + halfCell;
+				int64_t firstY = cellOf(by - reach - lo.y), lastRowY = std::min(cellOf(by + reach - lo.y), lastY);
+				int64_t firstZ = cellOf(bz - reach - lo.z), lastRowZ = std::min(cellOf(bz + reach - lo.z), lastZ);
+				auto sweepRow = [&](uint32_t begin, uint32_t end) {
+					uint32_t j = uint32_t(std::lower_bound(m_sx.begin() + begin, m_sx.begin() + end, bx - reach) - m_sx.begin());
+					for (; j < end && m_sx[j] < bx + reach; j++) {
+						testPair(bx, by, bz, br, body, m_sx[j], m_sy[j], m_sz[j], m_sr[j], m_order[j].second, out);
+						tests++;
+					}
+				};
+				if (uint64_t(lastRowY - firstY + 1) * uint64_t(lastRowZ - firstZ + 1) > rows) {
+					// Reaches more rows than there are, quicker to go through the ones there are
+					for (size_t r = 0; r < rows; r++) {
+						int64_t rowY = int64_t(m_rows[r] % rowsY), rowZ = int64_t(m_rows[r] / rowsY);
+						if (rowY >= firstY && rowY <= lastRowY && rowZ >= firstZ && rowZ <= lastRowZ) {
+							sweepRow(m_rowStarts[r], m_rowStarts[r + 1]);
+						}
+					}
+				} else {
+					for (int64_t rowZ = firstZ; rowZ <= lastRowZ; rowZ++) {
+						for (int64_t rowY = firstY; rowY <= lastRowY; rowY++) {
+							std::pair<uint32_t, uint32_t> run = findRow(uint64_t(rowZ * rowsY + rowY));
+							sweepRow(run.first, run.second);
+						}
+					}
+				}
+				// Against the large bodies after it along x that it reaches
+				for (size_t l = k + 1; l < count && x[m_order[l].second] - radius[m_order[l].second] < bx + br; l++) {
+					uint32_t other = m_order[l].second;
+					testPair(bx, by, bz, br, body, x[other], y[other], z[other], radius[other], other, out);
+					tests++;
+				}
+			}
+			tested[part] = tests;
+		}
+	});
+
+	size_t total = 0;
+	for (const std::vector<Pair> &part : found) {
+		total += part.size();
+	}
+	m_pairs.reserve(total);
+	for (size_t part = 0; part < parts; part++) {
+		m_pairs.insert(m_pairs.end(), found[part].begin(), found[part].end());
+		m_stats.candidates += tested[part];
+	}
+	m_stats.pairs = m_pairs.size();
+
+	auto finished = std::chrono::steady_clock::now();
+	m_stats.sortMs = std::chrono::duration<double, std::milli>(sorted - start).count();
+	m_stats.sweepMs = std::chrono::duration<double, std::milli>(finished - sorted).count();
+	m_stats.totalMs = std::chrono::duration<double, std::milli>(finished - start).count();
+}
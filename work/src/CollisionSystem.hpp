@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+// Finds every pair of bodies that touch, with each body a sphere. The broad phase lays a grid
+// over the bodies, with cells at least as wide as nearly every body, and sorts the bodies along
+// the rows of the grid, row by row and along x within a row. Two bodies can only touch if
+// their rows are the same or next to each other, so each row is swept along x against itself
+// and half of the rows around it, keeping a window of the bodies less than a cell away. The
+// few bodies too big for a cell are checked against every row they reach instead, and swept
+// along x against each other. The narrow phase is the exact sphere test. Everything but
+// finding the rows is spread over the shared thread pool.
+class CollisionSystem {
+public:
+	struct Settings {
+		// Width of a grid cell. 0 picks one from the radii each time, wide enough for all
+		// but the bodies more than twice as big as ninety nine in a hundred are
+		float cellSize = 0.0f;
+	};
+
+	// Two bodies that overlap, a < b, and how far they go into each other
+	struct Pair {
+		uint32_t a;
+		uint32_t b;
+		float depth;
+	};
+
+	// What the last detect() did
+	struct Stats {
+		size_t bodies = 0;
+		// Bodies wider than a cell, checked against the rows around them
+		size_t largeBodies = 0;
+		size_t rows = 0;
+		float cellSize = 0.0f;
+		// Sphere tests, and how many of them touched
+		uint64_t candidates = 0;
+		size_t pairs = 0;
+		double sortMs = 0.0;
+		double sweepMs = 0.0;
+		double totalMs = 0.0;
+	};
+
+	CollisionSystem() { }
+	explicit CollisionSystem(const Settings &settings);
+
+	const Settings &settings() const { return m_settings; }
+	void setSettings(const Settings &settings) { m_settings = settings; }
+
+	// Finds the pairs among `count` spheres, given one array per component as
+	// GravitySystem keeps them
+	void detect(const float *x, const float *y, const float *z, const float *radius, size_t count);
+	void detect(const std::vector<glm::vec3> &positions, const std::vector<float> &radii);
+
+	// Pairs from the last detect(), in no particular order
+	const std::vector<Pair> &pairs() const { return m_pairs; }
+	const Stats &stats() const { return m_stats; }
+
+private:
+	Settings m_settings;
+	Stats m_stats;
+	std::vector<Pair> m_pairs;
+
+	// Bodies in order of row and then x, those too big for a cell last, and copies of
+	// the small ones in that order
+	std::vector<std::pair<uint64_t, uint32_t>> m_order;
+	std::vector<float> m_sx, m_sy, m_sz, m_sr;
+	// Every row with a body in it, and where its run starts in m_order, with one past
+	// the last on the end
+	std::vector<uint64_t> m_rows;
+	std::vector<uint32_t> m_rowStarts;
+
+	// Run of the bodies in `row`, an empty run if there aren't any
+	std::pair<uint32_t, uint32_t> findRow(uint64_t row) const;
+};
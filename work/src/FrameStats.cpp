@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+#include "FrameStats.hpp"
+
+double FrameStats::mean(Column column) const {
+	if (m_frames.empty()) {
+		return 0.0;
+	}
+	double sum = 0.0;
+	for (const Frame &f : m_frames) {
+		sum += f.*column;
+	}
+	return sum / m_frames.size();
+}
+
+double FrameStats::min(Column column) const {
+	double result = m_frames.empty() ? 0.0 : m_frames.front().*column;
+	for (const Frame &f : m_frames) {
+		result = std::min(result, f.*column);
+	}
+	return result;
+}
+
+double FrameStats::max(Column column) const {
+	double result = m_frames.empty() ? 0.0 : m_frames.front().*column;
+	for (const Frame &f : m_frames) {
+		result = std::max(result, f.*column);
+	}
+	return result;
+}
+
+double FrameStats::percentile(Column column, double p) const {
+	if (m_frames.empty()) {
+		return 0.0;
+	}
+	std::vector<double> values;
+	for (const Frame &f : m_frames) {
+		values.push_back(f.*column);
+	}
+	std::sort(values.begin(), values.end());
+	size_t rank = (size_t)std::ceil(std::min(std::max(p, 0.0), 100.0) / 100.0 * values.size());
+	return values.at(rank == 0 ? 0 : rank - 1);
+}
+
+std::vector<size_t> FrameStats::worstFrames(Column column, size_t count) const {
+	std::vector<size_t> order(m_frames.size());
+	std::iota(order.begin(), order.end(), 0);
+	count = std::min(count, order.size());
+	std::partial_sort(order.begin(), order.begin() + count, order.end(), [&](size_t a, size_t b) {
+		return m_frames[a].*column > m_frames[b].*column;
+	});
+	order.resize(count);
+	return order;
+}
+
+bool FrameStats::writeCsv(const std::string &filename) const {
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		return false;
+	}
+	file << "frame,cpu_ms,gpu_ms,wall_ms\n";
+	for (size_t i = 0; i < m_frames.size(); i++) {
+		file << i << ',' << m_frames[i].cpuMs << ',' << m_frames[i].gpuMs << ',' << m_frames[i].wallMs << '\n';
+	}
+	return file.good();
+}
+
+std::string FrameStats::summary() const {
+	struct { const char *name; Column column; } columns[] = {
+		{ "cpu", &Frame::cpuMs }, { "gpu", &Frame::gpuMs }, { "wall", &Frame::wallMs }
+	};
+	std::ostringstream out;
+	out << m_frames.size() << " frames\n";
+	for (const auto &c : columns) {
+		out << c.name << " ms: mean " << mean(c.column) << ", median " << percentile(c.column, 50)
+			<< ", p95 " << percentile(c.column, 95) << ", p99 " << percentile(c.column, 99)
+			<< ", max " << max(c.column) << '\n';
+	}
+	return out.str();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Timings for a run of frames, with the usual summaries. Used by the headless renderer
+class FrameStats {
+public:
+	struct Frame {
+		double cpuMs = 0.0; // Time spent issuing the frame
+		double gpuMs = 0.0; // GPU time from a timer query
+		double wallMs = 0.0; // Until the frame was finished
+	};
+	// Picks which time a summary is about, e.g. &FrameStats::Frame::wallMs
+	typedef double Frame::*Column;
+
+	void add(const Frame &frame) { m_frames.push_back(frame); }
+	void clear() { m_frames.clear(); }
+	size_t size() const { return m_frames.size(); }
+	const Frame &at(size_t i) const { return m_frames.at(i); }
+
+	double mean(Column column) const;
+	double min(Column column) const;
+	double max(Column column) const;
+	// Nearest rank percentile, `p` from 0 to 100
+	double percentile(Column column, double p) const;
+	// Indices of the `count` slowest frames, slowest first
+	std::vector<size_t> worstFrames(Column column, size_t count) const;
+
+	// Writes one row per frame. Returns false if the file couldn't be written
+	bool writeCsv(const std::string &filename) const;
+	// One line of mean/median/p95/p99/max for each column
+	std::string summary() const;
+
+private:
+	std::vector<Frame> m_frames;
+};
@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <stdexcept>
+
+#include "glm/gtc/constants.hpp"
+
+#include "cgra/threadpool.hpp"
+#include "Galaxy.hpp"
+
+// Systems having their planets made at once
+static const size_t MAX_IN_FLIGHT = 2;
+// Nodes this deep are never split, a few hundredths of a unit across for the default radius
+static const int MAX_DEPTH = 24;
+// Goes at placing a bulge system before settling for wherever the last one landed
+static const int BULGE_TRIES = 32;
+
+// Attribute locations of a point, the same as cgra::Mesh for position and colour
+static const GLuint POINT_POSITION = 0;
+static const GLuint POINT_COLOUR = 3;
+static const GLuint POINT_LUMINOSITY = 5;
+
+// Colours of the coolest, sun-like and hottest stars
+static const glm::vec3 COOL_STAR(1.0f, 0.6f, 0.4f);
+static const glm::vec3 SUN_STAR(1.0f, 0.95f, 0.88f);
+static const glm::vec3 HOT_STAR(0.65f, 0.75f, 1.0f);
+// Light of the old stars of the bulge, and of the young stars along the arms
+static const glm::vec3 BULGE_LIGHT(1.0f, 0.85f, 0.6f);
+static const glm::vec3 ARM_LIGHT(0.75f, 0.85f, 1.0f);
+
+struct Galaxy::Results {
+	std::mutex mutex;
+	std::vector<std::pair<uint64_t, std::vector<Planet>>> done;
+};
+
+/*
+* splitmix64, spreads the bits of a seed so nearby seeds give unrelated numbers
+*/
+static uint64_t mixSeed(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+/*
+* Random numbers for the standard distributions from splitmix64. A leaf is made again every
+* frame it's drawn up close, and seeding a Mersenne Twister for each took longer than
+* making its systems
+*/
+struct SplitMix {
+	typedef uint64_t result_type;
+	uint64_t state;
+
+	explicit SplitMix(uint64_t seed) : state(seed) { }
+	static constexpr uint64_t min() { return 0; }
+	static constexpr uint64_t max() { return ~uint64_t(0); }
+	uint64_t operator()() {
+		uint64_t x = state;
+		state += 0x9e3779b97f4a7c15ull;
+		return mixSeed(x);
+	}
+};
+
+/*
+* The disc thins out as exp(-|y| / h) above and below the plane. This is its integral
+* from 0 to y, and the inverse of that, so systems can be spread the same way
+*/
+static double verticalIntegral(double y, double h) {
+	return (y < 0.0 ? -h : h) * (1.0 - std::exp(-std::abs(y) / h));
+}
+
+static double verticalInverse(double u, double h) {
+	double a = std::min(std::abs(u) / h, 1.0 - 1e-12);
+	return (u < 0.0 ? h : -h) * std::log(1.0 - a);
+}
+
+/*
+* Integral of exp(-|y| / h) from `bottom` to `top`, and of y times it, for the mean height
+*/
+static void verticalMoments(double bottom, double top, double h, double &weight, double &moment) {
+	if (bottom < 0.0 && top > 0.0) {
+		double w0, m0, w1, m1;
+		verticalMoments(bottom, 0.0, h, w0, m0);
+		verticalMoments(0.0, top, h, w1, m1);
+		weight = w0 + w1;
+		moment = m0 + m1;
+	} else if (top <= 0.0) {
+		verticalMoments(-top, -bottom, h, weight, moment);
+		moment = -moment;
+	} else {
+		double a = std::exp(-bottom / h), b = std::exp(-top / h);
+		weight = h * (a - b);
+		moment = h * ((bottom + h) * a - (top + h) * b);
+	}
+}
+
+/*
+* Integral of exp(-x^2 / 2s^2) from `low` to `high`, and of x times it. The bulge is a
+* product of three of these, so its share of a box is exact
+*/
+static void gaussianMoments(double low, double high, double s, double &weight, double &moment) {
+	double k = 1.0 / (s * std::sqrt(2.0));
+	weight = s * std::sqrt(glm::half_pi<double>()) * (std::erf(high * k) - std::erf(low * k));
+	moment = s * s * (std::exp(-low * low * k * k) - std::exp(-high * high * k * k));
+}
+
+/*
+* Colour and brightness of a star from a number in [0, 1). Most stars are small and red,
+* a few are bright and blue
+*/
+static void starType(double t, glm::vec3 &colour, float &luminosity) {
+	t *= t;
+	colour = t < 0.5 ? glm::mix(COOL_STAR, SUN_STAR, float(t * 2.0)) : glm::mix(SUN_STAR, HOT_STAR, float(t * 2.0 - 1.0));
+	luminosity = 0.05f * std::pow(2000.0f, float(t));
+}
+
+// Mean luminosity of a star, for the light of a node too far away to make its systems
+static float meanLuminosity() {
+	const int STEPS = 256;
+	double sum = 0.0;
+	for (int i = 0; i < STEPS; i++) {
+		glm::vec3 colour;
+		float luminosity;
+		starType((i + 0.5) / STEPS, colour, luminosity);
+		sum += luminosity;
+	}
+	return float(sum / STEPS);
+}
+
+Galaxy::Galaxy(const Settings &settings, const PlanetFactory &factory)
+	: m_settings(settings), m_factory(factory), m_results(std::make_shared<Results>()) {
+	if (m_settings.leafSystems == 0 || m_settings.radius <= 0.0 || m_settings.discHeight <= 0.0 ||
+		m_settings.discLength <= 0.0 || m_settings.bulgeLength <= 0.0) {
+		throw std::runtime_error("Error: galaxy sizes must be positive");
+	}
+	// Scale the bulge so it holds about bulgeWeight of the systems. The arms average out to
+	// a little over half the density of the disc they're on
+	double arms = 0.3 + 0.7 * 3.0 / 8.0;
+	double disc = 2.0 * glm::pi<double>() * m_settings.discLength * m_settings.discLength * arms * 2.0 * m_settings.discHeight;
+	double bulge = std::pow(glm::two_pi<double>(), 1.5) * std::pow(m_settings.bulgeLength, 3.0);
+	double weight = glm::clamp(m_settings.bulgeWeight, 0.0, 0.99);
+	m_bulgeScale = weight / (1.0 - weight) * disc / bulge;
+	m_meanLuminosity = meanLuminosity();
+
+	m_root.centre = glm::dvec3(0.0);
+	m_root.halfSize = m_settings.radius;
+	m_root.centroid = glm::dvec3(0.0);
+	m_root.count = m_settings.systems;
+	m_root.seed = mixSeed(m_settings.seed);
+	m_root.discShare = float(1.0 - weight);
+	m_root.colour = glm::mix(BULGE_LIGHT, regionColour(glm::dvec3(0.0)), m_root.discShare);
+}
+
+Galaxy::~Galaxy() {
+	if (m_vao != 0) {
+		glDeleteVertexArrays(1, &m_vao);
+		glDeleteBuffers(1, &m_buffer);
+	}
+}
+
+/*
+* How strongly the arms light up a spot on the plane, from 0 between them to 1 along them
+*/
+double Galaxy::armStrength(double x, double z) const {
+	double r = std::sqrt(x * x + z * z);
+	double phase = m_settings.arms * (std::atan2(z, x) - m_settings.twist * r / m_settings.radius);
+	double arm = 0.5 + 0.5 * std::cos(phase);
+	arm *= arm;
+	return arm * arm;
+}
+
+/*
+* Density of the disc on the plane, per unit of the vertical falloff
+*/
+double Galaxy::discDensity(double x, double z) const {
+	double r = std::sqrt(x * x + z * z);
+	return std::exp(-r / m_settings.discLength) * (0.3 + 0.7 * armStrength(x, z));
+}
+
+glm::vec3 Galaxy::regionColour(const glm::dvec3 &p) const {
+	return glm::mix(SUN_STAR, ARM_LIGHT, float(armStrength(p.x, p.z)));
+}
+
+bool Galaxy::isLeaf(const Node &node) const {
+	return node.count <= m_settings.leafSystems || node.depth >= MAX_DEPTH;
+}
+
+/*
+* Makes the eight children of a node. The disc is sampled on a grid across each child, fine
+* enough to follow it on the coarse levels, times its falloff over the child's height. The
+* bulge's share is exact. The nodes systems are then dealt out one child at a time, each
+* taking a binomial share of what's left, so the counts always add up and only depend on
+* the nodes seed
+*/
+void Galaxy::split(Node &node) {
+	node.children.reset(new Node[8]);
+	m_nodeCount += 8;
+	double half = node.halfSize * 0.5;
+	int samples = glm::clamp(int(std::ceil(2.0 * half / (0.25 * m_settings.discLength))), 2, 16);
+	double step = 2.0 * half / samples, area = step * step;
+	double weights[8], total = 0.0;
+	for (int c = 0; c < 8; c++) {
+		Node &child = node.children[c];
+		child.centre = node.centre + half * glm::dvec3(c & 1 ? 1.0 : -1.0, c & 2 ? 1.0 : -1.0, c & 4 ? 1.0 : -1.0);
+		child.halfSize = half;
+		child.depth = node.depth + 1;
+		child.seed = mixSeed(node.seed ^ uint64_t(c + 1) * 0x2545f4914f6cdd1dull);
+		child.lastUsed = m_frame;
+		glm::dvec3 low = child.centre - half, high = child.centre + half;
+
+		double disc = 0.0;
+		glm::dvec3 discCentre(0.0);
+		for (int i = 0; i < samples; i++) {
+			for (int j = 0; j < samples; j++) {
+				double x = low.x + (i + 0.5) * step, z = low.z + (j + 0.5) * step;
+				double d = discDensity(x, z) * area;
+				disc += d;
+				discCentre += d * glm::dvec3(x, 0.0, z);
+			}
+		}
+		double height, heightMoment;
+		verticalMoments(low.y, high.y, m_settings.discHeight, height, heightMoment);
+		discCentre = disc > 0.0 ? discCentre / disc : child.centre;
+		discCentre.y = height > 0.0 ? heightMoment / height : child.centre.y;
+		disc *= height;
+
+		double bulge = m_bulgeScale;
+		glm::dvec3 bulgeCentre;
+		for (int axis = 0; axis < 3; axis++) {
+			double weight, moment;
+			gaussianMoments(low[axis], high[axis], m_settings.bulgeLength, weight, moment);
+			bulge *= weight;
+			bulgeCentre[axis] = weight > 0.0 ? moment / weight : child.centre[axis];
+		}
+
+		weights[c] = disc + bulge;
+		total += weights[c];
+		child.discShare = weights[c] > 0.0 ? float(disc / weights[c]) : 1.0f;
+		child.centroid = glm::clamp(glm::mix(bulgeCentre, discCentre, double(child.discShare)), low, high);
+		child.colour = glm::mix(BULGE_LIGHT, regionColour(child.centroid), child.discShare);
+	}
+
+	SplitMix gen(node.seed);
+	uint64_t left = node.count, firstId = node.firstId;
+	for (int c = 0; c < 8; c++) {
+		Node &child = node.children[c];
+		if (c == 7 || total <= 0.0) {
+			child.count = c == 7 ? left : (left + 7 - c) / (8 - c);
+		} else {
+			std::binomial_distribution<uint64_t> share(left, glm::clamp(weights[c] / total, 0.0, 1.0));
+			child.count = share(gen);
+		}
+		child.firstId = firstId;
+		left -= child.count;
+		firstId += child.count;
+		total -= weights[c];
+	}
+}
+
+/*
+* The systems of a leaf, the same every time. A system is in the disc or the bulge by the
+* leaf's share of each, disc systems following its falloff above and below the plane
+*/
+void Galaxy::generateSystems(const Node &node, std::vector<StarSystem> &systems) const {
+	systems.resize(size_t(node.count));
+	SplitMix gen(node.seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	glm::dvec3 low = node.centre - node.halfSize, size(node.halfSize * 2.0);
+	double bottom = verticalIntegral(low.y, m_settings.discHeight);
+	double top = verticalIntegral(low.y + size.y, m_settings.discHeight);
+	double bulgeLength2 = m_settings.bulgeLength * m_settings.bulgeLength;
+	for (size_t i = 0; i < systems.size(); i++) {
+		StarSystem &system = systems[i];
+		system.id = node.firstId + i;
+		system.position.x = low.x + unit(gen) * size.x;
+		system.position.z = low.z + unit(gen) * size.z;
+		if (unit(gen) < node.discShare) {
+			system.position.y = verticalInverse(bottom + unit(gen) * (top - bottom), m_settings.discHeight);
+		} else {
+			// Points of the box kept by how dense the bulge is there. Boxes much bigger than the
+			// bulge keep few, they give up after a while, which only happens far out where
+			// there are hardly any bulge systems
+			glm::dvec3 nearest = glm::clamp(glm::dvec3(0.0), low, low + size);
+			double peak = glm::dot(nearest, nearest);
+			for (int tries = 0; tries < BULGE_TRIES; tries++) {
+				system.position = low + glm::dvec3(unit(gen), unit(gen), unit(gen)) * size;
+				double falloff = glm::dot(system.position, system.position) - peak;
+				if (unit(gen) < std::exp(-falloff / (2.0 * bulgeLength2))) break;
+			}
+		}
+		starType(unit(gen), system.colour, system.luminosity);
+		uint64_t bits = gen();
+		// Planets treat a seed of 0 as pick one at random
+		system.seed = unsigned(bits >> 32) | 1u;
+		system.planets = 1 + int(bits % 8);
+	}
+}
+
+void Galaxy::visit(Node &node, const glm::dvec3 &centre, double radius, const std::function<void(const StarSystem &)> &fn) {
+	node.lastUsed = m_frame;
+	if (node.count == 0) return;
+	glm::dvec3 outside = glm::max(glm::abs(centre - node.centre) - node.halfSize, glm::dvec3(0.0));
+	if (glm::dot(outside, outside) > radius * radius) return;
+
+	if (isLeaf(node)) {
+		std::vector<StarSystem> systems;
+		generateSystems(node, systems);
+		for (const StarSystem &system : systems) {
+			if (glm::distance(system.position, centre) <= radius) {
+				fn(system);
+			}
+		}
+		return;
+	}
+	if (!node.children) {
+		split(node);
+	}
+	for (int c = 0; c < 8; c++) {
+		visit(node.children[c], centre, radius, fn);
+	}
+}
+
+void Galaxy::forEachSystem(const glm::dvec3 &centre, double radius, const std::function<void(const StarSystem &)> &fn) {
+	visit(m_root, centre, radius, fn);
+}
+
+bool Galaxy::nearest(const glm::dvec3 &point, double radius, StarSystem &system) {
+	double best = radius;
+	bool found = false;
+	forEachSystem(point, radius, [&](const StarSystem &s) {
+		double distance = glm::distance(s.position, point);
+		if (distance <= best) {
+			best = distance;
+			system = s;
+			found = true;
+		}
+	});
+	return found;
+}
+
+/*
+* How big a node looks from `eye`, in radians near enough, and infinite from inside it
+*/
+static double angularSize(const glm::dvec3 &centre, double halfSize, const glm::dvec3 &eye) {
+	glm::dvec3 outside = glm::max(glm::abs(eye - centre) - halfSize, glm::dvec3(0.0));
+	double distance = glm::length(outside);
+	return distance > 0.0 ? 2.0 * halfSize / distance : std::numeric_limits<double>::infinity();
+}
+
+/*
+* Lets go of the children of every node whose children weren't used this frame, and
+* returns how many nodes went
+*/
+size_t Galaxy::trim(Node &node) {
+	if (!node.children) return 0;
+	bool used = node.children[0].lastUsed == m_frame;
+	size_t removed = 0;
+	for (int c = 0; c < 8; c++) {
+		removed += trim(node.children[c]);
+	}
+	if (!used) {
+		node.children.reset();
+		removed += 8;
+	}
+	return removed;
+}
+
+void Galaxy::prepare(const glm::dvec3 &eye, double detail, uint64_t skip) {
+	m_frame++;
+	collectResults();
+	evict();
+
+	m_points.clear();
+	m_nearSystems = 0;
+	// Nodes still to be drawn or split, biggest looking at the top. Splitting a node swaps
+	// its point for at most eight, splitting a leaf for at most leafSystems
+	typedef std::pair<double, Node *> Entry;
+	std::priority_queue<Entry> open;
+	m_root.lastUsed = m_frame;
+	open.push(Entry(angularSize(m_root.centre, m_root.halfSize, eye), &m_root));
+	while (!open.empty()) {
+		Node &node = *open.top().second;
+		double size = open.top().first;
+		size_t cost = size_t(isLeaf(node) ? node.count : 8);
+		if (size < detail || m_points.size() + open.size() - 1 + cost > m_settings.maxPoints) break;
+		open.pop();
+
+		if (isLeaf(node)) {
+			std::vector<StarSystem> systems;
+			generateSystems(node, systems);
+			for (const StarSystem &system : systems) {
+				if (system.id == skip) continue;
+				Point point;
+				point.position = glm::vec3(system.position - eye);
+				point.colour = system.colour;
+				point.luminosity = system.luminosity;
+				m_points.push_back(point);
+			}
+			m_nearSystems += systems.size();
+			continue;
+		}
+		if (!node.children) {
+			split(node);
+		}
+		for (int c = 0; c < 8; c++) {
+			Node &child = node.children[c];
+			child.lastUsed = m_frame;
+			if (child.count > 0) {
+				open.push(Entry(angularSize(child.centre, child.halfSize, eye), &child));
+			}
+		}
+	}
+	// Whatever is left is too small or too far to be worth splitting
+	for (; !open.empty(); open.pop()) {
+		const Node &node = *open.top().second;
+		Point point;
+		point.position = glm::vec3(node.centroid - eye);
+		point.colour = node.colour;
+		point.luminosity = float(node.count) * m_meanLuminosity;
+		m_points.push_back(point);
+	}
+
+	if (m_nodeCount > m_settings.maxNodes) {
+		m_nodeCount -= trim(m_root);
+	}
+}
+
+void Galaxy::draw(cgra::Program &program) {
+	if (m_points.empty()) return;
+	if (m_vao == 0) {
+		glGenVertexArrays(1, &m_vao);
+		glBindVertexArray(m_vao);
+		glGenBuffers(1, &m_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+		glVertexAttribPointer(POINT_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(Point), reinterpret_cast<void *>(offsetof(Point, position)));
+		glEnableVertexAttribArray(POINT_POSITION);
+		glVertexAttribPointer(POINT_COLOUR, 3, GL_FLOAT, GL_FALSE, sizeof(Point), reinterpret_cast<void *>(offsetof(Point, colour)));
+		glEnableVertexAttribArray(POINT_COLOUR);
+		glVertexAttribPointer(POINT_LUMINOSITY, 1, GL_FLOAT, GL_FALSE, sizeof(Point), reinterpret_cast<void *>(offsetof(Point, luminosity)));
+		glEnableVertexAttribArray(POINT_LUMINOSITY);
+	}
+
+	// Orphan last frames points, the buffer only ever grows
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+	size_t bytes = m_points.size() * sizeof(Point);
+	if (bytes > m_bufferCapacity) {
+		m_bufferCapacity = bytes + bytes / 4;
+	}
+	glBufferData(GL_ARRAY_BUFFER, m_bufferCapacity, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, m_points.data());
+
+	// Added together behind everything, so whatever is drawn after covers them
+	program.use();
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glBindVertexArray(m_vao);
+	glDrawArrays(GL_POINTS, 0, GLsizei(m_points.size()));
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisable(GL_BLEND);
+	glDepthMask(GL_TRUE);
+	glEnable(GL_DEPTH_TEST);
+}
+
+void Galaxy::collectResults() {
+	std::vector<std::pair<uint64_t, std::vector<Planet>>> done;
+	{
+		std::lock_guard<std::mutex> lock(m_results->mutex);
+		done.swap(m_results->done);
+	}
+	for (std::pair<uint64_t, std::vector<Planet>> &result : done) {
+		m_pending.erase(result.first);
+		if (!m_resident.count(result.first)) {
+			store(result.first, std::move(result.second));
+		}
+	}
+}
+
+void Galaxy::request(const StarSystem &system) {
+	if (m_resident.count(system.id) || m_pending.count(system.id) || m_pending.size() >= MAX_IN_FLIGHT) return;
+	m_pending.insert(system.id);
+	PlanetFactory factory = m_factory;
+	std::shared_ptr<Results> results = m_results;
+	cgra::ThreadPool::shared().submit([factory, results, system] {
+		std::vector<Planet> planets = factory(system);
+		std::lock_guard<std::mutex> lock(results->mutex);
+		results->done.emplace_back(system.id, std::move(planets));
+	});
+}
+
+bool Galaxy::take(uint64_t id, std::vector<Planet> &planets) {
+	auto it = m_resident.find(id);
+	if (it == m_resident.end()) return false;
+	planets = std::move(it->second.planets);
+	m_lru.erase(it->second.lru);
+	m_resident.erase(it);
+	return true;
+}
+
+void Galaxy::store(uint64_t id, std::vector<Planet> &&planets) {
+	auto it = m_resident.find(id);
+	if (it != m_resident.end()) {
+		it->second.planets = std::move(planets);
+		m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+		return;
+	}
+	m_lru.push_front(id);
+	Resident &resident = m_resident[id];
+	resident.planets = std::move(planets);
+	resident.lru = m_lru.begin();
+}
+
+/*
+* Drops the planets of the systems left longest ago
+*/
+void Galaxy::evict() {
+	while (m_resident.size() > m_settings.residentSystems && !m_lru.empty()) {
+		m_resident.erase(m_lru.back());
+		m_lru.pop_back();
+	}
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "opengl.hpp"
+#include "glm/glm.hpp"
+
+#include "cgra/shader.hpp"
+#include "Planet.hpp"
+
+// Millions of star systems in a spiral, all made up from one seed. Nothing is stored per
+// system: a sparse octree only knows how many systems are in each of its nodes, and a node is
+// split when something needs to look inside it, its count shared among its children by how
+// dense the galaxy is there. Splitting again always gives the same children, so nodes nothing
+// has used lately are thrown away once there are too many. The systems of a leaf are made
+// from its seed whenever they're needed.
+// Far away, a node is drawn as one point with the light of all its systems. Close up each
+// system is a point of its own, and the planets of the systems the camera comes near are
+// made on worker threads, then kept in an LRU cache.
+class Galaxy {
+public:
+	struct Settings {
+		unsigned int seed = 1;
+		uint64_t systems = 4000000;
+		// Half the width of the cube holding the galaxy
+		double radius = 400000.0;
+		// How quickly the disc thins out, in the same units as the solar system, and the
+		// width of the bulge, which falls off as a Gaussian
+		double discLength = 90000.0;
+		double discHeight = 1500.0;
+		double bulgeLength = 15000.0;
+		// Share of the systems in the bulge, near enough
+		double bulgeWeight = 0.2;
+		int arms = 2;
+		// How far round the arms wind on their way out, in radians
+		double twist = 6.0;
+		// Nodes with this many systems or fewer aren't split
+		uint64_t leafSystems = 64;
+		// Points drawn at most, the nodes that look biggest are split first
+		size_t maxPoints = 16000;
+		// Nodes kept before those not used in the last frame are let go
+		size_t maxNodes = 1 << 16;
+		// Systems whose planets are kept once the camera has left them
+		size_t residentSystems = 8;
+	};
+
+	static const uint64_t NO_SYSTEM = ~uint64_t(0);
+
+	struct StarSystem {
+		uint64_t id = NO_SYSTEM;
+		glm::dvec3 position;
+		unsigned int seed = 0;
+		float luminosity = 1.0f; // Of the sun
+		glm::vec3 colour;
+		int planets = 0;
+	};
+
+	// Makes the planets of a system. Called on worker threads, and should always make the
+	// same planets for the same system
+	typedef std::function<std::vector<Planet>(const StarSystem &)> PlanetFactory;
+
+	// One point drawn by draw(), relative to the eye given to prepare
+	struct Point {
+		glm::vec3 position;
+		glm::vec3 colour;
+		float luminosity; // All of the systems the point stands for
+	};
+
+	Galaxy(const Settings &settings, const PlanetFactory &factory);
+	~Galaxy();
+
+	Galaxy(const Galaxy &) = delete;
+	Galaxy & operator=(const Galaxy &) = delete;
+
+	const Settings &settings() const { return m_settings; }
+
+	// Calls `fn` on every system within `radius` of `centre`
+	void forEachSystem(const glm::dvec3 &centre, double radius, const std::function<void(const StarSystem &)> &fn);
+	// The closest system to `point` within `radius`, false if there isn't one
+	bool nearest(const glm::dvec3 &point, double radius, StarSystem &system);
+
+	// Works out the points to draw from `eye`. Nodes are split biggest looking first, until
+	// there would be more than maxPoints or every node is smaller than `detail` radians
+	// across. Each node left is one point, and each leaf split is a point per system, except
+	// `skip`. Also picks up any planets that have been made. Doesn't use OpenGL
+	void prepare(const glm::dvec3 &eye, double detail, uint64_t skip = NO_SYSTEM);
+	const std::vector<Point> &points() const { return m_points; }
+
+	// Draws the points of the last prepare with `program`, blended over whatever is there
+	void draw(cgra::Program &program);
+
+	// Starts making the planets of `system`, if they aren't made or on their way
+	void request(const StarSystem &system);
+	bool resident(uint64_t id) const { return m_resident.count(id) != 0; }
+	// Hands over the planets of a resident system, which stops being resident until it's
+	// given back with store(). False if they aren't ready yet
+	bool take(uint64_t id, std::vector<Planet> &planets);
+	// Keeps `planets` as the planets of system `id`, e.g. the ones the camera is leaving
+	void store(uint64_t id, std::vector<Planet> &&planets);
+
+	size_t nodeCount() const { return m_nodeCount; }
+	size_t residentCount() const { return m_resident.size(); }
+	size_t pendingCount() const { return m_pending.size(); }
+	// Systems that were drawn one to a point in the last prepare
+	size_t nearSystems() const { return m_nearSystems; }
+
+	struct Results;
+
+private:
+	struct Node {
+		glm::dvec3 centre;
+		double halfSize;
+		// Roughly where the nodes systems are, their light is drawn here from far away
+		glm::dvec3 centroid;
+		glm::vec3 colour;
+		uint64_t count = 0;
+		uint64_t firstId = 0; // The nodes systems have ids firstId to firstId + count - 1
+		uint64_t seed = 0;
+		// Share of the nodes systems in the disc rather than the bulge
+		float discShare = 1.0f;
+		int depth = 0;
+		unsigned int lastUsed = 0;
+		std::unique_ptr<Node[]> children; // Eight of them, or none
+	};
+
+	// Planets of a system the camera isn't in
+	struct Resident {
+		std::vector<Planet> planets;
+		std::list<uint64_t>::iterator lru;
+	};
+
+	Settings m_settings;
+	PlanetFactory m_factory;
+	std::shared_ptr<Results> m_results;
+	unsigned int m_frame = 0;
+	// Makes the bulge hold bulgeWeight of the systems
+	double m_bulgeScale = 1.0;
+	float m_meanLuminosity = 1.0f;
+
+	Node m_root;
+	size_t m_nodeCount = 1;
+
+	std::unordered_map<uint64_t, Resident> m_resident;
+	std::list<uint64_t> m_lru; // Most recently used at the front
+	std::unordered_set<uint64_t> m_pending;
+
+	std::vector<Point> m_points;
+	size_t m_nearSystems = 0;
+	GLuint m_vao = 0;
+	GLuint m_buffer = 0;
+	size_t m_bufferCapacity = 0;
+
+	double armStrength(double x, double z) const;
+	double discDensity(double x, double z) const;
+	glm::vec3 regionColour(const glm::dvec3 &p) const;
+	bool isLeaf(const Node &node) const;
+	void split(Node &node);
+	void generateSystems(const Node &node, std::vector<StarSystem> &systems) const;
+	void visit(Node &node, const glm::dvec3 &centre, double radius, const std::function<void(const StarSystem &)> &fn);
+	size_t trim(Node &node);
+	void collectResults();
+	void evict();
+};
@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "cgra/threadpool.hpp"
+#include "GravitySystem.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GRAVITY_SSE
+#endif
+
+// Bits of each axis in a Morton code, which is also the deepest the tree goes
+static const int MORTON_BITS = 21;
+// Levels built before the rest of the tree is handed out to the workers, up to 8^2 subtrees
+static const int TOP_LEVELS = 2;
+// Below this many bodies the tree is built on one thread
+static const size_t PARALLEL_BUILD = 8192;
+// Bodies per range for the simple per body loops
+static const size_t BODY_CHUNK = 4096;
+
+/*
+* Spreads the low 21 bits of v out to every third bit
+*/
+static uint64_t spreadBits(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+GravitySystem::GravitySystem(const Settings &settings) : m_settings(settings) {}
+
+void GravitySystem::setSettings(const Settings &settings) {
+	m_settings = settings;
+	m_forcesValid = false;
+}
+
+size_t GravitySystem::addBody(const glm::vec3 &position, const glm::vec3 &velocity, float mass) {
+	m_x.push_back(position.x);
+	m_y.push_back(position.y);
+	m_z.push_back(position.z);
+	m_vx.push_back(velocity.x);
+	m_vy.push_back(velocity.y);
+	m_vz.push_back(velocity.z);
+	m_ax.push_back(0.0f);
+	m_ay.push_back(0.0f);
+	m_az.push_back(0.0f);
+	m_mass.push_back(mass);
+	m_potential.push_back(0.0f);
+	m_forcesValid = false;
+	return m_mass.size() - 1;
+}
+
+void GravitySystem::setPosition(size_t i, const glm::vec3 &position) {
+	m_x[i] = position.x;
+	m_y[i] = position.y;
+	m_z[i] = position.z;
+	m_forcesValid = false;
+}
+
+void GravitySystem::setVelocity(size_t i, const glm::vec3 &velocity) {
+	m_vx[i] = velocity.x;
+	m_vy[i] = velocity.y;
+	m_vz[i] = velocity.z;
+}
+
+void GravitySystem::clear() {
+	for (std::vector<float> *v : { &m_x, &m_y, &m_z, &m_vx, &m_vy, &m_vz, &m_ax, &m_ay, &m_az, &m_mass, &m_potential }) {
+		v->clear();
+	}
+	m_nodes.clear();
+	m_leaves.clear();
+	m_time = 0.0;
+	m_forcesValid = false;
+}
+
+/*
+* Fills in the mass, centre of mass and bounds of a node from its bodies, or from its
+* children if it has any
+*/
+void GravitySystem::finishNode(std::vector<Node> &nodes, uint32_t index) const {
+	Node &node = nodes[index];
+	glm::vec3 weighted(0.0f);
+	float mass = 0.0f;
+	glm::vec3 lo(INFINITY), hi(-INFINITY);
+	if (node.childCount == 0) {
+		for (uint32_t i = node.begin; i < node.end; i++) {
+			glm::vec3 p(m_sx[i], m_sy[i], m_sz[i]);
+			weighted += p * m_sm[i];
+			mass += m_sm[i];
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+	} else {
+		for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; c++) {
+			const Node &child = nodes[c];
+			weighted += child.centreOfMass * child.mass;
+			mass += child.mass;
+			lo = glm::min(lo, child.boxMin);
+			hi = glm::max(hi, child.boxMax);
+		}
+	}
+	node.mass = mass;
+	node.centreOfMass = mass > 0.0f ? weighted / mass : (lo + hi) * 0.5f;
+	node.boxMin = lo;
+	node.boxMax = hi;
+}
+
+/*
+* Builds the node at `index` over the sorted bodies [begin, end), and everything under it.
+* When `subtrees` is given, nodes at TOP_LEVELS that still need splitting are left for later
+*/
+void GravitySystem::buildNode(std::vector<Node> &nodes, uint32_t index, uint32_t begin, uint32_t end, int level,
+	std::vector<Subtree> *subtrees) const {
+	nodes[index].begin = begin;
+	nodes[index].end = end;
+	nodes[index].firstChild = 0;
+	nodes[index].childCount = 0;
+	if (end - begin <= (uint32_t)LEAF_SIZE || level >= MORTON_BITS) {
+		finishNode(nodes, index);
+		return;
+	}
+	if (subtrees && level >= TOP_LEVELS) {
+		subtrees->push_back(Subtree{ index, begin, end, level });
+		return;
+	}
+
+	// Every body here shares the code above `shift`, so the next three bits are sorted too
+	int shift = 3 * (MORTON_BITS - 1 - level);
+	uint32_t ranges[9];
+	uint32_t count = 0;
+	uint32_t start = begin;
+	for (uint64_t octant = 0; octant < 8 && start < end; octant++) {
+		auto stop = std::partition_point(m_order.begin() + start, m_order.begin() + end,
+			[&](const std::pair<uint64_t, uint32_t> &body) { return ((body.first >> shift) & 7) <= octant; });
+		uint32_t next = uint32_t(stop - m_order.begin());
+		if (next > start) {
+			ranges[count++] = start;
+			start = next;
+		}
+	}
+	ranges[count] = end;
+
+	uint32_t first = (uint32_t)nodes.size();
+	nodes.resize(first + count);
+	nodes[index].firstChild = first;
+	nodes[index].childCount = count;
+	for (uint32_t c = 0; c < count; c++) {
+		buildNode(nodes, first + c, ranges[c], ranges[c + 1], level + 1, subtrees);
+	}
+	if (!subtrees) {
+		finishNode(nodes, index);
+	}
+}
+
+void GravitySystem::buildTree() {
+	cgra::ThreadPool &pool = cgra::ThreadPool::shared();
+	size_t n = size();
+	m_nodes.clear();
+	m_leaves.clear();
+	if (n == 0) return;
+
+	// Morton codes within the cube around every body
+	glm::vec3 lo(m_x[0], m_y[0], m_z[0]), hi = lo;
+	for (size_t i = 1; i < n; i++) {
+		glm::vec3 p(m_x[i], m_y[i], m_z[i]);
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	float extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+	float scale = float(1 << MORTON_BITS) / (extent > 0.0f ? extent * 1.0001f : 1.0f);
+	m_order.resize(n);
+	pool.parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			uint64_t maxCell = (1u << MORTON_BITS) - 1;
+			uint64_t cx = std::min(uint64_t((m_x[i] - lo.x) * scale), maxCell);
+			uint64_t cy = std::min(uint64_t((m_y[i] - lo.y) * scale), maxCell);
+			uint64_t cz = std::min(uint64_t((m_z[i] - lo.z) * scale), maxCell);
+			m_order[i] = std::make_pair(spreadBits(cx) | spreadBits(cy) << 1 | spreadBits(cz) << 2, uint32_t(i));
+		}
+	}, BODY_CHUNK);
+
+	pool.parallelSort(m_order.begin(), m_order.end(), PARALLEL_BUILD);
+
+	m_sx.resize(n);
+	m_sy.resize(n);
+	m_sz.resize(n);
+	m_sm.resize(n);
+	pool.parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			uint32_t body = m_order[i].second;
+			m_sx[i] = m_x[body];
+			m_sy[i] = m_y[body];
+			m_sz[i] = m_z[body];
+			m_sm[i] = m_mass[body];
+		}
+	}, BODY_CHUNK);
+
+	// The top few levels here, the subtrees under them on the workers
+	m_nodes.resize(1);
+	std::vector<Subtree> subtrees;
+	buildNode(m_nodes, 0, 0, (uint32_t)n, 0, n < PARALLEL_BUILD ? nullptr : &subtrees);
+	if (!subtrees.empty()) {
+		size_t topNodes = m_nodes.size();
+		std::vector<std::vector<Node>> built(subtrees.size());
+		pool.parallelFor(0, subtrees.size(), [&](size_t begin, size_t end) {
+			for (size_t s = begin; s < end; s++) {
+				built[s].resize(1);
+				buildNode(built[s], 0, subtrees[s].begin, subtrees[s].end, subtrees[s].level, nullptr);
+			}
+		});
+		// Each subtree is appended after the rest, its root replaces the node it came from
+		for (size_t s = 0; s < subtrees.size(); s++) {
+			uint32_t base = uint32_t(m_nodes.size()) - 1;
+			for (size_t k = 0; k < built[s].size(); k++) {
+				Node node = built[s][k];
+				if (node.childCount > 0) {
+					node.firstChild += base;
+				}
+				if (k == 0) {
+					m_nodes[subtrees[s].index] = node;
+				} else {
+					m_nodes.push_back(node);
+				}
+			}
+		}
+		// Children of the top nodes always come after them
+		for (size_t i = topNodes; i-- > 0;) {
+			finishNode(m_nodes, uint32_t(i));
+		}
+	}
+
+	for (uint32_t i = 0; i < m_nodes.size(); i++) {
+		if (m_nodes[i].childCount == 0) {
+			m_leaves.push_back(i);
+		}
+	}
+}
+
+void GravitySystem::computeForces() {
+	buildTree();
+	size_t n = size();
+	float theta2 = m_settings.theta * m_settings.theta;
+	float eps2 = m_settings.softening * m_settings.softening;
+	float G = m_settings.G;
+	std::atomic<uint64_t> interactions(0);
+
+	cgra::ThreadPool::shared().parallelFor(0, m_leaves.size(), [&](size_t begin, size_t end) {
+		// Interaction list, bodies and far away cells alike as point masses
+		std::vector<float> lx, ly, lz, lm;
+		std::vector<uint32_t> stack;
+		uint64_t count = 0;
+		for (size_t l = begin; l < end; l++) {
+			uint32_t groupIndex = m_leaves[l];
+			const Node &group = m_nodes[groupIndex];
+			lx.clear();
+			ly.clear();
+			lz.clear();
+			lm.clear();
+			stack.assign(1, 0);
+			while (!stack.empty()) {
+				uint32_t index = stack.back();
+				stack.pop_back();
+				const Node &cell = m_nodes[index];
+				// Closest any body of the group gets to the cells centre of mass
+				glm::vec3 gap = glm::max(glm::max(group.boxMin - cell.centreOfMass, cell.centreOfMass - group.boxMax), glm::vec3(0.0f));
+				glm::vec3 size = cell.boxMax - cell.boxMin;
+				float width = std::max(size.x, std::max(size.y, size.z));
+				if (index != groupIndex && width * width < theta2 * glm::dot(gap, gap)) {
+					lx.push_back(cell.centreOfMass.x);
+					ly.push_back(cell.centreOfMass.y);
+					lz.push_back(cell.centreOfMass.z);
+					lm.push_back(cell.mass);
+				} else if (cell.childCount == 0) {
+					lx.insert(lx.end(), m_sx.begin() + cell.begin, m_sx.begin() + cell.end);
+					ly.insert(ly.end(), m_sy.begin() + cell.begin, m_sy.begin() + cell.end);
+					lz.insert(lz.end(), m_sz.begin() + cell.begin, m_sz.begin() + cell.end);
+					lm.insert(lm.end(), m_sm.begin() + cell.begin, m_sm.begin() + cell.end);
+				} else {
+					for (uint32_t c = 0; c < cell.childCount; c++) {
+						stack.push_back(cell.firstChild + c);
+					}
+				}
+			}
+			size_t sources = lm.size();
+			count += uint64_t(sources) * (group.end - group.begin);
+			// Massless padding so the list is whole groups of four
+			while (lm.size() % 4 != 0) {
+				lx.push_back(0.0f);
+				ly.push_back(0.0f);
+				lz.push_back(0.0f);
+				lm.push_back(0.0f);
+			}
+
+			for (uint32_t k = group.begin; k < group.end; k++) {
+				float ax, ay, az, phi;
+#ifdef GRAVITY_SSE
+				__m128 px = _mm_set1_ps(m_sx[k]), py = _mm_set1_ps(m_sy[k]), pz = _mm_set1_ps(m_sz[k]);
+				__m128 soft = _mm_set1_ps(eps2), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+				__m128 sumX = zero, sumY = zero, sumZ = zero, sumPhi = zero;
+				for (size_t j = 0; j < lm.size(); j += 4) {
+					__m128 dx = _mm_sub_ps(_mm_loadu_ps(&lx[j]), px);
+					__m128 dy = _mm_sub_ps(_mm_loadu_ps(&ly[j]), py);
+					__m128 dz = _mm_sub_ps(_mm_loadu_ps(&lz[j]), pz);
+					__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+					// A body doesn't pull on itself
+					__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(d2, soft)));
+					inv = _mm_and_ps(inv, _mm_cmpgt_ps(d2, zero));
+					__m128 mInv = _mm_mul_ps(_mm_loadu_ps(&lm[j]), inv);
+					__m128 mInv3 = _mm_mul_ps(mInv, _mm_mul_ps(inv, inv));
+					sumX = _mm_add_ps(sumX, _mm_mul_ps(dx, mInv3));
+					sumY = _mm_add_ps(sumY, _mm_mul_ps(dy, mInv3));
+					sumZ = _mm_add_ps(sumZ, _mm_mul_ps(dz, mInv3));
+					sumPhi = _mm_add_ps(sumPhi, mInv);
+				}
+				float lanes[4][4];
+				_mm_storeu_ps(lanes[0], sumX);
+				_mm_storeu_ps(lanes[1], sumY);
+				_mm_storeu_ps(lanes[2], sumZ);
+				_mm_storeu_ps(lanes[3], sumPhi);
+				ax = lanes[0][0] + lanes[0][1] + lanes[0][2] + lanes[0][3];
+				ay = lanes[1][0] + lanes[1][1] + lanes[1][2] + lanes[1][3];
+				az = lanes[2][0] + lanes[2][1] + lanes[2][2] + lanes[2][3];
+				phi = lanes[3][0] + lanes[3][1] + lanes[3][2] + lanes[3][3];
+#else
+				ax = ay = az = phi = 0.0f;
+				for (size_t j = 0; j < lm.size(); j++) {
+					float dx = lx[j] - m_sx[k], dy = ly[j] - m_sy[k], dz = lz[j] - m_sz[k];
+					float d2 = dx * dx + dy * dy + dz * dz;
+					if (d2 <= 0.0f) continue;
+					float inv = 1.0f / std::sqrt(d2 + eps2);
+					float mInv = lm[j] * inv;
+					float mInv3 = mInv * inv * inv;
+					ax += dx * mInv3;
+					ay += dy * mInv3;
+					az += dz * mInv3;
+					phi += mInv;
+				}
+#endif
+				uint32_t body = m_order[k].second;
+				m_ax[body] = G * ax;
+				m_ay[body] = G * ay;
+				m_az[body] = G * az;
+				m_potential[body] = -G * phi;
+			}
+		}
+		interactions += count;
+	});
+
+	m_interactions = interactions;
+	m_forcesValid = n > 0;
+}
+
+void GravitySystem::drift(float dt) {
+	cgra::ThreadPool::shared().parallelFor(0, size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			m_x[i] += m_vx[i] * dt;
+			m_y[i] += m_vy[i] * dt;
+			m_z[i] += m_vz[i] * dt;
+		}
+	}, BODY_CHUNK);
+	m_forcesValid = false;
+}
+
+void GravitySystem::kick(float dt) {
+	cgra::ThreadPool::shared().parallelFor(0, size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			m_vx[i] += m_ax[i] * dt;
+			m_vy[i] += m_ay[i] * dt;
+			m_vz[i] += m_az[i] * dt;
+		}
+	}, BODY_CHUNK);
+}
+
+void GravitySystem::step(float dt) {
+	if (size() > 0) {
+		if (m_settings.integrator == YOSHIDA) {
+			// Drift-kick-drift leapfrog composed with steps of w1, w0, w1
+			const double cbrt2 = std::cbrt(2.0);
+			const double w1 = 1.0 / (2.0 - cbrt2);
+			const double w0 = -cbrt2 / (2.0 - cbrt2);
+			const float c[4] = { float(w1 / 2), float((w0 + w1) / 2), float((w0 + w1) / 2), float(w1 / 2) };
+			const float d[3] = { float(w1), float(w0), float(w1) };
+			for (int i = 0; i < 3; i++) {
+				drift(c[i] * dt);
+				computeForces();
+				kick(d[i] * dt);
+			}
+			drift(c[3] * dt);
+		} else {
+			if (!m_forcesValid) {
+				computeForces();
+			}
+			kick(dt * 0.5f);
+			drift(dt);
+			computeForces();
+			kick(dt * 0.5f);
+		}
+	}
+	m_time += dt;
+}
+
+double GravitySystem::energy() {
+	if (!m_forcesValid) {
+		computeForces();
+	}
+	double kinetic = 0.0, potential = 0.0;
+	for (size_t i = 0; i < size(); i++) {
+		double v2 = double(m_vx[i]) * m_vx[i] + double(m_vy[i]) * m_vy[i] + double(m_vz[i]) * m_vz[i];
+		kinetic += 0.5 * m_mass[i] * v2;
+		// Each pair is counted from both ends
+		potential += 0.5 * m_mass[i] * m_potential[i];
+	}
+	return kinetic + potential;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+// Newtonian gravity between every pair of bodies, for planets, moons and asteroids that move
+// under each other's pull. Bodies are kept as one array per component (structure of arrays),
+// so the force loops can work on four at a time.
+// Forces come from a Barnes-Hut octree: a far away cell of bodies pulls like a single mass at
+// its centre of mass, so an evaluation costs about N log N instead of N^2. The tree is rebuilt
+// for every evaluation, by sorting the bodies along a Morton curve and splitting the sorted
+// list, across the shared thread pool. Each leaf of the tree walks the tree once for all of
+// its bodies and evaluates the resulting interaction list four sources at a time.
+class GravitySystem {
+public:
+	enum Integrator {
+		// Kick-drift-kick leapfrog. Second order, one force evaluation per step
+		LEAPFROG,
+		// Yoshida's fourth order composition of three leapfrog steps. Three evaluations per step
+		YOSHIDA
+	};
+
+	struct Settings {
+		float G = 1.0f;
+		// A cell is used as one mass when it is narrower than theta times its distance.
+		// Smaller is more accurate and slower, 0 is the exact N^2 sum
+		float theta = 0.5f;
+		// Plummer softening length, keeps close encounters from blowing up
+		float softening = 0.01f;
+		Integrator integrator = LEAPFROG;
+	};
+
+	// Most bodies in a leaf of the tree. A leaf shares one interaction list
+	static const int LEAF_SIZE = 16;
+
+	GravitySystem() { }
+	explicit GravitySystem(const Settings &settings);
+
+	const Settings &settings() const { return m_settings; }
+	void setSettings(const Settings &settings);
+
+	// Adds a body, returns its index. Indices stay the same until clear()
+	size_t addBody(const glm::vec3 &position, const glm::vec3 &velocity, float mass);
+	void clear();
+	size_t size() const { return m_mass.size(); }
+
+	glm::vec3 position(size_t i) const { return glm::vec3(m_x[i], m_y[i], m_z[i]); }
+	glm::vec3 velocity(size_t i) const { return glm::vec3(m_vx[i], m_vy[i], m_vz[i]); }
+	glm::vec3 acceleration(size_t i) const { return glm::vec3(m_ax[i], m_ay[i], m_az[i]); }
+	float mass(size_t i) const { return m_mass[i]; }
+	void setPosition(size_t i, const glm::vec3 &position);
+	void setVelocity(size_t i, const glm::vec3 &velocity);
+
+	// The arrays themselves, for code that copies every body out at once
+	const std::vector<float> &x() const { return m_x; }
+	const std::vector<float> &y() const { return m_y; }
+	const std::vector<float> &z() const { return m_z; }
+
+	// Moves every body on by `dt` with the integrator from the settings
+	void step(float dt);
+	// Simulated time so far
+	double time() const { return m_time; }
+
+	// Works out the acceleration and potential of every body at the current positions
+	void computeForces();
+
+	// Kinetic plus potential energy. The potential is as approximate as the forces, but the
+	// same approximation every time, so its drift shows how well the integrator is doing
+	double energy();
+
+	// Body and cell interactions in the last force evaluation, and nodes in its tree
+	uint64_t interactions() const { return m_interactions; }
+	size_t treeNodes() const { return m_nodes.size(); }
+
+private:
+	Settings m_settings;
+	double m_time = 0.0;
+	// Whether m_ax.. and m_potential are for the current positions
+	bool m_forcesValid = false;
+	uint64_t m_interactions = 0;
+
+	std::vector<float> m_x, m_y, m_z;
+	std::vector<float> m_vx, m_vy, m_vz;
+	std::vector<float> m_ax, m_ay, m_az;
+	std::vector<float> m_mass;
+	std::vector<float> m_potential;
+
+	// A cube of space, with the bodies inside it as a contiguous range of the sorted arrays
+	struct Node {
+		glm::vec3 centreOfMass;
+		float mass;
+		// Bounding box of the bodies, tighter than the cube
+		glm::vec3 boxMin;
+		glm::vec3 boxMax;
+		uint32_t begin;
+		uint32_t end;
+		// Children are next to each other, none for a leaf
+		uint32_t firstChild;
+		uint32_t childCount;
+	};
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_leaves;
+
+	// Bodies in Morton order, and copies of their positions and masses in that order
+	std::vector<std::pair<uint64_t, uint32_t>> m_order;
+	std::vector<float> m_sx, m_sy, m_sz, m_sm;
+
+	// A subtree left for a worker while the top of the tree is built
+	struct Subtree {
+		uint32_t index;
+		uint32_t begin;
+		uint32_t end;
+		int level;
+	};
+
+	void buildTree();
+	void buildNode(std::vector<Node> &nodes, uint32_t index, uint32_t begin, uint32_t end, int level,
+		std::vector<Subtree> *subtrees) const;
+	void finishNode(std::vector<Node> &nodes, uint32_t index) const;
+	void drift(float dt);
+	void kick(float dt);
+};
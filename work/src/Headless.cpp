@@ -0,0 +1,404 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "opengl.hpp"
+
+#ifdef CGRA_HAVE_EGL
+// Keep the X11 headers out, nothing here needs a display server
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "glm/glm.hpp"
+#include "glm/gtc/constants.hpp"
+
+#include "FrameStats.hpp"
+#include "Headless.hpp"
+#include "InputRecording.hpp"
+#include "SolarSystem.hpp"
+
+// Simulated time between frames, so every run animates the same way
+static const double FRAME_STEP = 1.0 / 60.0;
+// Slowest frames listed after the summary
+static const size_t WORST_FRAMES = 5;
+
+static void printUsage(const char *program) {
+	std::cout << "Usage: " << program << " [--headless] [options]\n"
+		<< "  --headless            Render offscreen instead of opening a window\n"
+		<< "  --frames N            Frames to time (default 300)\n"
+		<< "  --warmup N            Frames rendered before timing starts (default 10)\n"
+		<< "  --width W --height H  Framebuffer size (default 1280x720)\n"
+		<< "  --orbit-radius R      Distance of the camera from the sun (default 40)\n"
+		<< "  --orbit-height H      Height of the camera above the orbits (default 12)\n"
+		<< "  --timings FILE        Write per frame timings as CSV\n"
+		<< "  --capture DIR         Write frames to DIR/frame_NNNN.ppm\n"
+		<< "  --capture-every N     Only capture every Nth frame (default 1)\n"
+		<< "  --seed N              Seed for the planets (default 1 headless, random otherwise)\n"
+		<< "  --record FILE         Save the window's input and camera to FILE\n"
+		<< "  --replay FILE         Render a recording or script instead of the orbit\n";
+}
+
+/*
+* Every option apart from --headless takes a value
+*/
+bool parseOptions(int argc, const char **argv, HeadlessOptions &options) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--headless") {
+			options.enabled = true;
+			continue;
+		}
+		if (arg == "--help" || arg == "-h") {
+			printUsage(argv[0]);
+			return false;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "Error: " << arg << " needs a value" << std::endl;
+			printUsage(argv[0]);
+			return false;
+		}
+		std::string value = argv[++i];
+		try {
+			if (arg == "--frames") {
+				options.frames = std::stoi(value);
+			} else if (arg == "--warmup") {
+				options.warmupFrames = std::stoi(value);
+			} else if (arg == "--width") {
+				options.width = std::stoi(value);
+			} else if (arg == "--height") {
+				options.height = std::stoi(value);
+			} else if (arg == "--orbit-radius") {
+				options.orbitRadius = std::stof(value);
+			} else if (arg == "--orbit-height") {
+				options.orbitHeight = std::stof(value);
+			} else if (arg == "--timings") {
+				options.timingsFile = value;
+			} else if (arg == "--capture") {
+				options.captureDir = value;
+			} else if (arg == "--capture-every") {
+				options.captureEvery = std::stoi(value);
+			} else if (arg == "--seed") {
+				options.seed = unsigned(std::stoul(value));
+			} else if (arg == "--record") {
+				options.recordFile = value;
+			} else if (arg == "--replay") {
+				options.replayFile = value;
+			} else {
+				std::cerr << "Error: Unknown option '" << arg << "'" << std::endl;
+				printUsage(argv[0]);
+				return false;
+			}
+		} catch (std::exception &) {
+			std::cerr << "Error: Bad value '" << value << "' for " << arg << std::endl;
+			return false;
+		}
+	}
+	if (options.width <= 0 || options.height <= 0 || options.frames <= 0 || options.warmupFrames < 0 || options.captureEvery <= 0) {
+		std::cerr << "Error: Sizes and frame counts must be positive" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void setupRenderState() {
+	// Enabe depth testing
+	glEnable(GL_DEPTH_TEST);
+
+	// Enable backface culling
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	// Faces with a clockwise winding order when viewed are
+	// front-facing
+	glFrontFace(GL_CCW);
+
+	glDisable(GL_BLEND);
+}
+
+#ifdef CGRA_HAVE_EGL
+
+/*
+* Writes the framebuffer as a binary PPM. OpenGL's rows start at the bottom, so they're flipped
+*/
+static bool writePPM(const std::string &filename, int width, int height) {
+	std::vector<unsigned char> pixels(size_t(width) * height * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	file << "P6\n" << width << " " << height << "\n255\n";
+	for (int y = height - 1; y >= 0; y--) {
+		file.write(reinterpret_cast<const char *>(&pixels[size_t(y) * width * 3]), width * 3);
+	}
+	return file.good();
+}
+
+/*
+* Mesa can make a display without any window system at all, which is what a CI machine has.
+* Otherwise fall back to the default display and a small pbuffer
+*/
+static bool createContext(EGLDisplay &display, EGLContext &context, EGLSurface &surface) {
+	display = EGL_NO_DISPLAY;
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	bool surfaceless = extensions && std::strstr(extensions, "EGL_MESA_platform_surfaceless");
+	if (surfaceless) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay) {
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+	}
+	if (display == EGL_NO_DISPLAY) {
+		surfaceless = false;
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+		std::cerr << "Error: Could not initialise EGL" << std::endl;
+		return false;
+	}
+
+	EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+		std::cerr << "Error: No EGL config for desktop OpenGL" << std::endl;
+		return false;
+	}
+
+	surface = EGL_NO_SURFACE;
+	if (!surfaceless) {
+		// Everything is drawn to the framebuffer object, this is only here to make the context current
+		EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+	}
+
+	// Same as the window, at least OpenGL 3.3 with the Core profile
+	eglBindAPI(EGL_OPENGL_API);
+	EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) {
+		std::cerr << "Error: Could not create an OpenGL 3.3 context through EGL" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/*
+* Hands the frame's input to the app the way the window callbacks and the GUI would, then puts
+* the camera where it was. Cursor positions are scaled from the recorded window to the framebuffer
+*/
+static void replayFrame(SolarSystem &app, const InputRecording::Frame &frame, const glm::vec2 &scale) {
+	for (const InputRecording::Event &event : frame.events) {
+		switch (event.type) {
+		case InputRecording::KEY:
+			app.onKey(event.code, event.scancode, event.action, event.mods);
+			break;
+		case InputRecording::MOUSE_BUTTON:
+			app.onMouseButton(event.code, event.action, event.mods);
+			break;
+		case InputRecording::CURSOR_POS:
+			app.onCursorPos(event.position.x * scale.x, event.position.y * scale.y);
+			break;
+		case InputRecording::SCROLL:
+			app.onScroll(event.position.x, event.position.y);
+			break;
+		case InputRecording::SETTING:
+			if (!app.applySetting(event.name, event.value)) {
+				std::cerr << "Warning: the recording changes " << event.name << ", which isn't a setting" << std::endl;
+			}
+			break;
+		}
+	}
+	// Keys may have turned the free cam on, which the chunked terrain and galaxy travel need.
+	// The replay may not have reached the system the camera was in yet, or may have got there
+	// sooner, so the camera is moved into this system's coordinates
+	glm::vec3 offset = glm::vec3(frame.origin - app.galaxyOrigin);
+	app.setCameraPose(frame.eye + offset, frame.target + offset);
+}
+
+int runHeadless(const HeadlessOptions &options) {
+	// The same planets every run unless asked for others, or the ones the recording had
+	unsigned int seed = options.seed ? options.seed : 1;
+	InputRecording replay;
+	if (!options.replayFile.empty()) {
+		try {
+			replay = InputRecording::load(options.replayFile);
+		} catch (std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		if (int(replay.size()) <= options.warmupFrames) {
+			std::cerr << "Error: " << options.replayFile << " is over by the end of the warm up" << std::endl;
+			return 1;
+		}
+		if (!options.seed) {
+			seed = replay.seed();
+		}
+	}
+
+	EGLDisplay display;
+	EGLContext context;
+	EGLSurface surface;
+	if (!createContext(display, context, surface)) {
+		return 1;
+	}
+
+	// GLEW finds the functions through the same dispatch library EGL uses
+	glewExperimental = GL_TRUE;
+	GLenum err = glewInit();
+	if (err != GLEW_OK) {
+		std::cerr << "GLEW Error: " << glewGetErrorString(err) << std::endl;
+		return 1;
+	}
+	glGetError(); // glewInit leaves an error behind on core profiles
+	std::cout << "OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
+	std::cout << "OpenGL Renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+	// Framebuffer to draw into
+	GLuint fbo, colourBuffer, depthBuffer;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(1, &colourBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colourBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, options.width, options.height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colourBuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, options.width, options.height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "Error: Offscreen framebuffer is incomplete" << std::endl;
+		return 1;
+	}
+
+	setupRenderState();
+
+	int status = 0;
+	{
+		SolarSystem app(nullptr);
+		app.setWindowSize(options.width, options.height);
+		app.seed = seed;
+		try {
+			app.init();
+			app.m_clock.setPlaying(true);
+			app.waitForSimulation = true;
+
+			GLuint timer;
+			glGenQueries(1, &timer);
+			FrameStats stats;
+			int totalFrames = options.warmupFrames + options.frames;
+			double frameStep = FRAME_STEP;
+			glm::vec2 cursorScale(1.0f);
+			if (!replay.empty()) {
+				totalFrames = int(replay.size());
+				frameStep = replay.frameStep();
+				cursorScale = glm::vec2(options.width, options.height) / glm::vec2(replay.windowSize());
+			}
+			for (int frame = 0; frame < totalFrames; frame++) {
+				if (replay.empty()) {
+					// One lap around the sun over the run
+					float angle = 2.0f * glm::pi<float>() * frame / totalFrames;
+					app.setCamera(glm::vec3(options.orbitRadius * std::cos(angle), options.orbitHeight, options.orbitRadius * std::sin(angle)), glm::vec3(0.0f));
+				}
+				else {
+					replayFrame(app, replay.frame(frame), cursorScale);
+				}
+				app.frameTime = frame * frameStep;
+
+				auto start = std::chrono::steady_clock::now();
+				glBeginQuery(GL_TIME_ELAPSED, timer);
+
+				glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+				glViewport(0, 0, options.width, options.height);
+				glClearColor(0, 0, 0.0, 1);
+				glClearDepth(1);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				app.drawScene();
+				glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+				glEndQuery(GL_TIME_ELAPSED);
+				auto issued = std::chrono::steady_clock::now();
+				glFinish();
+				auto finished = std::chrono::steady_clock::now();
+
+				GLuint64 gpuNs = 0;
+				glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &gpuNs);
+
+				int timed = frame - options.warmupFrames;
+				if (timed < 0) {
+					continue;
+				}
+				FrameStats::Frame f;
+				f.cpuMs = std::chrono::duration<double, std::milli>(issued - start).count();
+				f.gpuMs = gpuNs / 1.0e6;
+				f.wallMs = std::chrono::duration<double, std::milli>(finished - start).count();
+				stats.add(f);
+
+				if (!options.captureDir.empty() && timed % options.captureEvery == 0) {
+					std::ostringstream name;
+					name << options.captureDir << "/frame_" << std::setw(4) << std::setfill('0') << timed << ".ppm";
+					if (!writePPM(name.str(), options.width, options.height)) {
+						std::cerr << "Error: Could not write '" << name.str() << "'" << std::endl;
+						status = 1;
+						break;
+					}
+				}
+			}
+			glDeleteQueries(1, &timer);
+
+			std::cout << stats.summary();
+			// Numbered from the first frame rendered, so they match the replay's frames
+			std::cout << "worst frames:";
+			for (size_t i : stats.worstFrames(&FrameStats::Frame::wallMs, WORST_FRAMES)) {
+				std::cout << " #" << i + options.warmupFrames << " " << stats.at(i).wallMs << " ms";
+			}
+			std::cout << std::endl;
+			if (!options.timingsFile.empty() && !stats.writeCsv(options.timingsFile)) {
+				std::cerr << "Error: Could not write '" << options.timingsFile << "'" << std::endl;
+				status = 1;
+			}
+		} catch (std::exception &e) {
+			std::cerr << "Error: " << e.what() << std::endl;
+			status = 1;
+		}
+	}
+
+	glDeleteRenderbuffers(1, &colourBuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	glDeleteFramebuffers(1, &fbo);
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	if (surface != EGL_NO_SURFACE) {
+		eglDestroySurface(display, surface);
+	}
+	eglTerminate(display);
+	return status;
+}
+
+#else
+
+int runHeadless(const HeadlessOptions &) {
+	std::cerr << "Error: Built without EGL, headless rendering isn't available" << std::endl;
+	return 1;
+}
+
+#endif
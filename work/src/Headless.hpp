@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+// Settings for rendering without a window, filled in from the command line
+struct HeadlessOptions {
+	bool enabled = false; // --headless
+	int width = 1280; // --width
+	int height = 720; // --height
+	int frames = 300; // --frames, not counting the warm up
+	int warmupFrames = 10; // --warmup, rendered but left out of the timings
+	float orbitRadius = 40.0f; // --orbit-radius, of the scripted camera
+	float orbitHeight = 12.0f; // --orbit-height
+	std::string timingsFile; // --timings, CSV of per frame timings
+	std::string captureDir; // --capture, PPM captures are written here
+	int captureEvery = 1; // --capture-every, frames between captures
+	unsigned int seed = 0; // --seed, for the planets. 0 picks one, except headless runs use 1
+	std::string recordFile; // --record, input from the window is saved here
+	std::string replayFile; // --replay, recording or script the headless camera follows
+};
+
+// Reads the command line. Returns false (after printing why) if it wasn't understood
+bool parseOptions(int argc, const char **argv, HeadlessOptions &options);
+
+// The render state shared by the window and headless modes
+void setupRenderState();
+
+// Creates an offscreen context through EGL, renders `options.frames` frames of the solar
+// system from a camera orbiting the sun into a framebuffer object, then prints (and optionally
+// saves) the timings. With a replay file every frame of it is rendered instead, from its
+// camera and with its input. Runs on Mesa's software rasteriser when there's no GPU.
+// Returns the exit code for main
+int runHeadless(const HeadlessOptions &options);
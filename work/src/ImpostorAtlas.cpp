@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "ImpostorAtlas.hpp"
+#include "LightClusters.hpp"
+
+// Bodies closer than this many radii are always drawn as meshes
+static const float MIN_DISTANCE = 1.5f;
+
+// Attribute locations of a quad corner, the same as cgra::Mesh for position
+static const GLuint CORNER_POSITION = 0;
+static const GLuint CORNER_UV = 2;
+
+namespace {
+	struct Corner {
+		glm::vec3 position;
+		glm::vec2 uv;
+	};
+}
+
+ImpostorAtlas::ImpostorAtlas(const Settings &settings) : m_settings(settings) {
+	if (settings.tileSize <= 0 || settings.tilesPerSide <= 0) {
+		throw std::runtime_error("Error: impostor tiles need a size");
+	}
+	// Handed out from the back, so the first tiles are at the bottom left
+	for (int slot = settings.tilesPerSide * settings.tilesPerSide - 1; slot >= 0; slot--) {
+		m_freeSlots.push_back(slot);
+	}
+}
+
+ImpostorAtlas::~ImpostorAtlas() {
+	if (m_framebuffer != 0) {
+		glDeleteFramebuffers(1, &m_framebuffer);
+		glDeleteRenderbuffers(1, &m_depth);
+		glDeleteTextures(1, &m_texture);
+	}
+	if (m_vao != 0) {
+		glDeleteVertexArrays(1, &m_vao);
+		glDeleteBuffers(1, &m_buffer);
+	}
+}
+
+void ImpostorAtlas::begin(const glm::vec3 &eye, const glm::mat4 &view, const glm::mat4 &projection,
+	const glm::vec3 &lightDirection, const glm::vec3 &lightPosition) {
+	m_frame++;
+	m_eye = eye;
+	m_view = view;
+	m_viewProjection = projection * view;
+	m_lightDirection = lightDirection;
+	m_lightPosition = lightPosition;
+	m_drawn.clear();
+	m_budget = m_settings.refreshesPerFrame;
+	m_refreshed = 0;
+
+	// Let go of the tiles of bodies that haven't been impostors for a while
+	for (auto it = m_tiles.begin(); it != m_tiles.end();) {
+		if (m_frame - it->second.lastUsed > m_settings.keepFrames) {
+			m_freeSlots.push_back(it->second.slot);
+			it = m_tiles.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+/*
+* How `body` looks from the camera this frame, and the projection that fits it into a tile. The
+* tile looks at the body from the camera, just wide enough for its sphere. False if the camera is
+* too close for a picture to stand in for it
+*/
+bool ImpostorAtlas::describe(const Body &body, Drawn &drawn) const {
+	glm::vec3 centre = glm::vec3(body.model[3]);
+	glm::vec3 viewCentre = glm::vec3(m_view * glm::vec4(centre, 1.0f));
+	float distance = glm::length(viewCentre);
+	if (body.mesh == nullptr || body.radius <= 0.0f || distance < MIN_DISTANCE * body.radius) {
+		return false;
+	}
+
+	// Up in the picture is as close to up on the screen as it can be
+	glm::vec3 forward = viewCentre / distance;
+	glm::vec3 up = std::abs(forward.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+	glm::mat4 look = glm::lookAt(glm::vec3(0.0f), forward, up);
+	float halfAngle = glm::asin(body.radius / distance);
+	float zNear = 0.5f * (distance - body.radius);
+	float zFar = distance + 1.01f * body.radius;
+	drawn.projection = glm::perspective(2.0f * halfAngle, 1.0f, zNear, zFar) * look;
+
+	// Everything that changes how it looks, turned into its own frame
+	glm::mat3 toBody = glm::inverse(glm::mat3(body.model));
+	glm::mat3 viewToBody = glm::inverse(glm::mat3(m_view * body.model));
+	Tile &now = drawn.now;
+	now.view = glm::normalize(toBody * (m_eye - centre));
+	now.up = glm::normalize(viewToBody * glm::vec3(look[0][1], look[1][1], look[2][1]));
+	now.light = glm::normalize(viewToBody * m_lightDirection);
+	glm::vec3 toSun = m_lightPosition - centre;
+	now.sun = glm::dot(toSun, toSun) > 1e-6f ? glm::normalize(toBody * toSun) : glm::vec3(0.0f);
+	now.distance = distance;
+	now.mesh = body.mesh;
+	now.version = body.version;
+
+	// The shader picks its light cluster from where the fragment is on screen, which in the
+	// tile isn't where it will be drawn. The whole tile uses the cluster under the centre
+	glm::vec4 clip = m_viewProjection * glm::vec4(centre, 1.0f);
+	glm::vec2 ndc = clip.w > 0.0f ? glm::vec2(clip) / clip.w : glm::vec2(0.0f);
+	glm::ivec2 tiles(LightClusters::TILES_X, LightClusters::TILES_Y);
+	drawn.clusterTile = glm::clamp(glm::ivec2((ndc * 0.5f + 0.5f) * glm::vec2(tiles)), glm::ivec2(0), tiles - 1);
+	drawn.body = body;
+	return true;
+}
+
+bool ImpostorAtlas::needsRender(const Tile &tile, const Tile &now) const {
+	if (tile.rendered == 0 || tile.mesh != now.mesh || tile.version != now.version) {
+		return true;
+	}
+	float viewCos = std::cos(m_settings.viewAngle), lightCos = std::cos(m_settings.lightAngle);
+	// The sun isn't lit from anywhere
+	float sunCos = tile.sun == now.sun ? 1.0f : glm::dot(tile.sun, now.sun);
+	return glm::dot(tile.view, now.view) < viewCos || glm::dot(tile.light, now.light) < lightCos ||
+		sunCos < lightCos || std::abs(now.distance / tile.distance - 1.0f) > m_settings.distanceChange;
+}
+
+bool ImpostorAtlas::add(const Body &body) {
+	Drawn drawn;
+	if (!describe(body, drawn)) {
+		return false;
+	}
+	auto found = m_tiles.find(body.id);
+	if (found == m_tiles.end()) {
+		// A new tile has to be rendered before there's anything to draw
+		if (m_budget == 0 || m_freeSlots.empty()) {
+			return false;
+		}
+		Tile tile = drawn.now;
+		tile.slot = m_freeSlots.back();
+		tile.rendered = 0;
+		m_freeSlots.pop_back();
+		found = m_tiles.emplace(body.id, tile).first;
+		m_budget--;
+		drawn.stale = true;
+	} else {
+		drawn.stale = needsRender(found->second, drawn.now);
+	}
+	found->second.lastUsed = m_frame;
+	m_drawn.push_back(drawn);
+	return true;
+}
+
+void ImpostorAtlas::clear() {
+	for (const std::pair<const int, Tile> &tile : m_tiles) {
+		m_freeSlots.push_back(tile.second.slot);
+	}
+	m_tiles.clear();
+	m_drawn.clear();
+}
+
+void ImpostorAtlas::createTargets() {
+	int size = m_settings.tileSize * m_settings.tilesPerSide;
+	// Whatever the shaders have bound is put back afterwards
+	GLint bound;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, size, size);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, GLuint(bound));
+
+	glGenRenderbuffers(1, &m_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &m_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		throw std::runtime_error("Error: couldn't make the impostor atlas framebuffer");
+	}
+}
+
+void ImpostorAtlas::render(cgra::Program &program, GLuint unit) {
+	// New tiles first, they were counted when they were added. Then the stale ones that have
+	// waited longest, with what's left
+	std::vector<Drawn *> renders, stale;
+	for (Drawn &drawn : m_drawn) {
+		if (!drawn.stale) continue;
+		if (m_tiles.at(drawn.body.id).rendered == 0) {
+			renders.push_back(&drawn);
+		} else {
+			stale.push_back(&drawn);
+		}
+	}
+	std::sort(stale.begin(), stale.end(), [&](const Drawn *a, const Drawn *b) {
+		return m_tiles.at(a->body.id).rendered < m_tiles.at(b->body.id).rendered;
+	});
+	stale.resize(std::min(stale.size(), size_t(m_budget)));
+	renders.insert(renders.end(), stale.begin(), stale.end());
+	if (renders.empty()) return;
+
+	GLint viewport[4], framebuffer;
+	GLfloat clearColour[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColour);
+	if (m_framebuffer == 0) {
+		createTargets();
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+	glEnable(GL_SCISSOR_TEST);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+	program.use();
+	GLint clusterTileLocation = glGetUniformLocation(program.getProgram(), "clusterTile");
+	int size = m_settings.tileSize;
+	for (Drawn *drawn : renders) {
+		Tile &tile = m_tiles.at(drawn->body.id);
+		int x = (tile.slot % m_settings.tilesPerSide) * size, y = (tile.slot / m_settings.tilesPerSide) * size;
+		glViewport(x, y, size, size);
+		glScissor(x, y, size, size);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// The model view is the scenes, so the body is lit just as it would be there. Only the
+		// projection is different
+		m_transforms.clear();
+		m_transforms.add(drawn->body.model);
+		m_transforms.compute(m_view, drawn->projection);
+		m_transforms.upload(unit);
+		glUniform2i(clusterTileLocation, drawn->clusterTile.x, drawn->clusterTile.y);
+		program.setMorphFactor(drawn->body.morphFactor);
+		program.setDrawIndex(0);
+		drawn->body.mesh->draw();
+
+		int slot = tile.slot;
+		unsigned int lastUsed = tile.lastUsed;
+		tile = drawn->now;
+		tile.slot = slot;
+		tile.lastUsed = lastUsed;
+		tile.rendered = m_frame;
+		m_refreshed++;
+	}
+	glUniform2i(clusterTileLocation, -1, -1);
+	program.setMorphFactor(0.0f);
+
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(clearColour[0], clearColour[1], clearColour[2], clearColour[3]);
+	glBindFramebuffer(GL_FRAMEBUFFER, GLuint(framebuffer));
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void ImpostorAtlas::draw(cgra::Program &program, GLuint unit) {
+	if (m_drawn.empty() || m_framebuffer == 0) return;
+
+	// A quad in front of each body, facing the camera and just big enough to cover it. Its
+	// picture is turned with the body, so it stays the right way up between renders
+	std::vector<Corner> corners;
+	corners.reserve(m_drawn.size() * 6);
+	float atlasSize = float(m_settings.tileSize * m_settings.tilesPerSide);
+	for (const Drawn &drawn : m_drawn) {
+		const Tile &tile = m_tiles.at(drawn.body.id);
+		glm::vec3 centre = glm::vec3(drawn.body.model[3]);
+		float distance = glm::distance(centre, m_eye), radius = drawn.body.radius;
+		glm::vec3 forward = (centre - m_eye) / distance;
+		glm::vec3 side = glm::cross(forward, glm::mat3(drawn.body.model) * tile.up);
+		if (glm::dot(side, side) < 1e-12f) {
+			side = glm::cross(forward, std::abs(forward.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f));
+		}
+		side = glm::normalize(side);
+		glm::vec3 up = glm::cross(side, forward);
+
+		float front = distance - radius;
+		float half = front * radius / std::sqrt(distance * distance - radius * radius);
+		glm::vec3 origin = m_eye + forward * front;
+		glm::vec2 tileMin = glm::vec2(float(tile.slot % m_settings.tilesPerSide), float(tile.slot / m_settings.tilesPerSide)) * float(m_settings.tileSize);
+		// Half a texel in, so nothing is filtered in from the next tile
+		glm::vec2 uvMin = (tileMin + 0.5f) / atlasSize;
+		glm::vec2 uvMax = (tileMin + float(m_settings.tileSize) - 0.5f) / atlasSize;
+		const glm::vec2 quad[6] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, -1 }, { 1, 1 }, { -1, 1 } };
+		for (const glm::vec2 &q : quad) {
+			Corner corner;
+			corner.position = origin + (side * q.x + up * q.y) * half;
+			corner.uv = glm::mix(uvMin, uvMax, q * 0.5f + 0.5f);
+			corners.push_back(corner);
+		}
+	}
+
+	if (m_vao == 0) {
+		glGenVertexArrays(1, &m_vao);
+		glBindVertexArray(m_vao);
+		glGenBuffers(1, &m_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+		glVertexAttribPointer(CORNER_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(Corner), reinterpret_cast<void *>(offsetof(Corner, position)));
+		glEnableVertexAttribArray(CORNER_POSITION);
+		glVertexAttribPointer(CORNER_UV, 2, GL_FLOAT, GL_FALSE, sizeof(Corner), reinterpret_cast<void *>(offsetof(Corner, uv)));
+		glEnableVertexAttribArray(CORNER_UV);
+	}
+
+	// Orphan last frames quads, the buffer only ever grows
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+	size_t bytes = corners.size() * sizeof(Corner);
+	if (bytes > m_bufferCapacity) {
+		m_bufferCapacity = bytes + bytes / 4;
+	}
+	glBufferData(GL_ARRAY_BUFFER, m_bufferCapacity, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, corners.data());
+
+	program.use();
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glUniform1i(glGetUniformLocation(program.getProgram(), "atlas"), unit);
+	glBindVertexArray(m_vao);
+	glDrawArrays(GL_TRIANGLES, 0, GLsizei(corners.size()));
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
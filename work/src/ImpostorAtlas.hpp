@@ -0,0 +1,128 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "opengl.hpp"
+#include "glm/glm.hpp"
+
+#include "cgra/mesh.hpp"
+#include "cgra/shader.hpp"
+#include "cgra/transformbatch.hpp"
+
+// Far away bodies drawn as pictures of themselves. Each one is rendered with the scenes own
+// shader into a tile of one atlas texture, looking at it from the camera, and is then drawn as a
+// single quad facing the camera. A tile is only rendered again once the body looks different
+// enough: the camera has gone round it, the light has moved round it, or it has turned. All of
+// those are measured in the bodies own frame, so turning the camera on the spot costs nothing.
+// Only a few tiles are rendered each frame, the oldest first, and a body that has no tile yet is
+// drawn as its mesh until it gets one.
+class ImpostorAtlas {
+public:
+	struct Settings {
+		int tileSize = 64; // Pixels across a tile
+		int tilesPerSide = 8;
+		// How far round the camera, in radians, and the light can go before a tile is
+		// rendered again
+		float viewAngle = 0.05f;
+		float lightAngle = 0.09f;
+		// How much closer or further away, as a share of the distance
+		float distanceChange = 0.25f;
+		int refreshesPerFrame = 4;
+		// Frames a tile is kept without being drawn
+		unsigned int keepFrames = 120;
+	};
+
+	// A body that could be drawn as an impostor this frame
+	struct Body {
+		int id; // Tiles are kept by id
+		glm::mat4 model;
+		float radius; // Of a sphere round the mesh, in the scene
+		cgra::Mesh *mesh;
+		float morphFactor;
+		unsigned int version; // Changes whenever the meshes shape or colours do
+	};
+
+	explicit ImpostorAtlas(const Settings &settings);
+	~ImpostorAtlas();
+
+	ImpostorAtlas(const ImpostorAtlas &) = delete;
+	ImpostorAtlas & operator=(const ImpostorAtlas &) = delete;
+
+	const Settings &settings() const { return m_settings; }
+
+	// Starts a frame seen from `eye`. The directional light is in view space, as the shader has
+	// it, and `lightPosition` is the light in the scene the bodies are lit from (the sun).
+	// Doesn't use OpenGL
+	void begin(const glm::vec3 &eye, const glm::mat4 &view, const glm::mat4 &projection,
+		const glm::vec3 &lightDirection, const glm::vec3 &lightPosition);
+	// Whether `body` is drawn as an impostor this frame, false if the mesh should be drawn
+	// instead. Doesn't use OpenGL
+	bool add(const Body &body);
+
+	// Renders the tiles that need it with `program`, the scenes shader, whose transforms are
+	// read from texture unit `unit`. Call after the lights are updated for the frame, and before
+	// the scenes own transforms are uploaded
+	void render(cgra::Program &program, GLuint unit);
+	// Draws the impostors of this frame with `program`, the atlas bound to texture unit `unit`
+	void draw(cgra::Program &program, GLuint unit);
+
+	// Forgets every tile, e.g. when the bodies are swapped for others with the same ids
+	void clear();
+
+	size_t drawnCount() const { return m_drawn.size(); }
+	size_t tileCount() const { return m_tiles.size(); }
+	int refreshedCount() const { return m_refreshed; }
+
+private:
+	// What a tile was rendered from, in the bodies own frame
+	struct Tile {
+		int slot;
+		glm::vec3 view; // Direction to the camera
+		glm::vec3 up;   // Up in the picture
+		glm::vec3 light;
+		glm::vec3 sun;
+		float distance;
+		const cgra::Mesh *mesh;
+		unsigned int version;
+		unsigned int rendered; // Frame it was rendered, 0 before it has been
+		unsigned int lastUsed;
+	};
+
+	// A body of this frame, with how it looks from here
+	struct Drawn {
+		Body body;
+		Tile now;
+		glm::mat4 projection; // From view space to the tile
+		glm::ivec2 clusterTile;
+		bool stale;
+	};
+
+	Settings m_settings;
+	std::unordered_map<int, Tile> m_tiles;
+	std::vector<int> m_freeSlots;
+	std::vector<Drawn> m_drawn;
+	unsigned int m_frame = 0;
+	int m_budget = 0; // Tiles that can still be rendered this frame
+	int m_refreshed = 0;
+
+	glm::vec3 m_eye;
+	glm::mat4 m_view;
+	glm::mat4 m_viewProjection;
+	glm::vec3 m_lightDirection;
+	glm::vec3 m_lightPosition;
+
+	// Each tile is drawn with a transform of its own
+	cgra::TransformBatch m_transforms;
+
+	GLuint m_framebuffer = 0;
+	GLuint m_texture = 0;
+	GLuint m_depth = 0;
+	GLuint m_vao = 0;
+	GLuint m_buffer = 0;
+	size_t m_bufferCapacity = 0;
+
+	bool describe(const Body &body, Drawn &drawn) const;
+	bool needsRender(const Tile &tile, const Tile &now) const;
+	void createTargets();
+};
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "opengl.hpp"
+
+#include "InputRecording.hpp"
+
+// Recordings are written in the machine's own byte order, like the other binary files
+static const char RECORDING_MAGIC[4] = { 'S', 'S', 'I', 'R' };
+static const uint32_t RECORDING_VERSION = 3;
+// Version 1 had no galaxy origin, it's read as the galaxy's centre, and version 2 had no
+// settings
+static const uint32_t OLDEST_RECORDING_VERSION = 1;
+
+template <typename T>
+static void writeValue(std::ostream &file, const T &value) {
+	file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static T readValue(std::istream &file) {
+	T value = T();
+	file.read(reinterpret_cast<char *>(&value), sizeof(T));
+	return value;
+}
+
+InputRecording::InputRecording(unsigned int seed, float frameStep, const glm::ivec2 &windowSize)
+	: m_seed(seed), m_frameStep(frameStep), m_windowSize(windowSize) {}
+
+void InputRecording::endFrame(const glm::vec3 &eye, const glm::vec3 &target, const glm::dvec3 &origin) {
+	m_pending.eye = eye;
+	m_pending.target = target;
+	m_pending.origin = origin;
+	m_frames.push_back(std::move(m_pending));
+	m_pending = Frame();
+}
+
+InputRecording InputRecording::load(const std::string &filename) {
+	std::ifstream file(filename, std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Error: could not open " + filename + " for reading");
+	}
+	InputRecording recording;
+	char magic[4];
+	if (file.read(magic, sizeof(magic)) && std::memcmp(magic, RECORDING_MAGIC, sizeof(magic)) == 0) {
+		recording.loadBinary(file, filename);
+	}
+	else {
+		file.clear();
+		file.seekg(0);
+		std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		recording.loadScript(text, filename);
+	}
+	if (recording.empty()) {
+		throw std::runtime_error("Error: " + filename + " has no frames");
+	}
+	return recording;
+}
+
+/*
+* Header, then each frame's camera and events. Events only take the bytes their type needs,
+* since a recording is mostly cursor movement
+*/
+bool InputRecording::save(const std::string &filename) const {
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	file.write(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+	writeValue(file, RECORDING_VERSION);
+	writeValue(file, uint32_t(m_seed));
+	writeValue(file, m_frameStep);
+	writeValue(file, int32_t(m_windowSize.x));
+	writeValue(file, int32_t(m_windowSize.y));
+	writeValue(file, uint32_t(m_frames.size()));
+	for (const Frame &frame : m_frames) {
+		writeValue(file, frame.eye);
+		writeValue(file, frame.target);
+		writeValue(file, frame.origin);
+		writeValue(file, uint32_t(frame.events.size()));
+		for (const Event &event : frame.events) {
+			writeValue(file, event.type);
+			switch (event.type) {
+			case KEY:
+				writeValue(file, int16_t(event.code));
+				writeValue(file, int16_t(event.scancode));
+				writeValue(file, uint8_t(event.action));
+				writeValue(file, uint8_t(event.mods));
+				break;
+			case MOUSE_BUTTON:
+				writeValue(file, uint8_t(event.code));
+				writeValue(file, uint8_t(event.action));
+				writeValue(file, uint8_t(event.mods));
+				break;
+			case CURSOR_POS:
+			case SCROLL:
+				writeValue(file, event.position);
+				break;
+			case SETTING:
+				writeValue(file, uint8_t(event.name.size()));
+				file.write(event.name.data(), std::min(event.name.size(), size_t(255)));
+				writeValue(file, event.value);
+				break;
+			}
+		}
+	}
+	return file.good();
+}
+
+void InputRecording::loadBinary(std::istream &file, const std::string &filename) {
+	uint32_t version = readValue<uint32_t>(file);
+	if (version < OLDEST_RECORDING_VERSION || version > RECORDING_VERSION) {
+		throw std::runtime_error("Error: " + filename + " is from a different version");
+	}
+	m_seed = readValue<uint32_t>(file);
+	m_frameStep = readValue<float>(file);
+	m_windowSize.x = readValue<int32_t>(file);
+	m_windowSize.y = readValue<int32_t>(file);
+	uint32_t frames = readValue<uint32_t>(file);
+	for (uint32_t i = 0; i < frames && file; i++) {
+		Frame frame;
+		frame.eye = readValue<glm::vec3>(file);
+		frame.target = readValue<glm::vec3>(file);
+		if (version >= 2) {
+			frame.origin = readValue<glm::dvec3>(file);
+		}
+		uint32_t events = readValue<uint32_t>(file);
+		for (uint32_t j = 0; j < events && file; j++) {
+			Event event;
+			event.type = readValue<EventType>(file);
+			switch (event.type) {
+			case KEY:
+				event.code = readValue<int16_t>(file);
+				event.scancode = readValue<int16_t>(file);
+				event.action = readValue<uint8_t>(file);
+				event.mods = readValue<uint8_t>(file);
+				break;
+			case MOUSE_BUTTON:
+				event.code = readValue<uint8_t>(file);
+				event.action = readValue<uint8_t>(file);
+				event.mods = readValue<uint8_t>(file);
+				break;
+			case CURSOR_POS:
+			case SCROLL:
+				event.position = readValue<glm::vec2>(file);
+				break;
+			case SETTING:
+				event.name.resize(readValue<uint8_t>(file));
+				file.read(&event.name[0], event.name.size());
+				event.value = readValue<glm::vec3>(file);
+				break;
+			default:
+				throw std::runtime_error("Error: " + filename + " has an unknown event");
+			}
+			frame.events.push_back(event);
+		}
+		m_frames.push_back(std::move(frame));
+	}
+	if (!file) {
+		throw std::runtime_error("Error: " + filename + " ends part way through a frame");
+	}
+}
+
+/*
+* One command a line, then the frame it happens on and its values:
+*   seed 7
+*   step 0.0166667
+*   window 1280 720
+*   frames 600                  (otherwise one past the last frame mentioned)
+*   camera 0 40 12 0  0 0 0     (eye then target, blended between keyframes)
+*   key 120 X press             (a GLFW key code, or a letter or digit)
+*   click 200 640 360           (left button at a window position)
+*   move 210 100 100
+*   scroll 220 0 1
+*   setting 230 physicsOrbits 1 (a GUI change, see SolarSystem::applySetting)
+* Anything after a # is ignored
+*/
+void InputRecording::loadScript(const std::string &text, const std::string &filename) {
+	std::map<int, std::pair<glm::vec3, glm::vec3>> cameras;
+	std::map<int, std::vector<Event>> events;
+	int frames = 0, lastFrame = -1;
+
+	std::istringstream lines(text);
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(lines, line)) {
+		lineNumber++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream values(line);
+		std::string command;
+		if (!(values >> command)) continue;
+
+		auto fail = [&](const char *what) {
+			std::ostringstream msgStream;
+			msgStream << "Error: " << what << " on line " << lineNumber << " of " << filename;
+			throw std::runtime_error(msgStream.str());
+		};
+		if (command == "seed") {
+			if (!(values >> m_seed)) fail("expected a seed");
+			continue;
+		}
+		if (command == "step") {
+			if (!(values >> m_frameStep) || m_frameStep <= 0.0f) fail("expected a positive step");
+			continue;
+		}
+		if (command == "window") {
+			if (!(values >> m_windowSize.x >> m_windowSize.y) || m_windowSize.x <= 0 || m_windowSize.y <= 0) fail("expected a window size");
+			continue;
+		}
+		if (command == "frames") {
+			if (!(values >> frames) || frames <= 0) fail("expected a frame count");
+			continue;
+		}
+
+		int frame;
+		if (!(values >> frame) || frame < 0) fail("expected a frame number");
+		lastFrame = std::max(lastFrame, frame);
+		Event event;
+		if (command == "camera") {
+			glm::vec3 eye, target;
+			if (!(values >> eye.x >> eye.y >> eye.z >> target.x >> target.y >> target.z)) fail("expected an eye and a target");
+			cameras[frame] = std::make_pair(eye, target);
+		}
+		else if (command == "key") {
+			std::string key, action;
+			if (!(values >> key >> action)) fail("expected a key and an action");
+			event.type = KEY;
+			if (key.size() == 1 && std::isalnum((unsigned char)key[0])) {
+				// GLFW's letter and digit keys are their upper case characters
+				event.code = std::toupper((unsigned char)key[0]);
+			}
+			else {
+				try {
+					event.code = std::stoi(key);
+				}
+				catch (std::exception &) {
+					fail("expected a key code");
+				}
+			}
+			if (action == "press") event.action = GLFW_PRESS;
+			else if (action == "release") event.action = GLFW_RELEASE;
+			else if (action == "repeat") event.action = GLFW_REPEAT;
+			else fail("expected press, release or repeat");
+			events[frame].push_back(event);
+		}
+		else if (command == "click" || command == "move" || command == "scroll") {
+			if (!(values >> event.position.x >> event.position.y)) fail("expected two values");
+			event.type = command == "scroll" ? SCROLL : CURSOR_POS;
+			events[frame].push_back(event);
+			if (command == "click") {
+				event.type = MOUSE_BUTTON;
+				event.code = GLFW_MOUSE_BUTTON_LEFT;
+				event.position = glm::vec2(0.0f);
+				event.action = GLFW_PRESS;
+				events[frame].push_back(event);
+				event.action = GLFW_RELEASE;
+				events[frame].push_back(event);
+			}
+		}
+		else if (command == "setting") {
+			event.type = SETTING;
+			if (!(values >> event.name >> event.value.x)) fail("expected a setting and a value");
+			if (values >> event.value.y) {
+				if (!(values >> event.value.z)) fail("expected one value or three");
+			}
+			events[frame].push_back(event);
+		}
+		else {
+			fail("unknown command");
+		}
+	}
+	if (cameras.empty()) {
+		throw std::runtime_error("Error: " + filename + " has no camera keyframes");
+	}
+
+	m_frames.resize(frames > 0 ? frames : lastFrame + 1);
+	for (size_t i = 0; i < m_frames.size(); i++) {
+		// Between the keyframes either side, or held at the first or last
+		auto after = cameras.lower_bound(int(i));
+		if (after == cameras.end()) {
+			--after;
+		}
+		auto before = after;
+		if (after->first > int(i) && after != cameras.begin()) {
+			--before;
+		}
+		float t = after->first > before->first ? float(int(i) - before->first) / float(after->first - before->first) : 0.0f;
+		t = glm::clamp(t, 0.0f, 1.0f);
+		m_frames[i].eye = glm::mix(before->second.first, after->second.first, t);
+		m_frames[i].target = glm::mix(before->second.second, after->second.second, t);
+		auto frameEvents = events.find(int(i));
+		if (frameEvents != events.end()) {
+			m_frames[i].events = frameEvents->second;
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+// Input to the app frame by frame, so a flythrough can be played back exactly as it was flown.
+// The window records what its callbacks pass on to the app, along with where the camera was
+// each frame, and the headless renderer plays it back at the same fixed timestep and seed.
+//
+// Input the GUI takes isn't passed on to the app, so the GUI records the changes it makes
+// instead, as named settings the replay makes through SolarSystem::applySetting. Loading an
+// orbit catalogue isn't recorded, the file may not be there when the recording is played.
+//
+// Recordings are saved as a small binary file. A text script of camera keyframes and events
+// can be loaded in the same way, for paths written by hand
+class InputRecording {
+public:
+	enum EventType : uint8_t { KEY, MOUSE_BUTTON, CURSOR_POS, SCROLL, SETTING };
+
+	struct Event {
+		EventType type = KEY;
+		int code = 0; // The key or mouse button
+		int scancode = 0;
+		int action = 0;
+		int mods = 0;
+		glm::vec2 position; // Of the cursor, or how far it scrolled
+		// A setting changed in the GUI, with its new value in x, or all three for a colour
+		std::string name;
+		glm::vec3 value;
+	};
+
+	struct Frame {
+		// Camera the frame was drawn from, relative to `origin` in the galaxy (the sun of the
+		// system the camera was in)
+		glm::vec3 eye, target;
+		glm::dvec3 origin = glm::dvec3(0.0);
+		// Everything that came in before the frame was drawn
+		std::vector<Event> events;
+	};
+
+	InputRecording() { }
+	InputRecording(unsigned int seed, float frameStep, const glm::ivec2 &windowSize);
+
+	// Reads a recording, or a script if the file isn't one. Throws std::runtime_error
+	// if neither can be read
+	static InputRecording load(const std::string &filename);
+	// Returns false if the file couldn't be written
+	bool save(const std::string &filename) const;
+
+	// What the planets were generated from, and the simulated time between frames
+	unsigned int seed() const { return m_seed; }
+	float frameStep() const { return m_frameStep; }
+	// Size of the window the cursor positions are in
+	const glm::ivec2 &windowSize() const { return m_windowSize; }
+
+	size_t size() const { return m_frames.size(); }
+	bool empty() const { return m_frames.empty(); }
+	const Frame &frame(size_t i) const { return m_frames.at(i); }
+
+	// Events go into the frame being recorded, which ends when its camera is set
+	void addEvent(const Event &event) { m_pending.events.push_back(event); }
+	void endFrame(const glm::vec3 &eye, const glm::vec3 &target, const glm::dvec3 &origin);
+
+private:
+	unsigned int m_seed = 1;
+	float m_frameStep = 1.0f / 60.0f;
+	glm::ivec2 m_windowSize = glm::ivec2(1280, 720);
+	std::vector<Frame> m_frames;
+	Frame m_pending;
+
+	void loadBinary(std::istream &file, const std::string &filename);
+	void loadScript(const std::string &text, const std::string &filename);
+};
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+#include "glm/gtc/constants.hpp"
+
+#include "cgra/simd.hpp"
+#include "cgra/threadpool.hpp"
+#include "KeplerOrbits.hpp"
+
+// Start of a binary catalogue, followed by the count as a uint64 and then the elements
+static const char BINARY_MAGIC[8] = { 'K', 'E', 'P', 'L', 'E', 'R', '0', '1' };
+// Bodies more eccentric than this take the extra Newton steps
+static const float ECCENTRIC = 0.9f;
+
+/*
+* Unit vectors in ecliptic coordinates, P pointing at periapsis and Q a quarter turn on from it
+* the way the body goes, both in the plane of the orbit
+*/
+static void orbitAxes(const KeplerOrbits::Elements &elements, glm::dvec3 &p, glm::dvec3 &q) {
+	double cosI = std::cos(glm::radians(elements.inclination)), sinI = std::sin(glm::radians(elements.inclination));
+	double cosN = std::cos(glm::radians(elements.ascendingNode)), sinN = std::sin(glm::radians(elements.ascendingNode));
+	double cosW = std::cos(glm::radians(elements.periapsis)), sinW = std::sin(glm::radians(elements.periapsis));
+	p = glm::dvec3(cosW * cosN - sinW * sinN * cosI, cosW * sinN + sinW * cosN * cosI, sinW * sinI);
+	q = glm::dvec3(-sinW * cosN - cosW * sinN * cosI, -sinW * sinN + cosW * cosN * cosI, cosW * sinI);
+}
+
+KeplerOrbits::KeplerOrbits(const Settings &settings) : m_settings(settings) {}
+
+/*
+* Works out the solvers numbers for an orbit. The elements are relative to the ecliptic,
+* which is the scenes x-z plane, with the ecliptics north pole up +y
+*/
+void KeplerOrbits::add(const Elements &elements) {
+	double a = elements.semiMajorAxis, e = elements.eccentricity;
+	if (!(a > 0.0) || !(e >= 0.0 && e < 1.0)) {
+		throw std::runtime_error("Error: orbit is not an ellipse");
+	}
+	m_elements.push_back(elements);
+	m_meanAnomaly.push_back(glm::radians(elements.meanAnomaly));
+	m_meanMotion.push_back(std::sqrt(m_settings.mu / (a * a * a)));
+	m_eccentricity.push_back(float(e));
+
+	glm::dvec3 p, q;
+	orbitAxes(elements, p, q);
+	double scaleP = m_settings.scale * a;
+	double scaleQ = m_settings.scale * a * std::sqrt(1.0 - e * e);
+	// Ecliptic x, y, z is scene x, -z, y
+	m_px.push_back(float(scaleP * p.x));
+	m_py.push_back(float(scaleP * p.z));
+	m_pz.push_back(float(-scaleP * p.y));
+	m_qx.push_back(float(scaleQ * q.x));
+	m_qy.push_back(float(scaleQ * q.z));
+	m_qz.push_back(float(-scaleQ * q.y));
+}
+
+void KeplerOrbits::clear() {
+	m_elements.clear();
+	m_meanAnomaly.clear();
+	m_meanMotion.clear();
+	m_eccentricity.clear();
+	m_px.clear();
+	m_py.clear();
+	m_pz.clear();
+	m_qx.clear();
+	m_qy.clear();
+	m_qz.clear();
+}
+
+void KeplerOrbits::load(const std::string &filename) {
+	std::ifstream file(filename, std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Error: could not open file for reading");
+	}
+	char magic[sizeof(BINARY_MAGIC)] = {};
+	file.read(magic, sizeof(magic));
+	file.close();
+	clear();
+	if (std::memcmp(magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0) {
+		loadBinary(filename);
+	}
+	else {
+		loadText(filename);
+	}
+}
+
+void KeplerOrbits::loadText(const std::string &filename) {
+	std::ifstream file(filename, std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Error: could not open file for reading");
+	}
+	std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	// strtod straight off the text, a stream per line is far too slow for big catalogues
+	const char *next = text.c_str();
+	int line = 0;
+	while (*next) {
+		line++;
+		const char *end = std::strchr(next, '\n');
+		if (!end) {
+			end = next + std::strlen(next);
+		}
+		const char *start = next;
+		while (start < end && (*start == ' ' || *start == '\t' || *start == '\r')) start++;
+		if (start < end && *start != '#') {
+			double values[6];
+			const char *read = start;
+			for (double &value : values) {
+				char *after;
+				value = std::strtod(read, &after);
+				if (after == read || after > end) {
+					std::ostringstream msgStream;
+					msgStream << "Error: expected six orbital elements on line " << line << " of " << filename;
+					throw std::runtime_error(msgStream.str());
+				}
+				read = after;
+			}
+			Elements elements = { values[0], values[1], values[2], values[3], values[4], values[5] };
+			try {
+				add(elements);
+			}
+			catch (const std::runtime_error &) {
+				std::ostringstream msgStream;
+				msgStream << "Error: orbit on line " << line << " of " << filename << " is not an ellipse";
+				throw std::runtime_error(msgStream.str());
+			}
+		}
+		next = *end ? end + 1 : end;
+	}
+}
+
+void KeplerOrbits::loadBinary(const std::string &filename) {
+	std::ifstream file(filename, std::ios::in | std::ios::binary);
+	char magic[sizeof(BINARY_MAGIC)];
+	uint64_t count = 0;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char *>(&count), sizeof(count));
+	std::vector<Elements> elements(size_t(file ? count : 0));
+	file.read(reinterpret_cast<char *>(elements.data()), std::streamsize(elements.size() * sizeof(Elements)));
+	if (!file) {
+		throw std::runtime_error("Error: binary orbit catalogue is cut short");
+	}
+	m_elements.reserve(elements.size());
+	for (const Elements &body : elements) {
+		add(body);
+	}
+}
+
+void KeplerOrbits::saveBinary(const std::string &filename) const {
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Error: could not open file for writing");
+	}
+	uint64_t count = m_elements.size();
+	file.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+	file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	file.write(reinterpret_cast<const char *>(m_elements.data()), std::streamsize(m_elements.size() * sizeof(Elements)));
+	if (!file) {
+		throw std::runtime_error("Error: could not write the orbit catalogue");
+	}
+}
+
+void KeplerOrbits::sortByOrbit(int bands) {
+	std::vector<size_t> order(m_elements.size());
+	std::iota(order.begin(), order.end(), size_t(0));
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return m_elements[a].semiMajorAxis < m_elements[b].semiMajorAxis;
+	});
+	// Mean longitude, how far round from the reference direction the body was at the epoch
+	auto longitude = [&](size_t i) {
+		const Elements &body = m_elements[i];
+		double degrees = std::fmod(body.ascendingNode + body.periapsis + body.meanAnomaly, 360.0);
+		return degrees < 0.0 ? degrees + 360.0 : degrees;
+	};
+	bands = std::max(bands, 1);
+	for (int band = 0; band < bands; band++) {
+		auto first = order.begin() + order.size() * band / bands;
+		auto last = order.begin() + order.size() * (band + 1) / bands;
+		std::sort(first, last, [&](size_t a, size_t b) { return longitude(a) < longitude(b); });
+	}
+
+	std::vector<Elements> elements;
+	elements.reserve(order.size());
+	for (size_t i : order) {
+		elements.push_back(m_elements[i]);
+	}
+	clear();
+	for (const Elements &body : elements) {
+		add(body);
+	}
+}
+
+/*
+* Mean anomaly at `time`, in [-pi, pi), so the solver always starts on the right turn
+*/
+static inline float meanAnomalyAt(double meanAnomaly, double meanMotion, double time) {
+	double m = meanAnomaly + meanMotion * time;
+	return float(m - glm::two_pi<double>() * std::floor((m + glm::pi<double>()) / glm::two_pi<double>()));
+}
+
+/*
+* Solves M = E - e sin E for the eccentric anomaly E, which places the body. The guess is
+* M + e sin M (1 + e cos M), which is already close to E for all but very eccentric orbits,
+* then every body takes the same number of Newton steps
+*/
+void KeplerOrbits::positions(size_t begin, size_t end, double time, const glm::vec3 &centre, float *x, float *y, float *z) const {
+	size_t i = begin;
+#ifdef CGRA_SSE2
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 cx = _mm_set1_ps(centre.x), cy = _mm_set1_ps(centre.y), cz = _mm_set1_ps(centre.z);
+	for (; i + 4 <= end; i += 4) {
+		float lanes[4];
+		for (int l = 0; l < 4; l++) {
+			lanes[l] = meanAnomalyAt(m_meanAnomaly[i + l], m_meanMotion[i + l], time);
+		}
+		__m128 m = _mm_loadu_ps(lanes);
+		__m128 e = _mm_loadu_ps(&m_eccentricity[i]);
+		__m128 s, c;
+		cgra::sinCos(m, s, c);
+		__m128 anomaly = _mm_add_ps(m, _mm_mul_ps(_mm_mul_ps(e, s), _mm_add_ps(one, _mm_mul_ps(e, c))));
+
+		int steps = NEWTON_STEPS;
+		if (_mm_movemask_ps(_mm_cmpgt_ps(e, _mm_set1_ps(ECCENTRIC)))) {
+			steps += ECCENTRIC_STEPS;
+		}
+		for (int step = 0; step < steps; step++) {
+			cgra::sinCos(anomaly, s, c);
+			__m128 error = _mm_sub_ps(_mm_sub_ps(anomaly, _mm_mul_ps(e, s)), m);
+			anomaly = _mm_sub_ps(anomaly, _mm_div_ps(error, _mm_sub_ps(one, _mm_mul_ps(e, c))));
+		}
+		cgra::sinCos(anomaly, s, c);
+
+		// Along P from the centre of the ellipse to the focus, then out to the body
+		__m128 alongP = _mm_sub_ps(c, e);
+		_mm_storeu_ps(x + (i - begin), _mm_add_ps(cx, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_px[i]), alongP), _mm_mul_ps(_mm_loadu_ps(&m_qx[i]), s))));
+		_mm_storeu_ps(y + (i - begin), _mm_add_ps(cy, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_py[i]), alongP), _mm_mul_ps(_mm_loadu_ps(&m_qy[i]), s))));
+		_mm_storeu_ps(z + (i - begin), _mm_add_ps(cz, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_pz[i]), alongP), _mm_mul_ps(_mm_loadu_ps(&m_qz[i]), s))));
+	}
+#endif
+	for (; i < end; i++) {
+		float m = meanAnomalyAt(m_meanAnomaly[i], m_meanMotion[i], time);
+		float e = m_eccentricity[i];
+		float anomaly = m + e * std::sin(m) * (1.0f + e * std::cos(m));
+		int steps = NEWTON_STEPS + (e > ECCENTRIC ? ECCENTRIC_STEPS : 0);
+		for (int step = 0; step < steps; step++) {
+			anomaly -= (anomaly - e * std::sin(anomaly) - m) / (1.0f - e * std::cos(anomaly));
+		}
+		float alongP = std::cos(anomaly) - e, alongQ = std::sin(anomaly);
+		x[i - begin] = centre.x + m_px[i] * alongP + m_qx[i] * alongQ;
+		y[i - begin] = centre.y + m_py[i] * alongP + m_qy[i] * alongQ;
+		z[i - begin] = centre.z + m_pz[i] * alongP + m_qz[i] * alongQ;
+	}
+}
+
+void KeplerOrbits::positions(double time, const glm::vec3 &centre, std::vector<float> &x, std::vector<float> &y, std::vector<float> &z) const {
+	x.resize(size());
+	y.resize(size());
+	z.resize(size());
+	cgra::ThreadPool::shared().parallelFor(0, size(), [&](size_t begin, size_t end) {
+		positions(begin, end, time, centre, &x[begin], &y[begin], &z[begin]);
+	}, 4096);
+}
+
+glm::dvec3 KeplerOrbits::position(size_t i, double time) const {
+	const Elements &body = m_elements[i];
+	double a = body.semiMajorAxis, e = body.eccentricity;
+	double m = glm::radians(body.meanAnomaly) + std::sqrt(m_settings.mu / (a * a * a)) * time;
+	m = std::fmod(m, glm::two_pi<double>());
+	double anomaly = e > 0.8 ? glm::pi<double>() : m;
+	for (int step = 0; step < 100; step++) {
+		double change = (anomaly - e * std::sin(anomaly) - m) / (1.0 - e * std::cos(anomaly));
+		anomaly -= change;
+		if (std::abs(change) < 1e-15) break;
+	}
+
+	glm::dvec3 p, q;
+	orbitAxes(body, p, q);
+	glm::dvec3 ecliptic = a * (std::cos(anomaly) - e) * p + a * std::sqrt(1.0 - e * e) * std::sin(anomaly) * q;
+	return double(m_settings.scale) * glm::dvec3(ecliptic.x, ecliptic.z, -ecliptic.y);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+// Bodies on fixed Kepler orbits around the sun, from a catalogue of orbital elements such as
+// a list of minor planets. Where a body is at any time comes straight from its elements,
+// nothing is integrated, so time can jump anywhere and costs the same. Kepler's equation is
+// solved four bodies at a time with a fixed number of Newton steps from a guess that's
+// already close, so every lane does the same work, and the bodies are split across the
+// thread pool.
+//
+// A text catalogue has one body a line, "a e i node periapsis M", with a in AU and the angles
+// in degrees, M being the mean anomaly at the epoch. Blank lines and lines starting with #
+// are skipped. A binary catalogue is what saveBinary() writes, and loads much faster.
+class KeplerOrbits {
+public:
+	// One orbit as the catalogue has it
+	struct Elements {
+		double semiMajorAxis;
+		double eccentricity;
+		double inclination;
+		// Longitude of the ascending node
+		double ascendingNode;
+		// Argument of periapsis
+		double periapsis;
+		double meanAnomaly;
+	};
+
+	struct Settings {
+		// G times the mass of the sun in AU^3 per day^2, so times are days since the epoch
+		double mu = 2.9591220828559e-4;
+		// Scene units to an AU
+		float scale = 10.0f;
+	};
+
+	// Newton steps for every four bodies, enough for float precision up to an eccentricity
+	// of 0.9. Four with any more eccentric than that take the extra steps as well
+	static const int NEWTON_STEPS = 4;
+	static const int ECCENTRIC_STEPS = 2;
+
+	KeplerOrbits() {}
+	explicit KeplerOrbits(const Settings &settings);
+
+	const Settings &settings() const { return m_settings; }
+	size_t size() const { return m_elements.size(); }
+	const Elements &elements(size_t i) const { return m_elements[i]; }
+
+	// Adds a body, throws if the orbit isn't closed
+	void add(const Elements &elements);
+	void clear();
+
+	// Replaces the bodies with the ones in a text or binary catalogue, throws if it can't
+	void load(const std::string &filename);
+	void saveBinary(const std::string &filename) const;
+
+	// Puts the bodies in order of semi-major axis, split into `bands` of equal size, then
+	// each band in order of where the bodies were at the epoch. Bodies close together in the
+	// list start out close together in space, the further from the epoch the less so
+	void sortByOrbit(int bands);
+
+	// Where bodies [begin, end) are `time` days from the epoch, in scene units around
+	// `centre`. The plane of the orbits is the x-z plane and north is +y
+	void positions(size_t begin, size_t end, double time, const glm::vec3 &centre, float *x, float *y, float *z) const;
+	// Every body, across the thread pool
+	void positions(double time, const glm::vec3 &centre, std::vector<float> &x, std::vector<float> &y, std::vector<float> &z) const;
+
+	// One body solved in double precision until it stops changing. For checking the fast one
+	glm::dvec3 position(size_t i, double time) const;
+
+private:
+	Settings m_settings;
+	std::vector<Elements> m_elements;
+
+	// Everything the solver needs, one array per component. The mean anomaly is kept
+	// in double, so times far from the epoch don't lose the phase
+	std::vector<double> m_meanAnomaly;
+	std::vector<double> m_meanMotion;
+	std::vector<float> m_eccentricity;
+	// a P and b Q in scene units and axes, where P points at periapsis and Q is a quarter
+	// turn on from it in the plane of the orbit, and b is the semi-minor axis
+	std::vector<float> m_px, m_py, m_pz;
+	std::vector<float> m_qx, m_qy, m_qz;
+
+	void loadText(const std::string &filename);
+	void loadBinary(const std::string &filename);
+};
@@ -33,6 +33,12 @@
 		
 	}
 
+	// Makes the probabilistic rules repeatable
+	void LSystem::setSeed(unsigned s) {
+		seed = s;
+		randGen.seed(s);
+	}
+
 	void LSystem::setRules(){
 		axiom = "A";
 		currentTree = axiom;
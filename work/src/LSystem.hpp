@@ -42,6 +42,7 @@ public:
 	int generations;
 
 	void generate();
+	void setSeed(unsigned s);
 	void setRules();
 	void readRules(string filename);
 	void resetTree();
@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <cmath>
+
+#include "glm/gtc/constants.hpp"
+
+#include "cgra/simd.hpp"
+#include "cgra/threadpool.hpp"
+#include "LightClusters.hpp"
+
+const float LightClusters::LIGHT_CUTOFF = 0.01f;
+// Closest a light is taken to be when dividing by its distance, for a light at the viewer
+static const float MIN_LIGHT_DISTANCE = 1e-4f;
+
+float LightClusters::lightRange(const PointLight &light) {
+	// Matches the diffuse falloff in volume.fs.glsl, intensity * 4pi / d^2
+	return std::sqrt(std::max(light.intensity, 0.0f) * 4.0f * glm::pi<float>() / LIGHT_CUTOFF);
+}
+
+glm::vec2 LightClusters::glowAngles(const PointLight &light, float distance, float beta) {
+	if (distance <= 0.0f) {
+		return glm::vec2(1.0f);
+	}
+	// The airlight is 5 * beta * colour * exp(-beta * d * cos(gamma)) / (2pi * d * sin(gamma)) for
+	// a view ray gamma away from the light. Towards the light the exponential is at most one,
+	// away from it at most exp(beta * d)
+	float colour = std::max(light.color.r, std::max(light.color.g, light.color.b));
+	float scale = 5.0f * beta * colour / (2.0f * glm::pi<float>() * distance * LIGHT_CUTOFF);
+	return glm::min(glm::vec2(scale, scale * std::exp(beta * distance)), glm::vec2(1.0f));
+}
+
+/*
+* Tiles covered by the part of a view space box between two depths, as the first and last
+* tile across and up. Returns false if none are
+*/
+static bool tileRect(const glm::vec3 &lo, const glm::vec3 &hi, float dNear, float dFar,
+	float tanX, float tanY, int rect[4]) {
+	float za = std::max(dNear, -hi.z);
+	float zb = std::min(dFar, -lo.z);
+	if (za > zb) {
+		return false;
+	}
+	// x / depth only gets bigger or smaller along each edge, so the corners bound it
+	float x0 = std::min(lo.x / za, lo.x / zb) / tanX;
+	float x1 = std::max(hi.x / za, hi.x / zb) / tanX;
+	float y0 = std::min(lo.y / za, lo.y / zb) / tanY;
+	float y1 = std::max(hi.y / za, hi.y / zb) / tanY;
+	if (x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f) {
+		return false;
+	}
+	rect[0] = glm::clamp(int(std::floor((x0 + 1.0f) * 0.5f * LightClusters::TILES_X)), 0, LightClusters::TILES_X - 1);
+	rect[1] = glm::clamp(int(std::floor((x1 + 1.0f) * 0.5f * LightClusters::TILES_X)), 0, LightClusters::TILES_X - 1);
+	rect[2] = glm::clamp(int(std::floor((y0 + 1.0f) * 0.5f * LightClusters::TILES_Y)), 0, LightClusters::TILES_Y - 1);
+	rect[3] = glm::clamp(int(std::floor((y1 + 1.0f) * 0.5f * LightClusters::TILES_Y)), 0, LightClusters::TILES_Y - 1);
+	return true;
+}
+
+/*
+* Narrows [t0, t1] to where k * t >= m. Returns false if nothing is left
+*/
+static bool clampRay(float k, float m, float &t0, float &t1) {
+	if (k > 0.0f) {
+		t0 = std::max(t0, m / k);
+	} else if (k < 0.0f) {
+		t1 = std::min(t1, m / k);
+	} else if (m > 0.0f) {
+		return false;
+	}
+	return t0 <= t1;
+}
+
+/*
+* The clusters of one slice as boxes, and as the sphere around each seen from the viewer. Kept
+* as separate arrays so the four tiles of a row that start on a multiple of four load together
+*/
+struct SliceBoxes {
+	static_assert(LightClusters::TILES_X % 4 == 0, "Rows are loaded four tiles at a time");
+	static const int NUM_TILES = LightClusters::TILES_X * LightClusters::TILES_Y;
+	alignas(16) float minX[NUM_TILES], minY[NUM_TILES], minZ[NUM_TILES];
+	alignas(16) float maxX[NUM_TILES], maxY[NUM_TILES], maxZ[NUM_TILES];
+	// Centre relative to the viewer
+	alignas(16) float centreX[NUM_TILES], centreY[NUM_TILES], centreZ[NUM_TILES];
+	alignas(16) float distance[NUM_TILES], sine[NUM_TILES], cosine[NUM_TILES];
+	// All bits set if the viewer is inside the sphere
+	alignas(16) uint32_t inside[NUM_TILES];
+};
+
+#ifdef CGRA_SSE2
+/*
+* Which of the four tiles from `tx` are between `first` and `last`, as movemask bits
+*/
+static inline int rowLanes(int tx, int first, int last) {
+	int from = std::max(first - tx, 0), to = std::min(last - tx, 3);
+	return (0xf << from) & (0xf >> (3 - to)) & 0xf;
+}
+#endif
+
+/*
+* Calls `add` for the tiles in `rect` whose box is within `range` of `centre`
+*/
+template <typename Add>
+static void addLitTiles(const SliceBoxes &boxes, const int rect[4], const glm::vec3 &centre, float range, Add add) {
+	for (int ty = rect[2]; ty <= rect[3]; ty++) {
+		int row = ty * LightClusters::TILES_X;
+#ifdef CGRA_SSE2
+		__m128 zero = _mm_setzero_ps(), rangeSq = _mm_set1_ps(range * range);
+		__m128 cx = _mm_set1_ps(centre.x), cy = _mm_set1_ps(centre.y), cz = _mm_set1_ps(centre.z);
+		for (int tx = rect[0] & ~3; tx <= rect[1]; tx += 4) {
+			int tile = row + tx;
+			__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(&boxes.minX[tile]), cx), _mm_sub_ps(cx, _mm_load_ps(&boxes.maxX[tile]))), zero);
+			__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(&boxes.minY[tile]), cy), _mm_sub_ps(cy, _mm_load_ps(&boxes.maxY[tile]))), zero);
+			__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(&boxes.minZ[tile]), cz), _mm_sub_ps(cz, _mm_load_ps(&boxes.maxZ[tile]))), zero);
+			__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			int hits = _mm_movemask_ps(_mm_cmple_ps(distSq, rangeSq)) & rowLanes(tx, rect[0], rect[1]);
+			for (int lane = 0; lane < 4; lane++) {
+				if (hits & (1 << lane)) add(tile + lane);
+			}
+		}
+#else
+		for (int tx = rect[0]; tx <= rect[1]; tx++) {
+			int tile = row + tx;
+			glm::vec3 lo(boxes.minX[tile], boxes.minY[tile], boxes.minZ[tile]);
+			glm::vec3 hi(boxes.maxX[tile], boxes.maxY[tile], boxes.maxZ[tile]);
+			glm::vec3 d = glm::max(glm::max(lo - centre, centre - hi), glm::vec3(0.0f));
+			if (glm::dot(d, d) <= range * range) {
+				add(tile);
+			}
+		}
+#endif
+	}
+}
+
+/*
+* Calls `add` for the tiles in `rect` whose sphere is inside a glow cone, given as its axis and
+* the cosine and sine of its angle. The angle to a cluster is at most the glow angle plus the
+* angle the cluster covers
+*/
+template <typename Add>
+static void addGlowTiles(const SliceBoxes &boxes, const int rect[4], const glm::vec3 &axis, float cosine, float sine, Add add) {
+	for (int ty = rect[2]; ty <= rect[3]; ty++) {
+		int row = ty * LightClusters::TILES_X;
+#ifdef CGRA_SSE2
+		__m128 ax = _mm_set1_ps(axis.x), ay = _mm_set1_ps(axis.y), az = _mm_set1_ps(axis.z);
+		__m128 c = _mm_set1_ps(cosine), s = _mm_set1_ps(sine);
+		for (int tx = rect[0] & ~3; tx <= rect[1]; tx += 4) {
+			int tile = row + tx;
+			__m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(&boxes.centreX[tile]), ax),
+				_mm_mul_ps(_mm_load_ps(&boxes.centreY[tile]), ay)), _mm_mul_ps(_mm_load_ps(&boxes.centreZ[tile]), az));
+			__m128 limit = _mm_mul_ps(_mm_load_ps(&boxes.distance[tile]),
+				_mm_sub_ps(_mm_mul_ps(c, _mm_load_ps(&boxes.cosine[tile])), _mm_mul_ps(s, _mm_load_ps(&boxes.sine[tile]))));
+			__m128 inside = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i *>(&boxes.inside[tile])));
+			int hits = _mm_movemask_ps(_mm_or_ps(inside, _mm_cmpge_ps(along, limit))) & rowLanes(tx, rect[0], rect[1]);
+			for (int lane = 0; lane < 4; lane++) {
+				if (hits & (1 << lane)) add(tile + lane);
+			}
+		}
+#else
+		for (int tx = rect[0]; tx <= rect[1]; tx++) {
+			int tile = row + tx;
+			float along = glm::dot(glm::vec3(boxes.centreX[tile], boxes.centreY[tile], boxes.centreZ[tile]), axis);
+			if (boxes.inside[tile] || along >= boxes.distance[tile] * (cosine * boxes.cosine[tile] - sine * boxes.sine[tile])) {
+				add(tile);
+			}
+		}
+#endif
+	}
+}
+
+void LightClusters::build(const std::vector<PointLight> &lights, const glm::mat4 &view,
+	float fovY, float aspect, float zNear, float zFar, float beta, const glm::vec3 &viewer) {
+	const int NUM_TILES = TILES_X * TILES_Y;
+	size_t numLights = lights.size();
+	m_lights.resize(numLights);
+	m_glows.clear();
+	m_everywhere.assign(numLights, 0);
+	m_directAirlight = glm::vec3(0.0f);
+	for (size_t i = 0; i < numLights; i++) {
+		const PointLight &light = lights[i];
+		glm::vec3 p = glm::vec3(view * glm::vec4(light.position, 1.0f));
+		glm::vec3 toLight = p - viewer;
+		float distance = glm::length(toLight);
+		float divisor = std::max(distance, MIN_LIGHT_DISTANCE);
+		Light &out = m_lights[i];
+		out.positionRange = glm::vec4(p, lightRange(light));
+		out.airlightThickness = glm::vec4(5.0f * beta * light.color / (2.0f * glm::pi<float>() * divisor), beta * distance);
+		out.directionDistance = glm::vec4(toLight / divisor, distance);
+		out.surfaceScales = glm::vec4(light.intensity * 4.0f * glm::pi<float>(), light.intensity * beta / (2.0f * glm::pi<float>()), 0.0f, 0.0f);
+
+		// Straight to the viewer, colour / d^2 * exp(-beta * d)
+		if (distance > 0.0f) {
+			m_directAirlight += light.color / (distance * distance) * std::exp(-beta * distance);
+		}
+
+		glm::vec2 sines = glowAngles(light, distance, beta);
+		if (sines.x >= 1.0f || sines.y >= 1.0f) {
+			m_everywhere[i] = 1;
+			continue;
+		}
+		for (int side = 0; side < 2; side++) {
+			Glow glow;
+			glow.light = (uint32_t)i;
+			glow.axis = (side == 0 ? toLight : -toLight) / divisor;
+			glow.sine = sines[side];
+			glow.cosine = std::sqrt(1.0f - glow.sine * glow.sine);
+			// Each component of a direction in the cone is within the glow angle of the axis's
+			float angle = std::asin(glow.sine);
+			for (int axis = 0; axis < 3; axis++) {
+				float theta = std::acos(glm::clamp(glow.axis[axis], -1.0f, 1.0f));
+				glow.directionMin[axis] = std::cos(std::min(theta + angle, glm::pi<float>()));
+				glow.directionMax[axis] = std::cos(std::max(theta - angle, 0.0f));
+			}
+			m_glows.push_back(glow);
+		}
+	}
+
+	float logRatio = std::log(zFar / zNear);
+	m_sliceScale = SLICES / logRatio;
+	m_sliceBias = -SLICES * std::log(zNear) / logRatio;
+	float tanY = std::tan(fovY * 0.5f);
+	float tanX = tanY * aspect;
+	// Far enough along a glow cone to be past anything drawn
+	float rayLength = glm::length(viewer) + zFar * std::sqrt(1.0f + tanX * tanX + tanY * tanY);
+
+	m_clusters.resize(NUM_CLUSTERS);
+	m_sliceIndices.resize(SLICES);
+	cgra::ThreadPool::shared().parallelFor(0, SLICES, [&](size_t begin, size_t end) {
+		std::vector<std::vector<uint32_t>> tileLights(NUM_TILES);
+		SliceBoxes boxes;
+		uint32_t lastLight[NUM_TILES];
+		int rect[4];
+		for (size_t slice = begin; slice < end; slice++) {
+			// Depths are positive here, the camera looks down -z
+			float dNear = zNear * std::pow(zFar / zNear, float(slice) / SLICES);
+			float dFar = zNear * std::pow(zFar / zNear, float(slice + 1) / SLICES);
+
+			// Each cluster as a box, and as the sphere around it seen from the viewer
+			for (int ty = 0; ty < TILES_Y; ty++) {
+				float y0 = (-1.0f + 2.0f * ty / TILES_Y) * tanY;
+				float y1 = (-1.0f + 2.0f * (ty + 1) / TILES_Y) * tanY;
+				for (int tx = 0; tx < TILES_X; tx++) {
+					float x0 = (-1.0f + 2.0f * tx / TILES_X) * tanX;
+					float x1 = (-1.0f + 2.0f * (tx + 1) / TILES_X) * tanX;
+					int tile = ty * TILES_X + tx;
+					glm::vec3 lo(std::min(x0 * dNear, x0 * dFar), std::min(y0 * dNear, y0 * dFar), -dFar);
+					glm::vec3 hi(std::max(x1 * dNear, x1 * dFar), std::max(y1 * dNear, y1 * dFar), -dNear);
+					glm::vec3 centre = (lo + hi) * 0.5f - viewer;
+					float radius = glm::length(hi - lo) * 0.5f;
+					float distance = glm::length(centre);
+					bool inside = distance <= radius;
+					boxes.minX[tile] = lo.x;
+					boxes.minY[tile] = lo.y;
+					boxes.minZ[tile] = lo.z;
+					boxes.maxX[tile] = hi.x;
+					boxes.maxY[tile] = hi.y;
+					boxes.maxZ[tile] = hi.z;
+					boxes.centreX[tile] = centre.x;
+					boxes.centreY[tile] = centre.y;
+					boxes.centreZ[tile] = centre.z;
+					boxes.distance[tile] = distance;
+					boxes.inside[tile] = inside ? UINT32_MAX : 0;
+					boxes.sine[tile] = inside ? 1.0f : radius / distance;
+					boxes.cosine[tile] = std::sqrt(1.0f - boxes.sine[tile] * boxes.sine[tile]);
+					tileLights[tile].clear();
+					lastLight[tile] = UINT32_MAX;
+				}
+			}
+
+			// Adds a light to a tile once, whichever way it got there
+			auto add = [&](int tile, uint32_t light) {
+				if (lastLight[tile] != light) {
+					lastLight[tile] = light;
+					tileLights[tile].push_back(light);
+				}
+			};
+
+			size_t nextGlow = 0;
+			for (uint32_t i = 0; i < numLights; i++) {
+				if (m_everywhere[i]) {
+					for (int tile = 0; tile < NUM_TILES; tile++) {
+						add(tile, i);
+					}
+					continue;
+				}
+
+				// Lit surfaces, only the tiles under the box around the lights range are tried
+				glm::vec3 centre = glm::vec3(m_lights[i].positionRange);
+				float range = m_lights[i].positionRange.w;
+				if (tileRect(centre - range, centre + range, dNear, dFar, tanX, tanY, rect)) {
+					addLitTiles(boxes, rect, centre, range, [&](int tile) { add(tile, i); });
+				}
+
+				// Glow, the part of each cone between the slices depths is bounded by a box too
+				for (; nextGlow < m_glows.size() && m_glows[nextGlow].light == i; nextGlow++) {
+					const Glow &glow = m_glows[nextGlow];
+					float t0 = 0.0f, t1 = rayLength;
+					if (!clampRay(glow.directionMax.z, -viewer.z - dFar, t0, t1) ||
+						!clampRay(-glow.directionMin.z, dNear + viewer.z, t0, t1)) {
+						continue;
+					}
+					glm::vec3 lo = viewer + glm::min(t0 * glow.directionMin, t1 * glow.directionMin);
+					glm::vec3 hi = viewer + glm::max(t0 * glow.directionMax, t1 * glow.directionMax);
+					if (tileRect(lo, hi, dNear, dFar, tanX, tanY, rect)) {
+						addGlowTiles(boxes, rect, glow.axis, glow.cosine, glow.sine, [&](int tile) { add(tile, i); });
+					}
+				}
+			}
+
+			std::vector<uint32_t> &out = m_sliceIndices[slice];
+			out.clear();
+			for (int tile = 0; tile < NUM_TILES; tile++) {
+				// Offsets are within the slice for now, they're fixed once the slices are joined
+				Cluster &cluster = m_clusters[slice * NUM_TILES + tile];
+				cluster.offset = (uint32_t)out.size();
+				cluster.count = (uint32_t)tileLights[tile].size();
+				out.insert(out.end(), tileLights[tile].begin(), tileLights[tile].end());
+			}
+		}
+	});
+
+	m_indices.clear();
+	m_maxPerCluster = 0;
+	for (int slice = 0; slice < SLICES; slice++) {
+		uint32_t base = (uint32_t)m_indices.size();
+		for (int tile = 0; tile < NUM_TILES; tile++) {
+			Cluster &cluster = m_clusters[slice * NUM_TILES + tile];
+			cluster.offset += base;
+			m_maxPerCluster = std::max(m_maxPerCluster, cluster.count);
+		}
+		m_indices.insert(m_indices.end(), m_sliceIndices[slice].begin(), m_sliceIndices[slice].end());
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "lightScene.hpp"
+
+// Splits the view frustum into a grid of clusters and lists the point lights that reach each
+// one, so a fragment only shades the lights of its own cluster. The grid is tiles across the
+// screen by slices in depth, spaced exponentially so clusters near the camera stay small.
+// A light reaches the clusters inside its range, plus the clusters around the view ray to it
+// where its glow through the fog (the airlight) is bright enough to see. The light that comes
+// straight to the viewer is the same for every fragment, so it's summed here instead.
+// Everything here is on the CPU, LightScene uploads the result for the shader.
+class LightClusters {
+public:
+	static const int TILES_X = 16;
+	static const int TILES_Y = 9;
+	static const int SLICES = 24;
+	static const int NUM_CLUSTERS = TILES_X * TILES_Y * SLICES;
+
+	// Below this much light (before fog) a light no longer touches a surface, which sets how
+	// far each one reaches
+	static const float LIGHT_CUTOFF;
+
+	// A light in view space, laid out as the four texels the shader reads. Everything
+	// that only depends on the light and the viewer is worked out here once a frame,
+	// instead of again for every fragment
+	struct Light {
+		glm::vec4 positionRange;
+		// rgb scales the airlight integral, 5 * beta * colour / (2pi * distance to the
+		// viewer), w is the optical thickness between the light and the viewer
+		glm::vec4 airlightThickness;
+		// Unit direction from the viewer to the light, and the distance
+		glm::vec4 directionDistance;
+		// x scales the direct surface light, intensity * 4pi, y the scattered surface
+		// light, intensity * beta / 2pi
+		glm::vec4 surfaceScales;
+	};
+
+	// Where a clusters lights are in the index list
+	struct Cluster {
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	// Builds the grid for a perspective camera, with fog as thick as `beta` (see
+	// LightScene::setBeta). Lights are given in world space, `viewer` is wherever the
+	// shader is told the viewer is
+	void build(const std::vector<PointLight> &lights, const glm::mat4 &view,
+		float fovY, float aspect, float zNear, float zFar, float beta, const glm::vec3 &viewer);
+
+	// How far a light reaches before it drops below LIGHT_CUTOFF
+	static float lightRange(const PointLight &light);
+
+	// Angles (as sines) around a light seen from `distance` away, towards it and directly
+	// away from it, where its glow drops below LIGHT_CUTOFF. 1 means the whole view
+	static glm::vec2 glowAngles(const PointLight &light, float distance, float beta);
+
+	// Light that reaches the viewer straight from every point light
+	glm::vec3 directAirlight() const { return m_directAirlight; }
+
+	const std::vector<Light> &lights() const { return m_lights; }
+	const std::vector<Cluster> &clusters() const { return m_clusters; }
+	const std::vector<uint32_t> &indices() const { return m_indices; }
+
+	// The shader finds a fragments slice as log(depth) * sliceScale + sliceBias
+	float sliceScale() const { return m_sliceScale; }
+	float sliceBias() const { return m_sliceBias; }
+
+	// Most lights any one cluster has
+	uint32_t maxLightsPerCluster() const { return m_maxPerCluster; }
+
+private:
+	std::vector<Light> m_lights;
+	std::vector<Cluster> m_clusters;
+	std::vector<uint32_t> m_indices;
+	float m_sliceScale = 0.0f;
+	float m_sliceBias = 0.0f;
+	uint32_t m_maxPerCluster = 0;
+
+	// Light indices of each slice, built in parallel then joined into m_indices.
+	// Kept between builds so they don't reallocate every frame
+	std::vector<std::vector<uint32_t>> m_sliceIndices;
+	// A cone of glow from the viewer, and the box of directions inside it
+	struct Glow {
+		uint32_t light;
+		glm::vec3 axis;
+		float cosine;
+		float sine;
+		glm::vec3 directionMin;
+		glm::vec3 directionMax;
+	};
+	std::vector<Glow> m_glows;
+	// Lights whose glow fills the view, they're in every cluster
+	std::vector<uint32_t> m_everywhere;
+	glm::vec3 m_directAirlight = glm::vec3(0.0f);
+};
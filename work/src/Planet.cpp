@@ -8,9 +8,10 @@
 #include "imgui.h"
 
 #include "cgra/matrix.hpp"
-#include "cgra/wavefront.hpp"
+#include "cgra/threadpool.hpp"
 
 #include "Planet.hpp"
+#include "TerrainCompute.hpp"
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
@@ -35,6 +36,61 @@ uint64_t rdtsc() {
 
 #endif
 
+// Projected radius, in pixels, at which level 1 is used. Each finer level needs twice the radius
+static const float LOD_BASE_PIXELS = 10.0f;
+// How far past a threshold the radius must move before the level changes
+static const float LOD_HYSTERESIS = 0.15f;
+
+/*
+* Projected radius at which a level, 1 or finer, is used
+*/
+static float lodThreshold(int level) {
+	return LOD_BASE_PIXELS * float(1 << (level - 1));
+}
+
+// Vertices each task of the thread pool handles at least
+static const size_t VERTEX_CHUNK = 1024;
+
+// Each stage along with every stage that uses what it makes
+static const unsigned int STAGE_INVALIDATES[Planet::STAGE_COUNT] = {
+	(1u << Planet::STAGE_COUNT) - 1,
+	(1u << Planet::STAGE_DISPLACEMENT) | (1u << Planet::STAGE_BIOMES) | (1u << Planet::STAGE_COLOURS) | (1u << Planet::STAGE_NORMALS) | (1u << Planet::STAGE_UPLOAD),
+	(1u << Planet::STAGE_BIOMES) | (1u << Planet::STAGE_COLOURS) | (1u << Planet::STAGE_UPLOAD),
+	(1u << Planet::STAGE_COLOURS) | (1u << Planet::STAGE_UPLOAD),
+	(1u << Planet::STAGE_NORMALS) | (1u << Planet::STAGE_UPLOAD),
+	(1u << Planet::STAGE_UPLOAD)
+};
+// Stages after which the meshes need building again, rather than just recolouring
+static const unsigned int STAGE_GEOMETRY = (1u << Planet::STAGE_TOPOLOGY) | (1u << Planet::STAGE_DISPLACEMENT) | (1u << Planet::STAGE_NORMALS);
+
+/*
+* Repeatable value between -1.0f & 1.0f for a point, used by the 'random' terrain.
+* The point is quantised first so that the same spot on the sphere always gives the same value
+*/
+static float hashNoise(const glm::vec3 &p) {
+	glm::ivec3 q = glm::ivec3(glm::floor(p * 4096.0f));
+	uint32_t h = uint32_t(q.x) * 73856093u ^ uint32_t(q.y) * 19349663u ^ uint32_t(q.z) * 83492791u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return (float(h) / 4294967295.0f) * 2.0f - 1.0f;
+}
+
+static double hashNoise(const glm::dvec3 &p) {
+	// Wrapped rather than overflowing, the high octaves go well past the range of an int
+	glm::dvec3 cell = glm::floor(p * 4096.0);
+	uint32_t x = uint32_t(int64_t(cell.x)), y = uint32_t(int64_t(cell.y)), z = uint32_t(int64_t(cell.z));
+	uint32_t h = x * 73856093u ^ y * 19349663u ^ z * 83492791u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return (double(h) / 4294967295.0) * 2.0 - 1.0;
+}
+
 /**
  * Constructor class. This is treated as the sun
  **/
@@ -78,8 +134,9 @@ Planet::Planet(PlanetInfo pi, int id, int octs, float freq, float amps, int sub)
 	this->octaves = octs;
 	this->frequency = freq;
 	this->amplitude = amps;
+	this->erosion = pi.erosion;
 	// Generate the Planet
-	generatePlanet();
+	generatePlanet(pi.seed);
 }
 
 /*
@@ -90,20 +147,24 @@ void Planet::generateIcosahedron() {
 	float t = (1.0f + glm::sqrt(5.0f)) / 2.0f;
 	originalVerticies = { glm::normalize(glm::vec3(-1.0f, t, 0.0f)), glm::normalize(glm::vec3(1.0f, t, 0.0f)), glm::normalize(glm::vec3(-1.0f, -t, 0.0f)), glm::normalize(glm::vec3(1.0f, -t, 0.0f)), glm::normalize(glm::vec3(0.0f, -1.0f, t)), glm::normalize(glm::vec3(0.0f, 1.0f, t)), glm::normalize(glm::vec3(0.0f, -1.0f, -t)), glm::normalize(glm::vec3(0.0f, 1.0f, -t)), glm::normalize(glm::vec3(t, 0.0f, -1.0f)), glm::normalize(glm::vec3(t, 0.0f, 1.0f)), glm::normalize(glm::vec3(-t, 0.0f, -1.0f)), glm::normalize(glm::vec3(-t, 0.0f, 1.0f)) };
 	originalTriangles = { { 0, 11, 5 }, { 0, 5, 1 }, {0, 1, 7}, {0, 7, 10}, {0, 10, 11}, {1,5,9},{5, 11,4}, {11, 10,2}, {10, 7,6}, {7, 1,8}, {3, 9,4}, {3,4,2}, {3,2,6}, {3,6,8}, {3,8,9}, {4,9,5}, {2,4,11}, {6,2,10}, {8,6,7}, {9,8,1} };
+	vertexParents.assign(originalVerticies.size(), glm::ivec2(-1));
 }
 
 /*
 * Method to generate the planets
 */
-void Planet::generatePlanet() {
-	srand((unsigned int)rdtsc()); // Makes sure we have a random seed
-	double startTime = glfwGetTime();
-	generateIcosahedron();
-	subdivideIcosahedron();
-	generateTerrain();
+void Planet::generatePlanet(unsigned int seed) {
+	this->seed = seed ? seed : (unsigned int)rdtsc();
+	randGen = default_random_engine(this->seed);
+	auto startTime = std::chrono::steady_clock::now();
+	// The noise doesn't depend on the seed, so the same sphere and displacement can be kept
+	if (topologySubdivisions != this->subdivisions) {
+		invalidate(STAGE_TOPOLOGY);
+	}
+	invalidate(STAGE_BIOMES);
+	updateTerrain();
 
-	std::random_device rd;
-	std::mt19937 gen(rd());
+	std::mt19937 gen(this->seed);
 	uniform_real_distribution<double> distribution(0.0, 1.0);
 	// Do we want to generate other planet features?
 	float point = distribution(randGen);
@@ -118,20 +179,29 @@ void Planet::generatePlanet() {
 	std::uniform_int_distribution<> dis(0, 4);
 	amtTrees = dis(gen);
 	for (int i = 0; i < amtTrees;i++) {
-		int seed = std::chrono::system_clock::now().time_since_epoch().count();
-		randGen = default_random_engine(seed);
-		uniform_real_distribution<double> dis(0.0, modifiedVerticies.size()-1);
+		uniform_real_distribution<double> dis(0.0, originalVerticies.size()-1);
 		int tv = dis(randGen);
 		treeVerts.push_back(tv);
 	}
-	this->timeTaken = glfwGetTime() - startTime; // Update Time
+	this->timeTaken = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(); // Update Time
 }
 
 /*
 * Every triangle when subdivided will turn into 4 triangles
 */
 void Planet::subdivideIcosahedron() {
-	midPoints = std::map<int, int>();
+	midPoints = std::map<uint64_t, int>();
+	erosionGraph.reset();
+	octaveNoise.clear();
+	lodNormals.clear();
+	topologySubdivisions = this->subdivisions;
+	// Keep every level around for the LOD chain
+	lodTriangles.clear();
+	lodVertexCounts.clear();
+	lodAdjacency.clear();
+	lodTriangles.push_back(this->originalTriangles);
+	lodVertexCounts.push_back(this->originalVerticies.size());
+	lodAdjacency.push_back(std::make_shared<cgra::MeshAdjacency>(this->originalVerticies.size(), this->originalTriangles));
 	for (int i = 0; i < this->subdivisions; i++) {
 		std::vector<std::vector<unsigned int>> newTris;
 		for (std::vector<unsigned int> tri : this->originalTriangles) { // Cycle through each polygon
@@ -147,6 +217,9 @@ void Planet::subdivideIcosahedron() {
 		}
 		// Update List
 		this->originalTriangles = newTris;
+		lodTriangles.push_back(newTris);
+		lodVertexCounts.push_back(this->originalVerticies.size());
+		lodAdjacency.push_back(std::make_shared<cgra::MeshAdjacency>(this->originalVerticies.size(), newTris));
 	}
 }
 
@@ -156,9 +229,10 @@ void Planet::subdivideIcosahedron() {
 int Planet::getMidPoint(int a, int b) {
 	int smallerIndex = glm::min(a, b);
 	int greaterIndex = glm::max(a, b);
-	int key = (smallerIndex << 16) + greaterIndex;
+	// Past level 7 there are more than 65536 vertices, so the indices need the full 32 bits each
+	uint64_t key = (uint64_t(smallerIndex) << 32) + uint64_t(greaterIndex);
 	// Is a midpoint already avaliable to use? The return that
-	std::map<int, int>::iterator i = midPoints.find(key);
+	std::map<uint64_t, int>::iterator i = midPoints.find(key);
 	if (i != midPoints.end()) {
 		return midPoints.at(key);
 	}
@@ -169,8 +243,9 @@ int Planet::getMidPoint(int a, int b) {
 
 	int loc = originalVerticies.size();
 	originalVerticies.push_back({mid.x, mid.y, mid.z});
+	vertexParents.push_back(glm::ivec2(smallerIndex, greaterIndex));
 
-	midPoints.insert(std::pair<int, int>(key, loc));
+	midPoints.insert(std::pair<uint64_t, int>(key, loc));
 	return loc;
 }
 
@@ -178,31 +253,30 @@ int Planet::getMidPoint(int a, int b) {
 *  Returns a floating point between -1.0f & 1.0f which has been generated through running a vertex point through a Perlin noise algorithm
 */
 float Planet::generateNoise(int i) {
-	float xFactor = 1.0f / (glm::sqrt(originalVerticies.size()) - 1);
-	float yFactor = 1.0f / (glm::sqrt(originalVerticies.size()) - 1);
-	float zFactor = 1.0f / (glm::sqrt(originalVerticies.size()) - 1);
+	return generateNoise(originalVerticies.at(i));
+}
 
-	float x = xFactor * originalVerticies.at(i)[0];
-	float y = yFactor * originalVerticies.at(i)[1];
-	float z = zFactor * originalVerticies.at(i)[2];
+/*
+* Noise for a point on the unit sphere. Only the position matters, not how finely the sphere
+* was subdivided, so every level of detail samples the same terrain
+*/
+float Planet::generateNoise(const glm::vec3 &p) const {
+	return fractalNoise(p, this->octaves, this->frequency, this->amplitude, this->perlin, this->simplex);
+}
 
+/*
+* Sums octaves of noise, each at double the frequency and half the weight of the last
+*/
+float Planet::fractalNoise(const glm::vec3 &p, int octaves, float frequency, float amplitude, bool perlin, bool simplex) {
 	float sum = 0.0f;
 	// Tuneable
-	float freq = this->frequency;
-	float amp = this->amplitude;
-	for (int octs = 0; octs < this->octaves; octs++) {
-		glm::vec3 p = glm::vec3(x * freq, y*freq, z * freq);
-		float value;
-		if (this->perlin) {
-			value = glm::perlin(p, glm::vec3(freq)) / amp;
-		} else if (this->simplex) {
-			value = glm::simplex(p) / amp;
-		} else { // Random
-			std::random_device rd;
-			std::mt19937 gen(rd());
-			uniform_real_distribution<double> distribution(-1.0, 1.0);
-			value = distribution(gen);
-		}
+	float freq = frequency;
+	float amp = amplitude;
+	for (int octs = 0; octs < octaves; octs++) {
+		float value = noiseOctave(p, freq, perlin, simplex);
+		if (perlin || simplex) {
+			value /= amp;
+		} // Random isn't scaled
 		sum += value;
 		freq *= 2.0f;
 		amp *= 2;
@@ -210,6 +284,47 @@ float Planet::generateNoise(int i) {
 	return sum;
 }
 
+double Planet::fractalNoise(const glm::dvec3 &p, int octaves, double frequency, double amplitude, bool perlin, bool simplex) {
+	double sum = 0.0;
+	double freq = frequency;
+	double amp = amplitude;
+	for (int octs = 0; octs < octaves; octs++) {
+		double value = noiseOctave(p, freq, perlin, simplex);
+		if (perlin || simplex) {
+			value /= amp;
+		} // Random isn't scaled
+		sum += value;
+		freq *= 2.0;
+		amp *= 2.0;
+	}
+	return sum;
+}
+
+/*
+* One octave of noise at a frequency, before the amplitude scales it
+*/
+float Planet::noiseOctave(const glm::vec3 &p, float frequency, bool perlin, bool simplex) {
+	glm::vec3 pf = p * frequency;
+	if (perlin) {
+		return glm::perlin(pf, glm::vec3(frequency));
+	} else if (simplex) {
+		return glm::simplex(pf);
+	} else { // Random
+		return hashNoise(pf);
+	}
+}
+
+double Planet::noiseOctave(const glm::dvec3 &p, double frequency, bool perlin, bool simplex) {
+	glm::dvec3 pf = p * frequency;
+	if (perlin) {
+		return glm::perlin(pf, glm::dvec3(frequency));
+	} else if (simplex) {
+		return glm::simplex(pf);
+	} else {
+		return hashNoise(pf);
+	}
+}
+
 /*
 * Biome Keys:
 * 0 = FlatLand (Grass)
@@ -225,25 +340,248 @@ float Planet::generateNoise(int i) {
 * 3 = Mountain
 */
 void Planet::generateTerrain() {
-	// Generate and apply noise to change terrain
-	modifiedVerticies.clear();
-	for (int i = 0; i < originalVerticies.size(); i++) {
-		modifiedVerticies.push_back(originalVerticies.at(i) * (glm::length(originalVerticies.at(i)) + generateNoise(i)));
+	octaveNoise.clear();
+	invalidate(STAGE_DISPLACEMENT);
+	updateTerrain();
+}
+
+void Planet::invalidate(TerrainStage stage) {
+	dirtyStages |= STAGE_INVALIDATES[stage];
+}
+
+/*
+* Runs the dirty stages in order. The compute shader does every stage after the topology
+* straight into the meshes, so on that path any change runs all of them, timed as the
+* displacement
+*/
+void Planet::updateTerrain() {
+	if (originalVerticies.empty()) {
+		invalidate(STAGE_TOPOLOGY);
 	}
-	// Use Vor Cells to generate biomes
-	voronoiCells();
-	// Set mesh
-	cgra::Matrix<double> vertices(modifiedVerticies.size(), 3);
-	for (int i = 0; i < modifiedVerticies.size(); i++) {
-		vertices.setRow(i, { modifiedVerticies.at(i)[0], modifiedVerticies.at(i)[1], modifiedVerticies.at(i)[2] });
+	if (dirtyStages) {
+		surfaceVersion++;
 	}
-	// Setup Triangles
-	cgra::Matrix<unsigned int> triangles(originalTriangles.size(), 3);
-	for (int i = 0; i < originalTriangles.size(); i++) {
-		triangles.setRow(i, { originalTriangles.at(i)[0], originalTriangles.at(i)[1], originalTriangles.at(i)[2] });
+	auto start = std::chrono::steady_clock::now();
+	auto finishStage = [&](TerrainStage stage) {
+		auto finished = std::chrono::steady_clock::now();
+		stageMs[stage] = std::chrono::duration<double, std::milli>(finished - start).count();
+		start = finished;
+		dirtyStages &= ~(1u << stage);
+	};
+	unsigned int ran = dirtyStages;
+	if (dirtyStages & (1u << STAGE_TOPOLOGY)) {
+		generateIcosahedron();
+		subdivideIcosahedron();
+		surfaceTriangles.reset();
+		finishStage(STAGE_TOPOLOGY);
+	}
+	if (!dirtyStages) return;
+
+	// The compute shader can't erode
+	if (this->terrainCompute && TerrainCompute::supported() && !erosion.enabled()) {
+		chunkedTerrain.reset();
+		this->terrainCompute->generate(*this);
+		buildSurfaceTree();
+		std::fill(stageMs + STAGE_DISPLACEMENT, stageMs + STAGE_COUNT, 0.0);
+		finishStage(STAGE_DISPLACEMENT);
+		dirtyStages = 0;
+		return;
+	}
+	// The GPU path leaves nothing on the CPU, so a stage that was skipped may need to run again
+	size_t n = originalVerticies.size();
+	if (modifiedVerticies.size() != n) {
+		invalidate(STAGE_DISPLACEMENT);
+	} else if (biomeMap.size() != n) {
+		invalidate(STAGE_BIOMES);
+	} else if (vertColours.size() != n) {
+		invalidate(STAGE_COLOURS);
+	}
+	ran |= dirtyStages;
+
+	// Any close-up terrain was built from the old settings
+	chunkedTerrain.reset();
+	if (dirtyStages & (1u << STAGE_DISPLACEMENT)) {
+		displaceTerrain();
+		buildSurfaceTree();
+		finishStage(STAGE_DISPLACEMENT);
+	}
+	if (dirtyStages & (1u << STAGE_BIOMES)) {
+		voronoiCells();
+		finishStage(STAGE_BIOMES);
+	}
+	if (dirtyStages & (1u << STAGE_COLOURS)) {
+		colourTerrain();
+		finishStage(STAGE_COLOURS);
+	}
+	if (dirtyStages & (1u << STAGE_NORMALS)) {
+		lodNormals.resize(lodAdjacency.size());
+		for (size_t level = 0; level < lodAdjacency.size(); level++) {
+			lodAdjacency[level]->normals(modifiedVerticies, lodNormals[level]);
+		}
+		finishStage(STAGE_NORMALS);
+	}
+	if (dirtyStages & (1u << STAGE_UPLOAD)) {
+		bool meshesBuilt = lodMeshes.size() + 1 == lodTriangles.size() && mesh.getVertexCount() == n;
+		if (!(ran & STAGE_GEOMETRY) && meshesBuilt) {
+			// Only the colours changed, each level uses a prefix of them
+			mesh.setColours(vertColours);
+			for (cgra::Mesh &lod : lodMeshes) {
+				lod.setColours(vertColours);
+			}
+		} else {
+			generateLodMeshes();
+		}
+		finishStage(STAGE_UPLOAD);
+	}
+}
+
+/*
+* Applies the noise to every vertex, then erodes them. Each octave is only sampled once for the
+* same topology, frequency and noise type, after that the amplitude and the number of octaves
+* just change how the kept octaves are summed. Summed the same way as fractalNoise, so both
+* give exactly the same heights
+*/
+void Planet::displaceTerrain() {
+	cgra::ThreadPool &pool = cgra::ThreadPool::shared();
+	int noiseType = this->perlin ? 0 : (this->simplex ? 1 : 2);
+	if (octaveFrequency != this->frequency || octaveNoiseType != noiseType) {
+		octaveNoise.clear();
+		octaveFrequency = this->frequency;
+		octaveNoiseType = noiseType;
+	}
+	size_t n = originalVerticies.size();
+	float freq = this->frequency;
+	for (int octs = 0; octs < this->octaves; octs++) {
+		if (octs >= (int)octaveNoise.size()) {
+			octaveNoise.emplace_back(n);
+			std::vector<float> &noise = octaveNoise.back();
+			pool.parallelFor(0, n, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++) {
+					noise[i] = noiseOctave(originalVerticies[i], freq, this->perlin, this->simplex);
+				}
+			}, VERTEX_CHUNK);
+		}
+		freq *= 2.0f;
+	}
+
+	modifiedVerticies.resize(n);
+	pool.parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			float sum = 0.0f;
+			float amp = this->amplitude;
+			for (int octs = 0; octs < this->octaves; octs++) {
+				float value = octaveNoise[octs][i];
+				if (noiseType != 2) {
+					value /= amp;
+				}
+				sum += value;
+				amp *= 2;
+			}
+			modifiedVerticies[i] = originalVerticies[i] * (glm::length(originalVerticies[i]) + sum);
+		}
+	}, VERTEX_CHUNK);
+	if (erosion.enabled()) {
+		erodeTerrain();
 	}
-	// Set Mesh
-	this->mesh.setData(vertices, triangles, this->vertColours);
+}
+
+/*
+* Weathers the displaced vertices, moving each one in or out along its direction from the centre
+*/
+void Planet::erodeTerrain() {
+	if (!erosionGraph || erosionGraph->size() != originalVerticies.size()) {
+		erosionGraph = std::make_shared<TerrainErosion>(originalVerticies, lodAdjacency.back());
+	}
+	std::vector<float> heights(modifiedVerticies.size());
+	for (size_t i = 0; i < heights.size(); i++) {
+		heights[i] = glm::length(modifiedVerticies[i]);
+	}
+	erosionGraph->erode(heights, erosion);
+	for (size_t i = 0; i < heights.size(); i++) {
+		modifiedVerticies[i] = glm::normalize(originalVerticies[i]) * heights[i];
+	}
+}
+
+/*
+* Builds a mesh for every subdivision level from the displaced vertices.
+* Vertices added at a level get the midpoint of their parents as a morph target, so they can
+* be blended in from the coarser level's shape instead of popping
+*/
+void Planet::generateLodMeshes() {
+	lodMeshes.clear();
+	boundingRadius = 0.0f;
+	for (const glm::vec3 &v : modifiedVerticies) {
+		boundingRadius = glm::max(boundingRadius, glm::length(v));
+	}
+	for (size_t level = 0; level < lodTriangles.size(); level++) {
+		unsigned int numVerts = lodVertexCounts.at(level);
+		unsigned int firstNew = (level == 0) ? numVerts : lodVertexCounts.at(level - 1);
+		cgra::Matrix<double> vertices(numVerts, 3);
+		std::vector<glm::vec3> morphTargets;
+		for (unsigned int i = 0; i < numVerts; i++) {
+			glm::vec3 v = modifiedVerticies.at(i);
+			vertices.setRow(i, { v.x, v.y, v.z });
+			if (i >= firstNew) {
+				glm::ivec2 parents = vertexParents.at(i);
+				morphTargets.push_back((modifiedVerticies.at(parents.x) + modifiedVerticies.at(parents.y)) * 0.5f);
+			} else {
+				morphTargets.push_back(v);
+			}
+		}
+		// Setup Triangles
+		const std::vector<std::vector<unsigned int>> &tris = lodTriangles.at(level);
+		cgra::Matrix<unsigned int> triangles(tris.size(), 3);
+		for (size_t i = 0; i < tris.size(); i++) {
+			triangles.setRow(i, { tris.at(i)[0], tris.at(i)[1], tris.at(i)[2] });
+		}
+		std::vector<glm::vec3> colours(vertColours.begin(), vertColours.begin() + numVerts);
+		// Worked out from the triangles by the mesh if the normals stage hasn't run
+		static const std::vector<glm::vec3> noNormals;
+		const std::vector<glm::vec3> &normals = (level < lodNormals.size() && lodNormals[level].size() == numVerts) ? lodNormals[level] : noNormals;
+		// The finest level is the planets main mesh
+		if (level + 1 == lodTriangles.size()) {
+			this->mesh.setData(vertices, triangles, colours, morphTargets, normals);
+		} else {
+			lodMeshes.emplace_back();
+			lodMeshes.back().setData(vertices, triangles, colours, morphTargets, normals);
+		}
+	}
+	currentLod = -1;
+}
+
+/*
+* Picks the level of detail from the planets projected radius in pixels.
+* A level is only left once the radius is past its threshold by the hysteresis margin, so planets
+* sitting on a boundary don't flicker. The morph factor runs from 1 where a level is switched in
+* down to 0 where the next level takes over, which hides the change
+*/
+void Planet::updateLod(float pixelRadius) {
+	int maxLod = lodMeshes.size();
+	if (currentLod < 0 || currentLod > maxLod) {
+		currentLod = maxLod;
+	}
+	while (currentLod < maxLod && pixelRadius >= lodThreshold(currentLod + 1) * (1.0f + LOD_HYSTERESIS)) {
+		currentLod++;
+	}
+	while (currentLod > 0 && pixelRadius < lodThreshold(currentLod) * (1.0f - LOD_HYSTERESIS)) {
+		currentLod--;
+	}
+	if (currentLod == 0) {
+		morphFactor = 0.0f;
+	} else {
+		float switchIn = lodThreshold(currentLod) * (1.0f + LOD_HYSTERESIS);
+		morphFactor = glm::clamp(2.0f - pixelRadius / switchIn, 0.0f, 1.0f);
+	}
+}
+
+/*
+* The mesh for the current level of detail
+*/
+cgra::Mesh &Planet::lodMesh() {
+	if (currentLod >= 0 && size_t(currentLod) < lodMeshes.size()) {
+		return lodMeshes.at(currentLod);
+	}
+	return mesh;
 }
 
 /*
@@ -252,41 +590,172 @@ void Planet::generateTerrain() {
 */
 void Planet::voronoiCells() {
 	// Determin which points are going to become main sites
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_int_distribution<> dis(0, this->modifiedVerticies.size()-1);
-	int numberOfSites = 5;
-	for (int i = 0; i < numberOfSites; i++) {
+	this->sites = chooseSites();
+	biomeMap.resize(this->modifiedVerticies.size());
+	cgra::ThreadPool::shared().parallelFor(0, biomeMap.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			// First we will check the height, if the height is less than 1.0f, it will be a sea tile regardless
+			// Get distance between center of planet and current vertex (vertices are relative to the planet)
+			float dis = glm::length(modifiedVerticies.at(i));
+			biomeMap[i] = dis <= 1.0f ? -1 : closestSite(originalVerticies.at(i), this->sites);
+		}
+	}, VERTEX_CHUNK);
+}
+
+/*
+* Colours each vertex from its biome, the sea colour then one per biome
+*/
+void Planet::colourTerrain() {
+	vertColours.resize(biomeMap.size());
+	for (size_t i = 0; i < biomeMap.size(); i++) {
+		vertColours[i] = this->cs1.at(biomeMap[i] + 1); // -1 for the 'Sea' color
+	}
+}
+
+/*
+* Picks random vertices, from the planets seed, to be the biome sites.
+* Sites are the displaced positions, so only the noise at those vertices is needed
+*/
+std::vector<glm::vec3> Planet::chooseSites() const {
+	std::mt19937 gen(this->seed);
+	std::uniform_int_distribution<> dis(0, this->originalVerticies.size()-1);
+	std::vector<glm::vec3> chosen;
+	for (int i = 0; i < this->numberOfSites; i++) {
 		// Decide on a random point
 		int vertToSite = dis(gen);
-		this->sites.push_back(this->modifiedVerticies.at(vertToSite));
+		chosen.push_back(surfacePoint(vertToSite));
 	}
-	vertColours.clear();
-	// Now
-	for (int i = 0; i < this->modifiedVerticies.size(); i++) {
-		float shortestDistance = FLT_MAX;
-		int ClosetBiomeNum;
-		// List of potential canidates
-		// If a point is an equal distance between multiple points, randomly decide on what it should be
-		for (int j = 0; j < this->sites.size(); j++) {
-			float dis = glm::distance(originalVerticies.at(i), this->sites.at(j));
-			if (dis <= shortestDistance) {
-				shortestDistance = dis;
-				ClosetBiomeNum = j;
-			}
+	return chosen;
+}
+
+/*
+* Index of the site nearest to a point. Ties go to the later site
+*/
+int Planet::closestSite(const glm::vec3 &p, const std::vector<glm::vec3> &sites) {
+	float shortestDistance = FLT_MAX;
+	int closest = 0;
+	for (int j = 0; j < sites.size(); j++) {
+		float dis = glm::distance(p, sites.at(j));
+		if (dis <= shortestDistance) {
+			shortestDistance = dis;
+			closest = j;
 		}
-		// First we will check the height, if the height is less than 1.0f, it will be a sea tile, so it will be blue regardless
-		// Get distance between center of planet and current vertex
-		float dis = glm::distance(modifiedVerticies.at(i), this->location);
-		//std::cout << dis << std::endl;
-		if (dis <= 1.0f) {
-			vertColours.push_back(this->cs1.at(0)); // 'Sea' color
-			biomeMap.push_back(-1);
-		} else {
-			vertColours.push_back(this->cs1.at(ClosetBiomeNum + 1));
-			biomeMap.push_back(ClosetBiomeNum);
+	}
+	return closest;
+}
+
+/*
+* Where a vertex ends up once the noise is applied
+*/
+glm::vec3 Planet::surfacePoint(size_t i) const {
+	if (i < this->modifiedVerticies.size()) {
+		return this->modifiedVerticies.at(i);
+	}
+	glm::vec3 v = this->originalVerticies.at(i);
+	return v * (glm::length(v) + generateNoise(v));
+}
+
+/*
+* Biome of a vertex, -1 for sea
+*/
+int Planet::surfaceBiome(size_t i) const {
+	if (i < this->biomeMap.size()) {
+		return this->biomeMap.at(i);
+	}
+	if (glm::length(surfacePoint(i)) <= 1.0f) {
+		return -1;
+	}
+	return closestSite(this->originalVerticies.at(i), this->sites);
+}
+
+/*
+* Starts building the picking tree over the finest level on the thread pool, working the
+* vertices out from the noise there if the CPU copies weren't kept. The build gets copies of
+* everything it uses, so the terrain can be edited again while it runs
+*/
+void Planet::buildSurfaceTree() {
+	this->surfaceTree.reset();
+	if (this->surfaceTreeSuperseded) {
+		*this->surfaceTreeSuperseded = true;
+	}
+	if (!this->surfaceTriangles) {
+		this->surfaceTriangles = std::make_shared<const std::vector<std::vector<unsigned int>>>(this->originalTriangles);
+	}
+	bool displaced = this->modifiedVerticies.size() == this->originalVerticies.size();
+	std::vector<glm::vec3> vertices = displaced ? this->modifiedVerticies : this->originalVerticies;
+	TerrainSettings settings = terrainSettings();
+	std::shared_ptr<const std::vector<std::vector<unsigned int>>> triangles = this->surfaceTriangles;
+	std::shared_ptr<std::atomic<bool>> superseded = std::make_shared<std::atomic<bool>>(false);
+	this->surfaceTreeSuperseded = superseded;
+
+	auto promise = std::make_shared<std::promise<std::shared_ptr<TriangleBVH>>>();
+	this->surfaceTreeBuilding = promise->get_future().share();
+	cgra::ThreadPool &pool = cgra::ThreadPool::shared();
+	pool.submit([=, &pool]() mutable {
+		try {
+			if (*superseded) {
+				promise->set_value(nullptr);
+				return;
+			}
+			if (!displaced) {
+				pool.parallelFor(0, vertices.size(), [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++) {
+						glm::vec3 v = vertices[i];
+						vertices[i] = v * (glm::length(v) + fractalNoise(v, settings.octaves, settings.frequency, settings.amplitude, settings.perlin, settings.simplex));
+					}
+				}, VERTEX_CHUNK);
+			}
+			promise->set_value(std::make_shared<TriangleBVH>(vertices, *triangles));
+		} catch (...) {
+			promise->set_exception(std::current_exception());
 		}
+	});
+}
+
+/*
+* First point on the surface along a ray, with the triangle and biome there
+*/
+Planet::SurfaceHit Planet::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) {
+	if (this->surfaceTreeBuilding.valid()) {
+		// Usually finished long before anything is picked
+		this->surfaceTree = this->surfaceTreeBuilding.get();
+		this->surfaceTreeBuilding = std::shared_future<std::shared_ptr<TriangleBVH>>();
+	}
+	if (!this->surfaceTree) {
+		// Never built, or given up on because a copy of this planet started a newer one
+		buildSurfaceTree();
+		this->surfaceTree = this->surfaceTreeBuilding.get();
+		this->surfaceTreeBuilding = std::shared_future<std::shared_ptr<TriangleBVH>>();
 	}
+	SurfaceHit result;
+	TriangleBVH::Hit hit = this->surfaceTree->intersect(origin, direction, maxDistance);
+	if (hit.triangle < 0) {
+		return result;
+	}
+	result.triangle = hit.triangle;
+	result.distance = hit.distance;
+	result.point = origin + direction * hit.distance;
+	// The corner with the most weight at the hit
+	const std::vector<unsigned int> &t = this->originalTriangles.at(hit.triangle);
+	float w0 = 1.0f - hit.u - hit.v;
+	int corner = w0 >= hit.u && w0 >= hit.v ? 0 : (hit.u >= hit.v ? 1 : 2);
+	result.biome = surfaceBiome(t[corner]);
+	return result;
+}
+
+/*
+* Snapshot of the current terrain parameters
+*/
+TerrainSettings Planet::terrainSettings() const {
+	TerrainSettings settings;
+	settings.octaves = this->octaves;
+	settings.frequency = this->frequency;
+	settings.amplitude = this->amplitude;
+	settings.perlin = this->perlin;
+	settings.simplex = this->simplex;
+	settings.sites = this->sites;
+	settings.colours = this->cs1;
+	return settings;
 }
 
 /*
@@ -308,8 +777,8 @@ void Planet::generateMoon() {
 	for (int i = 0; i < moonTriangles.size(); i++) {
 		mT.setRow(i, { moonTriangles.at(i)[0], moonTriangles.at(i)[1], moonTriangles.at(i)[2] });
 	}
-	// Set Mesh
-	this->moonMesh.setData(mV, mT, vC);
+	// Set Mesh, every moon is the same so they all share one
+	this->moonMesh = cgra::MeshRegistry::shared().fromData(mV, mT, vC);
 }
 
 /*
@@ -317,34 +786,13 @@ void Planet::generateMoon() {
 */
 void Planet::generateRings() {
 	this->hasRing = true;
-	cgra::Mesh m_mesh;
-	cgra::Wavefront obj;
 	// Wrap the loading in a try..catch block
 	try {
-		obj = cgra::Wavefront::load("work/res/Ring.obj");
+		// Loaded once, then shared by every planet with a ring
+		this->ringMesh = cgra::MeshRegistry::shared().loadObj(CGRA_SRCDIR "/res/Ring.obj", glm::vec3(1.0f, 0.0f, 1.0f));
 	}
 	catch (std::exception e) {
 		std::cerr << "Couldn't load file: '" << e.what() << "'" << std::endl;
+		this->hasRing = false;
 	}
-	// The mesh data
-	 // Replace these with appropriate values
-	unsigned int numVertices = obj.m_positions.size();
-	unsigned int numTriangles = obj.m_faces.size();
-
-	cgra::Matrix<double> vertices(numVertices, 3);
-	cgra::Matrix<unsigned int> triangles(numTriangles, 3);
-	std::vector<glm::vec3> vC;
-	for (size_t i = 0; i < obj.m_positions.size(); i++) {
-		// Add each position to the vertices matrix
-		vertices.setRow(i, { obj.m_positions[i][0],  obj.m_positions[i][1],  obj.m_positions[i][2] });
-		vC.push_back(glm::vec3(1.0f, 0.0f, 1.0f));
-	}
-
-	for (unsigned int i = 0; i < obj.m_faces.size(); i++) {
-		// Add each triangle's indices to the triangles matrix
-		// Remember that Wavefront files use indices that start at 1
-		std::vector<cgra::Wavefront::Vertex> theVertices = obj.m_faces[i].m_vertices;
-		triangles.setRow(i, { theVertices[0].m_p - 1, theVertices[1].m_p - 1, theVertices[2].m_p - 1 });
-	}
-	m_mesh.setData(vertices, triangles, vC);
 }
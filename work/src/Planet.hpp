@@ -4,20 +4,45 @@
 
 
 #include "cgra/mesh.hpp"
+#include "cgra/meshadjacency.hpp"
+#include "cgra/meshregistry.hpp"
 #include "cgra/shader.hpp"
 
 #include "cgra/matrix.hpp"
 #include "glm/glm.hpp"
 #include "glm/gtc/noise.hpp"
 
+#include "TerrainErosion.hpp"
+#include "TriangleBVH.hpp"
+
+#include <atomic>
+#include <future>
 #include <map>
+#include <memory>
 
 using namespace std;
 
+class ChunkedTerrain;
+class TerrainCompute;
+
 struct PlanetInfo {
 	glm::vec3 location;
 	std::vector<glm::vec3> colorSet1;
 	float rotationSpeed;
+	// For the same planet every time, 0 picks a new one
+	unsigned int seed = 0;
+	TerrainErosion::Settings erosion;
+};
+
+// A copy of everything that decides a planets surface, so terrain can be built away from the planet
+// (and off the main thread)
+struct TerrainSettings {
+	int octaves = 4;
+	float frequency = 1;
+	float amplitude = 2;
+	bool perlin = true, simplex = false;
+	std::vector<glm::vec3> sites; // Biome sites
+	std::vector<glm::vec3> colours; // Sea colour, then one per biome
 };
 
 class Planet {
@@ -34,8 +59,9 @@ public:
 	float rotationSpeed = 2.0f;
 
 	cgra::Mesh mesh;
-	cgra::Mesh moonMesh;
-	cgra::Mesh ringMesh;
+	// Shared with every other planet through the mesh registry
+	cgra::MeshRegistry::Handle moonMesh;
+	cgra::MeshRegistry::Handle ringMesh;
 
 	// Original
 	std::vector<glm::vec3> originalVerticies;
@@ -48,8 +74,24 @@ public:
 
 	// Sites used for voronoi
 	std::vector<glm::vec3> sites;
-
-	std::map<int, int> midPoints;
+	int numberOfSites = 5; // Needs a colour for each, after the sea colour
+
+	// Keyed on both parents, the smaller in the top half
+	std::map<uint64_t, int> midPoints;
+	// The two vertices each midpoint was created from, (-1, -1) for the base icosahedron
+	std::vector<glm::ivec2> vertexParents;
+
+	// Level of detail
+	// Subdivision only ever appends vertices, so every level uses a prefix of the vertex list
+	std::vector<std::vector<std::vector<unsigned int>>> lodTriangles; // Triangles for each level
+	std::vector<unsigned int> lodVertexCounts; // Vertices used by each level
+	// Neighbours and triangles round each vertex of each level, made as the level is subdivided.
+	// Shared so the stages working over a level can hold on to it
+	std::vector<std::shared_ptr<const cgra::MeshAdjacency>> lodAdjacency;
+	std::vector<cgra::Mesh> lodMeshes; // Meshes for the levels below `subdivisions`, `mesh` is the finest
+	int currentLod = -1;
+	float morphFactor = 0.0f;
+	float boundingRadius = 1.0f; // Furthest displaced vertex from the centre
 	std::vector<glm::vec3> vertColours; // Current colors for each vertex
 
 	std::string name;
@@ -66,24 +108,113 @@ public:
 	float frequency = 1;
 	float amplitude = 2;
 
+	// Weathering of the noise, done on the CPU. It works along the finest level's adjacency,
+	// and is kept until the planet is subdivided again
+	TerrainErosion::Settings erosion;
+	std::shared_ptr<TerrainErosion> erosionGraph;
+
 	double timeTaken;
+	// Picks the biome sites (and anything else random about the surface), so the same seed
+	// and settings always give the same planet
+	unsigned int seed = 0;
 
 	//TREE STUFF
 	int amtTrees;
 	default_random_engine randGen = default_random_engine(std::chrono::system_clock::now().time_since_epoch().count());
 	std::vector<int> treeVerts;
 
+	// The surface is built in stages, each working from what the stages before it kept.
+	// Changing a setting only needs the first stage that reads it marked dirty, updateTerrain()
+	// then runs that stage and the stages that depend on it:
+	//   topology     - subdivisions
+	//   displacement - amplitude, octaves, frequency, noise type, erosion
+	//   biomes       - seed, number of sites
+	//   colours      - cs1
+	//   normals      - (only the displacement)
+	//   upload       - recolours the meshes in place when only the colours changed
+	enum TerrainStage {
+		STAGE_TOPOLOGY,
+		STAGE_DISPLACEMENT,
+		STAGE_BIOMES,
+		STAGE_COLOURS,
+		STAGE_NORMALS,
+		STAGE_UPLOAD,
+		STAGE_COUNT
+	};
+	unsigned int dirtyStages = (1u << STAGE_COUNT) - 1; // A bit for each stage
+	double stageMs[STAGE_COUNT] = {}; // How long each stage took the last time it ran
+	unsigned int surfaceVersion = 0; // Goes up whenever updateTerrain changes the meshes
+
+	// Raw noise of each octave at every vertex, before the amplitude scales it. Kept while the
+	// topology, frequency and noise type stay the same, so the amplitude and number of octaves
+	// can change without sampling any noise again
+	std::vector<std::vector<float>> octaveNoise;
+	float octaveFrequency = 0.0f;
+	int octaveNoiseType = -1;
+	// Area weighted normals of each level, gathered round its adjacency
+	std::vector<std::vector<glm::vec3>> lodNormals;
+	int topologySubdivisions = -1; // What the current topology was subdivided to
+
 	// Methods
-	void generatePlanet();
+	void generatePlanet(unsigned int seed = 0); // A new seed if it's 0
 	void generateIcosahedron();
 	void subdivideIcosahedron();
 	int getMidPoint(int a, int b);
-	void generateTerrain();
+	void generateTerrain(); // Every stage after the topology, sampling the noise again
+	void invalidate(TerrainStage stage); // Marks the stage and every stage that depends on it
+	void updateTerrain(); // Runs the dirty stages
+	void displaceTerrain();
+	void erodeTerrain();
 	void generateMoon();
 	void generateRings();
 	void voronoiCells();
+	void colourTerrain();
+	std::vector<glm::vec3> chooseSites() const;
+	void generateLodMeshes();
+	void updateLod(float pixelRadius);
+	cgra::Mesh &lodMesh();
 
 	// Noise
 	float generateNoise(int i);
+	float generateNoise(const glm::vec3 &p) const;
+	static float fractalNoise(const glm::vec3 &p, int octaves, float frequency, float amplitude, bool perlin, bool simplex);
+	static float noiseOctave(const glm::vec3 &p, float frequency, bool perlin, bool simplex);
+	// The same in double precision, for close-up surfaces whose high octaves floats can't place
+	static double fractalNoise(const glm::dvec3 &p, int octaves, double frequency, double amplitude, bool perlin, bool simplex);
+	static double noiseOctave(const glm::dvec3 &p, double frequency, bool perlin, bool simplex);
+	static int closestSite(const glm::vec3 &p, const std::vector<glm::vec3> &sites);
+
+	// Displaced position and biome of a vertex, worked out from the noise if the CPU copies
+	// weren't kept (the GPU path doesn't keep them)
+	glm::vec3 surfacePoint(size_t i) const;
+	int surfaceBiome(size_t i) const;
+
+	// When set and supported, generateTerrain runs on the GPU instead
+	std::shared_ptr<TerrainCompute> terrainCompute;
+
+	// Surface detail for when the camera is close, built on demand
+	std::shared_ptr<ChunkedTerrain> chunkedTerrain;
+	TerrainSettings terrainSettings() const;
+
+	// The finest triangles where the noise put them, for picking. Built on the thread pool each
+	// time the displacement runs, as it takes longer than the rest of an edit, and a ray that
+	// comes before the build is done waits for it
+	std::shared_ptr<TriangleBVH> surfaceTree;
+	std::shared_future<std::shared_ptr<TriangleBVH>> surfaceTreeBuilding;
+	// Set to give up on a build that hasn't started yet, as a newer one replaces it
+	std::shared_ptr<std::atomic<bool>> surfaceTreeSuperseded;
+	// Copy of the triangles for the builds, made again when the topology changes
+	std::shared_ptr<const std::vector<std::vector<unsigned int>>> surfaceTriangles;
+	void buildSurfaceTree();
+
+	// What a ray first hits on the surface
+	struct SurfaceHit {
+		int triangle = -1; // In originalTriangles, -1 for a miss
+		float distance = 0.0f; // Along the ray, in lengths of its direction
+		glm::vec3 point = glm::vec3(0.0f);
+		int biome = -1; // Of the corner nearest the hit, -1 for sea
+	};
+	// `origin` and `direction` are in the planets own space, before its scale
+	SurfaceHit raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance = std::numeric_limits<float>::infinity());
 
 };
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "SimulationThread.hpp"
+
+const double SimulationThread::MAX_LAG = 0.25;
+
+SimulationThread::SimulationThread(float step) : m_step(step), m_checkpoints(CHECKPOINT_COUNT), m_interrupt(false) {}
+
+SimulationThread::~SimulationThread() {
+	stop();
+}
+
+void SimulationThread::start(const StepFunction &stepFunction, const std::vector<Body> &bodies, double time,
+	const SaveFunction &save, const RestoreFunction &restore) {
+	stop();
+	m_stepFunction = stepFunction;
+	m_save = save;
+	m_restore = restore;
+	m_stopping = false;
+	m_jumping = false;
+	m_interrupt = false;
+	m_target = time;
+	m_publishedFrom = time;
+	m_publishedTime = time;
+
+	// Published from here before the thread exists, so there's always something to draw
+	Snapshot &first = m_snapshots.writeBuffer();
+	first.previousTime = first.time = time;
+	first.previous = first.current = bodies;
+	first.steps = 0;
+	first.stepMs = 0.0;
+	m_snapshots.publish();
+	m_snapshots.update();
+
+	m_checkpoints.clear(m_checkpointCount);
+	m_nextCheckpoint = 0;
+	saveCheckpoint(bodies, time);
+
+	m_thread = std::thread(&SimulationThread::run, this, bodies, time);
+}
+
+void SimulationThread::stop() {
+	if (!m_thread.joinable()) return;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+		m_interrupt = true;
+	}
+	m_wake.notify_all();
+	m_thread.join();
+}
+
+void SimulationThread::setCheckpoints(int interval, size_t count) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_checkpointInterval = std::max(interval, 1);
+	m_checkpointCount = std::max<size_t>(count, 1);
+}
+
+void SimulationThread::setMaxLag(double seconds) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_maxLag = seconds;
+}
+
+void SimulationThread::advanceTo(double time) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_target = std::max(m_target, time);
+	}
+	m_wake.notify_one();
+}
+
+double SimulationThread::jumpTo(double time) {
+	double checkpointTime;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!running() || m_checkpoints.empty()) {
+			return time;
+		}
+		// The newest checkpoint at or before `time`, they're in order of time
+		size_t first = 0, last = m_checkpoints.size();
+		while (last - first > 1) {
+			size_t middle = (first + last) / 2;
+			if (m_checkpoints[middle].time <= time) {
+				first = middle;
+			}
+			else {
+				last = middle;
+			}
+		}
+		const Checkpoint &checkpoint = m_checkpoints[first];
+		if (time >= m_publishedFrom && checkpoint.time <= m_publishedTime) {
+			return time;
+		}
+		m_jump = checkpoint;
+		m_nextCheckpoint = first + 1;
+		m_jumping = true;
+		m_interrupt = true;
+		m_target = std::max(time, m_jump.time);
+		m_publishedFrom = m_publishedTime = checkpointTime = m_jump.time;
+	}
+	m_wake.notify_one();
+	return checkpointTime;
+}
+
+double SimulationThread::earliestCheckpoint() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_checkpoints.empty() ? -INFINITY : m_checkpoints.front().time;
+}
+
+size_t SimulationThread::checkpoints() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_checkpoints.size();
+}
+
+void SimulationThread::saveCheckpoint(const std::vector<Body> &bodies, double time) {
+	if (m_nextCheckpoint < m_checkpoints.size() && std::abs(m_checkpoints[m_nextCheckpoint].time - time) > m_step * 0.5) {
+		// Time was skipped since the jump back, so the rest are from a different run
+		while (m_checkpoints.size() > m_nextCheckpoint) {
+			m_checkpoints.popBack();
+		}
+	}
+	if (m_nextCheckpoint == m_checkpoints.size()) {
+		m_checkpoints.push();
+		m_nextCheckpoint = m_checkpoints.size();
+	}
+	else {
+		m_nextCheckpoint++;
+	}
+	Checkpoint &checkpoint = m_checkpoints[m_nextCheckpoint - 1];
+	checkpoint.time = time;
+	checkpoint.bodies = bodies;
+	checkpoint.state.clear();
+	if (m_save) {
+		m_save(checkpoint.state);
+	}
+}
+
+void SimulationThread::interpolate(double time, std::vector<Body> &bodies, bool wait) {
+	if (wait && running()) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_published.wait(lock, [&] { return m_publishedTime >= std::min(time, m_target); });
+	}
+	m_snapshots.update();
+	const Snapshot &snapshot = m_snapshots.readBuffer();
+
+	float t = 1.0f;
+	if (snapshot.time > snapshot.previousTime) {
+		t = float(glm::clamp((time - snapshot.previousTime) / (snapshot.time - snapshot.previousTime), 0.0, 1.0));
+	}
+	bodies.resize(snapshot.current.size());
+	for (size_t i = 0; i < bodies.size(); i++) {
+		const Body &a = snapshot.previous[i], &b = snapshot.current[i];
+		bodies[i].position = glm::mix(a.position, b.position, t);
+		bodies[i].angle = glm::mix(a.angle, b.angle, t);
+	}
+}
+
+void SimulationThread::run(std::vector<Body> bodies, double time) {
+	uint64_t steps = 0;
+	int sinceCheckpoint = 0;
+	std::vector<Body> previous = bodies;
+	double previousTime = time;
+	// Time is never skipped before here, so a jump steps all the way on to where it was sent
+	double catchUpTo = time;
+	while (true) {
+		double target, maxLag;
+		int interval;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stopping || m_jumping || time < m_target; });
+			if (m_stopping) return;
+			if (m_jumping) {
+				m_jumping = false;
+				m_interrupt = false;
+				bodies = m_jump.bodies;
+				time = m_jump.time;
+				if (m_restore) {
+					m_restore(bodies, m_jump.state);
+				}
+				previous = bodies;
+				previousTime = time;
+				sinceCheckpoint = 0;
+				catchUpTo = m_target;
+
+				// Something to draw at the checkpoint until the steps after it arrive
+				Snapshot &snapshot = m_snapshots.writeBuffer();
+				snapshot.previousTime = snapshot.time = time;
+				snapshot.previous = snapshot.current = bodies;
+				snapshot.steps = steps;
+				snapshot.stepMs = 0.0;
+				m_snapshots.publish();
+			}
+			target = m_target;
+			maxLag = m_maxLag;
+			interval = m_checkpointInterval;
+		}
+		// Too far behind to catch up, lose the time rather than fall further back
+		if (time >= catchUpTo && target - time > maxLag) {
+			time = target - maxLag;
+		}
+
+		// Steps until it's at or just past the target, so the target is between the last two
+		while (time < target && !m_interrupt) {
+			auto start = std::chrono::steady_clock::now();
+			previous = bodies;
+			previousTime = time;
+			m_stepFunction(time, m_step, bodies);
+			time += m_step;
+			steps++;
+
+			if (++sinceCheckpoint >= interval) {
+				sinceCheckpoint = 0;
+				std::lock_guard<std::mutex> lock(m_mutex);
+				saveCheckpoint(bodies, time);
+			}
+
+			Snapshot &snapshot = m_snapshots.writeBuffer();
+			snapshot.previousTime = previousTime;
+			snapshot.time = time;
+			snapshot.previous = previous;
+			snapshot.current = bodies;
+			snapshot.steps = steps;
+			snapshot.stepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			m_snapshots.publish();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			// A jump already says where the simulation has got to
+			if (!m_jumping) {
+				m_publishedFrom = previousTime;
+				m_publishedTime = time;
+			}
+		}
+		m_published.notify_all();
+	}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "cgra/ringbuffer.hpp"
+#include "cgra/triplebuffer.hpp"
+
+// Moves the solar system on in fixed steps on a thread of its own, so a slow step never holds
+// up a frame and a slow frame never changes what the simulation does. The renderer says how far
+// the simulation should have got each frame. Every step is handed back through a triple buffer,
+// along with the step before it, so the renderer can place each body between the two.
+// Every so many steps the bodies and whatever else the step function keeps are saved as a
+// checkpoint, in a ring buffer of the most recent ones. Sending the simulation to another time
+// restores the checkpoint before it and steps forward from there. Checkpoints past where it
+// went are kept, since it steps through the same states again, so it can jump forward to them
+// as well as back.
+class SimulationThread {
+public:
+	// Where a body is, and how far round its fixed orbit it has turned
+	struct Body {
+		glm::vec3 position;
+		float angle;
+	};
+
+	// Two steps in a row, as published by the simulation
+	struct Snapshot {
+		double previousTime = 0.0;
+		double time = 0.0;
+		std::vector<Body> previous;
+		std::vector<Body> current;
+		// Steps taken so far, and how long the last one took
+		uint64_t steps = 0;
+		double stepMs = 0.0;
+	};
+
+	// Moves `bodies` on by `dt` from `time`. Called on the simulation thread
+	typedef std::function<void(double time, float dt, std::vector<Body> &bodies)> StepFunction;
+	// Write out whatever the step function keeps between steps besides the bodies, and put it
+	// back along with the bodies. Called on the simulation thread, or before it starts
+	typedef std::function<void(std::vector<float> &state)> SaveFunction;
+	typedef std::function<void(const std::vector<Body> &bodies, const std::vector<float> &state)> RestoreFunction;
+
+	// A step the simulation can be sent back to
+	struct Checkpoint {
+		double time = 0.0;
+		std::vector<Body> bodies;
+		std::vector<float> state;
+	};
+
+	// Unless set otherwise the simulation never lags further than this behind, it skips
+	// ahead instead
+	static const double MAX_LAG;
+	// Steps between checkpoints, and how many are kept, unless set otherwise
+	static const int CHECKPOINT_INTERVAL = 120;
+	static const size_t CHECKPOINT_COUNT = 3600;
+
+	explicit SimulationThread(float step);
+	~SimulationThread();
+
+	SimulationThread(const SimulationThread &) = delete;
+	SimulationThread & operator=(const SimulationThread &) = delete;
+
+	// Starts stepping `bodies` from `time`, stopping whatever was running before and forgetting
+	// its checkpoints. Without `save` and `restore` the bodies are all a checkpoint keeps
+	void start(const StepFunction &stepFunction, const std::vector<Body> &bodies, double time,
+		const SaveFunction &save = SaveFunction(), const RestoreFunction &restore = RestoreFunction());
+	void stop();
+	bool running() const { return m_thread.joinable(); }
+
+	float step() const { return m_step; }
+
+	// How often checkpoints are saved, from the next start(), and how many are kept
+	void setCheckpoints(int interval, size_t count);
+	void setMaxLag(double seconds);
+
+	// Lets the simulation run on until it reaches `time`
+	void advanceTo(double time);
+
+	// Sends the simulation to the newest checkpoint at or before `time` (or the oldest there
+	// is) to run on from there, if it has already published steps past `time` or the checkpoint
+	// is ahead of it. Returns the time of the checkpoint, or `time` if it didn't jump
+	double jumpTo(double time);
+	// Time of the oldest checkpoint, as far back as jumpTo() can go
+	double earliestCheckpoint();
+	size_t checkpoints();
+
+	// Bodies at `time`, between the last two steps the simulation has published. If the
+	// simulation hasn't got that far yet, the newest it has, unless `wait` is set.
+	// The newest snapshot is picked up first, so it's also what latest() returns after
+	void interpolate(double time, std::vector<Body> &bodies, bool wait = false);
+	const Snapshot &latest() const { return m_snapshots.readBuffer(); }
+
+private:
+	float m_step;
+	StepFunction m_stepFunction;
+	cgra::TripleBuffer<Snapshot> m_snapshots;
+	std::thread m_thread;
+
+	SaveFunction m_save;
+	RestoreFunction m_restore;
+
+	// Guards the target, stopping, jumping and the checkpoints, and the waits on them.
+	// Snapshots don't need it
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_published;
+	double m_target = 0.0;
+	double m_maxLag = MAX_LAG;
+	int m_checkpointInterval = CHECKPOINT_INTERVAL;
+	size_t m_checkpointCount = CHECKPOINT_COUNT;
+	// The last two steps published before the simulation stopped to wait
+	double m_publishedFrom = 0.0;
+	double m_publishedTime = 0.0;
+	bool m_stopping = false;
+	cgra::RingBuffer<Checkpoint> m_checkpoints;
+	// Where the next checkpoint the simulation saves goes. Below the count after a jump back
+	size_t m_nextCheckpoint = 0;
+	// Where jumpTo() is sending the simulation, while m_jumping is set
+	Checkpoint m_jump;
+	bool m_jumping = false;
+	// Set with m_stopping or m_jumping, so a long run of steps stops early
+	std::atomic<bool> m_interrupt;
+
+	void run(std::vector<Body> bodies, double time);
+	// Saves a checkpoint of `bodies` at `time`, with m_mutex held. One already there for the
+	// same time is written over, any others after it are dropped
+	void saveCheckpoint(const std::vector<Body> &bodies, double time);
+};
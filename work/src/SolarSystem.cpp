@@ -1,16 +1,25 @@
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <random>
 #include <stdexcept>
 
 #include "opengl.hpp"
 #include "imgui.h"
 
 #include "cgra/matrix.hpp"
+#include "cgra/programcache.hpp"
+#include "cgra/threadpool.hpp"
 #include "cgra/wavefront.hpp"
 
 #include "SolarSystem.hpp"
 #include "Planet.hpp"
+#include "ChunkedTerrain.hpp"
+#include "LightClusters.hpp"
+#include "TerrainCompute.hpp"
+#include "InputRecording.hpp"
 
 
 #include "GLFW/glfw3.h"
@@ -18,32 +27,67 @@
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtx/euler_angles.hpp"
 
+#ifndef CGRA_TEXTURE_DIR
+#define CGRA_TEXTURE_DIR ""
+#endif
+
+// Texture unit the transforms of each frame are bound to, after the light buffers
+static const GLuint TRANSFORM_TEXTURE_UNIT = 6;
+// Texture unit the impostor atlas is drawn from
+static const GLuint IMPOSTOR_TEXTURE_UNIT = 7;
+
+// Mass of the sun for the physical orbits. With G = 1 this gives the closest planet
+// spot about the same speed as its fixed orbit
+static const float SUN_MASS = 125.0f;
+// Planet mass for each unit of scale cubed, as a fraction of the sun
+static const float PLANET_MASS = 1e-3f;
+
 void SolarSystem::init() {
+	// Start decoding the leaves first, it happens while everything else is set up.
+	// texbake makes the baked copy at build time, the PNGs are the fallback
+	std::string bakedLeaves = CGRA_TEXTURE_DIR;
+	leafTexturesLoading = cgra::TextureLayers::loadAsync(CGRA_SRCDIR "/res/Textures/leaves.txt",
+		bakedLeaves.empty() ? bakedLeaves : bakedLeaves + "/leaves.ctex");
+
     // Load the shader program
     // The use of CGRA_SRCDIR "/path/to/shader" is so you don't
     // have to run the program from a specific folder.
-    m_program = cgra::Program::load_program(
-        CGRA_SRCDIR "/res/shaders/simple.vs.glsl",
-        CGRA_SRCDIR "/res/shaders/volume.fs.glsl");
+    // Both programs are loaded together so they can compile side by side,
+    // and come from the program cache after the first run.
+    std::vector<cgra::Program> programs = cgra::Program::load_programs({
+        { CGRA_SRCDIR "/res/shaders/simple.vs.glsl", CGRA_SRCDIR "/res/shaders/volume.fs.glsl" },
+        { CGRA_SRCDIR "/res/shaders/Billboard.vs.glsl", CGRA_SRCDIR "/res/shaders/Billboard.fs.glsl" },
+        { CGRA_SRCDIR "/res/shaders/asteroid.vs.glsl", CGRA_SRCDIR "/res/shaders/asteroid.fs.glsl" },
+        { CGRA_SRCDIR "/res/shaders/star.vs.glsl", CGRA_SRCDIR "/res/shaders/star.fs.glsl" },
+        { CGRA_SRCDIR "/res/shaders/impostor.vs.glsl", CGRA_SRCDIR "/res/shaders/impostor.fs.glsl" } });
+    m_program = programs[0];
+    billBoardShader = programs[1];
+    asteroidShader = programs[2];
+    starShader = programs[3];
+    impostorShader = programs[4];
+    const cgra::ProgramCache::Stats &cacheStats = cgra::ProgramCache::shared().stats();
+    std::cout << "Loaded shaders in " << cacheStats.milliseconds << " ms (" << cacheStats.hits << " cached, "
+        << cacheStats.misses << " compiled)" << std::endl;
 
 	m_lightScene = LightScene(m_program);
 	m_lightScene.init();
+	m_program.setTransforms(TRANSFORM_TEXTURE_UNIT);
 
+	if (this->seed) {
+		srand(this->seed);
+	}
 	generateLights();
 
 
     // Create a view matrix that positions the camera
     // 10 units behind the object
     viewMatrix[3] = glm::vec4(0, 0, -9, 1);
-	m_program.setViewerPosition(glm::vec3(0, 0, -9));
+	m_lightScene.setViewerPosition(glm::vec3(0, 0, -9));
     m_program.setViewMatrix(viewMatrix);
 	glm::vec3 rotation(1.0f, 1.0f, 0.0f);
 	m_rotationMatrix = glm::mat4(1.0f);// glm::rotate(glm::mat4(1.0f), 45.0f, glm::vec3(rotation[0], rotation[1], rotation[2]));
 
 	//TREESTUFF
-	billBoardShader = cgra::Program::load_program(
-		CGRA_SRCDIR "/res/shaders/Billboard.vs.glsl",
-		CGRA_SRCDIR "/res/shaders/Billboard.fs.glsl");
 	generateCylinder();
 	billBoardShader.setViewMatrix(viewMatrix);
 
@@ -63,7 +107,10 @@ void SolarSystem::init() {
 	jungleTrees.readRules(CGRA_SRCDIR "/res/TreeFiles/Tree5.txt");
 	urbanTrees.readRules(CGRA_SRCDIR "/res/TreeFiles/Tree4.txt");
 
-	billBoardShader.specifyLeafTexture(CGRA_SRCDIR "/res/Textures/leaves.png");
+	// Planets can be generated on the GPU if it's new enough
+	if (TerrainCompute::supported()) {
+		m_terrainCompute = std::make_shared<TerrainCompute>();
+	}
 
 	// Create the sun
 	generateSun();
@@ -82,11 +129,19 @@ void::SolarSystem::generateLights() {
 	PointLight p4 = PointLight(glm::vec3(0, 1, 1), 20, glm::vec3(10, -10, 9));
 	PointLight p5 = PointLight(glm::vec3(1, 1, 1), 20, glm::vec3(-13, 6, 12));
 	PointLight p6 = PointLight(glm::vec3(0, .5, .5), 20, glm::vec3(9, 9, -8));
-	PointLight pLights[] = { p, p2, p3, p4, p5, p6 };
+	std::vector<PointLight> pLights = { p, p2, p3, p4, p5, p6 };
+
+	// Small lights scattered through the scene, like city lights or ships.
+	// Each only reaches a few clusters, so there can be lots of them
+	for (int i = 0; i < this->extraLights; i++) {
+		glm::vec3 colour = glm::vec3(rand() % 100, rand() % 100, rand() % 100) / 100.0f;
+		glm::vec3 pos = glm::vec3(rand() % 90 - 45, rand() % 90 - 45, rand() % 90 - 45);
+		pLights.push_back(PointLight(colour, 0.05f + (rand() % 100) / 400.0f, pos));
+	}
 
 	DirectionalLight d = DirectionalLight(glm::vec3(0.25, 0.25, -1));
 
-	m_lightScene.setPointLights(6, &pLights[0]);
+	m_lightScene.setPointLights((unsigned int)pLights.size(), pLights.data());
 
 	m_lightScene.setDirectionalLight(d);
 }
@@ -100,7 +155,7 @@ void SolarSystem::generateSun() {
 }
 
 void SolarSystem::generateSystem() {
-	double startTime = glfwGetTime();
+	auto startTime = std::chrono::steady_clock::now();
 	planets.clear();
 	std::vector<PlanetInfo> temp = this->planetSpots;
 	// Generate Planets
@@ -108,11 +163,17 @@ void SolarSystem::generateSystem() {
 		int spot = rand() % temp.size();
 		PlanetInfo pi = temp.at(spot);
 		temp.erase(temp.begin() + spot);
+		if (this->seed) {
+			pi.seed = this->seed + i;
+		}
+		pi.erosion = this->erosion;
 		Planet p = Planet(pi, i, this->octaves, this->freq, this->amp, this->subs);
 		p.name = std::to_string(i);
 		planets.push_back(p);
 	}
-	this->timeTaken = glfwGetTime() - startTime;
+	// The old bodies are for the old planets
+	restartSimulation();
+	this->timeTaken = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
 }
 
 /*
@@ -174,7 +235,7 @@ void SolarSystem::generatePlanetSpots() {
 	));
 }
 
-void::SolarSystem::generateTree(LSystem LS, mat4 transMat, vec3 startPos, float length, float trunkSize, int &index) {
+void::SolarSystem::generateTree(LSystem LS, mat4 transMat, vec3 startPos, float length, float trunkSize, int leafLayer, int &index) {
 	float  angle = LS.angle;
 	float tsize = trunkSize;
 
@@ -187,9 +248,7 @@ void::SolarSystem::generateTree(LSystem LS, mat4 transMat, vec3 startPos, float
 			mat4 cyMat = glm::translate(transMat, midPoint);
 			cyMat = td * glm::scale(cyMat, vec3(tsize*0.2, length, tsize*0.2)); // translate tree down so we cna see all of it
 
-			m_program.setModelMatrix(cyMat);
-			m_program.setColour(vec3(1, 0.8, 0.6));
-			m_cylinder.draw();
+			queueDraw(cyMat, m_cylinder.get());
 
 			transMat = translate(transMat, vec3(0, length, 0));
 		}
@@ -198,7 +257,7 @@ void::SolarSystem::generateTree(LSystem LS, mat4 transMat, vec3 startPos, float
 		}
 		else if (c == '[') {
 			index++;
-			generateTree(LS, transMat, startPos, length, tsize, index);
+			generateTree(LS, transMat, startPos, length, tsize, leafLayer, index);
 		}
 		else if (c == ']') {
 			return;
@@ -242,9 +301,7 @@ void::SolarSystem::generateTree(LSystem LS, mat4 transMat, vec3 startPos, float
 
 			td = td * scaleMat;
 
-			m_program.setModelMatrix(td);
-			billBoardShader.setModelMatrix(td);
-			drawLeaf();
+			m_leafDraws.push_back(std::make_pair(td, leafLayer));
 		}
 	}
 }
@@ -300,12 +357,30 @@ void SolarSystem::generateCylinder() {
 		triangles.setRow(count++, { indices.at(i), indices.at(i + 1), indices.at(i + 2) });
 	}
 
-	m_cylinder.setData(vertices, triangles, vertColours);
+	m_cylinder = cgra::MeshRegistry::shared().fromData(vertices, triangles, vertColours);
 }
 
 
 
+/*
+* Uploads the leaf textures once the worker has them. Returns whether they can be drawn with
+*/
+bool SolarSystem::leafTexturesReady() {
+	if (leafTextures == 0 && leafTexturesLoading.valid()
+		&& leafTexturesLoading.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		try {
+			leafTextures = leafTexturesLoading.get().upload();
+			billBoardShader.setLeafTextures(leafTextures);
+		} catch (std::exception &e) {
+			std::cerr << "Couldn't load leaf textures: " << e.what() << std::endl;
+		}
+		leafTexturesLoading = std::shared_future<cgra::TextureLayers>();
+	}
+	return leafTextures != 0;
+}
+
 void SolarSystem::drawLeaf() {
+	if (leafTextures == 0) return;
 	float aspectRatio = m_viewportSize.x / m_viewportSize.y;
 	billBoardShader.setViewMatrix(viewMatrix);
 
@@ -418,71 +493,294 @@ void SolarSystem::createCube() {
 		vertColours.push_back(vec3(0.0f));
 	}
 
-	m_cube.setData(vertices, triangles, vertColours);
+	m_cube = cgra::MeshRegistry::shared().fromData(vertices, triangles, vertColours);
 }
 
 void SolarSystem::drawBoundingBox() {
-	GLuint airlightOnly;
-	glUniform1i(glGetUniformLocation(m_program.getProgram(), "onlyPointLights"), 1);
-	//m_program.setColour(glm::vec3(0, 0, 0));
-	// Bottom
-	glm::mat4 modelTransform = glm::mat4(1.0f);
-	modelTransform = glm::translate(modelTransform, glm::vec3(0, -50, 0));
-	modelTransform = glm::scale(modelTransform, glm::vec3(50, 1, 50));
-
-	m_program.setModelMatrix(modelTransform);
-	m_cube.draw();
-
-	//Top
-	modelTransform = glm::mat4(1.0f);
-	modelTransform = glm::translate(modelTransform, glm::vec3(0, 50, 0));
-	modelTransform = glm::scale(modelTransform, glm::vec3(50, 1, 50));
-	m_program.setModelMatrix(modelTransform);
-	m_cube.draw();
-
-	//Front
-	modelTransform = glm::mat4(1.0f);
-	modelTransform = glm::translate(modelTransform, glm::vec3(0, 0, -50));
-	modelTransform = glm::scale(modelTransform, glm::vec3(50, 50, 1));
-	m_program.setModelMatrix(modelTransform);
-	m_cube.draw();
-
-	//Back
-	modelTransform = glm::mat4(1.0f);
-	modelTransform = glm::translate(modelTransform, glm::vec3(0, 0, 50));
-	modelTransform = glm::scale(modelTransform, glm::vec3(50, 50, 1));
-	m_program.setModelMatrix(modelTransform);
-	m_cube.draw();
-
-	//Left
-	modelTransform = glm::mat4(1.0f);
-	modelTransform = glm::translate(modelTransform, glm::vec3(-50, 0, 0));
-	modelTransform = glm::scale(modelTransform, glm::vec3(1, 50, 50));
-	m_program.setModelMatrix(modelTransform);
-	m_cube.draw();
-
-	//Right
-	modelTransform = glm::mat4(1.0f);
-	modelTransform = glm::translate(modelTransform, glm::vec3(50, 0, 0));
-	modelTransform = glm::scale(modelTransform, glm::vec3(1, 50, 50));
-	m_program.setModelMatrix(modelTransform);
-	m_cube.draw();
-	glUniform1i(glGetUniformLocation(m_program.getProgram(), "onlyPointLights"), 0);
+	// Only lit by the point lights, not the sun
+	static const glm::vec3 WALLS[6][2] = {
+		{ glm::vec3(0, -50, 0), glm::vec3(50, 1, 50) }, // Bottom
+		{ glm::vec3(0, 50, 0), glm::vec3(50, 1, 50) },  // Top
+		{ glm::vec3(0, 0, -50), glm::vec3(50, 50, 1) }, // Front
+		{ glm::vec3(0, 0, 50), glm::vec3(50, 50, 1) },  // Back
+		{ glm::vec3(-50, 0, 0), glm::vec3(1, 50, 50) }, // Left
+		{ glm::vec3(50, 0, 0), glm::vec3(1, 50, 50) }   // Right
+	};
+	for (const glm::vec3 *wall : WALLS) {
+		glm::mat4 modelTransform = glm::mat4(1.0f);
+		modelTransform = glm::translate(modelTransform, wall[0]);
+		modelTransform = glm::scale(modelTransform, wall[1]);
+		queueDraw(modelTransform, m_cube.get(), 0.0f, true);
+	}
+}
+
+void SolarSystem::queueDraw(const glm::mat4 &model, cgra::Mesh *mesh, float morphFactor, bool onlyPointLights) {
+	DrawCall call;
+	call.transform = m_transforms.add(model);
+	call.mesh = mesh;
+	call.morphFactor = morphFactor;
+	call.onlyPointLights = onlyPointLights;
+	call.terrain = nullptr;
+	m_drawCalls.push_back(call);
+}
+
+void SolarSystem::queueBody(int id, const glm::mat4 &model, float radius, float pixelRadius, cgra::Mesh *mesh,
+	float morphFactor, unsigned int version) {
+	if (m_impostors && pixelRadius < impostorPixels) {
+		ImpostorAtlas::Body body = { id, model, radius, mesh, morphFactor, version };
+		if (m_impostors->add(body)) return;
+	}
+	queueDraw(model, mesh, morphFactor);
+}
+
+
+void SolarSystem::restartSimulation() {
+	std::vector<SimulationThread::Body> bodies;
+	bodies.push_back({ sun.location, 0.0f });
+	for (const Planet &p : planets) {
+		float angle = float(m_clock.time()) / p.rotationSpeed;
+		glm::vec3 location = glm::vec3(glm::rotate(m_rotationMatrix, angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(p.location, 1.0f));
+		bodies.push_back({ location, angle });
+	}
+
+	// The thread gets its own copy of everything it needs from the planets
+	std::vector<float> rotationSpeeds;
+	for (const Planet &p : planets) {
+		rotationSpeeds.push_back(p.rotationSpeed);
+	}
+	if (!physicsOrbits) {
+		std::vector<glm::vec3> locations;
+		for (const Planet &p : planets) {
+			locations.push_back(p.location);
+		}
+		glm::mat4 rotation = m_rotationMatrix;
+		m_simulation.start([=](double time, float dt, std::vector<SimulationThread::Body> &bodies) {
+			for (size_t i = 0; i < locations.size(); i++) {
+				float angle = float(time + dt) / rotationSpeeds[i];
+				bodies[i + 1].angle = angle;
+				bodies[i + 1].position = glm::vec3(glm::rotate(rotation, angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(locations[i], 1.0f));
+			}
+		}, bodies, m_clock.time());
+		m_clock.reset(m_clock.time());
+		return;
+	}
+
+	// Circular orbits from where the fixed orbits have them, going around the same way
+	GravitySystem::Settings settings;
+	settings.integrator = GravitySystem::YOSHIDA;
+	std::shared_ptr<GravitySystem> gravity = std::make_shared<GravitySystem>(settings);
+	gravity->addBody(sun.location, glm::vec3(0.0f), SUN_MASS);
+	glm::vec3 momentum(0.0f);
+	for (size_t i = 0; i < planets.size(); i++) {
+		glm::vec3 radial = bodies[i + 1].position - sun.location;
+		float speed = glm::sqrt(settings.G * SUN_MASS / glm::length(radial));
+		glm::vec3 velocity = speed * glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), radial));
+		float mass = PLANET_MASS * SUN_MASS * planets[i].scale.x * planets[i].scale.x * planets[i].scale.x;
+		gravity->addBody(bodies[i + 1].position, velocity, mass);
+		momentum += mass * velocity;
+	}
+	// Keep the centre of mass still, otherwise the whole system drifts away
+	gravity->setVelocity(0, -momentum / SUN_MASS);
+	m_simulation.start([=](double time, float dt, std::vector<SimulationThread::Body> &bodies) {
+		gravity->step(dt);
+		for (size_t i = 0; i < bodies.size(); i++) {
+			bodies[i].position = gravity->position(i);
+			bodies[i].angle = i > 0 ? float(time + dt) / rotationSpeeds[i - 1] : 0.0f;
+		}
+	}, bodies, m_clock.time(), [=](std::vector<float> &state) {
+		// The bodies have the positions, so checkpoints only need the velocities
+		for (size_t i = 0; i < gravity->size(); i++) {
+			glm::vec3 velocity = gravity->velocity(i);
+			state.insert(state.end(), { velocity.x, velocity.y, velocity.z });
+		}
+	}, [=](const std::vector<SimulationThread::Body> &bodies, const std::vector<float> &state) {
+		for (size_t i = 0; i < gravity->size(); i++) {
+			gravity->setPosition(i, bodies[i].position);
+			gravity->setVelocity(i, glm::vec3(state[i * 3], state[i * 3 + 1], state[i * 3 + 2]));
+		}
+	});
+	m_clock.reset(m_clock.time());
+}
+
+void SolarSystem::loadCatalogue() {
+	m_catalogue.reset();
+	catalogueError.clear();
+	try {
+		std::shared_ptr<KeplerOrbits> orbits = std::make_shared<KeplerOrbits>();
+		orbits->load(catalogueFile);
+		// So the belts chunks are bodies near each other
+		orbits->sortByOrbit(AsteroidBelt::BANDS);
+		AsteroidBelt::Settings settings;
+		m_catalogue = std::make_shared<AsteroidBelt>(settings, orbits);
+	} catch (std::exception &e) {
+		catalogueError = e.what();
+		std::cerr << "Couldn't load orbit catalogue: " << e.what() << std::endl;
+	}
+}
+
+SolarSystem::Pick SolarSystem::pick(const glm::vec2 &pixel) {
+	auto startTime = std::chrono::steady_clock::now();
+	Pick result;
+	// The ray through the pixel, from the near plane at 0 to the far plane at 1
+	glm::mat4 inverseViewProjection = glm::inverse(m_projectionMatrix * viewMatrix);
+	glm::vec2 ndc(2.0f * pixel.x / m_viewportSize.x - 1.0f, 1.0f - 2.0f * pixel.y / m_viewportSize.y);
+	glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+	// Every bounding sphere the ray goes through, by where it goes in
+	std::vector<std::pair<float, int>> spheres;
+	for (size_t i = 0; i < m_bodyTransforms.size(); i++) {
+		const glm::mat4 &model = m_bodyTransforms[i];
+		const Planet &p = i == 0 ? sun : planets[i - 1];
+		glm::vec3 offset = origin - glm::vec3(model[3]);
+		float radius = p.boundingRadius * glm::length(glm::vec3(model[0]));
+		float a = glm::dot(direction, direction);
+		float b = glm::dot(offset, direction);
+		float c = glm::dot(offset, offset) - radius * radius;
+		float discriminant = b * b - a * c;
+		if (discriminant < 0.0f || (-b + std::sqrt(discriminant)) / a < 0.0f) continue;
+		spheres.push_back(std::make_pair(glm::max((-b - std::sqrt(discriminant)) / a, 0.0f), int(i)));
+	}
+	std::sort(spheres.begin(), spheres.end());
+
+	// Then the surfaces inside them, until the next sphere starts behind the best hit
+	float best = 1.0f;
+	for (const std::pair<float, int> &sphere : spheres) {
+		if (sphere.first >= best) break;
+		int body = sphere.second;
+		if (body == 0) {
+			// The sun has no terrain, its sphere will do
+			best = sphere.first;
+			result = Pick();
+			result.body = 0;
+			continue;
+		}
+		Planet &p = planets[body - 1];
+		glm::mat4 toLocal = glm::inverse(m_bodyTransforms[body]);
+		Planet::SurfaceHit hit = p.raycast(glm::vec3(toLocal * glm::vec4(origin, 1.0f)), glm::mat3(toLocal) * direction, best);
+		if (hit.triangle < 0) continue;
+		best = hit.distance;
+		result.body = body;
+		result.triangle = hit.triangle;
+		result.biome = hit.biome;
+	}
+	if (result.body >= 0) {
+		result.point = origin + direction * best;
+		result.distance = best * glm::length(direction);
+	}
+	result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	return result;
 }
 
+void SolarSystem::createGalaxy() {
+	// The planets are made on worker threads, so they get copies of the settings
+	std::vector<PlanetInfo> spots = this->planetSpots;
+	int octs = this->octaves, frequency = this->freq, amplitude = this->amp, subdivisions = this->subs;
+	TerrainErosion::Settings eroding = this->erosion;
+	Galaxy::PlanetFactory factory = [=](const Galaxy::StarSystem &system) {
+		// Like generateSystem, but only from the systems seed
+		std::mt19937 gen(system.seed);
+		std::vector<PlanetInfo> free = spots;
+		std::vector<Planet> result;
+		for (int i = 0; i < system.planets && !free.empty(); i++) {
+			size_t spot = gen() % free.size();
+			PlanetInfo pi = free[spot];
+			free.erase(free.begin() + spot);
+			if (gen() % 2) {
+				pi.location = -pi.location;
+			}
+			pi.seed = system.seed + i;
+			pi.erosion = eroding;
+			result.push_back(Planet(pi, i, octs, float(frequency), float(amplitude), subdivisions));
+			result.back().name = std::to_string(i);
+		}
+		return result;
+	};
+
+	Galaxy::Settings settings;
+	settings.seed = this->seed ? this->seed : unsigned(rand());
+	m_galaxy = std::make_shared<Galaxy>(settings, factory);
+
+	Galaxy::StarSystem home;
+	glm::dvec3 spot(settings.discLength, 0.0, 0.0);
+	for (double radius = 1000.0; !m_galaxy->nearest(spot, radius, home) && radius < settings.radius; radius *= 2.0) { }
+	galaxyOrigin = home.id == Galaxy::NO_SYSTEM ? spot : home.position;
+	currentSystem = home.id;
+}
+
+void SolarSystem::updateGalaxy() {
+	if (!m_galaxy) {
+		createGalaxy();
+	}
+	glm::dvec3 eye = galaxyOrigin + glm::dvec3(position);
+
+	// The closest system's planets are made while the camera is on its way, and swapped
+	// with this systems once it arrives. This systems go in the galaxy's cache, in case
+	// it comes back
+	Galaxy::StarSystem next;
+	if (m_galaxy->nearest(eye, GALAXY_PREFETCH_DISTANCE, next) && next.id != currentSystem) {
+		m_galaxy->request(next);
+		if (glm::distance(eye, next.position) < GALAXY_ENTER_DISTANCE && m_galaxy->resident(next.id)) {
+			if (currentSystem != Galaxy::NO_SYSTEM) {
+				m_galaxy->store(currentSystem, std::move(planets));
+			}
+			m_galaxy->take(next.id, planets);
+			position = glm::vec3(eye - next.position);
+			galaxyOrigin = next.position;
+			currentSystem = next.id;
+			currentPlanet = 0;
+			m_pick = Pick();
+			if (m_impostors) {
+				m_impostors->clear(); // The new planets have the same ids
+			}
+			m_lightScene.setViewerPosition(position);
+			restartSimulation();
+		}
+	}
+	m_galaxy->prepare(eye, galaxyDetail, currentSystem);
+}
+
+void SolarSystem::drawStars(float fovY, float aspectRatio) {
+	// Points are from the eye, so only the view's rotation is needed. The far plane is
+	// past the other side of the galaxy
+	starShader.setProjectionMatrix(glm::perspective(fovY, aspectRatio, 1.0f, float(4.0 * m_galaxy->settings().radius)));
+	starShader.setViewMatrix(glm::mat4(glm::mat3(viewMatrix)));
+	glUniform1f(glGetUniformLocation(starShader.getProgram(), "pointScale"), STAR_POINT_SCALE * m_viewportSize.y / 720.0f);
+	m_galaxy->draw(starShader);
+}
+
+void SolarSystem::setCamera(const glm::vec3 &eye, const glm::vec3 &target) {
+	freeCam = false;
+	setCameraPose(eye, target);
+}
+
+void SolarSystem::setCameraPose(const glm::vec3 &eye, const glm::vec3 &target) {
+	position = eye;
+	// Angles that give this direction in drawScene
+	glm::vec3 dir = glm::normalize(target - eye);
+	verticalAngle = glm::asin(glm::clamp(dir.y, -1.0f, 1.0f));
+	horizontalAngle = glm::atan(dir.x, dir.z);
+}
 
 void SolarSystem::drawScene() {
 	// Calculate the aspect ratio of the viewport;
 	float aspectRatio = m_viewportSize.x / m_viewportSize.y;
 	// Calculate the projection matrix with a field-of-view of 45 degrees
-	glm::mat4 projectionMatrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 200.0f);
+	const float fovY = glm::radians(45.0f), zNear = 0.1f, zFar = 200.0f;
+	glm::mat4 projectionMatrix = glm::perspective(fovY, aspectRatio, zNear, zFar);
+	m_projectionMatrix = projectionMatrix;
 	// Set the projection matrix
 	m_program.setProjectionMatrix(projectionMatrix);
 	billBoardShader.setProjectionMatrix(projectionMatrix);
+	asteroidShader.setProjectionMatrix(projectionMatrix);
+
+	deltaTime = float(frameTime - lastTime);
+	lastTime = frameTime;
 
-	if (freeCam) { // Does the user want to move the camera about
-		double currentTime = glfwGetTime();
-		deltaTime = float(currentTime - lastTime);
+	// Without a window (replaying input) the recorded camera has the turn in it already
+	if (freeCam && m_window) { // Does the user want to move the camera about
 		double xpos, ypos;
 		glfwGetCursorPos(m_window, &xpos, &ypos);
 		glfwSetCursorPos(m_window, m_viewportSize.x / 2, m_viewportSize.y / 2);
@@ -495,28 +793,81 @@ void SolarSystem::drawScene() {
 	// Perpendicular to both direction and right camera views
 	up = glm::cross(right, direction);
 
+	// Before the view, the camera moves into another system's coordinates when it gets there
+	if (showGalaxy) {
+		updateGalaxy();
+	}
+
 	viewMatrix = glm::lookAt(position, position + direction, up);
 	m_program.setViewMatrix(viewMatrix);
+	m_lightScene.update(viewMatrix, fovY, aspectRatio, zNear, zFar, m_viewportSize);
+
+	// Stars first, everything drawn after covers them
+	if (showGalaxy) {
+		drawStars(fovY, aspectRatio);
+	}
+
+	// Everything is queued up first, then drawn once the transforms are ready
+	m_transforms.clear();
+	m_drawCalls.clear();
+	m_leafDraws.clear();
+
+	// The simulation runs on by itself, this frame just draws wherever it has got to. After a
+	// jump it's only a checkpoint's worth of steps away, so that's waited for
+	m_clock.update(deltaTime);
+	m_simulation.interpolate(m_clock.time(), m_bodies, waitForSimulation || m_clock.jumped());
+
+	// Far bodies can be drawn as pictures, lit from the sun wherever the simulation has it
+	if (useImpostors) {
+		if (!m_impostors) {
+			m_impostors = std::make_shared<ImpostorAtlas>(ImpostorAtlas::Settings());
+		}
+		m_impostors->begin(position, viewMatrix, projectionMatrix, m_lightScene.directionalLight().direction, m_bodies[0].position);
+	} else {
+		m_impostors.reset();
+	}
+
+	// Spheres as big as the meshes drawn below
+	std::vector<glm::vec3> bodyPositions;
+	std::vector<float> bodyRadii;
+	for (size_t i = 0; i < m_bodies.size(); i++) {
+		bodyPositions.push_back(m_bodies[i].position);
+		bodyRadii.push_back(i == 0 ? sun.boundingRadius * 1.3f : planets[i - 1].boundingRadius * planets[i - 1].scale.x);
+	}
+	m_collisions.detect(bodyPositions, bodyRadii);
+	m_bodyTransforms.assign(m_bodies.size(), glm::mat4(1.0f));
 
 	// Draw the sun (code to rotate object = ((float)glfwGetTime() / p.rotationSpeed))
-	glm::mat4 modelTransform = glm::rotate(glm::mat4(1.0f), 1.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-	// Translate the actual mesh
-	modelTransform = glm::translate(modelTransform, sun.location);
+	glm::mat4 modelTransform = glm::translate(glm::mat4(1.0f), m_bodies[0].position);
+	modelTransform = glm::rotate(modelTransform, 1.0f, glm::vec3(0.0f, 1.0f, 0.0f));
 	// Scale the mesh
 	modelTransform = glm::scale(modelTransform, glm::vec3(1.3f));
+	m_bodyTransforms[0] = modelTransform;
+
+	// Distance to pixels for picking each planets level of detail
+	float pixelsPerUnit = (m_viewportSize.y * 0.5f) / glm::tan(glm::radians(45.0f) * 0.5f);
+
 	// Draw the mesh
-	m_program.setModelMatrix(modelTransform);
-	sun.mesh.draw();
+	float sunRadius = sun.boundingRadius * 1.3f;
+	float sunDistance = glm::max(glm::distance(m_bodies[0].position, position), 0.001f);
+	queueBody(0, modelTransform, sunRadius, sunRadius / sunDistance * pixelsPerUnit, &sun.mesh, 0.0f, sun.surfaceVersion);
 
 	// Draw each planet
-	for (Planet p : planets) {
-		// Move the planet and rotate it
-		modelTransform = glm::rotate(m_rotationMatrix, (playingRotation) ? ((float)glfwGetTime() / p.rotationSpeed) : 0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+	for (size_t i = 0; i < planets.size(); i++) {
+		Planet &p = planets[i];
+		const SimulationThread::Body &body = m_bodies[i + 1];
+		if (physicsOrbits) {
+			// Wherever the simulation has it
+			modelTransform = glm::translate(m_rotationMatrix, body.position);
+		} else {
+			// Move the planet and rotate it
+			modelTransform = glm::rotate(m_rotationMatrix, body.angle, glm::vec3(0.0f, 1.0f, 0.0f));
 
-		//modelTransform = glm::rotate(m_rotationMatrix * glm::mat4(1.0f), (float)glfwGetTime() / p.rotationSpeed, glm::vec3(0.0f, 1.0f, 0.0f));
-		// Translate the actual mesh
+			//modelTransform = glm::rotate(m_rotationMatrix * glm::mat4(1.0f), (float)glfwGetTime() / p.rotationSpeed, glm::vec3(0.0f, 1.0f, 0.0f));
+			// Translate the actual mesh
 
-		modelTransform = glm::translate(modelTransform, p.location);
+			modelTransform = glm::translate(modelTransform, p.location);
+		}
 
 		//TREES
 		/*
@@ -528,51 +879,170 @@ void SolarSystem::drawScene() {
 		* 4 = Urban
 		*/
 		if (this->showTrees) {
+			leafTexturesReady();
 			for (int i = 0; i < p.treeVerts.size(); i++) {
-				int biome = p.biomeMap.at(i);
+				int biome = p.surfaceBiome(i);
 				int tv = p.treeVerts.at(i);
-				vec3 mv = p.modifiedVerticies.at(tv);
+				vec3 mv = p.surfacePoint(tv);
 				mat4 td = createTreeTransMatrix(mv);
 				int h = 0;
+				// Every species uses the same texture, only the layer changes
 
 				if (biome == 0) {
-					generateTree(basicTrees, modelTransform *td, mv, 0.05, 0.05, h);
+					generateTree(basicTrees, modelTransform *td, mv, 0.05, 0.05, biome, h);
 				}
 				else if (biome == 1) {
-					generateTree(dessertTrees, modelTransform *td, mv, 0.05, 0.05, h);
+					generateTree(dessertTrees, modelTransform *td, mv, 0.05, 0.05, biome, h);
 				}
 				else if (biome == 2) {
-					generateTree(snowTrees, modelTransform *td, mv, 0.05, 0.05, h);
+					generateTree(snowTrees, modelTransform *td, mv, 0.05, 0.05, biome, h);
 				}
 				else if (biome == 3) {
-					generateTree(jungleTrees, modelTransform *td, mv, 0.05, 0.05, h);
+					generateTree(jungleTrees, modelTransform *td, mv, 0.05, 0.05, biome, h);
 				}
 				else {
-					generateTree(urbanTrees, modelTransform *td, mv, 0.05, 0.05, h);
+					generateTree(urbanTrees, modelTransform *td, mv, 0.05, 0.05, biome, h);
 				}
 			}
 		}
 
+		// Pick the level of detail from how big the planet is on screen
+		glm::vec3 centre = glm::vec3(modelTransform[3]);
+		float dist = glm::max(glm::distance(centre, position), 0.001f);
+		p.updateLod(p.boundingRadius * p.scale.x / dist * pixelsPerUnit);
+
 		// Scale the mesh
 		modelTransform = glm::scale(modelTransform, p.scale);
+		m_bodyTransforms[i + 1] = modelTransform;
 		// Draw the mesh
-		m_program.setModelMatrix(modelTransform);
-		p.mesh.draw();
-		if (p.hasMoon) {
+		float worldRadius = p.boundingRadius * p.scale.x;
+		if (freeCam && dist < CHUNKED_TERRAIN_DISTANCE * worldRadius) {
+			// Close to the surface, switch to the chunked terrain for more detail
+			if (!p.chunkedTerrain) {
+				p.chunkedTerrain = std::make_shared<ChunkedTerrain>(p.terrainSettings());
+			}
+			glm::vec3 cameraLocal = glm::vec3(glm::inverse(modelTransform) * glm::vec4(position, 1.0f));
+			p.chunkedTerrain->prepare(m_transforms, modelTransform, cameraLocal);
+			DrawCall call = { -1, nullptr, 0.0f, false, p.chunkedTerrain.get() };
+			m_drawCalls.push_back(call);
+		} else {
+			if (dist > 2.0f * CHUNKED_TERRAIN_DISTANCE * worldRadius) {
+				p.chunkedTerrain.reset(); // Well away, free the chunks
+			}
+			// Trees would be hidden behind a picture of the planet
+			float pixelRadius = showTrees ? impostorPixels : worldRadius / dist * pixelsPerUnit;
+			queueBody(int(i + 1), modelTransform, worldRadius, pixelRadius, &p.lodMesh(), p.morphFactor, p.surfaceVersion);
+		}
+		if (p.hasMoon && physicsOrbits) {
+			// Moons aren't simulated, they keep the same place next to their planet
+			modelTransform = glm::translate(m_rotationMatrix, body.position + glm::vec3(0.0f, 0.5f, 1.25f));
+			modelTransform = glm::scale(modelTransform, glm::vec3(0.2f));
+			queueDraw(modelTransform, p.moonMesh.get());
+		} else if (p.hasMoon) {
 			// Move the planet and rotate it
-			modelTransform = glm::rotate(m_rotationMatrix, (playingRotation) ? ((float)glfwGetTime() / p.rotationSpeed) : 0.0f, glm::vec3(0.0f, 1.0f, 0.0f)); // Rotates with planet
-			modelTransform = glm::rotate(modelTransform, (playingRotation) ? ((float)glfwGetTime() / p.rotationSpeed) : 0.0f, p.location); // Rotates around planet
+			modelTransform = glm::rotate(m_rotationMatrix, body.angle, glm::vec3(0.0f, 1.0f, 0.0f)); // Rotates with planet
+			modelTransform = glm::rotate(modelTransform, body.angle, p.location); // Rotates around planet
 			// Translate the actual mesh
 			modelTransform = glm::translate(modelTransform, glm::vec3(p.location.x, p.location.y+0.5f, p.location.z+1.25f));
 			// Scale the mesh
 			modelTransform = glm::scale(modelTransform, glm::vec3(0.2f));
 			// Draw the mesh
-			m_program.setModelMatrix(modelTransform);
-			p.moonMesh.draw();
+			queueDraw(modelTransform, p.moonMesh.get());
 		}
 	}
-	// Draw Bounding Box
-	drawBoundingBox();
+	// Draw Bounding Box, unless it would hide the stars
+	if (!showGalaxy) {
+		drawBoundingBox();
+	}
+
+	// Pictures that are out of date are rendered before the scenes transforms take their place
+	if (m_impostors) {
+		m_impostors->render(m_program, TRANSFORM_TEXTURE_UNIT);
+	}
+
+	// The matrices of every draw in one pass, then a single upload
+	m_transforms.compute(viewMatrix, projectionMatrix);
+	m_transforms.upload(TRANSFORM_TEXTURE_UNIT);
+
+	float morphFactor = 0.0f;
+	bool onlyPointLights = false;
+	m_program.setMorphFactor(morphFactor);
+	for (const DrawCall &call : m_drawCalls) {
+		if (call.onlyPointLights != onlyPointLights) {
+			onlyPointLights = call.onlyPointLights;
+			glUniform1i(glGetUniformLocation(m_program.getProgram(), "onlyPointLights"), onlyPointLights);
+		}
+		if (call.terrain) {
+			call.terrain->draw(m_program);
+			m_program.setMorphFactor(morphFactor = 0.0f);
+			continue;
+		}
+		if (call.morphFactor != morphFactor) {
+			m_program.setMorphFactor(morphFactor = call.morphFactor);
+		}
+		m_program.setDrawIndex(call.transform);
+		call.mesh->draw();
+	}
+	if (onlyPointLights) {
+		glUniform1i(glGetUniformLocation(m_program.getProgram(), "onlyPointLights"), 0);
+	}
+	m_program.setMorphFactor(0.0f);
+
+	if (m_impostors) {
+		impostorShader.setProjectionMatrix(projectionMatrix);
+		impostorShader.setViewMatrix(viewMatrix);
+		m_impostors->draw(impostorShader, IMPOSTOR_TEXTURE_UNIT);
+	}
+
+	if (showAsteroids || showCatalogue) {
+		asteroidShader.setViewMatrix(viewMatrix);
+		glm::vec3 sunPosition = glm::vec3(viewMatrix * glm::vec4(m_bodies[0].position, 1.0f));
+		glUniform3fv(glGetUniformLocation(asteroidShader.getProgram(), "sunPosition"), 1, &sunPosition[0]);
+	}
+	if (showAsteroids) {
+		if ((!m_asteroids || int(m_asteroids->size()) != asteroidCount) && !asteroidsBuilding.valid()) {
+			AsteroidBelt::Settings settings;
+			settings.count = asteroidCount;
+			settings.centralMass = SUN_MASS;
+			auto promise = std::make_shared<std::promise<std::shared_ptr<AsteroidBelt>>>();
+			asteroidsBuilding = promise->get_future().share();
+			cgra::ThreadPool::shared().submit([promise, settings]() {
+				try {
+					promise->set_value(std::make_shared<AsteroidBelt>(settings));
+				} catch (...) {
+					promise->set_exception(std::current_exception());
+				}
+			});
+		}
+		// Runs that wait for the simulation wait for the belt too, so they always draw it
+		if (asteroidsBuilding.valid() && (waitForSimulation
+			|| asteroidsBuilding.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+			m_asteroids = asteroidsBuilding.get();
+			asteroidsBuilding = std::shared_future<std::shared_ptr<AsteroidBelt>>();
+		}
+		if (m_asteroids) {
+			// Around the sun wherever the simulation has it, but the rocks don't pull on anything
+			m_asteroids->prepare(m_clock.time(), m_bodies[0].position, projectionMatrix * viewMatrix);
+			m_asteroids->draw(asteroidShader);
+		}
+	}
+	if (showCatalogue) {
+		if (!m_catalogue && catalogueError.empty()) {
+			loadCatalogue();
+		}
+		if (m_catalogue) {
+			double days = catalogueDays + m_clock.time() * catalogueDaysPerSecond;
+			m_catalogue->prepare(days, m_bodies[0].position, projectionMatrix * viewMatrix);
+			m_catalogue->draw(asteroidShader);
+		}
+	}
+
+	// Leaves last, they're blended over everything else
+	for (const std::pair<glm::mat4, int> &leaf : m_leafDraws) {
+		billBoardShader.setLeafLayer(leaf.second);
+		billBoardShader.setModelMatrix(leaf.first);
+		drawLeaf();
+	}
 }
 
 void SolarSystem::doGUI() {
@@ -591,70 +1061,164 @@ void SolarSystem::doGUI() {
 		std::string timeTaken = "System Generation Time: " + std::to_string(this->timeTaken) + " Seconds";
 		ImGui::Text("%s", timeTaken.c_str());
 
+		cgra::MeshRegistry::Stats meshStats = cgra::MeshRegistry::shared().stats();
+		ImGui::Text("Shared Meshes: %d (%d uses, %.1f KB)", (int)meshStats.assets, (int)meshStats.references, meshStats.bytes / 1024.0);
+
+		const LightClusters &clusters = m_lightScene.clusters();
+		ImGui::Text("Point Lights: %d (%.1f per cluster, %d at most)", (int)m_lightScene.numPointLights(),
+			clusters.indices().size() / float(LightClusters::NUM_CLUSTERS), (int)clusters.maxLightsPerCluster());
+		if (ImGui::InputInt("Extra Lights", &this->extraLights, 10, 100)) {
+			guiSetting("extraLights", glm::vec3(this->extraLights));
+		}
+
 		if (ImGui::InputInt("Number of Planets", &numberOfPlanets)) {
-			if (numberOfPlanets < 0) {
-				numberOfPlanets = 0;
-			}
-			if (numberOfPlanets > 8) {
-				numberOfPlanets = 8;
-			}
+			guiSetting("numberOfPlanets", glm::vec3(numberOfPlanets));
 		}
 
 		if (ImGui::InputInt("Planet Subdivisions", &this->subs)) {
-			if (this->subs < 0) {
-				this->subs = 0;
-			}
-			if (this->subs > 3) {
-				this->subs = 3;
-			}
+			guiSetting("subs", glm::vec3(this->subs));
 		}
 
 		if (ImGui::InputInt("Frequency", &this->freq)) {
-			if (this->freq < 0) {
-				this->freq = 0;
-			}
+			guiSetting("freq", glm::vec3(this->freq));
 		}
 
 		if (ImGui::InputInt("Scale", &this->amp)) {
-			if (this->amp < 0) {
-				this->amp = 0;
-			}
+			guiSetting("amp", glm::vec3(this->amp));
 		}
 
 		if (ImGui::InputInt("Octaves", &this->octaves)) {
-			if (this->octaves < 0) {
-				this->octaves = 0;
-			}
+			guiSetting("octaves", glm::vec3(this->octaves));
+		}
+
+		if (ImGui::InputInt("Thermal Erosion", &this->erosion.thermalIterations, 10, 100)) {
+			guiSetting("thermalErosion", glm::vec3(this->erosion.thermalIterations));
+		}
+
+		if (ImGui::InputInt("Hydraulic Erosion", &this->erosion.hydraulicIterations, 10, 100)) {
+			guiSetting("hydraulicErosion", glm::vec3(this->erosion.hydraulicIterations));
 		}
 
 		if (ImGui::Checkbox("Activate Trees", &this->showTrees)) { // Rotates around the scene
-			
+			guiSetting("showTrees", glm::vec3(this->showTrees));
 		}
 
 		std::string rot;
-		if (playingRotation) {
+		if (m_clock.playing()) {
 			rot = "Pause";
 		}
 		else {
 			rot = "Play";
 		}
 		if (ImGui::Button(rot.data())) {
-			if (playingRotation) {
-				playingRotation = false;
+			guiSetting("playing", glm::vec3(!m_clock.playing()));
+		}
+		float speed = m_clock.speed();
+		if (ImGui::SliderFloat("Time Speed", &speed, -TimeController::MAX_SPEED, TimeController::MAX_SPEED, "%.2fx", 3.0f)) {
+			guiSetting("timeSpeed", glm::vec3(speed));
+		}
+		// Anywhere between the oldest checkpoint and the furthest the clock has been
+		float time = float(m_clock.time());
+		if (ImGui::SliderFloat("Time", &time, float(m_clock.earliestTime()), float(m_clock.furthestTime()), "%.2f s")) {
+			guiSetting("time", glm::vec3(time));
+		}
+		ImGui::Text("Checkpoints: %d, last jump stepped through %.2f s", int(m_simulation.checkpoints()), m_clock.lastReplay());
+
+		if (ImGui::Checkbox("Physical Orbits", &this->physicsOrbits)) {
+			guiSetting("physicsOrbits", glm::vec3(this->physicsOrbits));
+		}
+		if (ImGui::Checkbox("Asteroid Belt", &this->showAsteroids)) {
+			guiSetting("showAsteroids", glm::vec3(this->showAsteroids));
+		}
+		if (showAsteroids) {
+			if (ImGui::InputInt("Asteroids", &this->asteroidCount, 100000)) {
+				guiSetting("asteroidCount", glm::vec3(this->asteroidCount));
+			}
+			if (m_asteroids) {
+				ImGui::Text("Asteroids drawn: %d of %d, %d chunks, %d draw calls", int(m_asteroids->visibleCount()),
+					int(m_asteroids->size()), m_asteroids->visibleChunks(), m_asteroids->drawCalls());
+			}
+		}
+		if (ImGui::Checkbox("Orbit Catalogue", &this->showCatalogue)) {
+			guiSetting("showCatalogue", glm::vec3(this->showCatalogue));
+		}
+		if (showCatalogue) {
+			ImGui::InputText("Catalogue File", this->catalogueFile, sizeof(this->catalogueFile));
+			if (ImGui::Button("Load Catalogue")) {
+				if (this->recording) {
+					std::cerr << "Warning: loading a catalogue isn't recorded, the replay shows the default one" << std::endl;
+				}
+				loadCatalogue();
+			}
+			// A century either side of the epoch
+			if (ImGui::SliderFloat("Catalogue Days", &this->catalogueDays, -36525.0f, 36525.0f, "%.0f")) {
+				guiSetting("catalogueDays", glm::vec3(this->catalogueDays));
+			}
+			if (ImGui::InputFloat("Days per Second", &this->catalogueDaysPerSecond, 1.0f, 10.0f)) {
+				guiSetting("catalogueDaysPerSecond", glm::vec3(this->catalogueDaysPerSecond));
+			}
+			if (m_catalogue) {
+				ImGui::Text("Catalogue drawn: %d of %d, %d chunks", int(m_catalogue->visibleCount()),
+					int(m_catalogue->size()), m_catalogue->visibleChunks());
+			}
+			else if (!catalogueError.empty()) {
+				ImGui::TextWrapped("%s", catalogueError.c_str());
+			}
+		}
+		if (ImGui::Checkbox("Impostors", &this->useImpostors)) {
+			guiSetting("useImpostors", glm::vec3(this->useImpostors));
+		}
+		if (useImpostors) {
+			if (ImGui::SliderFloat("Impostor Size", &this->impostorPixels, 1.0f, 64.0f, "%.0f px")) {
+				guiSetting("impostorPixels", glm::vec3(this->impostorPixels));
+			}
+			if (m_impostors) {
+				ImGui::Text("Impostors drawn: %d, %d pictures kept, %d rendered this frame", int(m_impostors->drawnCount()),
+					int(m_impostors->tileCount()), m_impostors->refreshedCount());
+			}
+		}
+		if (ImGui::Checkbox("Galaxy", &this->showGalaxy)) {
+			guiSetting("showGalaxy", glm::vec3(this->showGalaxy));
+		}
+		if (showGalaxy) {
+			if (ImGui::SliderFloat("Flight Speed", &this->movementSpeed, 1.0f, 100000.0f, "%.0f", 4.0f)) {
+				guiSetting("movementSpeed", glm::vec3(this->movementSpeed));
+			}
+			if (ImGui::SliderFloat("Galaxy Detail", &this->galaxyDetail, 0.0005f, 0.05f, "%.4f", 2.0f)) {
+				guiSetting("galaxyDetail", glm::vec3(this->galaxyDetail));
 			}
-			else {
-				playingRotation = true;
+			if (m_galaxy) {
+				ImGui::Text("Galaxy: %d points, %d systems up close, %d nodes", int(m_galaxy->points().size()),
+					int(m_galaxy->nearSystems()), int(m_galaxy->nodeCount()));
+				ImGui::Text("Systems kept: %d, being made: %d", int(m_galaxy->residentCount()), int(m_galaxy->pendingCount()));
+				glm::dvec3 eye = galaxyOrigin + glm::dvec3(position);
+				ImGui::Text("Position: (%.0f, %.0f, %.0f) in system %lld", eye.x, eye.y, eye.z, (long long)currentSystem);
 			}
 		}
+		const SimulationThread::Snapshot &simulation = m_simulation.latest();
+		ImGui::Text("Simulation: %d bodies, %.3f ms per step, %.2f s behind", int(simulation.current.size()), simulation.stepMs,
+			glm::max(m_clock.time() - simulation.time, 0.0));
+		ImGui::Text("Collisions: %d touching pairs, %.3f ms", int(m_collisions.stats().pairs), m_collisions.stats().totalMs);
+		if (m_pick.body == 0) {
+			ImGui::Text("Picked: %s, %.3f ms", sun.name.c_str(), m_pick.ms);
+		}
+		else if (m_pick.body > 0) {
+			ImGui::Text("Picked: planet %s, triangle %d, biome %d, %.3f ms", planets[m_pick.body - 1].name.c_str(),
+				m_pick.triangle, m_pick.biome, m_pick.ms);
+			ImGui::Text("Surface point: (%.3f, %.3f, %.3f)", m_pick.point.x, m_pick.point.y, m_pick.point.z);
+		}
+		else {
+			ImGui::Text("Click a planet to pick it");
+		}
 
 		static float beta;
 		if (ImGui::SliderFloat("Beta", &beta, 0.0f, 0.04f, "%.2f")) {
-			m_program.setBeta(beta);
+			guiSetting("beta", glm::vec3(beta));
 		}
 
 
 		if (ImGui::Button("Generate New System")) {
-			this->generateSystem();
+			guiSetting("generateSystem");
 		}
 
 		if (ImGui::Button("View Planet Screen")) {
@@ -676,63 +1240,101 @@ void SolarSystem::doGUI() {
 		std::string timeTaken = "Generation Time: " + std::to_string(this->planets.at(this->currentPlanet).timeTaken) + " Seconds";
 		ImGui::Text("%s", timeTaken.c_str());
 
+		if (this->planets.at(this->currentPlanet).chunkedTerrain) {
+			const ChunkedTerrain &chunks = *this->planets.at(this->currentPlanet).chunkedTerrain;
+			ImGui::Text("Surface Chunks: %d drawn, %d cached, %d building", (int)chunks.drawnChunks(), (int)chunks.residentChunks(), (int)chunks.pendingChunks());
+		}
+
 		if (ImGui::Checkbox("Perlin Noise", &this->planets.at(this->currentPlanet).perlin)) { // Use Perlin Noise
-			this->planets.at(this->currentPlanet).simplex = false;
+			guiSetting("planetPerlin", glm::vec3(this->planets.at(this->currentPlanet).perlin));
 		}
 
 		if (ImGui::Checkbox("Simplex Camera", &this->planets.at(this->currentPlanet).simplex)) { // Rotates around the scene
-			this->planets.at(this->currentPlanet).perlin = false;
+			guiSetting("planetSimplex", glm::vec3(this->planets.at(this->currentPlanet).simplex));
 		}
 
 		if (ImGui::InputInt("Planet Subdivisions", &this->planets.at(this->currentPlanet).subdivisions)) {
-			if (this->planets.at(this->currentPlanet).subdivisions < 0) {
-				this->planets.at(this->currentPlanet).subdivisions = 0;
-			}
-			if (this->planets.at(this->currentPlanet).subdivisions > 3) {
-				this->planets.at(this->currentPlanet).subdivisions = 3;
-			}
+			guiSetting("planetSubdivisions", glm::vec3(this->planets.at(this->currentPlanet).subdivisions));
 		}
 
 		if (ImGui::InputFloat("Frequency", &this->planets.at(this->currentPlanet).frequency)) {
-			if (this->planets.at(this->currentPlanet).frequency < 0) {
-				this->planets.at(this->currentPlanet).frequency = 0;
-			}
-			// Regenerate
-			this->planets.at(this->currentPlanet).generateTerrain();
+			guiSetting("planetFrequency", glm::vec3(this->planets.at(this->currentPlanet).frequency));
 		}
 
 		if (ImGui::InputFloat("Scale", &this->planets.at(this->currentPlanet).amplitude)) {
-			if (this->planets.at(this->currentPlanet).amplitude < 0) {
-				this->planets.at(this->currentPlanet).amplitude = 0;
-			}
-			// Regenerate
-			this->planets.at(this->currentPlanet).generateTerrain();
+			guiSetting("planetAmplitude", glm::vec3(this->planets.at(this->currentPlanet).amplitude));
 		}
 
 		if (ImGui::InputInt("Octaves", &this->planets.at(this->currentPlanet).octaves)) {
-			if (this->planets.at(this->currentPlanet).octaves < 0) {
-				this->planets.at(this->currentPlanet).octaves = 0;
+			guiSetting("planetOctaves", glm::vec3(this->planets.at(this->currentPlanet).octaves));
+		}
+
+		// Iterations of each kind of erosion, 0 for none
+		if (ImGui::InputInt("Thermal Erosion", &this->planets.at(this->currentPlanet).erosion.thermalIterations, 10, 100)) {
+			guiSetting("planetThermalErosion", glm::vec3(this->planets.at(this->currentPlanet).erosion.thermalIterations));
+		}
+
+		if (ImGui::InputInt("Hydraulic Erosion", &this->planets.at(this->currentPlanet).erosion.hydraulicIterations, 10, 100)) {
+			guiSetting("planetHydraulicErosion", glm::vec3(this->planets.at(this->currentPlanet).erosion.hydraulicIterations));
+		}
+		// Only recolours the planet, the sea colour then one for each biome
+		if (ImGui::CollapsingHeader("Colours")) {
+			std::vector<glm::vec3> &colours = this->planets.at(this->currentPlanet).cs1;
+			for (size_t i = 0; i < colours.size(); i++) {
+				std::string label = i == 0 ? std::string("Sea") : "Biome " + std::to_string(i);
+				if (ImGui::ColorEdit3(label.c_str(), &colours[i].x)) {
+					guiSetting("planetColour" + std::to_string(i), colours[i]);
+				}
 			}
-			// Regenerate
-			this->planets.at(this->currentPlanet).generateTerrain();
 		}
 
+		if (this->planets.at(this->currentPlanet).erosion.enabled() && this->planets.at(this->currentPlanet).erosionGraph) {
+			const TerrainErosion::Stats &erosionStats = this->planets.at(this->currentPlanet).erosionGraph->stats();
+			ImGui::Text("Erosion: %.1f ms hydraulic, %.1f ms thermal, mean change %.4f", erosionStats.hydraulicMs, erosionStats.thermalMs, erosionStats.meanChange);
+		}
+
+		if (m_terrainCompute) {
+			bool gpuTerrain = this->planets.at(this->currentPlanet).terrainCompute != nullptr;
+			if (ImGui::Checkbox("GPU Terrain", &gpuTerrain)) {
+				guiSetting("gpuTerrain", glm::vec3(gpuTerrain));
+			}
+			if (gpuTerrain && this->planets.at(this->currentPlanet).erosion.enabled()) {
+				ImGui::Text("Eroded terrain is generated on the CPU");
+			}
+			if (ImGui::Button("Validate GPU Terrain")) {
+				this->terrainComputeReport = m_terrainCompute->validate(this->planets.at(this->currentPlanet)).summary();
+				std::cout << this->terrainComputeReport << std::endl;
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Benchmark Terrain")) {
+				this->terrainComputeReport = m_terrainCompute->benchmark(this->planets.at(this->currentPlanet), 10).summary();
+				std::cout << this->terrainComputeReport << std::endl;
+			}
+			if (!this->terrainComputeReport.empty()) {
+				ImGui::TextWrapped("%s", this->terrainComputeReport.c_str());
+			}
+		} else {
+			ImGui::Text("GPU Terrain needs OpenGL 4.3");
+		}
+
+		// Runs the stages the changes above need, if there were any
+		if (this->planets.at(this->currentPlanet).dirtyStages) {
+			this->planets.at(this->currentPlanet).updateTerrain();
+		}
+		const double *stageMs = this->planets.at(this->currentPlanet).stageMs;
+		ImGui::Text("Stage Times: displace %.1f, biomes %.1f, colour %.1f, normals %.1f, upload %.1f ms",
+			stageMs[Planet::STAGE_DISPLACEMENT], stageMs[Planet::STAGE_BIOMES], stageMs[Planet::STAGE_COLOURS], stageMs[Planet::STAGE_NORMALS], stageMs[Planet::STAGE_UPLOAD]);
+
 		if (ImGui::Button("Regenerate Planet")) {
-			this->planets.at(this->currentPlanet).generatePlanet();
+			guiSetting("regeneratePlanet");
 		}
 
 		if (ImGui::Button("Reset Camera")) { // Just incase user loses track
-			freeCam = false;
-			position = glm::vec3(0, 0, 10);
-			right = glm::vec3(1.0f);
-			direction = glm::vec3(1.0f);
-			up = glm::vec3(1.0f);
-			horizontalAngle = 3.14f; // horizontal angle : toward -Z
-			verticalAngle = 0.0f; // vertical angle : 0, look at the horizon
+			guiSetting("resetCamera");
 		}
 
 		if (ImGui::Button("Next Planet")) {
-			this->currentPlanet = (this->currentPlanet + 1) % planets.size();
+			guiSetting("nextPlanet");
 		}
 
 		if (ImGui::Button("Previous Planet")) {
@@ -742,6 +1344,142 @@ void SolarSystem::doGUI() {
 	}
 }
 
+/*
+* The changes doGUI makes, by name, so a recording can make them again without the GUI. The
+* values are clamped here rather than in the GUI, so a replay gets the same ones
+*/
+bool SolarSystem::applySetting(const std::string &name, const glm::vec3 &value) {
+	int count = int(value.x);
+	bool on = value.x != 0.0f;
+	if (name == "extraLights") {
+		this->extraLights = glm::clamp(count, 0, 2000);
+		generateLights();
+	} else if (name == "numberOfPlanets") {
+		this->numberOfPlanets = glm::clamp(count, 0, 8);
+	} else if (name == "subs") {
+		this->subs = glm::clamp(count, 0, 5);
+	} else if (name == "freq") {
+		this->freq = glm::max(count, 0);
+	} else if (name == "amp") {
+		this->amp = glm::max(count, 0);
+	} else if (name == "octaves") {
+		this->octaves = glm::max(count, 0);
+	} else if (name == "thermalErosion") {
+		this->erosion.thermalIterations = glm::max(count, 0);
+	} else if (name == "hydraulicErosion") {
+		this->erosion.hydraulicIterations = glm::max(count, 0);
+	} else if (name == "showTrees") {
+		this->showTrees = on;
+	} else if (name == "playing") {
+		m_clock.setPlaying(on);
+	} else if (name == "timeSpeed") {
+		m_clock.setSpeed(value.x);
+	} else if (name == "time") {
+		m_clock.seek(value.x);
+	} else if (name == "physicsOrbits") {
+		this->physicsOrbits = on;
+		restartSimulation(); // Start again from the fixed orbits
+	} else if (name == "showAsteroids") {
+		this->showAsteroids = on;
+	} else if (name == "asteroidCount") {
+		this->asteroidCount = glm::clamp(count, 0, MAX_ASTEROIDS);
+	} else if (name == "showCatalogue") {
+		this->showCatalogue = on;
+	} else if (name == "catalogueDays") {
+		this->catalogueDays = value.x;
+	} else if (name == "catalogueDaysPerSecond") {
+		this->catalogueDaysPerSecond = value.x;
+	} else if (name == "useImpostors") {
+		this->useImpostors = on;
+	} else if (name == "impostorPixels") {
+		this->impostorPixels = value.x;
+	} else if (name == "showGalaxy") {
+		this->showGalaxy = on;
+	} else if (name == "movementSpeed") {
+		this->movementSpeed = value.x;
+	} else if (name == "galaxyDetail") {
+		this->galaxyDetail = value.x;
+	} else if (name == "beta") {
+		m_lightScene.setBeta(value.x);
+	} else if (name == "generateSystem") {
+		this->generateSystem();
+	} else if (name == "resetCamera") {
+		freeCam = false;
+		position = glm::vec3(0, 0, 10);
+		right = glm::vec3(1.0f);
+		direction = glm::vec3(1.0f);
+		up = glm::vec3(1.0f);
+		horizontalAngle = 3.14f; // horizontal angle : toward -Z
+		verticalAngle = 0.0f; // vertical angle : 0, look at the horizon
+	} else if (name.compare(0, 6, "planet") == 0 || name == "gpuTerrain" || name == "nextPlanet") {
+		// The rest change the planet the planet screen shows
+		if (this->planets.empty()) {
+			return true;
+		}
+		Planet &planet = this->planets.at(this->currentPlanet);
+		if (name == "planetPerlin") {
+			planet.perlin = on;
+			planet.simplex = false;
+			planet.invalidate(Planet::STAGE_DISPLACEMENT);
+		} else if (name == "planetSimplex") {
+			planet.simplex = on;
+			planet.perlin = false;
+			planet.invalidate(Planet::STAGE_DISPLACEMENT);
+		} else if (name == "planetSubdivisions") {
+			planet.subdivisions = glm::clamp(count, 0, 5);
+		} else if (name == "planetFrequency") {
+			planet.frequency = glm::max(value.x, 0.0f);
+			planet.invalidate(Planet::STAGE_DISPLACEMENT);
+		} else if (name == "planetAmplitude") {
+			planet.amplitude = glm::max(value.x, 0.0f);
+			planet.invalidate(Planet::STAGE_DISPLACEMENT);
+		} else if (name == "planetOctaves") {
+			planet.octaves = glm::max(count, 0);
+			planet.invalidate(Planet::STAGE_DISPLACEMENT);
+		} else if (name == "planetThermalErosion") {
+			planet.erosion.thermalIterations = glm::max(count, 0);
+			planet.invalidate(Planet::STAGE_DISPLACEMENT);
+		} else if (name == "planetHydraulicErosion") {
+			planet.erosion.hydraulicIterations = glm::max(count, 0);
+			planet.invalidate(Planet::STAGE_DISPLACEMENT);
+		} else if (name.compare(0, 12, "planetColour") == 0) {
+			size_t i = std::strtoul(name.c_str() + 12, nullptr, 10);
+			if (i >= planet.cs1.size()) {
+				return false;
+			}
+			planet.cs1[i] = value;
+			planet.invalidate(Planet::STAGE_COLOURS);
+		} else if (name == "gpuTerrain") {
+			planet.terrainCompute = on ? m_terrainCompute : nullptr;
+			planet.invalidate(Planet::STAGE_DISPLACEMENT);
+		} else if (name == "regeneratePlanet") {
+			planet.generatePlanet();
+		} else if (name == "nextPlanet") {
+			this->currentPlanet = (this->currentPlanet + 1) % planets.size();
+		} else {
+			return false;
+		}
+		// Without the GUI nothing else runs the stages the change needs
+		if (planet.dirtyStages) {
+			planet.updateTerrain();
+		}
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void SolarSystem::guiSetting(const std::string &name, const glm::vec3 &value) {
+	if (this->recording) {
+		InputRecording::Event event;
+		event.type = InputRecording::SETTING;
+		event.name = name;
+		event.value = value;
+		this->recording->addEvent(event);
+	}
+	applySetting(name, value);
+}
+
 
 // Input Handlers
 
@@ -750,6 +1488,20 @@ void SolarSystem::onMouseButton(int button, int action, int) {
         // Set the 'down' state for the appropriate mouse button
         m_mouseButtonDown[button] = action == GLFW_PRESS;
     }
+
+    // Clicking a planet makes it the one the planet screen shows
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && !m_bodyTransforms.empty()) {
+        // The mouse is in window coordinates, which can be smaller than the viewport.
+        // Without a window (replaying input) it's already in the viewport's
+        int width = int(m_viewportSize.x), height = int(m_viewportSize.y);
+        if (m_window) {
+            glfwGetWindowSize(m_window, &width, &height);
+        }
+        m_pick = pick(m_mousePosition * m_viewportSize / glm::max(glm::vec2(width, height), glm::vec2(1.0f)));
+        if (m_pick.body > 0) {
+            this->currentPlanet = m_pick.body - 1;
+        }
+    }
 }
 
 void SolarSystem::onCursorPos(double xpos, double ypos) {
@@ -804,7 +1556,7 @@ void SolarSystem::onKey(int key, int scancode, int action, int mods) {
 		if (GLFW_KEY_D == key) {
 			position += right * deltaTime * movementSpeed;
 		}
-		m_program.setViewerPosition(position);
+		m_lightScene.setViewerPosition(position);
 	}
 
 }
@@ -1,32 +1,65 @@
 #pragma once
 
 #include "cgra/mesh.hpp"
+#include "cgra/meshregistry.hpp"
 #include "cgra/shader.hpp"
+#include "cgra/texture.hpp"
+#include "cgra/transformbatch.hpp"
+#include <future>
 #include <string>
 
 #include "glm/glm.hpp"
 
 #include "Planet.hpp"
 #include "LSystem.hpp"
+#include "GravitySystem.hpp"
+#include "CollisionSystem.hpp"
+#include "SimulationThread.hpp"
+#include "TimeController.hpp"
+#include "AsteroidBelt.hpp"
+#include "Galaxy.hpp"
+#include "ImpostorAtlas.hpp"
 #include "lightScene.hpp"
 
 using namespace glm;
 
+class InputRecording;
+
 class SolarSystem {
 public:
     // The window object managed by GLFW
     GLFWwindow *m_window;
 
 	LightScene m_lightScene;
+	// Small point lights added on top of the fixed ones
+	int extraLights = 0;
 
     // The shader program used for drawing
     cgra::Program m_program;
 	cgra::Program billBoardShader;
+	cgra::Program asteroidShader;
+	cgra::Program starShader;
+	cgra::Program impostorShader;
+
+	// Model matrices of everything drawn with m_program this frame. The
+	// draws are queued up first, so the shader matrices of all of them can
+	// be worked out together before anything is drawn
+	cgra::TransformBatch m_transforms;
+	struct DrawCall {
+		int transform;
+		cgra::Mesh *mesh;
+		float morphFactor;
+		bool onlyPointLights;
+		ChunkedTerrain *terrain; // Draws its own chunks when set
+	};
+	std::vector<DrawCall> m_drawCalls;
+	// Leaves queued up with the cylinders, and the leaf layer each uses
+	std::vector<std::pair<glm::mat4, int>> m_leafDraws;
 
     // The mesh data
     cgra::Mesh m_mesh;
-	cgra::Mesh m_cylinder;
-	cgra::Mesh m_cube;
+	cgra::MeshRegistry::Handle m_cylinder;
+	cgra::MeshRegistry::Handle m_cube;
 
     // The current size of the viewport
     glm::vec2 m_viewportSize;
@@ -40,6 +73,10 @@ public:
 	LSystem jungleTrees;
 	LSystem urbanTrees;
 	bool showTrees = false;
+	// Leaf textures, one layer per biome. Decoded on a worker thread and
+	// uploaded once they're ready, leaves aren't drawn until then
+	std::shared_future<cgra::TextureLayers> leafTexturesLoading;
+	GLuint leafTextures = 0;
 
 
     // The translation of the mesh as a vec3
@@ -60,6 +97,8 @@ public:
 	std::vector<Planet> planets;
 	std::vector<PlanetInfo> planetSpots;
 	int numberOfPlanets = 1;
+	// Set before init() to get the same lights and planets every run, 0 picks new ones
+	unsigned int seed = 0;
 
 	// Camera Controls
 	bool freeCam = false;
@@ -73,10 +112,11 @@ public:
 	float verticalAngle = 0.0f; // vertical angle : 0, look at the horizon
 
 	// Movement and mouse
-	float movementSpeed = 0.05f;
-	float mouseSpeed = 0.00009f;
+	float movementSpeed = 20.0f;
+	float mouseSpeed = 0.3f;
+	// Seconds between the last two frames, and the frameTime of the last one
 	float deltaTime = 0.0f;
-	float lastTime = 0.0f;
+	double lastTime = 0.0;
 
 	bool changeScreen;
 	bool wire = false;
@@ -89,18 +129,105 @@ public:
 	int freq = 1;
 	int amp = 2;
 	int octaves = 4;
+	// Erosion for the planets generated next
+	TerrainErosion::Settings erosion;
 
-	//
-	bool playingRotation = false;
 	double timeTaken;
+	// Seconds since the start, set each frame by whatever is driving the frames
+	double frameTime = 0.0;
+
+	// Planets pulled around by the sun and each other instead of turning on fixed circles
+	bool physicsOrbits = false;
+
+	// Moves the sun and planets on, body 0 is the sun and body i + 1 is planet i.
+	// Started again whenever the planets or the kind of orbit change
+	SimulationThread m_simulation;
+	// Where the bodies are this frame
+	std::vector<SimulationThread::Body> m_bodies;
+	// The simulations clock, which only runs while the rotation is playing, at whatever speed
+	// and in whichever direction it's set to
+	TimeController m_clock;
+	// Bodies that touch where they are this frame
+	CollisionSystem m_collisions;
+	// Model matrix of each body as drawn this frame, in the same order as m_bodies, and the
+	// projection they were drawn with, so clicks can be turned into rays
+	std::vector<glm::mat4> m_bodyTransforms;
+	glm::mat4 m_projectionMatrix;
+
+	// What a click last landed on
+	struct Pick {
+		int body = -1; // 0 for the sun, i + 1 for planet i, -1 for nothing
+		int triangle = -1; // In the planets originalTriangles, -1 for the sun
+		int biome = -1;
+		glm::vec3 point = glm::vec3(0.0f); // In the scene
+		float distance = 0.0f; // From the near plane
+		double ms = 0.0; // How long finding it took
+	};
+	Pick m_pick;
+	// Rocks between the outer planets. Made when they're first shown, and again when
+	// the count changes
+	std::shared_ptr<AsteroidBelt> m_asteroids;
+	bool showAsteroids = false;
+	int asteroidCount = 1000000;
+	// A belt for a new count is made on the thread pool, the old one is drawn until it's ready
+	std::shared_future<std::shared_ptr<AsteroidBelt>> asteroidsBuilding;
+	// Rocks on the orbits of a catalogue of minor planets instead, loaded when first shown
+	// and again when asked. Its clock runs from the catalogues epoch plus the days chosen,
+	// and moves on with the simulations, so it can be scrubbed to any date
+	std::shared_ptr<AsteroidBelt> m_catalogue;
+	bool showCatalogue = false;
+	char catalogueFile[256] = CGRA_SRCDIR "/res/orbits/planets.txt";
+	std::string catalogueError;
+	float catalogueDays = 0.0f;
+	float catalogueDaysPerSecond = 10.0f;
+
+	// Other star systems to fly to, made when first shown. The camera and planets stay in the
+	// coordinates of the system the camera is in, whose sun is at galaxyOrigin in the galaxy
+	std::shared_ptr<Galaxy> m_galaxy;
+	bool showGalaxy = false;
+	glm::dvec3 galaxyOrigin = glm::dvec3(0.0);
+	uint64_t currentSystem = Galaxy::NO_SYSTEM;
+	// Radians across a node is split below, see Galaxy::prepare
+	float galaxyDetail = 0.002f;
+
+	// Bodies smaller than impostorPixels across on screen (as a radius) are drawn as pictures
+	// rendered into an atlas, made when first used
+	std::shared_ptr<ImpostorAtlas> m_impostors;
+	bool useImpostors = true;
+	float impostorPixels = 24.0f;
+
+	// Wait for the simulation to reach each frame instead of drawing what's ready,
+	// so a run draws the same thing however fast the simulation thread goes
+	bool waitForSimulation = false;
+	// Where the changes made in the GUI are saved while a flythrough is recorded
+	InputRecording *recording = nullptr;
 
 	// Interaction
 	bool wasLeftMouseDown = false;
 
+	// Within this many planet radii the free cam sees the chunked surface
+	const float CHUNKED_TERRAIN_DISTANCE = 3.0f;
+	// The planets of the closest system within this distance are made on the way there,
+	// and the camera moves into it within the smaller one
+	const double GALAXY_PREFETCH_DISTANCE = 3000.0;
+	const double GALAXY_ENTER_DISTANCE = 100.0;
+	// Most rocks the belt can have, about 100 bytes each
+	const int MAX_ASTEROIDS = 4000000;
+	// Pixels across a star as bright as the sun, one unit away
+	const float STAR_POINT_SCALE = 2000.0f;
+
+	// Compute shader terrain, null when OpenGL 4.3 isn't available
+	std::shared_ptr<TerrainCompute> m_terrainCompute;
+	std::string terrainComputeReport;
+
+	// The simulation always steps by this much, however long the frames take
+	static constexpr float SIMULATION_STEP = 1.0f / 120.0f;
+
 	SolarSystem(GLFWwindow *win)
         : m_window(win),
           m_viewportSize(1, 1), m_mousePosition(0, 0),
-          m_translation(0), m_scale(1), m_rotationMatrix(1) {
+          m_translation(0), m_scale(1), m_rotationMatrix(1),
+          m_simulation(SIMULATION_STEP), m_clock(m_simulation) {
         m_mouseButtonDown[0] = false;
         m_mouseButtonDown[1] = false;
         m_mouseButtonDown[2] = false;
@@ -122,19 +249,55 @@ public:
 	void generateCylinder();
 
 	void drawLeaf();
+	bool leafTexturesReady();
 
 	mat4 createTreeTransMatrix(vec3 startPoint);
 
 	void generateLights();
 
-	void generateTree(LSystem LS, mat4 transMat, vec3 startPos, float length, float trunkSize, int & index);
+	// Starts the simulation from where the sun and planets are now
+	void restartSimulation();
+
+	// Reads catalogueFile into m_catalogue, or sets catalogueError
+	void loadCatalogue();
+
+	// Makes m_galaxy, with this system at the star nearest a spot out along the disc
+	void createGalaxy();
+	// Moves the camera into the closest system once its planets are ready, then picks the stars to draw
+	void updateGalaxy();
+	// Draws the stars picked by updateGalaxy behind everything else
+	void drawStars(float fovY, float aspectRatio);
+
+	// Whatever is under a pixel of the viewport, as last drawn. The ray is tried against
+	// each bodies bounding sphere, then against the surface of the planets it goes through
+	Pick pick(const glm::vec2 &pixel);
+
+	void generateTree(LSystem LS, mat4 transMat, vec3 startPos, float length, float trunkSize, int leafLayer, int & index);
+
+	// Queues `mesh` to be drawn with m_program once the frames transforms are ready
+	void queueDraw(const glm::mat4 &model, cgra::Mesh *mesh, float morphFactor = 0.0f, bool onlyPointLights = false);
+	// Draws body `id` (0 for the sun, i + 1 for planet i) as an impostor if it's small enough on
+	// screen and has a picture, otherwise queues its mesh
+	void queueBody(int id, const glm::mat4 &model, float radius, float pixelRadius, cgra::Mesh *mesh,
+		float morphFactor, unsigned int version);
 
 
 	PlanetInfo generatePlanetInfo(glm::vec3 pos, float rs, std::vector<glm::vec3> cs1);
 
+    // Points the camera at `target` from `eye`, turning off the free cam
+    void setCamera(const glm::vec3 &eye, const glm::vec3 &target);
+    // The same, leaving the free cam as it is
+    void setCameraPose(const glm::vec3 &eye, const glm::vec3 &target);
+
     void drawScene();
     void doGUI();
 
+    // Makes a change the GUI makes, by the name it's recorded under, with a scalar in value.x.
+    // Returns false if there is no setting with that name
+    bool applySetting(const std::string &name, const glm::vec3 &value);
+    // Applies a change made in the GUI, saving it first while recording
+    void guiSetting(const std::string &name, const glm::vec3 &value = glm::vec3(0.0f));
+
     void onKey(int key, int scancode, int action, int mods);
 
     void onMouseButton(int button, int action, int mods);
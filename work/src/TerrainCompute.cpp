@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+#include "TerrainCompute.hpp"
+#include "Planet.hpp"
+
+// Threads in a work group, must match local_size_x in terrain.cs.glsl
+static const unsigned int GROUP_SIZE = 64;
+// How close the two paths have to be. The GPU is free to fuse and reorder float maths,
+// so the results are only equal to a few ulps
+static const float POSITION_TOLERANCE = 1e-4f;
+static const float NORMAL_TOLERANCE = 1e-3f;
+// Fraction of vertices allowed to differ in colour or normal. These are the ones sitting right
+// on a boundary, where a last-bit difference in the noise changes the answer
+static const double MISMATCH_FRACTION = 0.001;
+// Largest value of one perlin or simplex octave, with some room as neither quite keeps to +-1
+static const float NOISE_RANGE = 1.1f;
+
+/*
+* The mesh a planet uses for a level, the finest level is the main mesh
+*/
+static cgra::Mesh &levelMesh(Planet &planet, size_t level) {
+	if (level < planet.lodMeshes.size()) {
+		return planet.lodMeshes.at(level);
+	}
+	return planet.mesh;
+}
+
+/*
+* Furthest any vertex can be from the centre, so the radius never has to be read back. Perlin and
+* simplex octaves stay within about +-1 before the amplitude divides them, random ones aren't scaled
+*/
+static float boundingRadius(const Planet &planet) {
+	float bound = 1.0f;
+	float amp = planet.amplitude;
+	for (int octs = 0; octs < planet.octaves; octs++) {
+		bound += (planet.perlin || planet.simplex) ? NOISE_RANGE / amp : 1.0f;
+		amp *= 2;
+	}
+	return bound;
+}
+
+static GLuint storageBuffer(const void *data, size_t size) {
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STATIC_DRAW);
+	return buffer;
+}
+
+TerrainCompute::TerrainCompute() {
+	m_program = cgra::Program::load_compute_program(CGRA_SRCDIR "/res/shaders/terrain.cs.glsl");
+	glGenBuffers(1, &m_biomes);
+}
+
+TerrainCompute::~TerrainCompute() {
+	for (auto &level : m_topology) {
+		deleteTopology(level.second);
+	}
+	glDeleteBuffers(1, &m_biomes);
+	glDeleteProgram(m_program.getProgram());
+}
+
+/*
+* Compute shaders and storage buffers both arrived in 4.3
+*/
+bool TerrainCompute::supported() {
+	return GLEW_VERSION_4_3 != 0;
+}
+
+/*
+* Buffers for a subdivision level. Every planet is subdivided the same way, so they're built
+* once and reused. The vertex to triangle lists keep each vertexs triangles in the same order
+* as the CPU adds up the normals
+*/
+const TerrainCompute::Topology &TerrainCompute::topology(const Planet &planet, int level) {
+	unsigned int numVerts = planet.lodVertexCounts.at(level);
+	const std::vector<std::vector<unsigned int>> &tris = planet.lodTriangles.at(level);
+	Topology &topo = m_topology[level];
+	if (topo.numVertices == numVerts && topo.numTriangles == tris.size()) {
+		return topo;
+	}
+	deleteTopology(topo);
+	topo.numVertices = numVerts;
+	topo.numTriangles = tris.size();
+
+	std::vector<glm::vec4> unitPositions;
+	std::vector<glm::ivec2> parents;
+	for (unsigned int i = 0; i < numVerts; i++) {
+		unitPositions.push_back(glm::vec4(planet.originalVerticies.at(i), 0.0f));
+		parents.push_back(planet.vertexParents.at(i));
+	}
+
+	topo.indices.clear();
+	std::vector<unsigned int> faceOffsets(numVerts + 1, 0);
+	for (const std::vector<unsigned int> &tri : tris) {
+		for (int k = 0; k < 3; k++) {
+			topo.indices.push_back(tri[k]);
+			faceOffsets[tri[k] + 1]++;
+		}
+	}
+	for (unsigned int i = 0; i < numVerts; i++) {
+		faceOffsets[i + 1] += faceOffsets[i];
+	}
+	std::vector<unsigned int> faceList(faceOffsets.back());
+	std::vector<unsigned int> cursor(faceOffsets.begin(), faceOffsets.end() - 1);
+	for (unsigned int f = 0; f < tris.size(); f++) {
+		for (int k = 0; k < 3; k++) {
+			faceList[cursor[tris[f][k]]++] = f;
+		}
+	}
+
+	topo.unitPositions = storageBuffer(&unitPositions[0], sizeof(glm::vec4) * unitPositions.size());
+	topo.parents = storageBuffer(&parents[0], sizeof(glm::ivec2) * parents.size());
+	topo.faceOffsets = storageBuffer(&faceOffsets[0], sizeof(unsigned int) * faceOffsets.size());
+	topo.faceList = storageBuffer(&faceList[0], sizeof(unsigned int) * faceList.size());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return topo;
+}
+
+void TerrainCompute::deleteTopology(Topology &topo) {
+	GLuint buffers[] = { topo.unitPositions, topo.parents, topo.faceOffsets, topo.faceList };
+	glDeleteBuffers(4, buffers);
+	topo = Topology();
+}
+
+void TerrainCompute::uniform(const char *name, int value) {
+	glUniform1i(glGetUniformLocation(m_program.getProgram(), name), value);
+}
+
+void TerrainCompute::uniform(const char *name, unsigned int value) {
+	glUniform1ui(glGetUniformLocation(m_program.getProgram(), name), value);
+}
+
+void TerrainCompute::uniform(const char *name, float value) {
+	glUniform1f(glGetUniformLocation(m_program.getProgram(), name), value);
+}
+
+/*
+* The finest level is displaced and coloured first. Coarser levels use a prefix of the same
+* vertices, so they copy those instead of running the noise again, then only need their own
+* normals and morph targets
+*/
+void TerrainCompute::generate(Planet &planet) {
+	// Anything left on the CPU would be from the old terrain
+	planet.modifiedVerticies.clear();
+	planet.vertColours.clear();
+	planet.biomeMap.clear();
+	planet.sites = planet.chooseSites();
+
+	// Sites, then the colours
+	std::vector<glm::vec4> biomes;
+	for (const glm::vec3 &site : planet.sites) {
+		biomes.push_back(glm::vec4(site, 0.0f));
+	}
+	for (const glm::vec3 &colour : planet.cs1) {
+		biomes.push_back(glm::vec4(colour, 0.0f));
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_biomes);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * biomes.size(), &biomes[0], GL_DYNAMIC_DRAW);
+	m_program.use();
+	uniform("octaves", planet.octaves);
+	uniform("frequency", planet.frequency);
+	uniform("amplitude", planet.amplitude);
+	uniform("noiseType", planet.perlin ? 0 : (planet.simplex ? 1 : 2));
+	uniform("numSites", (int)planet.sites.size());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_biomes);
+
+	int levels = planet.lodTriangles.size();
+	planet.lodMeshes.resize(levels - 1);
+	GLuint finestBuffer = 0;
+	for (int n = 0; n < levels; n++) {
+		// Finest first
+		int level = (n == 0) ? levels - 1 : n - 1;
+		const Topology &topo = topology(planet, level);
+		cgra::Mesh &mesh = levelMesh(planet, level);
+		mesh.setGpuData(topo.numVertices, topo.indices);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mesh.getVertexBuffer());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.getIndexBuffer());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, topo.unitPositions);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, topo.parents);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, topo.faceOffsets);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, topo.faceList);
+		uniform("numVertices", topo.numVertices);
+		uniform("firstNewVertex", (level == 0) ? topo.numVertices : planet.lodVertexCounts.at(level - 1));
+		GLuint groups = (topo.numVertices + GROUP_SIZE - 1) / GROUP_SIZE;
+
+		if (n == 0) {
+			uniform("pass", 0);
+			glDispatchCompute(groups, 1, 1);
+			finestBuffer = mesh.getVertexBuffer();
+		} else {
+			glBindBuffer(GL_COPY_READ_BUFFER, finestBuffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.getVertexBuffer());
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(float) * cgra::Mesh::VERTEX_FLOATS * topo.numVertices);
+		}
+		// Normals need every position written first
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		uniform("pass", 1);
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	}
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	// Nothing is read back, so the level of detail uses a bound worked out from the noise
+	planet.boundingRadius = boundingRadius(planet);
+	for (int b = 0; b < 7; b++) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+	}
+	planet.currentLod = -1;
+}
+
+/*
+* Builds the terrain on the CPU, keeps a copy of every level, then builds it on the GPU and
+* compares vertex by vertex
+*/
+TerrainCompute::Validation TerrainCompute::validate(Planet &planet) {
+	std::shared_ptr<TerrainCompute> compute = planet.terrainCompute;
+	planet.terrainCompute.reset();
+	planet.generateTerrain();
+	planet.terrainCompute = compute;
+	int levels = planet.lodTriangles.size();
+	std::vector<std::vector<float>> reference;
+	for (int level = 0; level < levels; level++) {
+		reference.push_back(levelMesh(planet, level).getVertexData());
+	}
+
+	generate(planet);
+
+	Validation result;
+	const int F = cgra::Mesh::VERTEX_FLOATS;
+	for (int level = 0; level < levels; level++) {
+		std::vector<float> gpu = levelMesh(planet, level).getVertexData();
+		const std::vector<float> &cpu = reference.at(level);
+		size_t numVerts = std::min(gpu.size(), cpu.size()) / F;
+		result.vertices += numVerts;
+		result.positionMismatches += std::max(gpu.size(), cpu.size()) / F - numVerts;
+		for (size_t i = 0; i < numVerts; i++) {
+			const float *g = &gpu[i * F];
+			const float *c = &cpu[i * F];
+			// Position and morph target
+			float positionError = 0.0f;
+			for (int k : { 0, 1, 2, 9, 10, 11 }) {
+				positionError = std::max(positionError, std::fabs(g[k] - c[k]));
+			}
+			float normalError = 0.0f;
+			for (int k = 3; k < 6; k++) {
+				normalError = std::max(normalError, std::fabs(g[k] - c[k]));
+			}
+			bool colourMatches = g[6] == c[6] && g[7] == c[7] && g[8] == c[8];
+			// NaNs compare false, so count them as errors
+			if (!(positionError <= POSITION_TOLERANCE)) {
+				result.positionMismatches++;
+			}
+			if (!(normalError <= NORMAL_TOLERANCE)) {
+				result.normalMismatches++;
+			}
+			if (!colourMatches) {
+				result.colourMismatches++;
+			}
+			result.maxPositionError = std::max(result.maxPositionError, positionError);
+			result.maxNormalError = std::max(result.maxNormalError, normalError);
+		}
+	}
+	return result;
+}
+
+bool TerrainCompute::Validation::passed() const {
+	size_t allowed = size_t(vertices * MISMATCH_FRACTION);
+	return vertices > 0 && positionMismatches == 0 && normalMismatches <= allowed && colourMismatches <= allowed;
+}
+
+std::string TerrainCompute::Validation::summary() const {
+	std::ostringstream out;
+	out << (passed() ? "Passed: " : "Failed: ") << vertices << " vertices, "
+		<< positionMismatches << " position, " << normalMismatches << " normal and "
+		<< colourMismatches << " colour mismatches (max errors " << maxPositionError << ", " << maxNormalError << ")";
+	return out.str();
+}
+
+/*
+* Times both paths on the same planet. The CPU path is timed up to the meshes being on the
+* GPU, so the two do the same amount of work. The planet is rebuilt with its own path after
+*/
+TerrainCompute::Benchmark TerrainCompute::benchmark(Planet &planet, int runs) {
+	Benchmark result;
+	result.runs = runs;
+	std::shared_ptr<TerrainCompute> compute = planet.terrainCompute;
+	planet.terrainCompute.reset();
+
+	glFinish();
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < runs; r++) {
+		planet.generateTerrain();
+		for (size_t level = 0; level < planet.lodTriangles.size(); level++) {
+			levelMesh(planet, level).upload();
+		}
+		glFinish();
+	}
+	result.cpuSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < runs; r++) {
+		generate(planet);
+		glFinish();
+	}
+	result.gpuSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+
+	planet.terrainCompute = compute;
+	planet.generateTerrain();
+	return result;
+}
+
+std::string TerrainCompute::Benchmark::summary() const {
+	std::ostringstream out;
+	out << "CPU " << cpuSeconds * 1000.0 << " ms, GPU " << gpuSeconds * 1000.0 << " ms";
+	if (gpuSeconds > 0.0) {
+		out << " (" << cpuSeconds / gpuSeconds << "x)";
+	}
+	out << " over " << runs << " runs";
+	return out.str();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "opengl.hpp"
+#include "glm/glm.hpp"
+
+#include "cgra/shader.hpp"
+
+class Planet;
+
+// Generates planet terrain with a compute shader (res/shaders/terrain.cs.glsl). The noise,
+// biome colours, normals and geomorph targets are written straight into the planets level of
+// detail meshes, and nothing is read back.
+// Needs OpenGL 4.3, which Mesa's llvmpipe has as well as most GPUs (but not macOS), so check
+// supported() first.
+class TerrainCompute {
+public:
+	TerrainCompute();
+	~TerrainCompute();
+
+	TerrainCompute(const TerrainCompute &) = delete;
+	TerrainCompute & operator=(const TerrainCompute &) = delete;
+
+	// Whether the current context can run the compute path
+	static bool supported();
+
+	// Does the work of Planet::generateTerrain on the GPU. The CPU copies of the displaced
+	// vertices, colours and biome map are left empty
+	void generate(Planet &planet);
+
+	// How far the GPU terrain is from the CPU terrain for the same planet and seed
+	struct Validation {
+		size_t vertices = 0;
+		size_t positionMismatches = 0;
+		size_t normalMismatches = 0;
+		size_t colourMismatches = 0; // Vertices right on a biome or sea boundary can flip
+		float maxPositionError = 0.0f;
+		float maxNormalError = 0.0f;
+
+		bool passed() const;
+		std::string summary() const;
+	};
+	// Builds the planet both ways and compares every level. Leaves the planet with its GPU terrain
+	Validation validate(Planet &planet);
+
+	// Average time to build the planets terrain each way
+	struct Benchmark {
+		int runs = 0;
+		double cpuSeconds = 0.0;
+		double gpuSeconds = 0.0;
+
+		std::string summary() const;
+	};
+	// Both times include the upload, and wait for the GPU to finish
+	Benchmark benchmark(Planet &planet, int runs);
+
+private:
+	// Per level buffers that only depend on the subdivision, shared by every planet
+	struct Topology {
+		unsigned int numVertices = 0;
+		size_t numTriangles = 0;
+		std::vector<unsigned int> indices;
+		GLuint unitPositions = 0;
+		GLuint parents = 0;
+		GLuint faceOffsets = 0;
+		GLuint faceList = 0;
+	};
+
+	cgra::Program m_program;
+	std::map<int, Topology> m_topology;
+	GLuint m_biomes = 0;
+
+	const Topology &topology(const Planet &planet, int level);
+	void deleteTopology(Topology &topo);
+	void uniform(const char *name, int value);
+	void uniform(const char *name, unsigned int value);
+	void uniform(const char *name, float value);
+};
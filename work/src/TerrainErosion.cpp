@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "cgra/threadpool.hpp"
+#include "TerrainErosion.hpp"
+
+// Vertices each task of the thread pool handles at least
+static const size_t VERTEX_CHUNK = 4096;
+
+TerrainErosion::TerrainErosion(const std::vector<glm::vec3> &vertices, std::shared_ptr<const cgra::MeshAdjacency> adjacency)
+	: m_adjacency(std::move(adjacency)) {
+	const cgra::MeshAdjacency &mesh = *m_adjacency;
+	if (vertices.size() < mesh.size()) {
+		throw std::runtime_error("Error: erosion needs a vertex for every row of the adjacency");
+	}
+	m_length.resize(mesh.edges());
+	m_flow.resize(mesh.edges());
+	cgra::ThreadPool::shared().parallelFor(0, mesh.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			glm::vec3 from = glm::normalize(vertices[i]);
+			for (unsigned int e = mesh.begin(i); e < mesh.end(i); e++) {
+				m_length[e] = glm::distance(from, glm::normalize(vertices[mesh.neighbour(e)]));
+			}
+		}
+	}, VERTEX_CHUNK);
+	m_stats.vertices = mesh.size();
+	m_stats.edges = mesh.edges();
+}
+
+void TerrainErosion::erode(std::vector<float> &heights, const Settings &settings) {
+	if (heights.size() != size()) {
+		throw std::runtime_error("Error: erosion needs a height for every vertex");
+	}
+	size_t n = size();
+	m_stats.thermalMs = m_stats.hydraulicMs = 0.0;
+	m_stats.maxChange = m_stats.meanChange = 0.0f;
+	std::vector<float> original = heights;
+	std::vector<float> next(n);
+
+	auto start = std::chrono::steady_clock::now();
+	if (settings.hydraulicIterations > 0) {
+		hydraulic(heights, next, settings);
+		auto finished = std::chrono::steady_clock::now();
+		m_stats.hydraulicMs = std::chrono::duration<double, std::milli>(finished - start).count();
+		start = finished;
+	}
+	// Slumping after the rivers have cut their valleys smooths off the sharpest banks
+	for (int i = 0; i < settings.thermalIterations; i++) {
+		thermal(heights, next, settings);
+	}
+	m_stats.thermalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	double total = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		float change = std::abs(heights[i] - original[i]);
+		m_stats.maxChange = std::max(m_stats.maxChange, change);
+		total += change;
+	}
+	m_stats.meanChange = n > 0 ? float(total / n) : 0.0f;
+}
+
+/*
+* One iteration. Each vertex sends a share of its height over the talus slope down each
+* edge that's too steep, more down the steeper ones
+*/
+void TerrainErosion::thermal(std::vector<float> &heights, std::vector<float> &next, const Settings &settings) {
+	cgra::ThreadPool &pool = cgra::ThreadPool::shared();
+	const cgra::MeshAdjacency &mesh = *m_adjacency;
+	float rate = glm::clamp(settings.thermalRate, 0.0f, 0.5f);
+	pool.parallelFor(0, size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			float h = heights[i], total = 0.0f, most = 0.0f;
+			for (unsigned int e = mesh.begin(i); e < mesh.end(i); e++) {
+				float over = std::max(h - heights[mesh.neighbour(e)] - settings.talusSlope * m_length[e], 0.0f);
+				m_flow[e] = over;
+				total += over;
+				most = std::max(most, over);
+			}
+			float share = total > 0.0f ? rate * most / total : 0.0f;
+			for (unsigned int e = mesh.begin(i); e < mesh.end(i); e++) {
+				m_flow[e] *= share;
+			}
+		}
+	}, VERTEX_CHUNK);
+	pool.parallelFor(0, size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			float h = heights[i];
+			for (unsigned int e = mesh.begin(i); e < mesh.end(i); e++) {
+				h += m_flow[mesh.reverse(e)] - m_flow[e];
+			}
+			next[i] = h;
+		}
+	}, VERTEX_CHUNK);
+	heights.swap(next);
+}
+
+/*
+* Every iteration. Water runs from each vertex towards the neighbours whose water surface is
+* lower, taking the same share of its sediment. What it can carry depends on how much water
+* left the vertex and how steeply, so the vertex is cut down where that's more than it has,
+* and built up where it's less. At the end whatever is still carried is dropped where it is
+*/
+void TerrainErosion::hydraulic(std::vector<float> &heights, std::vector<float> &next, const Settings &settings) {
+	cgra::ThreadPool &pool = cgra::ThreadPool::shared();
+	const cgra::MeshAdjacency &mesh = *m_adjacency;
+	size_t n = size();
+	std::vector<float> water(n, 0.0f), sediment(n, 0.0f);
+	std::vector<float> nextWater(n), nextSediment(n);
+	// Sediment in each unit of water leaving, what the water leaving can carry, and the most
+	// the vertex can be cut down without going below its lowest neighbour
+	std::vector<float> concentration(n), capacity(n), deepest(n);
+
+	for (int iteration = 0; iteration < settings.hydraulicIterations; iteration++) {
+		pool.parallelFor(0, n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				float h = heights[i];
+				float w = water[i] + settings.rain;
+				if (h <= settings.seaLevel) {
+					// The sea takes the water, nothing flows out of it
+					std::fill(m_flow.begin() + mesh.begin(i), m_flow.begin() + mesh.end(i), 0.0f);
+					concentration[i] = capacity[i] = deepest[i] = 0.0f;
+					continue;
+				}
+				float surface = h + w, total = 0.0f, most = 0.0f, lowest = h, slope = 0.0f;
+				for (unsigned int e = mesh.begin(i); e < mesh.end(i); e++) {
+					unsigned int j = mesh.neighbour(e);
+					float drop = std::max(surface - heights[j] - water[j], 0.0f);
+					m_flow[e] = drop;
+					total += drop;
+					most = std::max(most, drop);
+					// Weighted by the water going that way, once it's known
+					slope += drop * std::max(h - heights[j], 0.0f) / m_length[e];
+					lowest = std::min(lowest, heights[j]);
+				}
+				// Half the biggest drop evens out the water surfaces, rather than swapping them
+				float leaving = std::min(w, 0.5f * most);
+				float share = total > 0.0f ? leaving / total : 0.0f;
+				for (unsigned int e = mesh.begin(i); e < mesh.end(i); e++) {
+					m_flow[e] *= share;
+				}
+				float carry = slope * share;
+				concentration[i] = w > 0.0f ? sediment[i] / w : 0.0f;
+				capacity[i] = settings.capacity * carry;
+				deepest[i] = 0.5f * (h - lowest);
+			}
+		}, VERTEX_CHUNK);
+
+		pool.parallelFor(0, n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				float h = heights[i];
+				float w = water[i] + settings.rain, s = sediment[i];
+				for (unsigned int e = mesh.begin(i); e < mesh.end(i); e++) {
+					unsigned int j = mesh.neighbour(e);
+					float in = m_flow[mesh.reverse(e)];
+					w += in - m_flow[e];
+					s += in * concentration[j] - m_flow[e] * concentration[i];
+				}
+				s = std::max(s, 0.0f);
+				if (h <= settings.seaLevel) {
+					h = std::min(h + s, settings.seaLevel);
+					s = 0.0f;
+					w = 0.0f;
+				}
+				else {
+					if (s < capacity[i]) {
+						float cut = std::min(settings.erosionRate * (capacity[i] - s), deepest[i]);
+						h -= cut;
+						s += cut;
+					}
+					else {
+						float dropped = settings.depositionRate * (s - capacity[i]);
+						h += dropped;
+						s -= dropped;
+					}
+					w = std::max(w, 0.0f) * (1.0f - settings.evaporation);
+				}
+				next[i] = h;
+				nextWater[i] = w;
+				nextSediment[i] = s;
+			}
+		}, VERTEX_CHUNK);
+		heights.swap(next);
+		water.swap(nextWater);
+		sediment.swap(nextSediment);
+	}
+
+	pool.parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			heights[i] += sediment[i];
+		}
+	}, VERTEX_CHUNK);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "cgra/meshadjacency.hpp"
+
+// Weathers a planets surface. It works on how far each vertex of the subdivided sphere is from
+// the centre, moving material between vertices along the edges of the mesh:
+//  - Thermal erosion lets slopes steeper than the talus slope slump onto the vertices below
+//  - Hydraulic erosion rains on every vertex and runs the water downhill. Fast water picks up
+//    sediment, and slow water drops it again, as does water reaching the sea
+// Each iteration first works out what leaves every vertex along each of its edges, then each
+// vertex gathers what arrives along the same edges from its neighbours. Both passes only
+// write to their own vertex, so they split over the shared thread pool without locks and
+// give the same result however they're split.
+class TerrainErosion {
+public:
+	struct Settings {
+		int thermalIterations = 0;
+		// Steepest slope that holds, in height over distance along the unit sphere
+		float talusSlope = 1.0f;
+		// Share of the height over the talus slope moved each iteration, at most 0.5
+		float thermalRate = 0.25f;
+
+		int hydraulicIterations = 0;
+		// Water on each vertex each iteration, and the share of it that dries up
+		float rain = 0.0005f;
+		float evaporation = 0.02f;
+		// Sediment a unit of water can carry for each unit of slope it runs down
+		float capacity = 0.5f;
+		// Shares of the difference from capacity picked up, or dropped, each iteration
+		float erosionRate = 0.3f;
+		float depositionRate = 0.3f;
+		// Vertices at or below this are sea, where water is lost and drops what it carries.
+		// The sea floor only builds up to sea level, the rest is washed out to the deep sea
+		float seaLevel = 1.0f;
+
+		bool enabled() const { return thermalIterations > 0 || hydraulicIterations > 0; }
+	};
+
+	// What the last erode() did
+	struct Stats {
+		size_t vertices = 0;
+		size_t edges = 0; // Counting each direction
+		double thermalMs = 0.0;
+		double hydraulicMs = 0.0;
+		// Largest change in any vertex's height, and the mean change
+		float maxChange = 0.0f;
+		float meanChange = 0.0f;
+	};
+
+	// Works along the edges of `adjacency`. `vertices` are the undisplaced vertices, their
+	// lengths are ignored
+	TerrainErosion(const std::vector<glm::vec3> &vertices, std::shared_ptr<const cgra::MeshAdjacency> adjacency);
+
+	size_t size() const { return m_adjacency->size(); }
+	const Stats &stats() const { return m_stats; }
+
+	// Erodes `heights`, the distance of each vertex from the centre, in place
+	void erode(std::vector<float> &heights, const Settings &settings);
+
+private:
+	Stats m_stats;
+	std::shared_ptr<const cgra::MeshAdjacency> m_adjacency;
+	// Distance along the unit sphere for each edge of the adjacency
+	std::vector<float> m_length;
+	// What leaves each vertex along each of its edges this iteration
+	std::vector<float> m_flow;
+
+	void thermal(std::vector<float> &heights, std::vector<float> &next, const Settings &settings);
+	void hydraulic(std::vector<float> &heights, std::vector<float> &next, const Settings &settings);
+};
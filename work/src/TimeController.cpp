@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <cmath>
+
+#include "TimeController.hpp"
+
+constexpr float TimeController::MAX_SPEED;
+
+void TimeController::setSpeed(float speed) {
+	m_speed = std::min(std::max(speed, -MAX_SPEED), MAX_SPEED);
+}
+
+void TimeController::update(float seconds) {
+	if (m_playing) {
+		m_time += double(m_speed) * std::max(seconds, 0.0f);
+	}
+	double earliest = earliestTime();
+	if (m_time < earliest) {
+		// Run back to the oldest checkpoint, there's nothing before it to show
+		m_time = earliest;
+		if (m_speed < 0.0f) {
+			m_playing = false;
+		}
+	}
+	moveSimulation();
+}
+
+void TimeController::seek(double time) {
+	m_time = std::min(std::max(time, earliestTime()), m_furthest);
+	moveSimulation();
+}
+
+void TimeController::reset(double time) {
+	m_time = time;
+	m_furthest = time;
+	m_lastReplay = 0.0;
+	m_jumped = false;
+}
+
+void TimeController::moveSimulation() {
+	m_furthest = std::max(m_furthest, m_time);
+	// Fast clocks need more lag allowed, or the simulation skips time instead of stepping it
+	m_simulation.setMaxLag(SimulationThread::MAX_LAG * std::max(1.0f, std::abs(m_speed)));
+	double from = m_simulation.jumpTo(m_time);
+	m_jumped = from != m_time;
+	if (m_jumped) {
+		m_lastReplay = m_time - from;
+	}
+	m_simulation.advanceTo(m_time);
+}
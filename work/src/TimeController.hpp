@@ -0,0 +1,54 @@
+#pragma once
+
+#include "SimulationThread.hpp"
+
+// The simulations clock. It runs at any speed, backwards as well as forwards, and can be
+// dragged to any time the simulation still has a checkpoint for. Going back, or jumping
+// forward over checkpoints, sends the simulation to the checkpoint before the new time and lets
+// it step forward from there, so a jump costs at most one checkpoint interval of steps however
+// far it goes.
+class TimeController {
+public:
+	// Fastest the clock runs either way, in simulated seconds a second
+	static constexpr float MAX_SPEED = 100.0f;
+
+	explicit TimeController(SimulationThread &simulation) : m_simulation(simulation) {}
+
+	double time() const { return m_time; }
+	// Latest time the clock has been at since the last reset()
+	double furthestTime() const { return m_furthest; }
+	// As far back as seek() can go
+	double earliestTime() const { return m_simulation.earliestCheckpoint(); }
+
+	bool playing() const { return m_playing; }
+	void setPlaying(bool playing) { m_playing = playing; }
+	// Simulated seconds a second, below 0 runs backwards
+	float speed() const { return m_speed; }
+	void setSpeed(float speed);
+
+	// Moves the clock on by `seconds` of real time if it's playing, and the simulation after it
+	void update(float seconds);
+	// Jumps the clock to `time`, or as close as it can get between the earliest and
+	// furthest times
+	void seek(double time);
+	// Sets the clock without moving the simulation, for when it's started again from `time`
+	void reset(double time);
+
+	// Whether the last update() or seek() sent the simulation to a checkpoint. Until it has
+	// stepped forward again it only has the checkpoint to show
+	bool jumped() const { return m_jumped; }
+	// Simulated seconds the last jump had to step through again
+	double lastReplay() const { return m_lastReplay; }
+
+private:
+	SimulationThread &m_simulation;
+	double m_time = 0.0;
+	double m_furthest = 0.0;
+	float m_speed = 1.0f;
+	bool m_playing = false;
+	double m_lastReplay = 0.0;
+	bool m_jumped = false;
+
+	// Sends the simulation to m_time, through a checkpoint if it's past it or a long way short
+	void moveSimulation();
+};
@@ -0,0 +1,436 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+#include "cgra/threadpool.hpp"
+#include "TriangleBVH.hpp"
+
+// Nodes with more triangles than this have their binning spread over the pool
+static const size_t PARALLEL_BINNING = 65536;
+// Nodes with fewer than this aren't split any further before the subtrees are handed out
+static const size_t MIN_SUBTREE = 4096;
+// Triangles per range for the simple per triangle loops
+static const size_t TRIANGLE_CHUNK = 4096;
+// Cost of testing a ray against a node, next to testing it against a triangle
+static const float TRAVERSAL_COST = 1.0f;
+
+/*
+* Distance along the ray where it enters the box, infinity if it misses or only gets there
+* after `limit`
+*/
+static inline float enterBox(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &origin,
+	const glm::vec3 &inverse, float limit) {
+	glm::vec3 t0 = (min - origin) * inverse;
+	glm::vec3 t1 = (max - origin) * inverse;
+	glm::vec3 enters = glm::min(t0, t1), exits = glm::max(t0, t1);
+	float enter = std::max(std::max(enters.x, enters.y), std::max(enters.z, 0.0f));
+	float exit = std::min(std::min(exits.x, exits.y), std::min(exits.z, limit));
+	return enter <= exit ? enter : INFINITY;
+}
+
+// Everything a build needs while it runs
+struct TriangleBVH::Builder {
+	// An axis aligned box, empty until something is added to it
+	struct Box {
+		glm::vec3 min = glm::vec3(INFINITY);
+		glm::vec3 max = glm::vec3(-INFINITY);
+
+		void grow(const glm::vec3 &p) {
+			min = glm::min(min, p);
+			max = glm::max(max, p);
+		}
+		void grow(const Box &b) {
+			min = glm::min(min, b.min);
+			max = glm::max(max, b.max);
+		}
+		float area() const {
+			glm::vec3 d = max - min;
+			return d.x < 0.0f ? 0.0f : 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+		}
+	};
+
+	// Triangles whose centres fall in one slice of a node, what they cover and where their
+	// centres are
+	struct Bin {
+		Box bounds;
+		Box centres;
+		uint32_t count = 0;
+
+		void grow(const Bin &b) {
+			bounds.grow(b.bounds);
+			centres.grow(b.centres);
+			count += b.count;
+		}
+	};
+	struct Bins {
+		Bin axis[3][BINS];
+	};
+
+	// A node still to be built, over order[begin, end)
+	struct Task {
+		uint32_t node;
+		uint32_t begin, end;
+		Box bounds, centres;
+		int depth;
+	};
+
+	// Bounds and centre of every triangle as given, and the order the leaves will use
+	std::vector<Box> boxes;
+	std::vector<glm::vec3> centres;
+	std::vector<uint32_t> order;
+
+	/*
+	* Bin of a triangle centre along `axis`
+	*/
+	static int binOf(const glm::vec3 &centre, const Box &centres, int axis) {
+		float extent = centres.max[axis] - centres.min[axis];
+		int bin = int((centre[axis] - centres.min[axis]) / extent * BINS);
+		return std::min(std::max(bin, 0), BINS - 1);
+	}
+
+	/*
+	* Adds order[begin, end) to the bins along every axis
+	*/
+	void binRange(uint32_t begin, uint32_t end, const Box &nodeCentres, Bins &bins) const {
+		for (uint32_t i = begin; i < end; i++) {
+			uint32_t t = order[i];
+			for (int axis = 0; axis < 3; axis++) {
+				if (nodeCentres.max[axis] <= nodeCentres.min[axis]) continue;
+				Bin &bin = bins.axis[axis][binOf(centres[t], nodeCentres, axis)];
+				bin.bounds.grow(boxes[t]);
+				bin.centres.grow(centres[t]);
+				bin.count++;
+			}
+		}
+	}
+
+	/*
+	* The same spread over the pool, each range into its own bins which are then added up
+	* in order
+	*/
+	void binRangeParallel(uint32_t begin, uint32_t end, const Box &nodeCentres, Bins &bins) const {
+		cgra::ThreadPool &pool = cgra::ThreadPool::shared();
+		size_t parts = size_t(pool.size() + 1) * 4;
+		size_t slice = (end - begin + parts - 1) / parts;
+		std::vector<Bins> partBins(parts);
+		pool.parallelFor(0, parts, [&](size_t first, size_t last) {
+			for (size_t p = first; p < last; p++) {
+				uint32_t b = uint32_t(std::min(size_t(end), begin + p * slice));
+				uint32_t e = uint32_t(std::min(size_t(end), begin + (p + 1) * slice));
+				binRange(b, e, nodeCentres, partBins[p]);
+			}
+		});
+		for (size_t p = 0; p < parts; p++) {
+			for (int axis = 0; axis < 3; axis++) {
+				for (int b = 0; b < BINS; b++) {
+					bins.axis[axis][b].grow(partBins[p].axis[axis][b]);
+				}
+			}
+		}
+	}
+
+	/*
+	* Makes the tasks node into a leaf, or splits it and sets up the two children. Returns
+	* false for a leaf
+	*/
+	bool split(const Task &task, std::vector<Node> &nodes, bool parallel, Task &left, Task &right) {
+		uint32_t count = task.end - task.begin;
+		Node leaf = { task.bounds.min, task.begin, task.bounds.max, count };
+		if (count <= 1 || task.depth >= MAX_DEPTH - 1) {
+			nodes[task.node] = leaf;
+			return false;
+		}
+
+		Bins bins;
+		if (parallel && count > PARALLEL_BINNING) {
+			binRangeParallel(task.begin, task.end, task.centres, bins);
+		} else {
+			binRange(task.begin, task.end, task.centres, bins);
+		}
+
+		// Sweep each axis from both ends, the cost of a split being the chance a ray
+		// through this node goes through each side times what's in it
+		int bestAxis = -1, bestBin = 0;
+		float bestCost = INFINITY;
+		for (int axis = 0; axis < 3; axis++) {
+			if (task.centres.max[axis] <= task.centres.min[axis]) continue;
+			float rightArea[BINS];
+			uint32_t rightCount[BINS];
+			Box box;
+			uint32_t total = 0;
+			for (int b = BINS - 1; b > 0; b--) {
+				box.grow(bins.axis[axis][b].bounds);
+				total += bins.axis[axis][b].count;
+				rightArea[b] = box.area();
+				rightCount[b] = total;
+			}
+			box = Box();
+			total = 0;
+			for (int b = 0; b < BINS - 1; b++) {
+				box.grow(bins.axis[axis][b].bounds);
+				total += bins.axis[axis][b].count;
+				if (total == 0 || rightCount[b + 1] == 0) continue;
+				float cost = box.area() * total + rightArea[b + 1] * rightCount[b + 1];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+		float area = task.bounds.area();
+		bestCost = TRAVERSAL_COST + (area > 0.0f ? bestCost / area : 0.0f);
+		if (count <= MAX_LEAF_TRIANGLES && (bestAxis < 0 || float(count) <= bestCost)) {
+			nodes[task.node] = leaf;
+			return false;
+		}
+
+		uint32_t middle;
+		Bin leftBin, rightBin;
+		if (bestAxis >= 0) {
+			const Box &nodeCentres = task.centres;
+			auto first = order.begin() + task.begin;
+			middle = task.begin + uint32_t(std::partition(first, first + count, [&](uint32_t t) {
+				return binOf(centres[t], nodeCentres, bestAxis) <= bestBin;
+			}) - first);
+			for (int b = 0; b < BINS; b++) {
+				(b <= bestBin ? leftBin : rightBin).grow(bins.axis[bestAxis][b]);
+			}
+		} else {
+			// Every centre in the same place, so just halve them
+			middle = task.begin + count / 2;
+			for (uint32_t i = task.begin; i < task.end; i++) {
+				Bin &bin = i < middle ? leftBin : rightBin;
+				bin.bounds.grow(boxes[order[i]]);
+				bin.centres.grow(centres[order[i]]);
+			}
+		}
+
+		uint32_t child = uint32_t(nodes.size());
+		nodes[task.node] = { task.bounds.min, child, task.bounds.max, 0 };
+		nodes.resize(nodes.size() + 2);
+		left = { child, task.begin, middle, leftBin.bounds, leftBin.centres, task.depth + 1 };
+		right = { child + 1, middle, task.end, rightBin.bounds, rightBin.centres, task.depth + 1 };
+		return true;
+	}
+
+	/*
+	* Builds the whole tree under a task on this thread, into `nodes` with the tasks node first
+	*/
+	void buildSubtree(Task root, std::vector<Node> &nodes, Stats &stats) {
+		root.node = 0;
+		nodes.assign(1, Node());
+		std::vector<Task> stack(1, root);
+		while (!stack.empty()) {
+			Task task = stack.back();
+			stack.pop_back();
+			Task left, right;
+			if (split(task, nodes, false, left, right)) {
+				stack.push_back(right);
+				stack.push_back(left);
+			} else {
+				stats.leaves++;
+				stats.depth = std::max(stats.depth, task.depth);
+			}
+		}
+	}
+};
+
+TriangleBVH::TriangleBVH(const std::vector<glm::vec3> &vertices, const std::vector<std::vector<unsigned int>> &triangles) {
+	build(vertices, triangles);
+}
+
+void TriangleBVH::build(const std::vector<glm::vec3> &vertices, const std::vector<std::vector<unsigned int>> &triangles) {
+	auto start = std::chrono::steady_clock::now();
+	cgra::ThreadPool &pool = cgra::ThreadPool::shared();
+	m_nodes.clear();
+	m_triangles.clear();
+	m_original.clear();
+	m_stats = Stats();
+	for (const std::vector<unsigned int> &t : triangles) {
+		if (t.size() < 3 || t[0] >= vertices.size() || t[1] >= vertices.size() || t[2] >= vertices.size()) {
+			throw std::runtime_error("Error: triangle uses a vertex that doesn't exist");
+		}
+	}
+	size_t count = triangles.size();
+	m_stats.triangles = count;
+	if (count == 0) return;
+
+	Builder builder;
+	builder.boxes.resize(count);
+	builder.centres.resize(count);
+	builder.order.resize(count);
+	pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			Builder::Box &box = builder.boxes[i];
+			box = Builder::Box();
+			for (int corner = 0; corner < 3; corner++) {
+				box.grow(vertices[triangles[i][corner]]);
+			}
+			builder.centres[i] = (box.min + box.max) * 0.5f;
+			builder.order[i] = uint32_t(i);
+		}
+	}, TRIANGLE_CHUNK);
+
+	Builder::Task root = { 0, 0, uint32_t(count), Builder::Box(), Builder::Box(), 0 };
+	for (size_t i = 0; i < count; i++) {
+		root.bounds.grow(builder.boxes[i]);
+		root.centres.grow(builder.centres[i]);
+	}
+
+	// Split the biggest node left until there are enough for every thread to have a few,
+	// spreading the binning of each over the pool
+	m_nodes.resize(1);
+	std::vector<Builder::Task> pending(1, root);
+	size_t wanted = size_t(pool.size() + 1) * 8;
+	while (pending.size() < wanted) {
+		size_t biggest = 0;
+		for (size_t i = 1; i < pending.size(); i++) {
+			if (pending[i].end - pending[i].begin > pending[biggest].end - pending[biggest].begin) {
+				biggest = i;
+			}
+		}
+		Builder::Task task = pending[biggest];
+		if (task.end - task.begin < MIN_SUBTREE) break;
+		pending.erase(pending.begin() + biggest);
+		Builder::Task left, right;
+		if (builder.split(task, m_nodes, true, left, right)) {
+			pending.push_back(left);
+			pending.push_back(right);
+		} else {
+			m_stats.leaves++;
+			m_stats.depth = std::max(m_stats.depth, task.depth);
+		}
+	}
+
+	// Then the subtrees under those a thread each, and stitched on the end of the tree
+	std::vector<std::vector<Node>> subtrees(pending.size());
+	std::vector<Stats> subtreeStats(pending.size());
+	pool.parallelFor(0, pending.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			builder.buildSubtree(pending[i], subtrees[i], subtreeStats[i]);
+		}
+	});
+	for (size_t i = 0; i < pending.size(); i++) {
+		// The subtrees root takes the place of its node, the rest go after what's there
+		uint32_t offset = uint32_t(m_nodes.size()) - 1;
+		for (size_t n = 0; n < subtrees[i].size(); n++) {
+			Node node = subtrees[i][n];
+			if (node.count == 0) {
+				node.first += offset;
+			}
+			if (n == 0) {
+				m_nodes[pending[i].node] = node;
+			} else {
+				m_nodes.push_back(node);
+			}
+		}
+		m_stats.leaves += subtreeStats[i].leaves;
+		m_stats.depth = std::max(m_stats.depth, subtreeStats[i].depth);
+	}
+
+	// The triangles in the order the leaves use them, ready for the ray test
+	m_triangles.resize(count);
+	m_original.swap(builder.order);
+	pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const std::vector<unsigned int> &t = triangles[m_original[i]];
+			glm::vec3 v0 = vertices[t[0]];
+			m_triangles[i] = { v0, vertices[t[1]] - v0, vertices[t[2]] - v0 };
+		}
+	}, TRIANGLE_CHUNK);
+
+	m_stats.nodes = m_nodes.size();
+	m_stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+* Moller-Trumbore test against triangle i in leaf order, updates `hit` if it's closer
+*/
+bool TriangleBVH::testTriangle(uint32_t i, const glm::vec3 &origin, const glm::vec3 &direction, Hit &hit) const {
+	const Triangle &tri = m_triangles[i];
+	glm::vec3 p = glm::cross(direction, tri.e2);
+	float det = glm::dot(tri.e1, p);
+	if (det == 0.0f) return false;
+	float inverseDet = 1.0f / det;
+	glm::vec3 s = origin - tri.v0;
+	float u = glm::dot(s, p) * inverseDet;
+	if (u < 0.0f || u > 1.0f) return false;
+	glm::vec3 q = glm::cross(s, tri.e1);
+	float v = glm::dot(direction, q) * inverseDet;
+	if (v < 0.0f || u + v > 1.0f) return false;
+	float distance = glm::dot(tri.e2, q) * inverseDet;
+	if (distance < 0.0f || distance >= hit.distance) return false;
+	hit.triangle = int(i);
+	hit.distance = distance;
+	hit.u = u;
+	hit.v = v;
+	return true;
+}
+
+TriangleBVH::Hit TriangleBVH::intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const {
+	Hit hit;
+	if (m_nodes.empty()) return hit;
+	hit.distance = maxDistance;
+	glm::vec3 inverse = 1.0f / direction;
+
+	// Far children put off for later, with where the ray enters them. No deeper than the tree
+	struct Entry {
+		uint32_t node;
+		float distance;
+	};
+	Entry stack[MAX_DEPTH];
+	int size = 0;
+
+	bool more = enterBox(m_nodes[0].min, m_nodes[0].max, origin, inverse, hit.distance) != INFINITY;
+	uint32_t node = 0;
+	while (more) {
+		const Node &n = m_nodes[node];
+		if (n.count > 0) {
+			for (uint32_t i = n.first; i < n.first + n.count; i++) {
+				testTriangle(i, origin, direction, hit);
+			}
+		} else {
+			uint32_t nearChild = n.first, farChild = n.first + 1;
+			float nearDistance = enterBox(m_nodes[nearChild].min, m_nodes[nearChild].max, origin, inverse, hit.distance);
+			float farDistance = enterBox(m_nodes[farChild].min, m_nodes[farChild].max, origin, inverse, hit.distance);
+			if (farDistance < nearDistance) {
+				std::swap(nearChild, farChild);
+				std::swap(nearDistance, farDistance);
+			}
+			if (nearDistance != INFINITY) {
+				if (farDistance != INFINITY) {
+					stack[size++] = { farChild, farDistance };
+				}
+				node = nearChild;
+				continue;
+			}
+		}
+		// Back to the nearest node put off that the ray could still hit something in first
+		more = false;
+		while (size > 0) {
+			const Entry &entry = stack[--size];
+			if (entry.distance < hit.distance) {
+				node = entry.node;
+				more = true;
+				break;
+			}
+		}
+	}
+
+	if (hit.triangle < 0) return Hit();
+	hit.triangle = int(m_original[hit.triangle]);
+	return hit;
+}
+
+TriangleBVH::Hit TriangleBVH::intersectAll(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const {
+	Hit hit;
+	hit.distance = maxDistance;
+	for (uint32_t i = 0; i < uint32_t(m_triangles.size()); i++) {
+		testTriangle(i, origin, direction, hit);
+	}
+	if (hit.triangle < 0) return Hit();
+	hit.triangle = int(m_original[hit.triangle]);
+	return hit;
+}
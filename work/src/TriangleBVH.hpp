@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+// A bounding volume hierarchy over a triangle mesh, for finding the first triangle a ray hits.
+// The tree is built from the top down, each node split where the surface area heuristic says
+// rays will be cheapest to test, with the centres of the triangles counted into bins along
+// each axis instead of trying every split. The top few levels are split one node at a time
+// with the binning spread over the thread pool, then the subtrees under them are built a
+// thread each. Rays walk the tree nearest child first and stop at the first hit they can't
+// beat.
+class TriangleBVH {
+public:
+	// Where a ray first hits the mesh
+	struct Hit {
+		// Index in the triangles the tree was built from, -1 for a miss
+		int triangle = -1;
+		// Along the ray, in lengths of its direction
+		float distance = std::numeric_limits<float>::infinity();
+		// Weights of the second and third corners at the hit, the first has what's left
+		float u = 0.0f;
+		float v = 0.0f;
+	};
+
+	// What the last build() made
+	struct Stats {
+		size_t triangles = 0;
+		size_t nodes = 0;
+		size_t leaves = 0;
+		int depth = 0;
+		double buildMs = 0.0;
+	};
+
+	// Bins along each axis when looking for a split
+	static const int BINS = 16;
+	// Leaves never hold more than this, unless the tree gets too deep
+	static const int MAX_LEAF_TRIANGLES = 8;
+	static const int MAX_DEPTH = 64;
+
+	TriangleBVH() {}
+	TriangleBVH(const std::vector<glm::vec3> &vertices, const std::vector<std::vector<unsigned int>> &triangles);
+
+	// Replaces the tree with one over `triangles`, three indices into `vertices` each
+	void build(const std::vector<glm::vec3> &vertices, const std::vector<std::vector<unsigned int>> &triangles);
+
+	bool empty() const { return m_nodes.empty(); }
+	const Stats &stats() const { return m_stats; }
+
+	// First hit along origin + distance * direction, for distances in [0, maxDistance).
+	// Both sides of a triangle count
+	Hit intersect(const glm::vec3 &origin, const glm::vec3 &direction,
+		float maxDistance = std::numeric_limits<float>::infinity()) const;
+	// The same by testing every triangle, for checking the tree
+	Hit intersectAll(const glm::vec3 &origin, const glm::vec3 &direction,
+		float maxDistance = std::numeric_limits<float>::infinity()) const;
+
+private:
+	struct Node {
+		glm::vec3 min;
+		// First triangle of a leaf, or the left child of an inner node with the right next to it
+		uint32_t first;
+		glm::vec3 max;
+		// Triangles in a leaf, 0 for an inner node
+		uint32_t count;
+	};
+
+	// A triangle as the ray test wants it, one corner and the edges from it to the other two
+	struct Triangle {
+		glm::vec3 v0, e1, e2;
+	};
+
+	std::vector<Node> m_nodes;
+	// In the order the leaves use them, and the index each one was built from
+	std::vector<Triangle> m_triangles;
+	std::vector<uint32_t> m_original;
+	Stats m_stats;
+
+	// Working space for build(), only in the .cpp
+	struct Builder;
+
+	bool testTriangle(uint32_t i, const glm::vec3 &origin, const glm::vec3 &direction, Hit &hit) const;
+};
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
@@ -8,7 +9,9 @@ namespace cgra {
 
 	void Mesh::setData(const Matrix<double> &vertices,
 		const Matrix<unsigned int> &triangles,
-		const std::vector<glm::vec3> &vertColours) {
+		const std::vector<glm::vec3> &vertColours,
+		const std::vector<glm::vec3> &morphTargets,
+		const std::vector<glm::vec3> &normals) {
 
 		// Check to make sure that the number of columns in `vertices`
 		// and `triangles` is correct
@@ -25,16 +28,20 @@ namespace cgra {
 		// Clear any existing vertex and index data we have
 		m_vertices.clear();
 		m_indices.clear();
+		m_gpuVertexCount = 0;
+		m_verticesChanged = false;
 
 		// Copy the rows of `vertices` into `m_vertices`.
 		for (unsigned int r = 0; r < vertices.numRows(); r++) {
 			const double *vert = vertices[r];
+			glm::vec3 pos(vert[0], vert[1], vert[2]);
 
 			// Create the vertex
 			Vertex v(
-				glm::vec3(vert[0], vert[1], vert[2]),
-				glm::vec3(0), // Normal is zero here
-				vertColours.at(r)
+				pos,
+				normals.empty() ? glm::vec3(0) : normals.at(r), // Normal is zero here unless given
+				vertColours.at(r),
+				morphTargets.empty() ? pos : morphTargets.at(r)
 			);
 
 			// Add the vertex to m_vertices
@@ -42,7 +49,7 @@ namespace cgra {
 		}
 
 		// Copy the data from `triangles` into `m_indices`
-		// Also calculate vertex normals
+		// Also calculate vertex normals, if they weren't given
 		for (unsigned int r = 0; r < triangles.numRows(); r++) {
 			const unsigned int *tri = triangles[r];
 
@@ -51,6 +58,10 @@ namespace cgra {
 			m_indices.push_back(tri[1]);
 			m_indices.push_back(tri[2]);
 
+			if (!normals.empty()) {
+				continue;
+			}
+
 			// Get the three vertices of this triangle
 			Vertex &v0 = m_vertices[tri[0]];
 			Vertex &v1 = m_vertices[tri[1]];
@@ -78,13 +89,48 @@ namespace cgra {
 
 		// Normalize the normals for each vertex, ensuring that the length is
 		// 1.
-		for (Vertex &v : m_vertices) {
-			v.m_normal = glm::normalize(v.m_normal);
+		if (normals.empty()) {
+			for (Vertex &v : m_vertices) {
+				v.m_normal = glm::normalize(v.m_normal);
+			}
 		}
 	}
 
-    void Mesh::draw() {
-		glShadeModel(GL_FLAT);
+	void Mesh::setColours(const std::vector<glm::vec3> &vertColours) {
+		if (vertColours.size() < m_vertices.size() || m_vertices.empty()) {
+			throw std::out_of_range("`vertColours` should have a colour for every vertex");
+		}
+		for (size_t i = 0; i < m_vertices.size(); i++) {
+			m_vertices[i].m_color = vertColours[i];
+		}
+		m_verticesChanged = true;
+	}
+
+	void Mesh::setGpuData(unsigned int numVertices, const std::vector<unsigned int> &indices) {
+		deleteMesh();
+		m_vertices.clear();
+		m_indices = indices;
+		m_gpuVertexCount = numVertices;
+		upload();
+	}
+
+	std::vector<float> Mesh::getVertexData() {
+		static_assert(sizeof(Vertex) == VERTEX_FLOATS * sizeof(float), "Vertex should be tightly packed floats");
+		std::vector<float> data(getVertexCount() * VERTEX_FLOATS);
+		if (data.empty()) {
+			return data;
+		}
+		if (!m_vertices.empty()) {
+			const float *vertData = reinterpret_cast<const float *>(&m_vertices[0]);
+			std::copy(vertData, vertData + data.size(), data.begin());
+		} else if (m_vbo != 0) {
+			glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+			glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * data.size(), &data[0]);
+		}
+		return data;
+	}
+
+    void Mesh::upload() {
         // Check to see if we have all the GPU objects we need to draw the
         // mesh.
         if (m_vbo == 0 || m_ibo == 0 || m_vao == 0) {
@@ -103,10 +149,11 @@ namespace cgra {
             glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
 
             // Calculate the size, in bytes, of the vertex list
-            size_t size = sizeof(Vertex) * m_vertices.size();
+            size_t size = sizeof(Vertex) * getVertexCount();
             // We need to pass a `const void *` to OpenGL, so we use `reinterpret_cast`
-            // to do so
-            const void *vertData = reinterpret_cast<const void *>(&m_vertices[0]);
+            // to do so. With no CPU-side vertices the buffer is left
+            // uninitialised for the GPU to fill.
+            const void *vertData = m_vertices.empty() ? nullptr : reinterpret_cast<const void *>(&m_vertices[0]);
             // Copy the data from the CPU memory to the GPU
             glBufferData(GL_ARRAY_BUFFER, size, vertData, GL_STATIC_DRAW);
 
@@ -139,8 +186,23 @@ namespace cgra {
 			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
 									reinterpret_cast<void *>(offsetof(Vertex, m_color)));
 			glEnableVertexAttribArray(3);
-			
-        }
+
+			// Attribute 4 is the geomorph target.
+			glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+									reinterpret_cast<void *>(offsetof(Vertex, m_morphTarget)));
+			glEnableVertexAttribArray(4);
+        } else if (m_verticesChanged && !m_vertices.empty()) {
+			// Same size as before, so the buffer can be written over
+			glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Vertex) * m_vertices.size(), &m_vertices[0]);
+		}
+		m_verticesChanged = false;
+    }
+
+    void Mesh::draw() {
+		glShadeModel(GL_FLAT);
+        upload();
+
         // Set the appropriate polygon mode for the drawing mode
         if (m_drawWireframe) {
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -18,9 +18,12 @@ namespace cgra {
             glm::vec3 m_normal;
 			// The color
 			glm::vec3 m_color;
+			// Where the vertex sits on the next coarser level of detail,
+			// used to geomorph between levels. Same as m_position otherwise.
+			glm::vec3 m_morphTarget;
 
-            Vertex(glm::vec3 pos, glm::vec3 norm, glm::vec3 col) :
-                m_position(pos), m_normal(norm), m_color(col) { }
+            Vertex(glm::vec3 pos, glm::vec3 norm, glm::vec3 col, glm::vec3 morph) :
+                m_position(pos), m_normal(norm), m_color(col), m_morphTarget(morph) { }
         };
 
         // A list of all the vertices in the mesh
@@ -35,7 +38,13 @@ namespace cgra {
         // fourth triangles.
         std::vector<unsigned int> m_indices;
 
-		
+		// Number of vertices when they are only stored on the GPU,
+		// see setGpuData
+		unsigned int m_gpuVertexCount = 0;
+
+		// Whether m_vertices has changed since it was copied to the
+		// GPU, see setColours
+		bool m_verticesChanged = false;
 
         // Whether or not to draw this mesh as a wireframe
         bool m_drawWireframe;
@@ -63,9 +72,47 @@ namespace cgra {
 		// `triangles` is an n x 3 matrix of triangles using
 		//    indices into the rows of `vertices`
 		// 'vertColors indicates the verticies colors
+		// `morphTargets` optionally gives each vertex a position to
+		//    blend towards, an empty list means no morphing
+		// `normals` optionally gives each vertex its normal, an empty
+		//    list means they're worked out from the triangles
 		void setData(const Matrix<double> &vertices,
 			const Matrix<unsigned int> &triangles,
-			const std::vector<glm::vec3> &vertColours);
+			const std::vector<glm::vec3> &vertColours,
+			const std::vector<glm::vec3> &morphTargets = std::vector<glm::vec3>(),
+			const std::vector<glm::vec3> &normals = std::vector<glm::vec3>());
+
+		// Recolours a mesh made with setData, keeping everything
+		// else. `vertColours` needs a colour for every vertex. The
+		// GPU copy is updated in place the next time it's drawn
+		void setColours(const std::vector<glm::vec3> &vertColours);
+
+		// Allocates the GPU buffers for `numVertices` vertices and the
+		// given triangles without keeping any vertex data on the CPU.
+		// The vertices are meant to be written on the GPU (for example by
+		// a compute shader) through getVertexBuffer. Copies of a mesh
+		// made this way have no vertices.
+		void setGpuData(unsigned int numVertices, const std::vector<unsigned int> &indices);
+
+		// Creates the GPU objects if they don't exist yet. Called by draw
+		void upload();
+
+		// The interleaved vertex data, VERTEX_FLOATS floats per vertex
+		// in the order position, normal, color, morph target. Read back
+		// from the GPU if the vertices only live there
+		std::vector<float> getVertexData();
+
+		static const int VERTEX_FLOATS = 12;
+
+		GLuint getVertexBuffer() const { return m_vbo; }
+		GLuint getIndexBuffer() const { return m_ibo; }
+		unsigned int getVertexCount() const {
+			return m_vertices.empty() ? m_gpuVertexCount : (unsigned int)m_vertices.size();
+		}
+		// Bytes of vertex and index data, the same as the buffers take on the GPU
+		size_t getMemoryBytes() const {
+			return size_t(getVertexCount()) * VERTEX_FLOATS * sizeof(float) + m_indices.size() * sizeof(unsigned int);
+		}
 
         // Set whether or not to draw this mesh as a wireframe.
         // true means that the mesh will be drawn as a wireframe.
@@ -91,7 +138,7 @@ namespace cgra {
         // doesn't copy the GPU objects.
         Mesh(const Mesh &m) :
             m_vertices(m.m_vertices),
-            m_indices(m.m_indices),
+            m_indices(m.m_vertices.empty() ? std::vector<unsigned int>() : m.m_indices),
             m_drawWireframe(m.m_drawWireframe),
             m_vao(0), m_vbo(0), m_ibo(0) { }
 
@@ -99,7 +146,9 @@ namespace cgra {
         // except the GPU objects are released first
         Mesh & operator=(const Mesh &m) {
             m_vertices = m.m_vertices;
-            m_indices = m.m_indices;
+            m_indices = m.m_vertices.empty() ? std::vector<unsigned int>() : m.m_indices;
+            m_gpuVertexCount = 0;
+            m_verticesChanged = false;
             m_drawWireframe = m.m_drawWireframe;
 
             deleteMesh();
@@ -116,6 +165,8 @@ namespace cgra {
         Mesh(Mesh &&m)
             : m_vertices(std::move(m.m_vertices)),
               m_indices(std::move(m.m_indices)),
+              m_gpuVertexCount(m.m_gpuVertexCount),
+              m_verticesChanged(m.m_verticesChanged),
               m_drawWireframe(m.m_drawWireframe),
               m_vao(m.m_vao), m_vbo(m.m_vbo), m_ibo(m.m_ibo) {
             m.m_vao = 0;
@@ -128,6 +179,8 @@ namespace cgra {
         Mesh & operator=(Mesh &&m) {
             m_vertices = std::move(m.m_vertices);
             m_indices = std::move(m.m_indices);
+            m_gpuVertexCount = m.m_gpuVertexCount;
+            m_verticesChanged = m.m_verticesChanged;
             m_drawWireframe = m.m_drawWireframe;
 
             deleteMesh();
@@ -0,0 +1,116 @@
+#include <atomic>
+#include <stdexcept>
+
+#include "meshadjacency.hpp"
+#include "threadpool.hpp"
+
+namespace cgra {
+
+    // Vertices each task of the thread pool handles at least
+    static const size_t VERTEX_CHUNK = 4096;
+
+    // The corner after and before `vertex` in a triangle, going the way it winds
+    static inline void otherCorners(const std::vector<unsigned int> &triangle, unsigned int vertex,
+                                    unsigned int &after, unsigned int &before) {
+        int c = triangle[0] == vertex ? 0 : (triangle[1] == vertex ? 1 : 2);
+        after = triangle[(c + 1) % 3];
+        before = triangle[(c + 2) % 3];
+    }
+
+    // The triangles are counted and bucketed by corner, which is the only
+    // pass over all of them. Each ring is then put in order on its own by
+    // following the triangles round, which is cheap as there are only five
+    // or six of them on a subdivided sphere
+    MeshAdjacency::MeshAdjacency(size_t numVertices, const std::vector<std::vector<unsigned int>> &triangles) {
+        ThreadPool &pool = ThreadPool::shared();
+        m_offsets.assign(numVertices + 1, 0);
+        for (const std::vector<unsigned int> &triangle : triangles) {
+            if (triangle.size() != 3 || triangle[0] >= numVertices || triangle[1] >= numVertices || triangle[2] >= numVertices) {
+                throw std::runtime_error("Error: triangle refers to a vertex that doesn't exist");
+            }
+            m_offsets[triangle[0] + 1]++;
+            m_offsets[triangle[1] + 1]++;
+            m_offsets[triangle[2] + 1]++;
+        }
+        for (size_t i = 0; i < numVertices; i++) {
+            m_offsets[i + 1] += m_offsets[i];
+        }
+        size_t edges = m_offsets[numVertices];
+        std::vector<unsigned int> unordered(edges);
+        std::vector<unsigned int> next(m_offsets.begin(), m_offsets.end() - 1);
+        for (size_t f = 0; f < triangles.size(); f++) {
+            for (unsigned int corner : triangles[f]) {
+                unordered[next[corner]++] = unsigned(f);
+            }
+        }
+
+        m_neighbours.resize(edges);
+        m_faces.resize(edges);
+        m_reverse.resize(edges);
+        std::atomic<bool> closed(true);
+        pool.parallelFor(0, numVertices, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end && closed; i++) {
+                unsigned int first = m_offsets[i], last = m_offsets[i + 1];
+                if (first == last) continue;
+                // The triangle after each one shares the corner that comes before i in it
+                unsigned int face = unordered[first];
+                for (unsigned int e = first; e < last; e++) {
+                    unsigned int after, before;
+                    otherCorners(triangles[face], unsigned(i), after, before);
+                    m_neighbours[e] = after;
+                    m_faces[e] = face;
+                    if (e + 1 == last) {
+                        if (before != m_neighbours[first]) closed = false;
+                        break;
+                    }
+                    bool found = false;
+                    for (unsigned int k = first; k < last && !found; k++) {
+                        unsigned int candidate, unused;
+                        otherCorners(triangles[unordered[k]], unsigned(i), candidate, unused);
+                        if (candidate == before) {
+                            face = unordered[k];
+                            found = true;
+                        }
+                    }
+                    if (!found) {
+                        closed = false;
+                        break;
+                    }
+                }
+            }
+        }, VERTEX_CHUNK);
+        if (!closed) {
+            throw std::runtime_error("Error: triangles don't make a closed surface");
+        }
+
+        pool.parallelFor(0, numVertices, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                for (unsigned int e = m_offsets[i]; e < m_offsets[i + 1]; e++) {
+                    unsigned int j = m_neighbours[e], back = m_offsets[j];
+                    while (back < m_offsets[j + 1] && m_neighbours[back] != i) {
+                        back++;
+                    }
+                    m_reverse[e] = back;
+                }
+            }
+        }, VERTEX_CHUNK);
+    }
+
+    void MeshAdjacency::normals(const std::vector<glm::vec3> &positions, std::vector<glm::vec3> &normals) const {
+        if (positions.size() < size()) {
+            throw std::runtime_error("Error: normals need a position for every vertex");
+        }
+        normals.resize(size());
+        ThreadPool::shared().parallelFor(0, size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                glm::vec3 centre = positions[i], sum(0.0f);
+                unsigned int first = m_offsets[i], last = m_offsets[i + 1];
+                for (unsigned int e = first; e < last; e++) {
+                    unsigned int following = e + 1 < last ? e + 1 : first;
+                    sum += glm::cross(positions[m_neighbours[e]] - centre, positions[m_neighbours[following]] - centre);
+                }
+                normals[i] = glm::normalize(sum);
+            }
+        }, VERTEX_CHUNK);
+    }
+}
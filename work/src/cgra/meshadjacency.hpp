@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+namespace cgra {
+
+    // The one-ring of every vertex of a closed triangle mesh, stored as
+    // compressed rows: the ring of vertex i is the entries from begin(i)
+    // up to end(i). Each entry e is an edge from i to neighbour(e), and
+    // the rings go round in the same direction as the triangles wind, so
+    // face(e) is the triangle with corners i, neighbour(e) and the
+    // neighbour of the next entry. On a closed mesh a vertex has as many
+    // triangles as neighbours, so both share the one set of rows.
+    //
+    // Loops over the rows only ever write to their own vertex, so a pass
+    // over the mesh can gather from its neighbours on any number of
+    // threads without locks.
+    class MeshAdjacency {
+    public:
+        MeshAdjacency() { }
+
+        // Throws std::runtime_error if a triangle uses a vertex past
+        // `numVertices`, or the triangles don't make a closed surface
+        // (every edge in exactly two triangles, wound the same way)
+        MeshAdjacency(size_t numVertices, const std::vector<std::vector<unsigned int>> &triangles);
+
+        size_t size() const { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+        // Counting each direction, so twice the edges of the mesh
+        size_t edges() const { return m_neighbours.size(); }
+
+        unsigned int begin(size_t i) const { return m_offsets[i]; }
+        unsigned int end(size_t i) const { return m_offsets[i + 1]; }
+        unsigned int valence(size_t i) const { return m_offsets[i + 1] - m_offsets[i]; }
+
+        unsigned int neighbour(unsigned int e) const { return m_neighbours[e]; }
+        unsigned int face(unsigned int e) const { return m_faces[e]; }
+        // The same edge the other way, in the neighbour's ring
+        unsigned int reverse(unsigned int e) const { return m_reverse[e]; }
+
+        // Normal of each vertex, the sum of its triangles' normals weighted
+        // by their area. Gathers round the rings instead of scattering each
+        // triangle to its corners, so it splits over the shared thread pool
+        void normals(const std::vector<glm::vec3> &positions, std::vector<glm::vec3> &normals) const;
+
+    private:
+        std::vector<unsigned int> m_offsets;
+        std::vector<unsigned int> m_neighbours;
+        std::vector<unsigned int> m_faces;
+        std::vector<unsigned int> m_reverse;
+    };
+}
@@ -0,0 +1,114 @@
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+#include "meshregistry.hpp"
+#include "wavefront.hpp"
+
+namespace cgra {
+
+    // 64 bit FNV-1a, only used to tell meshes apart
+    static void hashBytes(uint64_t &hash, const void *data, size_t size) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ull;
+        }
+    }
+
+    MeshRegistry::Handle MeshRegistry::get(const std::string &key, const std::function<void(Mesh &)> &build) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_meshes.find(key);
+            if (found != m_meshes.end()) {
+                if (Handle mesh = found->second.lock()) {
+                    return mesh;
+                }
+            }
+        }
+
+        // Build without holding the lock, it can take a while
+        Handle mesh = std::make_shared<Mesh>();
+        build(*mesh);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::weak_ptr<Mesh> &entry = m_meshes[key];
+        if (Handle other = entry.lock()) {
+            // Someone else made it in the meantime
+            return other;
+        }
+        entry = mesh;
+
+        // Forget meshes that nothing uses any more
+        for (auto i = m_meshes.begin(); i != m_meshes.end();) {
+            if (i->second.expired()) {
+                i = m_meshes.erase(i);
+            } else {
+                ++i;
+            }
+        }
+        return mesh;
+    }
+
+    MeshRegistry::Handle MeshRegistry::fromData(const Matrix<double> &vertices,
+                                                const Matrix<unsigned int> &triangles,
+                                                const std::vector<glm::vec3> &vertColours) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        unsigned int sizes[] = { vertices.numRows(), triangles.numRows() };
+        hashBytes(hash, sizes, sizeof(sizes));
+        for (unsigned int r = 0; r < vertices.numRows(); r++) {
+            hashBytes(hash, vertices[r], sizeof(double) * vertices.numCols());
+        }
+        for (unsigned int r = 0; r < triangles.numRows(); r++) {
+            hashBytes(hash, triangles[r], sizeof(unsigned int) * triangles.numCols());
+        }
+        if (!vertColours.empty()) {
+            hashBytes(hash, &vertColours[0], sizeof(glm::vec3) * vertColours.size());
+        }
+
+        std::ostringstream key;
+        key << "data:" << std::hex << hash;
+        return get(key.str(), [&](Mesh &mesh) {
+            mesh.setData(vertices, triangles, vertColours);
+        });
+    }
+
+    MeshRegistry::Handle MeshRegistry::loadObj(const char *filename, const glm::vec3 &colour) {
+        std::ostringstream key;
+        key << "obj:" << filename << ":" << colour.x << "," << colour.y << "," << colour.z;
+        return get(key.str(), [&](Mesh &mesh) {
+            Wavefront::IndexedMesh obj = Wavefront::loadIndexed(filename);
+            unsigned int numTriangles = (unsigned int)obj.m_indices.size() / 3;
+
+            Matrix<double> vertices((unsigned int)obj.m_positions.size(), 3);
+            Matrix<unsigned int> triangles(numTriangles, 3);
+            for (unsigned int i = 0; i < obj.m_positions.size(); i++) {
+                const glm::vec3 &p = obj.m_positions[i];
+                vertices.setRow(i, { p.x, p.y, p.z });
+            }
+            for (unsigned int i = 0; i < numTriangles; i++) {
+                triangles.setRow(i, { obj.m_indices[i * 3], obj.m_indices[i * 3 + 1], obj.m_indices[i * 3 + 2] });
+            }
+            mesh.setData(vertices, triangles, std::vector<glm::vec3>(obj.m_positions.size(), colour));
+        });
+    }
+
+    MeshRegistry::Stats MeshRegistry::stats() const {
+        Stats stats;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &entry : m_meshes) {
+            if (Handle mesh = entry.second.lock()) {
+                stats.assets++;
+                // Not counting the one just taken
+                stats.references += size_t(mesh.use_count() - 1);
+                stats.bytes += mesh->getMemoryBytes();
+            }
+        }
+        return stats;
+    }
+
+    MeshRegistry &MeshRegistry::shared() {
+        static MeshRegistry registry;
+        return registry;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "matrix.hpp"
+#include "mesh.hpp"
+
+namespace cgra {
+
+    // Keeps a single copy of meshes that many objects draw, so the
+    // same geometry is only uploaded to the GPU once. Meshes are handed
+    // out as shared pointers and are freed once the last one is dropped.
+    // The meshes are shared, so don't change them after they are made.
+    class MeshRegistry {
+    public:
+        typedef std::shared_ptr<Mesh> Handle;
+
+        struct Stats {
+            // Meshes currently alive
+            size_t assets = 0;
+            // Handles to them held outside the registry
+            size_t references = 0;
+            // Size of their vertex and index data, which is also what
+            // they take on the GPU once drawn
+            size_t bytes = 0;
+        };
+
+        // Returns the mesh stored under `key`, calling `build` to fill
+        // in a new mesh if there isn't one
+        Handle get(const std::string &key, const std::function<void(Mesh &)> &build);
+
+        // Returns a mesh made from this data (see Mesh::setData), shared
+        // with every other mesh made from exactly the same data
+        Handle fromData(const Matrix<double> &vertices,
+                        const Matrix<unsigned int> &triangles,
+                        const std::vector<glm::vec3> &vertColours);
+
+        // Loads a Wavefront file once per path and colour. Throws if the
+        // file can't be loaded
+        Handle loadObj(const char *filename, const glm::vec3 &colour);
+
+        Stats stats() const;
+
+        // The registry shared by the whole program
+        static MeshRegistry &shared();
+
+    private:
+        mutable std::mutex m_mutex;
+        std::map<std::string, std::weak_ptr<Mesh>> m_meshes;
+    };
+}
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "programcache.hpp"
+
+namespace cgra {
+
+    // Bump this if the file layout or anything baked into a program
+    // (like how attributes are bound) changes
+    static const char CACHE_MAGIC[8] = { 'C', 'G', 'R', 'A', 'P', 'R', 'G', '1' };
+
+    // 64 bit FNV-1a, only used to name cache entries
+    static void hashBytes(uint64_t &hash, const void *data, size_t size) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ull;
+        }
+    }
+
+    static std::string readFile(const std::string &filename) {
+        std::ifstream file(filename, std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            std::ostringstream msgStream;
+            msgStream << "Cannot open file '" << filename << "'";
+            throw std::runtime_error(msgStream.str());
+        }
+        std::stringstream sstr;
+        sstr << file.rdbuf();
+        return sstr.str();
+    }
+
+    static std::string glString(GLenum name) {
+        const GLubyte *s = glGetString(name);
+        return s ? std::string(reinterpret_cast<const char *>(s)) : std::string();
+    }
+
+    // Prints the log of whatever went wrong and aborts
+    static void failProgram(GLuint program, const std::vector<GLuint> &shaders) {
+        for (GLuint shader : shaders) {
+            GLint isCompiled = 0;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
+            if (isCompiled == GL_FALSE) {
+                GLint maxLength = 0;
+                glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
+                std::string infoLog(std::max(maxLength, 1), 0);
+                glGetShaderInfoLog(shader, maxLength, &maxLength, &infoLog[0]);
+                std::cerr << "Failed to compile shader:\n" << infoLog << std::endl;
+                abort();
+            }
+        }
+        GLint maxLength = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength);
+        std::string infoLog(std::max(maxLength, 1), 0);
+        glGetProgramInfoLog(program, maxLength, &maxLength, &infoLog[0]);
+        std::cerr << "Failed to link program:\n" << infoLog << std::endl;
+        abort();
+    }
+
+    bool ProgramCache::supported() const {
+        if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+            return false;
+        }
+        // Some drivers have the functions but no formats to save in
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        return numFormats > 0;
+    }
+
+    std::vector<GLuint> ProgramCache::load(const std::vector<ProgramSource> &sources) {
+        auto startTime = std::chrono::steady_clock::now();
+        bool useCache = !m_directory.empty() && supported();
+        std::string driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+
+        struct Entry {
+            std::vector<std::string> code;
+            std::string path;
+            GLuint program = 0;
+            std::vector<GLuint> shaders;
+        };
+        std::vector<Entry> entries(sources.size());
+        std::vector<GLuint> programs(sources.size(), 0);
+
+        for (size_t i = 0; i < sources.size(); i++) {
+            Entry &entry = entries[i];
+            uint64_t hash = 0xCBF29CE484222325ull;
+            hashBytes(hash, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+            hashBytes(hash, driver.data(), driver.size());
+            for (const auto &stage : sources[i].stages) {
+                entry.code.push_back(readFile(stage.second));
+                hashBytes(hash, &stage.first, sizeof(stage.first));
+                hashBytes(hash, entry.code.back().data(), entry.code.back().size() + 1);
+            }
+            for (const auto &attribute : sources[i].attributes) {
+                hashBytes(hash, &attribute.first, sizeof(attribute.first));
+                hashBytes(hash, attribute.second.c_str(), attribute.second.size() + 1);
+            }
+            if (!useCache) continue;
+
+            char name[32];
+            std::snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)hash);
+            entry.path = m_directory + name;
+
+            // Header, then the driver it came from (in case of a hash collision), then the binary
+            std::ifstream file(entry.path, std::ios::in | std::ios::binary);
+            char magic[sizeof(CACHE_MAGIC)];
+            uint32_t format = 0, driverLength = 0, length = 0;
+            if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0) continue;
+            if (!file.read(reinterpret_cast<char *>(&format), sizeof(format))) continue;
+            if (!file.read(reinterpret_cast<char *>(&driverLength), sizeof(driverLength)) || driverLength != driver.size()) continue;
+            std::string storedDriver(driverLength, 0);
+            if (!file.read(&storedDriver[0], driverLength) || storedDriver != driver) continue;
+            if (!file.read(reinterpret_cast<char *>(&length), sizeof(length)) || length == 0) continue;
+            std::vector<char> binary(length);
+            if (!file.read(&binary[0], length)) continue;
+
+            GLuint program = glCreateProgram();
+            glProgramBinary(program, format, &binary[0], GLsizei(length));
+            GLint isLinked = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+            if (isLinked == GL_TRUE) {
+                programs[i] = program;
+                m_stats.hits++;
+            } else {
+                // The driver changed under us, compile it again below
+                glDeleteProgram(program);
+            }
+        }
+
+        // Submit everything that still needs compiling before checking any of it
+        for (size_t i = 0; i < sources.size(); i++) {
+            if (programs[i] != 0) continue;
+            Entry &entry = entries[i];
+            for (size_t s = 0; s < sources[i].stages.size(); s++) {
+                GLuint shader = glCreateShader(sources[i].stages[s].first);
+                const char *src = entry.code[s].c_str();
+                glShaderSource(shader, 1, &src, nullptr);
+                glCompileShader(shader);
+                entry.shaders.push_back(shader);
+            }
+        }
+        for (size_t i = 0; i < sources.size(); i++) {
+            Entry &entry = entries[i];
+            if (programs[i] != 0) continue;
+            entry.program = glCreateProgram();
+            for (GLuint shader : entry.shaders) {
+                glAttachShader(entry.program, shader);
+            }
+            for (const auto &attribute : sources[i].attributes) {
+                glBindAttribLocation(entry.program, attribute.first, attribute.second.c_str());
+            }
+            if (useCache) {
+                glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            }
+            glLinkProgram(entry.program);
+        }
+
+        for (size_t i = 0; i < sources.size(); i++) {
+            Entry &entry = entries[i];
+            if (programs[i] != 0) continue;
+            m_stats.misses++;
+
+            GLint isLinked = 0;
+            glGetProgramiv(entry.program, GL_LINK_STATUS, &isLinked);
+            if (isLinked == GL_FALSE) {
+                failProgram(entry.program, entry.shaders);
+            }
+            // Link was successful, the shader stages aren't needed any more
+            for (GLuint shader : entry.shaders) {
+                glDetachShader(entry.program, shader);
+                glDeleteShader(shader);
+            }
+            programs[i] = entry.program;
+            if (!useCache) continue;
+
+            GLint length = 0;
+            glGetProgramiv(entry.program, GL_PROGRAM_BINARY_LENGTH, &length);
+            if (length <= 0) continue;
+            std::vector<char> binary(length);
+            GLenum format = 0;
+            glGetProgramBinary(entry.program, length, &length, &format, &binary[0]);
+
+#ifdef _WIN32
+            _mkdir(m_directory.c_str());
+#else
+            mkdir(m_directory.c_str(), 0755);
+#endif
+            // Written to a temporary file first, so another copy of the
+            // program starting at the same time never sees half a file
+            std::ostringstream tempPath;
+            tempPath << entry.path << ".tmp" << std::hash<std::thread::id>()(std::this_thread::get_id())
+                << "_" << std::chrono::steady_clock::now().time_since_epoch().count();
+            {
+                std::ofstream file(tempPath.str(), std::ios::out | std::ios::binary);
+                uint32_t format32 = format, driverLength = uint32_t(driver.size()), length32 = uint32_t(length);
+                file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+                file.write(reinterpret_cast<const char *>(&format32), sizeof(format32));
+                file.write(reinterpret_cast<const char *>(&driverLength), sizeof(driverLength));
+                file.write(driver.data(), driver.size());
+                file.write(reinterpret_cast<const char *>(&length32), sizeof(length32));
+                file.write(&binary[0], length);
+                if (!file.good()) {
+                    std::cerr << "Warning: could not write program cache '" << tempPath.str() << "'" << std::endl;
+                }
+            }
+            if (std::rename(tempPath.str().c_str(), entry.path.c_str()) != 0) {
+                // Windows won't rename over an existing file
+                std::remove(entry.path.c_str());
+                if (std::rename(tempPath.str().c_str(), entry.path.c_str()) != 0) {
+                    std::remove(tempPath.str().c_str());
+                }
+            }
+        }
+
+        m_stats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        return programs;
+    }
+
+    ProgramCache &ProgramCache::shared() {
+        static ProgramCache cache([]() {
+            const char *dir = std::getenv("CGRA_PROGRAM_CACHE");
+            if (dir) {
+                return std::string(dir);
+            }
+#ifdef CGRA_PROGRAM_CACHE_DIR
+            return std::string(CGRA_PROGRAM_CACHE_DIR);
+#else
+            return std::string();
+#endif
+        }());
+        return cache;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opengl.hpp"
+
+namespace cgra {
+
+    // The files that make up one program, and the attribute
+    // locations to bind before linking it
+    struct ProgramSource {
+        // Shader type (e.g. GL_VERTEX_SHADER) and file name
+        std::vector<std::pair<GLenum, std::string>> stages;
+        std::vector<std::pair<GLuint, std::string>> attributes;
+    };
+
+    // Keeps linked programs on disk (from glGetProgramBinary) so later
+    // runs can skip compiling them. Entries are keyed by a hash of the
+    // shader sources and the driver's vendor, renderer and version.
+    // Anything that isn't cached, or that the driver won't take back, is
+    // compiled from source and the cache entry is rewritten.
+    class ProgramCache {
+    public:
+        struct Stats {
+            int hits = 0;
+            int misses = 0;
+            // Time spent in load, including compiling
+            double milliseconds = 0.0;
+        };
+
+        // An empty directory turns the cache off, everything is compiled
+        explicit ProgramCache(const std::string &directory) : m_directory(directory) { }
+
+        // Loads every program and returns their objects in the same order.
+        // Programs that have to be compiled are all submitted before any
+        // of them are checked, so drivers that compile in the background
+        // can work on them at the same time. Aborts if one doesn't compile,
+        // the same as Program::load_program always has.
+        std::vector<GLuint> load(const std::vector<ProgramSource> &sources);
+
+        // Whether the current context can save and load program binaries
+        bool supported() const;
+
+        const std::string &directory() const { return m_directory; }
+        const Stats &stats() const { return m_stats; }
+
+        // The cache used by Program::load_program. It lives in the
+        // CGRA_PROGRAM_CACHE environment variable's directory if that is
+        // set (empty turns it off), otherwise in the build directory
+        static ProgramCache &shared();
+
+    private:
+        std::string m_directory;
+        Stats m_stats;
+    };
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace cgra {
+
+    // The last `capacity` values pushed, oldest first. Once it's full
+    // each push reuses the slot of the oldest value, so values that own
+    // memory (like vectors) keep it from one time round to the next.
+    template <typename T>
+    class RingBuffer {
+    public:
+        explicit RingBuffer(size_t capacity = 1) : m_slots(capacity > 0 ? capacity : 1) { }
+
+        size_t capacity() const { return m_slots.size(); }
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+
+        // Forgets every value, and changes the capacity if one is given
+        void clear(size_t capacity = 0) {
+            if (capacity > 0) {
+                m_slots.resize(capacity);
+            }
+            m_first = 0;
+            m_size = 0;
+        }
+
+        // The slot for a new newest value, dropping the oldest if it's
+        // full. It still holds whatever was in it last
+        T &push() {
+            if (m_size == m_slots.size()) {
+                m_first = (m_first + 1) % m_slots.size();
+                m_size--;
+            }
+            m_size++;
+            return back();
+        }
+
+        // Drops the newest value
+        void popBack() {
+            if (m_size > 0) m_size--;
+        }
+
+        // Value i, counting from the oldest
+        T &operator[](size_t i) { return m_slots[(m_first + i) % m_slots.size()]; }
+        const T &operator[](size_t i) const { return m_slots[(m_first + i) % m_slots.size()]; }
+
+        T &front() { return (*this)[0]; }
+        const T &front() const { return (*this)[0]; }
+        T &back() { return (*this)[m_size - 1]; }
+        const T &back() const { return (*this)[m_size - 1]; }
+
+    private:
+        std::vector<T> m_slots;
+        size_t m_first = 0;
+        size_t m_size = 0;
+    };
+}
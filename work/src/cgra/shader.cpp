@@ -3,101 +3,49 @@
 #include <sstream>
 
 #include <stdexcept>
-#include "stb_image.h"
 
+#include "programcache.hpp"
 #include "shader.hpp"
 
 namespace cgra {
 
-    // Helper function for compiling a single shader stage
-    static GLuint compileShader(const char *src, GLenum type);
+    std::vector<Program> Program::load_programs(const std::vector<std::pair<std::string, std::string>> &files) {
+        std::vector<ProgramSource> sources;
+        for (const auto &f : files) {
+            ProgramSource source;
+            source.stages.push_back(std::make_pair(GLenum(GL_VERTEX_SHADER), f.first));
+            source.stages.push_back(std::make_pair(GLenum(GL_FRAGMENT_SHADER), f.second));
+            // Set the attribute locations
+            // 0 is the position.
+            // 1 is the normal.
+            source.attributes.push_back(std::make_pair(0u, std::string("vertPosition")));
+            source.attributes.push_back(std::make_pair(1u, std::string("vertexColor")));
+            sources.push_back(source);
+        }
 
-    // Helper function for reading a file into a string
-    static std::string read_all(std::ifstream &in) {
-        std::stringstream sstr;
-        sstr << in.rdbuf();
-        return sstr.str();
-    }
+        std::vector<Program> programs;
+        for (GLuint program : ProgramCache::shared().load(sources)) {
+            auto prog = Program(program);
 
-    // Helper function for reading a file into a string
-    static std::string read_all(const char *filename) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            std::ostringstream msgStream;
-            msgStream << "Cannot open file '" << filename << "'";
-            throw std::runtime_error(msgStream.str());
+            // Set default values for the matrices
+            prog.setModelMatrix(glm::mat4(1));
+            prog.setViewMatrix(glm::mat4(1));
+            prog.setProjectionMatrix(glm::mat4(1));
+
+            programs.push_back(prog);
         }
-        return read_all(file);
+        return programs;
     }
 
     Program Program::load_program(const char *vsFile, const char *fsFile) {
-        // Read the contents of the vertex and fragment shader files into memory
-        std::string vsSrc = read_all(vsFile);
-        std::string fsSrc = read_all(fsFile);
-
-        // Compile the shader stages.
-        GLuint vs = compileShader(vsSrc.c_str(), GL_VERTEX_SHADER);
-        GLuint fs = compileShader(fsSrc.c_str(), GL_FRAGMENT_SHADER);
-
-        // Create a new program object
-        GLuint program = glCreateProgram();
-
-        // Attach the shader stages to the program
-        glAttachShader(program, vs);
-        glAttachShader(program, fs);
-
-        // Set the attribute locations
-        // 0 is the position.
-        // 1 is the normal.
-        glBindAttribLocation(program, 0, "vertPosition");
-        glBindAttribLocation(program, 1, "vertexColor");
-
-        // Link the stages together. This must be done
-        // after setting the program
-        glLinkProgram(program);
-
-        // Check to see that the linking was successful
-        GLint isLinked = 0;
-        glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
-        if (isLinked == GL_FALSE) {
-            // Get the length of the error message
-            GLint maxLength = 0;
-            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength);
-
-            //The maxLength includes the NULL character
-            std::string infoLog(maxLength, 0);
-            glGetProgramInfoLog(program, maxLength, &maxLength, &infoLog[0]);
-
-            // Print an error message
-            std::cerr << "Failed to link program:\n" << infoLog << std::endl;
-
-            //We don't need the shader anymore.
-            glDeleteProgram(program);
-            glDeleteShader(vs);
-            glDeleteShader(fs);
-
-            // Abort the process.
-            abort();
-        }
-
-        // Link was successful, we can detach the shader stages from the
-        // program now
-        glDetachShader(program, vs);
-        glDetachShader(program, fs);
-
-        // We can also delete the shader objects, since we won't be using
-        // them again
-        glDeleteShader(vs);
-        glDeleteShader(fs);
-
-        auto prog = Program(program);
-
-        // Set default values for the matrices
-        prog.setModelMatrix(glm::mat4(1));
-        prog.setViewMatrix(glm::mat4(1));
-        prog.setProjectionMatrix(glm::mat4(1));
+        return load_programs({ std::make_pair(std::string(vsFile), std::string(fsFile)) })[0];
+    }
 
-        return prog;
+    Program Program::load_compute_program(const char *csFile) {
+        ProgramSource source;
+        source.stages.push_back(std::make_pair(GLenum(GL_COMPUTE_SHADER), std::string(csFile)));
+        // No matrices to set up, compute programs don't have them
+        return Program(ProgramCache::shared().load({ source })[0]);
     }
 
     void Program::use() {
@@ -142,70 +90,34 @@ namespace cgra {
         glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, &mat[0][0]);
     }
 
-    static GLuint compileShader(const char *src, GLenum type) {
-        // Create the shader object
-        GLuint shader = glCreateShader(type);
-        // Load the shader source into the object
-        glShaderSource(shader, 1, &src, nullptr);
-        // Compile the shader
-        glCompileShader(shader);
-
-        // Check to see if the compilation was successful
-        GLint isCompiled = 0;
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
-
-        if (isCompiled == GL_FALSE) {
-            // Get the length of the error message
-            GLint maxLength = 0;
-            glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
-
-            //The maxLength includes the NULL character
-            std::string infoLog(maxLength, 0);
-            glGetShaderInfoLog(shader, maxLength, &maxLength, &infoLog[0]);
-
-            // Print the error mesage
-            std::cerr << "Failed to compile shader:\n" << infoLog << std::endl;
-
-            //We don't need the shader anymore.
-            glDeleteShader(shader);
-
-            // Abort the process
-            abort();
-        }
-
-        return shader;
-    }
-
-	void Program::setBeta(const float &beta) {
+	void Program::setMorphFactor(float morph) {
 		if (m_program == 0) return;
 		use();
 
-		// Get the location of the beta uniform variable
-		GLint betaLoc = glGetUniformLocation(m_program, "beta");
-		glUniform1f(betaLoc, beta);
+		GLint morphLoc = glGetUniformLocation(m_program, "morphFactor");
+		glUniform1f(morphLoc, morph);
 	}
 
-	void Program::setViewerPosition(const glm::vec3 &viewerPos) {
+	void Program::setTransforms(GLuint unit) {
 		if (m_program == 0) return;
 		use();
-
-		// Get the location of the viewer position uniform variable
-		GLint viewerLoc = glGetUniformLocation(m_program, "viewerPos");
-		glUniform3f(viewerLoc, viewerPos.x, viewerPos.y, viewerPos.z);
+		glUniform1i(glGetUniformLocation(m_program, "transforms"), unit);
 	}
 
-	void Program::specifyLeafTexture(std::string filename) {
-		glGenTextures(1, &greenLeafTexture);
-		glBindTexture(GL_TEXTURE_2D, greenLeafTexture);
+	void Program::setDrawIndex(int index) {
+		if (m_program == 0) return;
+		use();
+		glUniform1i(drawIndexLocation, index);
+	}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	void Program::setLeafTextures(GLuint textureArray) {
+		leafTextures = textureArray;
+	}
 
-		int width, height, nrChannels;
-		unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrChannels, 0);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	void Program::setLeafLayer(int layer) {
+		if (m_program == 0) return;
+		use();
+		glUniform1i(glGetUniformLocation(m_program, "leafLayer"), layer);
 	}
 
 
@@ -217,7 +129,7 @@ namespace cgra {
 
 		GLuint TextureID = glGetUniformLocation(m_program, "myTextureSampler");
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, greenLeafTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, leafTextures);
 		// Set our "myTextureSampler" sampler to use Texture Unit 0
 		glUniform1i(TextureID, 0);
 
@@ -226,27 +138,31 @@ namespace cgra {
 
 		glUniform2f(BillboardSizeID, 0.1f, 0.1f);     // and 1m*12cm, because it matches its 256*32 resolution =)
 
-		static const GLfloat g_vertex_buffer_data[] = {
-		 -0.5f, -0.5f, 0.0f,
-		  0.5f, -0.5f, 0.0f,
-		 -0.5f,  0.5f, 0.0f,
-		  0.5f,  0.5f, 0.0f,
-		};
-		GLuint billboard_vertex_buffer;
-		glGenBuffers(1, &billboard_vertex_buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, billboard_vertex_buffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_DYNAMIC_DRAW);
-
+		// The quad is made once, core profiles need it in a vertex array
+		if (billboardVao == 0) {
+			static const GLfloat g_vertex_buffer_data[] = {
+			 -0.5f, -0.5f, 0.0f,
+			  0.5f, -0.5f, 0.0f,
+			 -0.5f,  0.5f, 0.0f,
+			  0.5f,  0.5f, 0.0f,
+			};
+			glGenVertexArrays(1, &billboardVao);
+			glBindVertexArray(billboardVao);
+			GLuint billboard_vertex_buffer;
+			glGenBuffers(1, &billboard_vertex_buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, billboard_vertex_buffer);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
+			glVertexAttribPointer(
+				2,                  // attribute. No particular reason for 0, but must match the layout in the shader.
+				3,                  // size
+				GL_FLOAT,           // type
+				GL_FALSE,           // normalized?
+				0,                  // stride
+				(void*)0            // array buffer offset
+			);
+		}
+		glBindVertexArray(billboardVao);
 		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, billboard_vertex_buffer);
-		glVertexAttribPointer(
-			2,                  // attribute. No particular reason for 0, but must match the layout in the shader.
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
 	}
 
 	void Program::buildAirlightData(const char *filename, std::vector<GLubyte> &textureData, int uResolution, int vResolution) {
@@ -4,22 +4,42 @@
 #include <vector>
 #include "glm/glm.hpp"
 #include <string>
+#include <utility>
 namespace cgra {
 
     class Program {
         // The OpenGL object representing the program
         GLuint m_program;
-		unsigned int greenLeafTexture;
-
-        Program(GLuint prog) : m_program(prog) { }
+		// Texture array with a leaf layer per biome
+		GLuint leafTextures = 0;
+		// The quad leaves are drawn with
+		GLuint billboardVao = 0;
+		// Location of "drawIndex", it changes every draw
+		GLint drawIndexLocation = -1;
+
+        Program(GLuint prog) : m_program(prog) {
+            if (prog != 0) {
+                drawIndexLocation = glGetUniformLocation(prog, "drawIndex");
+            }
+        }
     public:
         Program() : m_program(0) { }
 
         // Load the program from two files, a vertex shader and
         // a fragment shader.
+        // Compiled programs are kept in the ProgramCache, so later runs
+        // can skip compiling them.
         static Program load_program(const char *vertex_shader_file,
                                     const char *fragment_shader_file);
 
+        // Load several programs from (vertex shader, fragment shader)
+        // file pairs at once, so they can be compiled side by side
+        static std::vector<Program> load_programs(const std::vector<std::pair<std::string, std::string>> &files);
+
+        // Load a compute program from a single file. Needs OpenGL 4.3
+        // or ARB_compute_shader
+        static Program load_compute_program(const char *compute_shader_file);
+
         // Tells OpenGL to use this shader program
         void use();
 
@@ -40,13 +60,20 @@ namespace cgra {
         // 2D coordinates
         void setProjectionMatrix(const glm::mat4 &);
 
-		// Sets the beta variable that controls the level of fog
-		void setBeta(const float &);
+		// Sets how far vertices are blended towards their morph targets
+		void setMorphFactor(float);
+
+		// Sets the texture unit the TransformBatch of each frame is bound to
+		void setTransforms(GLuint unit);
+
+		// Sets which entry of the TransformBatch the next draws use
+		void setDrawIndex(int index);
 
-		// Sets the position of the viewer. Used for shading calculation
-		void setViewerPosition(const glm::vec3 &);
+		// Sets the leaf texture array (see TextureLayers::upload)
+		void setLeafTextures(GLuint textureArray);
 
-		void specifyLeafTexture(std::string filename);
+		// Sets which layer of the leaf textures to draw with
+		void setLeafLayer(int layer);
 
 
 
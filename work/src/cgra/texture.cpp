@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "stb_image.h"
+
+#include "texture.hpp"
+#include "threadpool.hpp"
+
+namespace cgra {
+
+    // Bump the version if the layout changes
+    static const char TEXTURE_MAGIC[4] = { 'C', 'T', 'E', 'X' };
+    static const uint32_t TEXTURE_VERSION = 1;
+
+    // An RGBA8 image
+    struct Image {
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    static Image decodeImage(const std::string &filename) {
+        Image image;
+        int channels = 0;
+        // Always ask for RGBA, whatever the file has
+        unsigned char *data = stbi_load(filename.c_str(), &image.width, &image.height, &channels, 4);
+        if (!data) {
+            std::ostringstream msgStream;
+            msgStream << "Cannot load image '" << filename << "': " << stbi_failure_reason();
+            throw std::runtime_error(msgStream.str());
+        }
+        image.pixels.assign(data, data + size_t(image.width) * image.height * 4);
+        stbi_image_free(data);
+        return image;
+    }
+
+    // Bilinear resample, only used when layers come in different sizes
+    static Image resizeImage(const Image &src, int width, int height) {
+        if (src.width == width && src.height == height) {
+            return src;
+        }
+        Image dst;
+        dst.width = width;
+        dst.height = height;
+        dst.pixels.resize(size_t(width) * height * 4);
+        for (int y = 0; y < height; y++) {
+            float sy = glm::clamp((y + 0.5f) * src.height / height - 0.5f, 0.0f, float(src.height - 1));
+            int y0 = int(sy), y1 = glm::min(y0 + 1, src.height - 1);
+            float fy = sy - y0;
+            for (int x = 0; x < width; x++) {
+                float sx = glm::clamp((x + 0.5f) * src.width / width - 0.5f, 0.0f, float(src.width - 1));
+                int x0 = int(sx), x1 = glm::min(x0 + 1, src.width - 1);
+                float fx = sx - x0;
+                for (int c = 0; c < 4; c++) {
+                    auto at = [&](int px, int py) { return float(src.pixels[(size_t(py) * src.width + px) * 4 + c]); };
+                    float top = at(x0, y0) * (1 - fx) + at(x1, y0) * fx;
+                    float bottom = at(x0, y1) * (1 - fx) + at(x1, y1) * fx;
+                    dst.pixels[(size_t(y) * width + x) * 4 + c] = (unsigned char)(top * (1 - fy) + bottom * fy + 0.5f);
+                }
+            }
+        }
+        return dst;
+    }
+
+    // Halves a level with a 2x2 box filter. Colours are weighted by alpha so
+    // the transparent (usually black) texels around cut out leaves don't
+    // bleed into the smaller levels.
+    static void downsample(const unsigned char *src, int srcWidth, int srcHeight,
+                           unsigned char *dst, int dstWidth, int dstHeight) {
+        for (int y = 0; y < dstHeight; y++) {
+            for (int x = 0; x < dstWidth; x++) {
+                float colour[3] = { 0, 0, 0 };
+                float alpha = 0, plain[3] = { 0, 0, 0 };
+                for (int dy = 0; dy < 2; dy++) {
+                    for (int dx = 0; dx < 2; dx++) {
+                        int sx = glm::min(x * 2 + dx, srcWidth - 1);
+                        int sy = glm::min(y * 2 + dy, srcHeight - 1);
+                        const unsigned char *p = src + (size_t(sy) * srcWidth + sx) * 4;
+                        float a = p[3];
+                        for (int c = 0; c < 3; c++) {
+                            colour[c] += p[c] * a;
+                            plain[c] += p[c];
+                        }
+                        alpha += a;
+                    }
+                }
+                unsigned char *out = dst + (size_t(y) * dstWidth + x) * 4;
+                for (int c = 0; c < 3; c++) {
+                    out[c] = (unsigned char)(alpha > 0 ? colour[c] / alpha + 0.5f : plain[c] / 4 + 0.5f);
+                }
+                out[3] = (unsigned char)(alpha / 4 + 0.5f);
+            }
+        }
+    }
+
+    std::vector<TextureLayers::Source> TextureLayers::readList(const std::string &listFile) {
+        std::ifstream file(listFile);
+        if (!file.is_open()) {
+            std::ostringstream msgStream;
+            msgStream << "Cannot open file '" << listFile << "'";
+            throw std::runtime_error(msgStream.str());
+        }
+        // Files are relative to the list
+        size_t slash = listFile.find_last_of("/\\");
+        std::string dir = slash == std::string::npos ? std::string() : listFile.substr(0, slash + 1);
+
+        std::vector<Source> sources;
+        std::string line;
+        while (std::getline(file, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream lineStream(line);
+            Source source;
+            if (!(lineStream >> source.filename)) continue;
+            source.filename = dir + source.filename;
+            float r, g, b;
+            if (lineStream >> r >> g >> b) {
+                source.tint = glm::vec3(r, g, b);
+            }
+            sources.push_back(source);
+        }
+        return sources;
+    }
+
+    TextureLayers TextureLayers::build(const std::vector<Source> &sources, bool mipmaps) {
+        TextureLayers result;
+        if (sources.empty()) {
+            return result;
+        }
+
+        // Decoding is the slow part, so each image gets its own task
+        // Errors are passed back rather than thrown on the workers
+        std::vector<Image> images(sources.size());
+        std::vector<std::string> errors(sources.size());
+        ThreadPool::shared().parallelFor(0, sources.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                try {
+                    images[i] = decodeImage(sources[i].filename);
+                } catch (std::exception &e) {
+                    errors[i] = e.what();
+                }
+            }
+        });
+        for (const std::string &error : errors) {
+            if (!error.empty()) {
+                throw std::runtime_error(error);
+            }
+        }
+
+        result.width = images[0].width;
+        result.height = images[0].height;
+        result.layers = int(images.size());
+        size_t layerBytes = size_t(result.width) * result.height * 4;
+        result.levels.push_back(std::vector<unsigned char>(layerBytes * result.layers));
+        for (size_t i = 0; i < images.size(); i++) {
+            Image image = resizeImage(images[i], result.width, result.height);
+            unsigned char *dst = &result.levels[0][layerBytes * i];
+            glm::vec3 tint = glm::clamp(sources[i].tint, glm::vec3(0.0f), glm::vec3(1.0f));
+            for (size_t p = 0; p < layerBytes; p += 4) {
+                for (int c = 0; c < 3; c++) {
+                    dst[p + c] = (unsigned char)(image.pixels[p + c] * tint[c] + 0.5f);
+                }
+                dst[p + 3] = image.pixels[p + 3];
+            }
+        }
+
+        if (mipmaps) {
+            for (int level = 1; result.levelWidth(level - 1) > 1 || result.levelHeight(level - 1) > 1; level++) {
+                int srcWidth = result.levelWidth(level - 1), srcHeight = result.levelHeight(level - 1);
+                int dstWidth = result.levelWidth(level), dstHeight = result.levelHeight(level);
+                size_t srcBytes = size_t(srcWidth) * srcHeight * 4, dstBytes = size_t(dstWidth) * dstHeight * 4;
+                result.levels.push_back(std::vector<unsigned char>(dstBytes * result.layers));
+                for (int i = 0; i < result.layers; i++) {
+                    downsample(&result.levels[level - 1][srcBytes * i], srcWidth, srcHeight,
+                               &result.levels[level][dstBytes * i], dstWidth, dstHeight);
+                }
+            }
+        }
+        return result;
+    }
+
+    bool TextureLayers::load(const std::string &filename, TextureLayers &layers) {
+        std::ifstream file(filename, std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        char magic[4];
+        uint32_t header[5]; // version, width, height, layers, levels
+        if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, TEXTURE_MAGIC, sizeof(magic)) != 0) return false;
+        if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != TEXTURE_VERSION) return false;
+
+        TextureLayers result;
+        result.width = int(header[1]);
+        result.height = int(header[2]);
+        result.layers = int(header[3]);
+        if (result.width <= 0 || result.height <= 0 || result.layers <= 0 || header[4] == 0 || header[4] > 32) return false;
+        for (uint32_t level = 0; level < header[4]; level++) {
+            size_t bytes = size_t(result.levelWidth(level)) * result.levelHeight(level) * 4 * result.layers;
+            result.levels.push_back(std::vector<unsigned char>(bytes));
+            if (!file.read(reinterpret_cast<char *>(&result.levels.back()[0]), bytes)) return false;
+        }
+        layers = std::move(result);
+        return true;
+    }
+
+    bool TextureLayers::save(const std::string &filename) const {
+        std::ofstream file(filename, std::ios::out | std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        uint32_t header[5] = { TEXTURE_VERSION, uint32_t(width), uint32_t(height), uint32_t(layers), uint32_t(levels.size()) };
+        file.write(TEXTURE_MAGIC, sizeof(TEXTURE_MAGIC));
+        file.write(reinterpret_cast<const char *>(header), sizeof(header));
+        for (const auto &level : levels) {
+            file.write(reinterpret_cast<const char *>(&level[0]), level.size());
+        }
+        return file.good();
+    }
+
+    std::shared_future<TextureLayers> TextureLayers::loadAsync(const std::string &listFile, const std::string &bakedFile) {
+        auto promise = std::make_shared<std::promise<TextureLayers>>();
+        std::shared_future<TextureLayers> future = promise->get_future().share();
+        ThreadPool::shared().submit([promise, listFile, bakedFile] {
+            try {
+                TextureLayers layers;
+                if (bakedFile.empty() || !load(bakedFile, layers)) {
+                    layers = build(readList(listFile));
+                }
+                promise->set_value(std::move(layers));
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+        return future;
+    }
+
+    GLuint TextureLayers::upload() const {
+        if (empty()) {
+            return 0;
+        }
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t level = 0; level < levels.size(); level++) {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, GLint(level), GL_RGBA8, levelWidth(int(level)), levelHeight(int(level)), layers,
+                         0, GL_RGBA, GL_UNSIGNED_BYTE, &levels[level][0]);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, GLint(levels.size()) - 1);
+        return texture;
+    }
+}
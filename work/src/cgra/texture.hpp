@@ -0,0 +1,55 @@
+#pragma once
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include "opengl.hpp"
+#include "glm/glm.hpp"
+
+namespace cgra {
+
+    // RGBA8 images of the same size stacked into layers, each with a full
+    // mip chain. This is what gets uploaded as a texture array, and what
+    // texbake writes out so it can be loaded again without decoding.
+    class TextureLayers {
+    public:
+        // One layer, an image file and a colour its pixels are multiplied by
+        struct Source {
+            std::string filename;
+            glm::vec3 tint = glm::vec3(1.0f);
+        };
+
+        int width = 0;
+        int height = 0;
+        int layers = 0;
+        // levels[l] holds every layer of mip level l, one after the other
+        std::vector<std::vector<unsigned char>> levels;
+
+        int levelWidth(int level) const { return glm::max(1, width >> level); }
+        int levelHeight(int level) const { return glm::max(1, height >> level); }
+        bool empty() const { return layers == 0; }
+
+        // Reads a layer list. Each line is an image file (relative to the
+        // list) optionally followed by the r g b tint, '#' starts a comment
+        static std::vector<Source> readList(const std::string &listFile);
+
+        // Decodes every layer across the shared thread pool, scales them to
+        // the size of the first one, tints them and builds the mip chains.
+        // Throws if an image can't be loaded
+        static TextureLayers build(const std::vector<Source> &sources, bool mipmaps = true);
+
+        // Reads a file written by save. Returns false if it's missing or
+        // not a valid texture file
+        static bool load(const std::string &filename, TextureLayers &layers);
+        bool save(const std::string &filename) const;
+
+        // Loads `bakedFile` if it can, otherwise builds the layers from
+        // `listFile`. Runs on the shared thread pool
+        static std::shared_future<TextureLayers> loadAsync(const std::string &listFile, const std::string &bakedFile);
+
+        // Creates a GL_TEXTURE_2D_ARRAY with every mip level and
+        // trilinear filtering, returns the texture object
+        GLuint upload() const;
+    };
+}
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "threadpool.hpp"
+
+namespace cgra {
+
+    ThreadPool::ThreadPool(unsigned int numThreads) : m_stopping(false) {
+        if (numThreads == 0) {
+            unsigned int hw = std::thread::hardware_concurrency();
+            numThreads = (hw > 1) ? hw - 1 : 1;
+        }
+        for (unsigned int i = 0; i < numThreads; i++) {
+            m_workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (std::thread &t : m_workers) {
+            t.join();
+        }
+    }
+
+    void ThreadPool::workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+                if (m_tasks.empty()) return; // Stopping and nothing left to do
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    void ThreadPool::submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_wake.notify_one();
+    }
+
+    void ThreadPool::parallelFor(size_t begin, size_t end,
+                                 const std::function<void(size_t, size_t)> &body,
+                                 size_t minChunk) {
+        if (end <= begin) return;
+        size_t count = end - begin;
+        minChunk = std::max<size_t>(minChunk, 1);
+
+        // A few ranges per thread so uneven work still balances out
+        size_t maxRanges = size_t(size() + 1) * 4;
+        size_t numRanges = std::min(maxRanges, (count + minChunk - 1) / minChunk);
+        if (numRanges <= 1) {
+            body(begin, end);
+            return;
+        }
+        size_t rangeSize = (count + numRanges - 1) / numRanges;
+        numRanges = (count + rangeSize - 1) / rangeSize;
+
+        // Shared with the helper tasks, which may still be queued after
+        // this call has returned
+        struct Job {
+            std::atomic<size_t> next;
+            std::atomic<size_t> done;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        auto job = std::make_shared<Job>();
+        job->next = 0;
+        job->done = 0;
+
+        // Runs ranges until there are none left
+        auto run = [job, begin, end, rangeSize, numRanges](const std::function<void(size_t, size_t)> *fn) {
+            size_t r;
+            while ((r = job->next++) < numRanges) {
+                size_t rb = begin + r * rangeSize;
+                size_t re = std::min(end, rb + rangeSize);
+                (*fn)(rb, re);
+                if (++job->done == numRanges) {
+                    std::lock_guard<std::mutex> lock(job->mutex);
+                    job->finished.notify_all();
+                }
+            }
+        };
+
+        // `body` is only touched while ranges remain, and the caller
+        // doesn't return until they have all finished
+        const std::function<void(size_t, size_t)> *fn = &body;
+        size_t helpers = std::min<size_t>(size(), numRanges - 1);
+        for (size_t i = 0; i < helpers; i++) {
+            submit([run, fn] { run(fn); });
+        }
+        run(fn);
+
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [&job, numRanges] { return job->done == numRanges; });
+    }
+
+    ThreadPool &ThreadPool::shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cgra {
+
+    // A fixed set of worker threads that run submitted tasks
+    // in the order they were submitted.
+    class ThreadPool {
+        std::vector<std::thread> m_workers;
+        std::deque<std::function<void()>> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        bool m_stopping;
+
+        void workerLoop();
+
+    public:
+        // Creates `numThreads` workers. 0 means one less than the
+        // number of hardware threads (but at least one), leaving a
+        // core for the thread that renders.
+        explicit ThreadPool(unsigned int numThreads = 0);
+
+        // Finishes the tasks already queued, then joins the workers
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool & operator=(const ThreadPool &) = delete;
+
+        // Queues a task to run on a worker thread
+        void submit(std::function<void()> task);
+
+        // Splits [begin, end) into ranges of at least `minChunk` items
+        // and calls `body(rangeBegin, rangeEnd)` for each of them across
+        // the workers and the calling thread. Returns once every range is
+        // done. The ranges only depend on the arguments, not on timing.
+        void parallelFor(size_t begin, size_t end,
+                         const std::function<void(size_t, size_t)> &body,
+                         size_t minChunk = 1);
+
+        // Sorts [first, last) with a slice per thread, then merges
+        // neighbouring slices in pairs until one is left. Fewer than
+        // `minParallel` items are sorted on the calling thread
+        template <typename RandomIt>
+        void parallelSort(RandomIt first, RandomIt last, size_t minParallel = 8192) {
+            size_t n = size_t(last - first);
+            size_t parts = n < minParallel ? 1 : size() + 1;
+            size_t slice = (n + parts - 1) / parts;
+            parallelFor(0, parts, [&](size_t begin, size_t end) {
+                for (size_t p = begin; p < end; p++) {
+                    std::sort(first + std::min(n, p * slice), first + std::min(n, (p + 1) * slice));
+                }
+            });
+            for (size_t width = slice; width < n; width *= 2) {
+                parallelFor(0, (n + 2 * width - 1) / (2 * width), [&](size_t begin, size_t end) {
+                    for (size_t p = begin; p < end; p++) {
+                        size_t merge = p * 2 * width;
+                        std::inplace_merge(first + merge, first + std::min(n, merge + width),
+                                           first + std::min(n, merge + 2 * width));
+                    }
+                });
+            }
+        }
+
+        // Number of worker threads
+        unsigned int size() const {
+            return (unsigned int)m_workers.size();
+        }
+
+        // The pool shared by the whole program
+        static ThreadPool &shared();
+    };
+}
@@ -0,0 +1,131 @@
+#include <algorithm>
+
+#include "threadpool.hpp"
+#include "transformbatch.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CGRA_TRANSFORM_SSE
+#endif
+
+namespace cgra {
+
+    // Below this many models it isn't worth waking the workers
+    static const size_t PARALLEL_CHUNK = 512;
+
+#ifdef CGRA_TRANSFORM_SSE
+    // a * b, building each column of the result from the columns of a
+    static inline void multiply(const __m128 a[4], const glm::mat4 &b, glm::mat4 &out) {
+        for (int c = 0; c < 4; c++) {
+            __m128 column = _mm_mul_ps(a[0], _mm_set1_ps(b[c][0]));
+            column = _mm_add_ps(column, _mm_mul_ps(a[1], _mm_set1_ps(b[c][1])));
+            column = _mm_add_ps(column, _mm_mul_ps(a[2], _mm_set1_ps(b[c][2])));
+            column = _mm_add_ps(column, _mm_mul_ps(a[3], _mm_set1_ps(b[c][3])));
+            _mm_storeu_ps(&out[c][0], column);
+        }
+    }
+
+    static inline __m128 cross(__m128 a, __m128 b) {
+        __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+        return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+    }
+#endif
+
+    // The inverse transpose of the top left 3x3 of `m`. Its columns are the
+    // cross products of the other two columns of m over the determinant,
+    // so there's no general inverse needed
+    static inline void normalMatrix(const glm::mat4 &m, glm::vec4 normal[3]) {
+#ifdef CGRA_TRANSFORM_SSE
+        // The w of each cross product comes out as zero whatever the w of the columns
+        __m128 c0 = _mm_loadu_ps(&m[0][0]);
+        __m128 c1 = _mm_loadu_ps(&m[1][0]);
+        __m128 c2 = _mm_loadu_ps(&m[2][0]);
+        __m128 n0 = cross(c1, c2);
+        __m128 n1 = cross(c2, c0);
+        __m128 n2 = cross(c0, c1);
+        float products[4];
+        _mm_storeu_ps(products, _mm_mul_ps(c0, n0));
+        float det = products[0] + products[1] + products[2];
+        __m128 scale = _mm_set1_ps(det != 0.0f ? 1.0f / det : 1.0f);
+        _mm_storeu_ps(&normal[0][0], _mm_mul_ps(n0, scale));
+        _mm_storeu_ps(&normal[1][0], _mm_mul_ps(n1, scale));
+        _mm_storeu_ps(&normal[2][0], _mm_mul_ps(n2, scale));
+#else
+        glm::vec3 c0(m[0]), c1(m[1]), c2(m[2]);
+        glm::vec3 n0 = glm::cross(c1, c2);
+        float det = glm::dot(c0, n0);
+        float scale = det != 0.0f ? 1.0f / det : 1.0f;
+        normal[0] = glm::vec4(n0 * scale, 0.0f);
+        normal[1] = glm::vec4(glm::cross(c2, c0) * scale, 0.0f);
+        normal[2] = glm::vec4(glm::cross(c0, c1) * scale, 0.0f);
+#endif
+    }
+
+    TransformBatch::~TransformBatch() {
+        if (m_buffer != 0) {
+            glDeleteTextures(1, &m_texture);
+            glDeleteBuffers(1, &m_buffer);
+        }
+    }
+
+    void TransformBatch::clear() {
+        m_models.clear();
+    }
+
+    int TransformBatch::add(const glm::mat4 &model) {
+        m_models.push_back(model);
+        return int(m_models.size() - 1);
+    }
+
+    void TransformBatch::compute(const glm::mat4 &view, const glm::mat4 &projection) {
+        m_transforms.resize(m_models.size());
+        glm::mat4 viewProjection = projection * view;
+        ThreadPool::shared().parallelFor(0, m_models.size(), [&](size_t begin, size_t end) {
+#ifdef CGRA_TRANSFORM_SSE
+            __m128 v[4], vp[4];
+            for (int c = 0; c < 4; c++) {
+                v[c] = _mm_loadu_ps(&view[c][0]);
+                vp[c] = _mm_loadu_ps(&viewProjection[c][0]);
+            }
+#endif
+            for (size_t i = begin; i < end; i++) {
+                const glm::mat4 &model = m_models[i];
+                Transform &out = m_transforms[i];
+#ifdef CGRA_TRANSFORM_SSE
+                multiply(v, model, out.modelView);
+                multiply(vp, model, out.modelViewProjection);
+#else
+                out.modelView = view * model;
+                out.modelViewProjection = viewProjection * model;
+#endif
+                normalMatrix(out.modelView, out.normal);
+            }
+        }, PARALLEL_CHUNK);
+    }
+
+    void TransformBatch::upload(GLuint unit) {
+        if (m_buffer == 0) {
+            glGenBuffers(1, &m_buffer);
+            glGenTextures(1, &m_texture);
+            glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(Transform), nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_buffer);
+        }
+
+        // Orphan the last frames data, empty buffers aren't allowed so keep at least one entry
+        size_t bytes = m_transforms.size() * sizeof(Transform);
+        glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, sizeof(Transform)), nullptr, GL_STREAM_DRAW);
+        if (bytes > 0) {
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, m_transforms.data());
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "opengl.hpp"
+#include "glm/glm.hpp"
+
+namespace cgra {
+
+    // The model matrices of everything drawn in a frame, kept in one
+    // array. The matrices the vertex shader needs (model view, model
+    // view projection and the normal matrix) are worked out for all of
+    // them in a single pass, then uploaded together as one texture
+    // buffer. Each draw only says which entry it uses, see
+    // Program::setDrawIndex.
+    class TransformBatch {
+    public:
+        // One entry, laid out as the texels the shader reads
+        struct Transform {
+            glm::mat4 modelView;
+            glm::mat4 modelViewProjection;
+            // Columns of the normal matrix, w is unused
+            glm::vec4 normal[3];
+        };
+        static const int TEXELS_PER_TRANSFORM = sizeof(Transform) / sizeof(glm::vec4);
+
+        TransformBatch() { }
+        ~TransformBatch();
+
+        TransformBatch(const TransformBatch &) = delete;
+        TransformBatch & operator=(const TransformBatch &) = delete;
+
+        // Forgets the models of the last frame
+        void clear();
+
+        // Adds a model matrix, returns the draw index it gets
+        int add(const glm::mat4 &model);
+
+        size_t size() const { return m_models.size(); }
+        const glm::mat4 &model(int index) const { return m_models[index]; }
+
+        // Works out every entry for this camera. Doesn't use OpenGL
+        void compute(const glm::mat4 &view, const glm::mat4 &projection);
+        const std::vector<Transform> &transforms() const { return m_transforms; }
+
+        // Uploads the entries from the last compute and binds them to
+        // texture unit `unit`
+        void upload(GLuint unit);
+
+    private:
+        std::vector<glm::mat4> m_models;
+        std::vector<Transform> m_transforms;
+        GLuint m_buffer = 0;
+        GLuint m_texture = 0;
+    };
+}
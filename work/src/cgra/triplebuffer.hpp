@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+
+namespace cgra {
+
+    // Hands values from one writer thread to one reader thread without
+    // either of them ever waiting on the other. The writer fills its own
+    // buffer and publishes it by swapping it with the middle one, the
+    // reader picks up the middle one by swapping it with its own. The
+    // reader always sees the newest complete value, values the reader
+    // never got to are just skipped.
+    template <typename T>
+    class TripleBuffer {
+    public:
+        TripleBuffer() : m_middle(1) { }
+
+        TripleBuffer(const TripleBuffer &) = delete;
+        TripleBuffer & operator=(const TripleBuffer &) = delete;
+
+        // Writer thread only. The buffer to fill in, it still holds
+        // whatever was in it the last time round
+        T &writeBuffer() { return m_buffers[m_write]; }
+
+        // Writer thread only. Makes the write buffer the newest value
+        void publish() {
+            m_write = m_middle.exchange(m_write | FRESH, std::memory_order_acq_rel) & INDEX;
+        }
+
+        // Reader thread only. Picks up the newest value if there's one
+        // the reader hasn't seen, returns whether there was
+        bool update() {
+            if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) {
+                return false;
+            }
+            m_read = m_middle.exchange(m_read, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+
+        // Reader thread only. The value from the last update
+        const T &readBuffer() const { return m_buffers[m_read]; }
+
+    private:
+        static const unsigned int INDEX = 3;
+        // Set on the middle index when it holds a value the reader hasn't taken
+        static const unsigned int FRESH = 4;
+
+        T m_buffers[3];
+        unsigned int m_write = 0;
+        std::atomic<unsigned int> m_middle;
+        unsigned int m_read = 2;
+    };
+}
@@ -1,144 +1,572 @@
-#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
-#include <sstream>
-
+#include <iostream>
+#include <iterator>
 #include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
+#include "threadpool.hpp"
 #include "wavefront.hpp"
 
 namespace cgra {
-    // Helper function for checking the next character in
-    // a stream and advancing if it matches the given character
-    static bool eat(std::istream &stream, char c) {
-        if (!stream.good()) return false;
-        if (stream.peek() == c) {
-            stream.ignore(1);
-            return true;
-        } else {
-            return false;
+    namespace {
+        // Files smaller than this are parsed in one go on the calling thread
+        const size_t MIN_CHUNK_BYTES = 1 << 20;
+
+        // A read only view of a whole file. It's memory mapped where possible,
+        // so pages are only read in as the parser reaches them, and nothing is
+        // copied into a string first.
+        class MappedFile {
+            const char *m_data = nullptr;
+            size_t m_size = 0;
+            // Used when the file can't be mapped (e.g. it's empty)
+            std::string m_fallback;
+#ifdef _WIN32
+            HANDLE m_file = INVALID_HANDLE_VALUE;
+            HANDLE m_mapping = nullptr;
+#endif
+
+            void readFallback(const char *filename) {
+                std::ifstream file(filename, std::ios::in | std::ios::binary);
+                if (!file.is_open()) {
+                    throw std::runtime_error("Error: could not open file for reading");
+                }
+                m_fallback.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+                m_data = m_fallback.data();
+                m_size = m_fallback.size();
+            }
+
+        public:
+            explicit MappedFile(const char *filename) {
+#ifdef _WIN32
+                m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+                if (m_file == INVALID_HANDLE_VALUE) {
+                    throw std::runtime_error("Error: could not open file for reading");
+                }
+                LARGE_INTEGER size;
+                if (GetFileSizeEx(m_file, &size) && size.QuadPart > 0) {
+                    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                    if (m_mapping) {
+                        m_data = (const char *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+                        m_size = size_t(size.QuadPart);
+                    }
+                }
+                if (!m_data) {
+                    readFallback(filename);
+                }
+#else
+                int fd = open(filename, O_RDONLY);
+                if (fd < 0) {
+                    throw std::runtime_error("Error: could not open file for reading");
+                }
+                struct stat info;
+                if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                    void *data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (data != MAP_FAILED) {
+                        madvise(data, size_t(info.st_size), MADV_SEQUENTIAL);
+                        m_data = (const char *)data;
+                        m_size = size_t(info.st_size);
+                    }
+                }
+                // The mapping stays valid after the descriptor is closed
+                close(fd);
+                if (!m_data) {
+                    readFallback(filename);
+                }
+#endif
+            }
+
+            ~MappedFile() {
+                bool mapped = m_data && m_data != m_fallback.data();
+#ifdef _WIN32
+                if (mapped) UnmapViewOfFile(m_data);
+                if (m_mapping) CloseHandle(m_mapping);
+                if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+                if (mapped) munmap((void *)m_data, m_size);
+#endif
+            }
+
+            MappedFile(const MappedFile &) = delete;
+            MappedFile & operator=(const MappedFile &) = delete;
+
+            const char *data() const { return m_data; }
+            size_t size() const { return m_size; }
+        };
+
+        // A face vertex as it's written in the file. Negative (relative) indices
+        // are turned into indices relative to the start of the chunk they are in,
+        // since the chunks before it haven't been counted yet.
+        struct RawVertex {
+            Wavefront::VertexType type;
+            int p, t, n;
+            // Bits 0, 1 and 2 are set when p, t and n are relative to the chunk
+            unsigned char relative;
+        };
+
+        // Everything parsed from one piece of the file
+        struct Chunk {
+            const char *begin, *end;
+            std::vector<glm::vec4> positions;
+            std::vector<glm::vec3> texCoords;
+            std::vector<glm::vec3> normals;
+            std::vector<RawVertex> vertices;
+            // Number of vertices in each face, in order
+            std::vector<unsigned int> faceSizes;
+            size_t lines = 0;
+            // Line within the chunk, and the message
+            std::vector<std::pair<size_t, const char *>> warnings;
+        };
+
+        inline bool isSpace(char c) {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
         }
-    }
 
-    Wavefront Wavefront::load(const char *filename, bool expectTriangles) {
-        Wavefront wavefront;
+        inline bool isDigit(char c) {
+            return c >= '0' && c <= '9';
+        }
 
-        // Open the file
-        std::ifstream file(filename, std::ios::in);
-        if (!file.is_open()) {
-            throw std::runtime_error("Error: could not open file for reading");
+        inline const char *skipSpaces(const char *p, const char *end) {
+            while (p < end && isSpace(*p)) p++;
+            return p;
         }
 
-        std::string line;
-        std::string mode;
-        size_t lineNumber = 0;
-        while (file.good()) {
-            // Get the next line in the file
-            std::getline(file, line);
-            lineNumber++;
-
-            // Skip comments
-            if (line[0] == '#') continue;
-
-            // Create a stream for the line
-            std::istringstream lineStream(line);
-
-            // Clear the previous mode
-            mode.clear();
-            lineStream >> mode;
-
-            // Empty line or comment
-            if (mode.size() == 0 || mode[0] == '#') continue;
-
-            if (mode == "v") {
-                // Vertex Position
-                // Wavefront positions can have three or four components
-                float x, y, z, w;
-                w = 1.0f;
-                lineStream >> x >> y >> z >> w;
-                wavefront.m_positions.push_back(glm::vec4(x, y, z, w));
-            } else if (mode == "vt") {
-                // Vertex Texture Coordinate
-                // Wavefront texture coordinates can have two or three components
-                float u, v, w;
-                w = 0.0f;
-
-                lineStream >> u >> v >> w;
-                wavefront.m_texCoords.push_back(glm::vec3(u, v, w));
-            } else if (mode == "vn") {
-                // Vertex Normal
-                // Wavefront normals always have three components
-                float x, y, z;
-                lineStream >> x >> y >> z;
-                wavefront.m_normals.push_back(glm::vec3(x, y, z));
-            } else if (mode == "f") {
-                // Face specification
-                // Wavefront faces consist of 3 or more vertices.
-                // Each vertex must have a position, but can also have an
-                // optional normal and/or texture coordinate. The indices are
-                // separated by '/'. There are 4 cases:
-                //
-                //    pos
-                //    pos/texCoord
-                //    pos//normal
-                //    pos/texCoord/normal
-
-                Face f;
-                // Reserve space for at least 3 vertices
-                f.m_vertices.reserve(3);
-                while (lineStream.good()) {
-                    VertexType type = VT_P;
-                    int p, t = 0, n = 0;
-
-                    // Read the position index
-                    lineStream >> p;
-                    if (lineStream.fail()) break;
-
-                    // Use the `eat` helper function to check for the
-                    // presence of '/' characters that indicate what kind
-                    // index we have
-                    if (eat(lineStream, '/')) {
-                        if (eat(lineStream, '/')) {
-                            type = VT_PN;
-                            lineStream >> n;
-                        } else {
-                            type = VT_PT;
-                            lineStream >> t;
-                            if (eat(lineStream, '/')) {
-                                type = VT_PTN;
-                                lineStream >> n;
-                            }
+        // Parses an integer, returns nullptr if there isn't one
+        const char *parseInt(const char *p, const char *end, int &out) {
+            bool negative = false;
+            if (p < end && (*p == '-' || *p == '+')) {
+                negative = *p == '-';
+                p++;
+            }
+            if (p == end || !isDigit(*p)) return nullptr;
+            int value = 0;
+            while (p < end && isDigit(*p)) {
+                value = value * 10 + (*p - '0');
+                p++;
+            }
+            out = negative ? -value : value;
+            return p;
+        }
+
+        double powerOfTen(int e) {
+            // Exactly representable, so scaling by these rounds once
+            static const double table[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+            return e <= 22 ? table[e] : std::pow(10.0, e);
+        }
+
+        // Parses a decimal float (with optional exponent), returns nullptr if
+        // there isn't one. Much faster than going through a stream, and only
+        // off from strtof in the last bit for the odd value.
+        const char *parseFloat(const char *p, const char *end, float &out) {
+            bool negative = false;
+            if (p < end && (*p == '-' || *p == '+')) {
+                negative = *p == '-';
+                p++;
+            }
+            // Up to 19 significant digits fit in 64 bits, the rest only move the exponent
+            uint64_t mantissa = 0;
+            int significant = 0;
+            int exponent = 0;
+            bool anyDigits = false;
+            while (p < end && isDigit(*p)) {
+                anyDigits = true;
+                if (significant < 19) {
+                    mantissa = mantissa * 10 + uint64_t(*p - '0');
+                    if (mantissa) significant++;
+                } else {
+                    exponent++;
+                }
+                p++;
+            }
+            if (p < end && *p == '.') {
+                p++;
+                while (p < end && isDigit(*p)) {
+                    anyDigits = true;
+                    if (significant < 19) {
+                        mantissa = mantissa * 10 + uint64_t(*p - '0');
+                        if (mantissa) significant++;
+                        exponent--;
+                    }
+                    p++;
+                }
+            }
+            if (!anyDigits) return nullptr;
+
+            if (p < end && (*p == 'e' || *p == 'E')) {
+                const char *q = p + 1;
+                bool negativeExponent = false;
+                if (q < end && (*q == '-' || *q == '+')) {
+                    negativeExponent = *q == '-';
+                    q++;
+                }
+                if (q < end && isDigit(*q)) {
+                    int e = 0;
+                    while (q < end && isDigit(*q)) {
+                        if (e < 10000) e = e * 10 + (*q - '0');
+                        q++;
+                    }
+                    exponent += negativeExponent ? -e : e;
+                    p = q;
+                }
+            }
+
+            double value = double(mantissa);
+            if (exponent < 0) {
+                value /= powerOfTen(-exponent);
+            } else if (exponent > 0) {
+                value *= powerOfTen(exponent);
+            }
+            out = float(negative ? -value : value);
+            return p;
+        }
+
+        // Reads up to `count` floats into `values`, leaving the rest as they are
+        void parseFloats(const char *p, const char *end, float *values, int count) {
+            for (int i = 0; i < count; i++) {
+                p = skipSpaces(p, end);
+                const char *next = parseFloat(p, end, values[i]);
+                if (!next) return;
+                p = next;
+            }
+        }
+
+        // Parses a face line (after the 'f') into the chunk
+        void parseFace(const char *p, const char *end, Chunk &chunk, bool expectTriangles) {
+            // Each vertex must have a position, but can also have an
+            // optional normal and/or texture coordinate. The indices are
+            // separated by '/'. There are 4 cases:
+            //
+            //    pos
+            //    pos/texCoord
+            //    pos//normal
+            //    pos/texCoord/normal
+            unsigned int count = 0;
+            while (true) {
+                p = skipSpaces(p, end);
+                RawVertex v = { Wavefront::VT_P, 0, 0, 0, 0 };
+                const char *next = parseInt(p, end, v.p);
+                if (!next) break;
+                p = next;
+
+                if (p < end && *p == '/') {
+                    p++;
+                    if (p < end && *p == '/') {
+                        p++;
+                        v.type = Wavefront::VT_PN;
+                        next = parseInt(p, end, v.n);
+                        if (next) p = next;
+                    } else {
+                        v.type = Wavefront::VT_PT;
+                        next = parseInt(p, end, v.t);
+                        if (next) p = next;
+                        if (p < end && *p == '/') {
+                            p++;
+                            v.type = Wavefront::VT_PTN;
+                            next = parseInt(p, end, v.n);
+                            if (next) p = next;
                         }
                     }
+                }
 
-                    // Convert from relative to absolute indices
-                    // Wavefront allows negative indices, which are intepreted to be
-                    // relative to the current list of values.
-                    // -1 is the most recent value, -2 is the one before that, etc.
-                    if (p < 0) p = wavefront.m_positions.size() - (p + 1);
-                    if (t < 0) t = wavefront.m_texCoords.size() - (t + 1);
-                    if (n < 0) n = wavefront.m_normals.size() - (n + 1);
+                // Wavefront allows negative indices, which are intepreted to be
+                // relative to the current list of values.
+                // -1 is the most recent value, -2 is the one before that, etc.
+                if (v.p < 0) { v.p += int(chunk.positions.size()) + 1; v.relative |= 1; }
+                if (v.t < 0) { v.t += int(chunk.texCoords.size()) + 1; v.relative |= 2; }
+                if (v.n < 0) { v.n += int(chunk.normals.size()) + 1; v.relative |= 4; }
 
-                    f.m_vertices.emplace_back(type, p, t, n);
+                chunk.vertices.push_back(v);
+                count++;
+            }
+
+            if (count < 3) {
+                // Faces shouldn't have less than three vertices, ever.
+                chunk.vertices.resize(chunk.vertices.size() - count);
+                chunk.warnings.emplace_back(chunk.lines, "Warning: face with less than 3 vertices");
+            } else {
+                // Faces can have more than three vertices, but that often isn't expected, so warn about
+                // it if we expect a triangluated mesh.
+                if (expectTriangles && count > 3) {
+                    chunk.warnings.emplace_back(chunk.lines, "Warning: face with more than 3 vertices");
                 }
+                chunk.faceSizes.push_back(count);
+            }
+        }
 
-                if (f.m_vertices.size() < 3) {
-                    // Faces shouldn't have less than three vertices, ever.
-                    std::cerr << '[' << lineNumber << "] Warning: face with less than 3 vertices" << std::endl;
-                } else {
-                    // Faces can have more than three vertices, but that often isn't expected, so warn about
-                    // it if we expect a triangluated mesh.
-                    if (expectTriangles && f.m_vertices.size() > 3) {
-                        std::cerr << '[' << lineNumber << "] Warning: face with more than 3 vertices" << std::endl;
+        void parseChunk(Chunk &chunk, bool expectTriangles) {
+            const char *p = chunk.begin;
+            while (p < chunk.end) {
+                const char *lineEnd = (const char *)std::memchr(p, '\n', size_t(chunk.end - p));
+                if (!lineEnd) lineEnd = chunk.end;
+                chunk.lines++;
+
+                p = skipSpaces(p, lineEnd);
+                // Anything other than these (comments, groups, materials) is skipped
+                if (lineEnd - p >= 2 && isSpace(p[1])) {
+                    if (p[0] == 'v') {
+                        // Vertex Position
+                        // Wavefront positions can have three or four components
+                        float v[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+                        parseFloats(p + 1, lineEnd, v, 4);
+                        chunk.positions.emplace_back(v[0], v[1], v[2], v[3]);
+                    } else if (p[0] == 'f') {
+                        parseFace(p + 1, lineEnd, chunk, expectTriangles);
+                    }
+                } else if (lineEnd - p >= 3 && p[0] == 'v' && isSpace(p[2])) {
+                    if (p[1] == 't') {
+                        // Vertex Texture Coordinate
+                        // Wavefront texture coordinates can have two or three components
+                        float v[3] = { 0.0f, 0.0f, 0.0f };
+                        parseFloats(p + 2, lineEnd, v, 3);
+                        chunk.texCoords.emplace_back(v[0], v[1], v[2]);
+                    } else if (p[1] == 'n') {
+                        // Vertex Normal
+                        // Wavefront normals always have three components
+                        float v[3] = { 0.0f, 0.0f, 0.0f };
+                        parseFloats(p + 2, lineEnd, v, 3);
+                        chunk.normals.emplace_back(v[0], v[1], v[2]);
                     }
-                    // Add the face to the list of faces
-                    wavefront.m_faces.push_back(f);
                 }
-            } else {
-                // Skip unrecognized things in the file
-                continue;
+                p = lineEnd + 1;
+            }
+        }
+
+        // The whole file, parsed, with every index made absolute
+        struct Parsed {
+            Wavefront wavefront; // Positions, normals and texture coordinates, but no faces yet
+            std::vector<Wavefront::Vertex> vertices;
+            std::vector<unsigned int> faceSizes;
+        };
+
+        // Splits the file into chunks on line boundaries, parses them in parallel,
+        // then joins them back together in order
+        void parseFile(const char *filename, bool expectTriangles, Parsed &parsed) {
+            MappedFile file(filename);
+            const char *data = file.data();
+            size_t size = file.size();
+
+            ThreadPool &pool = ThreadPool::shared();
+            size_t numChunks = std::max<size_t>(1, std::min<size_t>(size / MIN_CHUNK_BYTES, (pool.size() + 1) * 4));
+            std::vector<Chunk> chunks(numChunks);
+            size_t start = 0;
+            for (size_t i = 0; i < numChunks; i++) {
+                size_t stop = (i + 1 == numChunks) ? size : std::max(start, size / numChunks * (i + 1));
+                // Move the end to just after the next newline
+                if (stop < size) {
+                    const char *newline = (const char *)std::memchr(data + stop, '\n', size - stop);
+                    stop = newline ? size_t(newline - data) + 1 : size;
+                }
+                chunks[i].begin = data + start;
+                chunks[i].end = data + stop;
+                start = stop;
+            }
+
+            pool.parallelFor(0, numChunks, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    parseChunk(chunks[i], expectTriangles);
+                }
+            });
+
+            // Where each chunk's values start in the joined lists
+            std::vector<size_t> positionBase(numChunks + 1, 0), texCoordBase(numChunks + 1, 0), normalBase(numChunks + 1, 0);
+            std::vector<size_t> vertexBase(numChunks + 1, 0), faceBase(numChunks + 1, 0), lineBase(numChunks + 1, 0);
+            for (size_t i = 0; i < numChunks; i++) {
+                positionBase[i + 1] = positionBase[i] + chunks[i].positions.size();
+                texCoordBase[i + 1] = texCoordBase[i] + chunks[i].texCoords.size();
+                normalBase[i + 1] = normalBase[i] + chunks[i].normals.size();
+                vertexBase[i + 1] = vertexBase[i] + chunks[i].vertices.size();
+                faceBase[i + 1] = faceBase[i] + chunks[i].faceSizes.size();
+                lineBase[i + 1] = lineBase[i] + chunks[i].lines;
+            }
+
+            Wavefront &wavefront = parsed.wavefront;
+            wavefront.m_positions.resize(positionBase[numChunks]);
+            wavefront.m_texCoords.resize(texCoordBase[numChunks]);
+            wavefront.m_normals.resize(normalBase[numChunks]);
+            parsed.vertices.resize(vertexBase[numChunks], Wavefront::Vertex(Wavefront::VT_P, 0, 0, 0));
+            parsed.faceSizes.resize(faceBase[numChunks]);
+
+            pool.parallelFor(0, numChunks, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    Chunk &chunk = chunks[i];
+                    std::copy(chunk.positions.begin(), chunk.positions.end(), wavefront.m_positions.begin() + positionBase[i]);
+                    std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), wavefront.m_texCoords.begin() + texCoordBase[i]);
+                    std::copy(chunk.normals.begin(), chunk.normals.end(), wavefront.m_normals.begin() + normalBase[i]);
+                    std::copy(chunk.faceSizes.begin(), chunk.faceSizes.end(), parsed.faceSizes.begin() + faceBase[i]);
+                    for (size_t j = 0; j < chunk.vertices.size(); j++) {
+                        const RawVertex &v = chunk.vertices[j];
+                        parsed.vertices[vertexBase[i] + j] = Wavefront::Vertex(v.type,
+                            (unsigned int)(v.p + ((v.relative & 1) ? positionBase[i] : 0)),
+                            (unsigned int)(v.t + ((v.relative & 2) ? texCoordBase[i] : 0)),
+                            (unsigned int)(v.n + ((v.relative & 4) ? normalBase[i] : 0)));
+                    }
+                }
+            });
+
+            for (size_t i = 0; i < numChunks; i++) {
+                for (const auto &warning : chunks[i].warnings) {
+                    std::cerr << '[' << lineBase[i] + warning.first << "] " << warning.second << std::endl;
+                }
+            }
+        }
+
+        // Turns face vertices into deduplicated flat buffers
+        class IndexBuilder {
+            // Open addressing table from (p, t, n) to the vertex made for it.
+            // Position indices start at 1, so p == 0 marks an empty slot.
+            struct Slot {
+                unsigned int p, t, n;
+                unsigned int index;
+            };
+
+            const Wavefront &m_source;
+            std::vector<Slot> m_table;
+            size_t m_mask = 0;
+            std::vector<unsigned int> m_face;
+            bool m_anyNormals = false;
+            bool m_anyTexCoords = false;
+
+            static size_t hash(unsigned int p, unsigned int t, unsigned int n) {
+                uint64_t h = p * 0x9E3779B97F4A7C15ull;
+                h ^= (t + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2)) * 0xBF58476D1CE4E5B9ull;
+                h ^= (n + 0x8CB92BA72F3D8DD7ull + (h << 6) + (h >> 2)) * 0x94D049BB133111EBull;
+                return size_t(h ^ (h >> 31));
+            }
+
+            void resize(size_t capacity) {
+                std::vector<Slot> old;
+                old.swap(m_table);
+                m_table.assign(capacity, Slot{ 0, 0, 0, 0 });
+                m_mask = capacity - 1;
+                for (const Slot &slot : old) {
+                    if (slot.p == 0) continue;
+                    size_t i = hash(slot.p, slot.t, slot.n) & m_mask;
+                    while (m_table[i].p != 0) i = (i + 1) & m_mask;
+                    m_table[i] = slot;
+                }
             }
+
+            unsigned int vertexIndex(const Wavefront::Vertex &v) {
+                unsigned int p = v.m_p;
+                unsigned int t = v.hasTexCoord() ? v.m_t : 0;
+                unsigned int n = v.hasNormal() ? v.m_n : 0;
+                if (p < 1 || p > m_source.m_positions.size()
+                    || t > m_source.m_texCoords.size()
+                    || n > m_source.m_normals.size()) {
+                    throw std::runtime_error("Error: face refers to a vertex that doesn't exist");
+                }
+
+                size_t i = hash(p, t, n) & m_mask;
+                while (m_table[i].p != 0) {
+                    const Slot &slot = m_table[i];
+                    if (slot.p == p && slot.t == t && slot.n == n) {
+                        return slot.index;
+                    }
+                    i = (i + 1) & m_mask;
+                }
+
+                unsigned int index = (unsigned int)m_mesh.m_positions.size();
+                m_mesh.m_positions.push_back(glm::vec3(m_source.position(p)));
+                m_mesh.m_texCoords.push_back(t ? glm::vec2(m_source.texCoord(t)) : glm::vec2(0.0f));
+                m_mesh.m_normals.push_back(n ? m_source.normal(n) : glm::vec3(0.0f));
+                m_anyTexCoords |= t != 0;
+                m_anyNormals |= n != 0;
+                m_table[i] = Slot{ p, t, n, index };
+
+                // Keep the table at most half full
+                if (m_mesh.m_positions.size() * 2 > m_table.size()) {
+                    resize(m_table.size() * 2);
+                }
+                return index;
+            }
+
+        public:
+            Wavefront::IndexedMesh m_mesh;
+
+            IndexBuilder(const Wavefront &source, size_t numVertices) : m_source(source) {
+                size_t capacity = 16;
+                while (capacity < numVertices * 2) capacity *= 2;
+                resize(capacity);
+                m_mesh.m_positions.reserve(numVertices);
+            }
+
+            // Adds a face as a fan of triangles around its first vertex
+            void addFace(const Wavefront::Vertex *vertices, size_t count) {
+                m_face.clear();
+                for (size_t i = 0; i < count; i++) {
+                    m_face.push_back(vertexIndex(vertices[i]));
+                }
+                for (size_t i = 1; i + 1 < count; i++) {
+                    m_mesh.m_indices.push_back(m_face[0]);
+                    m_mesh.m_indices.push_back(m_face[i]);
+                    m_mesh.m_indices.push_back(m_face[i + 1]);
+                }
+            }
+
+            Wavefront::IndexedMesh finish() {
+                if (!m_anyNormals) m_mesh.m_normals.clear();
+                if (!m_anyTexCoords) m_mesh.m_texCoords.clear();
+                return std::move(m_mesh);
+            }
+        };
+    }
+
+    Wavefront Wavefront::load(const char *filename, bool expectTriangles) {
+        Parsed parsed;
+        parseFile(filename, expectTriangles, parsed);
+
+        Wavefront &wavefront = parsed.wavefront;
+        wavefront.m_faces.resize(parsed.faceSizes.size());
+        size_t first = 0;
+        for (size_t i = 0; i < parsed.faceSizes.size(); i++) {
+            auto begin = parsed.vertices.begin() + first;
+            wavefront.m_faces[i].m_vertices.assign(begin, begin + parsed.faceSizes[i]);
+            first += parsed.faceSizes[i];
         }
+        return std::move(wavefront);
+    }
 
-        return wavefront;
+    Wavefront::IndexedMesh Wavefront::loadIndexed(const char *filename) {
+        Parsed parsed;
+        parseFile(filename, false, parsed);
+
+        // Most files share vertices between a few faces, so this is a rough guess
+        IndexBuilder builder(parsed.wavefront, parsed.vertices.size() / 2);
+        size_t first = 0;
+        for (unsigned int count : parsed.faceSizes) {
+            builder.addFace(parsed.vertices.data() + first, count);
+            first += count;
+        }
+        return builder.finish();
+    }
+
+    Wavefront::IndexedMesh Wavefront::toIndexed() const {
+        IndexBuilder builder(*this, m_faces.size() * 3 / 2);
+        for (const Face &face : m_faces) {
+            builder.addFace(face.m_vertices.data(), face.m_vertices.size());
+        }
+        return builder.finish();
     }
 }
@@ -62,9 +62,32 @@ namespace cgra {
         // A list of faces.
         std::vector<Face> m_faces;
 
+        // Flat buffers that can be handed straight to the GPU. Every distinct
+        // position/texture coordinate/normal combination used by a face becomes
+        // one vertex, and faces are triangulated as fans.
+        // Indices here start at 0.
+        struct IndexedMesh {
+            std::vector<glm::vec3> m_positions;
+            // Empty if no face vertex has a normal, otherwise one per position
+            std::vector<glm::vec3> m_normals;
+            // Empty if no face vertex has a texture coordinate, otherwise one per position
+            std::vector<glm::vec2> m_texCoords;
+            // Three per triangle
+            std::vector<unsigned int> m_indices;
+        };
+
         // Load a wavefront file.
+        // The file is memory mapped and large files are parsed in chunks
+        // across the shared thread pool.
         static Wavefront load(const char *filename, bool expectTriangles = true);
 
+        // Load a wavefront file straight into flat index buffers, without
+        // building the per face lists.
+        static IndexedMesh loadIndexed(const char *filename);
+
+        // Builds flat index buffers from an already loaded file
+        IndexedMesh toIndexed() const;
+
         // Helper functions for querying vertex information
 
         glm::vec4 position(unsigned int i) const {
@@ -1,33 +1,54 @@
 #include "lightScene.hpp";
+#include "LightClusters.hpp"
+#include <algorithm>
 #include <stdio.h>
 
-LightScene::LightScene() {}
+// Texture units the light buffers are bound to, clear of the lookup tables
+static const int LIGHT_TEXTURE_UNIT = 3;
+// Uniform buffer binding of the LightFrame block
+static const GLuint LIGHT_FRAME_BINDING = 0;
 
-LightScene::LightScene(cgra::Program shader) {
+LightScene::LightScene() : m_clusters(std::make_shared<LightClusters>()) {}
+
+LightScene::LightScene(cgra::Program shader) : m_clusters(std::make_shared<LightClusters>()) {
 	m_program = shader;
 }
 
 void LightScene::init() {
-	m_numPointLightsLocation = glGetUniformLocation(m_program.getProgram(), "numPointLights");
+	// The uniforms below are set on whichever program is in use
+	m_program.use();
 
 	// Initialize directional light locations
 	m_dirLightLocation.color = glGetUniformLocation(m_program.getProgram(), "directionalLight.base.color");
 	m_dirLightLocation.intensity = glGetUniformLocation(m_program.getProgram(), "directionalLight.base.intensity");
 	m_dirLightLocation.direction = glGetUniformLocation(m_program.getProgram(), "directionalLight.direction");
 
-	// Initialize point light locations
-	for (unsigned int i = 0; i < NUM_POINT_LIGHTS; i++) {
-		char uniformName[128];
-
-		sprintf(uniformName, "pointLights[%d].base.color", i);
-		m_pointLightsLocation[i].color = glGetUniformLocation(m_program.getProgram(), uniformName);
-
-		sprintf(uniformName, "pointLights[%d].base.intensity", i);
-		m_pointLightsLocation[i].intensity = glGetUniformLocation(m_program.getProgram(), uniformName);
+	// Initialize the per frame uniform block
+	glGenBuffers(1, &m_frameBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_frameBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	GLuint frameBlock = glGetUniformBlockIndex(m_program.getProgram(), "LightFrame");
+	if (frameBlock != GL_INVALID_INDEX) {
+		glUniformBlockBinding(m_program.getProgram(), frameBlock, LIGHT_FRAME_BINDING);
+	}
 
-		sprintf(uniformName, "pointLights[%d].position", i);
-		m_pointLightsLocation[i].position = glGetUniformLocation(m_program.getProgram(), uniformName);
+	// Initialize point light buffers. Lights are four RGBA texels each (see LightClusters::Light),
+	// clusters are an offset and count into the light indices
+	const char *samplers[3] = { "lightData", "clusterData", "lightIndices" };
+	const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	glGenBuffers(3, m_buffers);
+	glGenTextures(3, m_bufferTextures);
+	for (int i = 0; i < 3; i++) {
+		glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+		glActiveTexture(GL_TEXTURE0 + LIGHT_TEXTURE_UNIT + i);
+		glBindTexture(GL_TEXTURE_BUFFER, m_bufferTextures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+		glUniform1i(glGetUniformLocation(m_program.getProgram(), samplers[i]), LIGHT_TEXTURE_UNIT + i);
 	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
 
 	// Build Airlight data
 	std::vector<GLubyte> airlightTextureData;
@@ -64,24 +85,59 @@ void LightScene::init() {
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, G20Tex);
 	glUniform1i(glGetUniformLocation(m_program.getProgram(), "G20"), 0);
-
-	m_program.setBeta(0.04);
 }
 
 void LightScene::setPointLights(unsigned int numLights, const PointLight * pLights) {
+	m_pointLights.assign(pLights, pLights + numLights);
+}
 
-	// Set uniform to designate number of lights
-	glUniform1i(m_numPointLightsLocation, numLights);
-
-	// Set uniform light attributes for each point light.
-	for (unsigned int i = 0; i < numLights; i++) {
-		glUniform3f(m_pointLightsLocation[i].color, pLights[i].color.r, pLights[i].color.g, pLights[i].color.b);
-		glUniform1f(m_pointLightsLocation[i].intensity, pLights[i].intensity);
-		glUniform3f(m_pointLightsLocation[i].position, pLights[i].position.x, pLights[i].position.y, pLights[i].position.z);
+void LightScene::update(const glm::mat4 &view, float fovY, float aspect, float zNear, float zFar, const glm::vec2 &viewportSize) {
+	m_clusters->build(m_pointLights, view, fovY, aspect, zNear, zFar, m_beta, m_viewerPosition);
+
+	// Orphan and refill each buffer, they change size with the number of lights
+	const void *data[3] = { m_clusters->lights().data(), m_clusters->clusters().data(), m_clusters->indices().data() };
+	size_t sizes[3] = {
+		m_clusters->lights().size() * sizeof(LightClusters::Light),
+		m_clusters->clusters().size() * sizeof(LightClusters::Cluster),
+		m_clusters->indices().size() * sizeof(uint32_t) };
+	for (int i = 0; i < 3; i++) {
+		glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+		// Empty buffers aren't allowed, keep at least one texel
+		glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(sizes[i], 16), nullptr, GL_STREAM_DRAW);
+		if (sizes[i] > 0) {
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+		}
+		glActiveTexture(GL_TEXTURE0 + LIGHT_TEXTURE_UNIT + i);
+		glBindTexture(GL_TEXTURE_BUFFER, m_bufferTextures[i]);
 	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+	FrameConstants frame;
+	frame.viewerPosition = m_viewerPosition;
+	frame.beta = m_beta;
+	frame.directAirlight = m_clusters->directAirlight();
+	frame.padding = 0.0f;
+	frame.viewportSize = viewportSize;
+	frame.sliceScale = m_clusters->sliceScale();
+	frame.sliceBias = m_clusters->sliceBias();
+	glBindBuffer(GL_UNIFORM_BUFFER, m_frameBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), &frame, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_FRAME_BINDING, m_frameBuffer);
+}
+
+void LightScene::setViewerPosition(const glm::vec3 &position) {
+	m_viewerPosition = position;
+}
+
+void LightScene::setBeta(float beta) {
+	m_beta = beta;
 }
 
 void LightScene::setDirectionalLight(const DirectionalLight& light) {
+	m_directionalLight = light;
+	m_program.use();
 	glUniform3f(m_dirLightLocation.color, light.color.r, light.color.g, light.color.b);
 	glUniform1f(m_dirLightLocation.intensity, light.intensity);
 	glm::vec3 direction = glm::normalize(light.direction);
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "opengl.hpp"
+#include <memory>
 #include <vector>
 
 #include "cgra/shader.hpp"
 #include "glm/glm.hpp"
 
+class LightClusters;
+
 // The Basic light struct. All types of lights are derived from this one.
 struct BaseLight {
 	glm::vec3 color;
@@ -50,14 +53,29 @@ struct DirectionalLight : public BaseLight {
 class LightScene {
 	cgra::Program m_program;
 
-	static const int NUM_POINT_LIGHTS = 5;
-	// An array of point light locations and their member variables locations.
-	// Used to easily reference uniform variables in the shader. 
-	struct {
-		GLuint color;
-		GLuint intensity;
-		GLuint position;
-	} m_pointLightsLocation[NUM_POINT_LIGHTS];
+	// Point lights in world space. They're clustered again every frame
+	// and handed to the shader through texture buffers, so there's no limit
+	// on how many there are.
+	std::vector<PointLight> m_pointLights;
+	std::shared_ptr<LightClusters> m_clusters;
+
+	// Buffers and the buffer textures that read them, for the lights,
+	// the clusters and the light indices of each cluster
+	GLuint m_buffers[3] = { 0, 0, 0 };
+	GLuint m_bufferTextures[3] = { 0, 0, 0 };
+
+	// Per frame constants of the shader, laid out like its LightFrame uniform
+	// block (std140). Set once in update() rather than uniform by uniform
+	struct FrameConstants {
+		glm::vec3 viewerPosition;
+		float beta;
+		glm::vec3 directAirlight;
+		float padding;
+		glm::vec2 viewportSize;
+		float sliceScale;
+		float sliceBias;
+	};
+	GLuint m_frameBuffer = 0;
 
 	// Struct used to represent the GL locations of directional light attributes.
 	struct {
@@ -66,12 +84,14 @@ class LightScene {
 		GLuint direction;
 	} m_dirLightLocation;
 
+	// How thick the fog is, see setBeta
+	float m_beta = 0.04f;
+	// Where the shader is told the viewer is
+	glm::vec3 m_viewerPosition = glm::vec3(0.0f);
+
 	// The single directional light in the scene. Represents the sun.
 	DirectionalLight m_directionalLight;
 
-	GLuint m_numPointLightsLocation;
-
-
 public:
 	LightScene();
 	// Constructor - Requires shader program being used in scene
@@ -80,9 +100,26 @@ public:
 	// Initializes the lightScene with correct GL locations
 	void init();
 
-	// Updates point light values in the shader
+	// Replaces the point lights, they reach the shader on the next update()
 	void setPointLights(unsigned int numLights, const PointLight * pLights);
 
+	// Sorts the point lights into clusters for the camera and uploads them.
+	// Call once per frame, after the view matrix is set
+	void update(const glm::mat4 &view, float fovY, float aspect, float zNear, float zFar, const glm::vec2 &viewportSize);
+
+	// The clusters from the last update
+	const LightClusters &clusters() const { return *m_clusters; }
+	unsigned int numPointLights() const { return (unsigned int)m_pointLights.size(); }
+
+	// Sets the viewer position used for shading, the lights glow is seen from here.
+	// Takes effect on the next update()
+	void setViewerPosition(const glm::vec3 &position);
+
+	// Sets how thick the fog is. Takes effect on the next update()
+	void setBeta(float beta);
+
 	//Updates the directional light value in the shader
 	void setDirectionalLight(const DirectionalLight& light);
+	// The directional light last set, its direction is in view space
+	const DirectionalLight &directionalLight() const { return m_directionalLight; }
 };
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include <stdio.h>
 
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <random>
 
 #include "opengl.hpp"
 
@@ -9,6 +11,14 @@
 #include "cgra/imgui_impl_glfw_gl3.h"
 
 #include "SolarSystem.hpp"
+#include "Headless.hpp"
+#include "InputRecording.hpp"
+
+// Simulated time between frames while recording, so a replay steps the same way
+static const double RECORD_STEP = 1.0 / 60.0;
+
+// Where the callbacks save the input they pass on, while recording
+static InputRecording *g_recording = nullptr;
 
 // Forward definition of callbacks
 extern "C" {
@@ -24,8 +34,14 @@ extern "C" {
 }
 
 int main(int argc, const char** argv) {
-    (void)argc;
-    (void)argv;
+    HeadlessOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    // No window, render offscreen and report timings
+    if (options.enabled) {
+        return runHeadless(options);
+    }
 
     // Initialize GLFW
     if (!glfwInit()) {
@@ -101,22 +117,27 @@ int main(int argc, const char** argv) {
         glDebugMessageControlARB(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, true);
     }
 
-    // Enabe depth testing
-    glEnable(GL_DEPTH_TEST);
-
-    // Enable backface culling
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    // Faces with a clockwise winding order when viewed are
-    // front-facing
-    glFrontFace(GL_CCW);
-
-	glDisable(GL_BLEND);
+    // Depth testing, backface culling and so on
+    setupRenderState();
 
     {
         // Create the application object
 		SolarSystem app(window);
 
+        // A recording needs a seed to replay with, so it gets one if there isn't one already
+        unsigned int seed = options.seed;
+        if (!options.recordFile.empty() && seed == 0) {
+            seed = std::max(std::random_device()(), 1u);
+        }
+        app.seed = seed;
+        int windowWidth, windowHeight;
+        glfwGetWindowSize(window, &windowWidth, &windowHeight);
+        InputRecording recording(seed, float(RECORD_STEP), glm::ivec2(windowWidth, windowHeight));
+        if (!options.recordFile.empty()) {
+            g_recording = &recording;
+            app.recording = &recording; // For the changes made in the GUI
+        }
+
         // Tell GLFW to pass along a pointer to `app` in callbacks
         glfwSetWindowUserPointer(window, reinterpret_cast<void *>(&app));
 
@@ -141,6 +162,11 @@ int main(int argc, const char** argv) {
                 glViewport(0, 0, width, height);
                 // Update the app's window size
                 app.setWindowSize(width, height);
+                if (g_recording) {
+                    app.frameTime = g_recording->size() * RECORD_STEP;
+                } else {
+                    app.frameTime = glfwGetTime();
+                }
 
 			
                 // Clear the color and depth buffers.
@@ -155,6 +181,9 @@ int main(int argc, const char** argv) {
 
                 // Draw the scene.
                 app.drawScene();
+                if (g_recording) {
+                    g_recording->endFrame(app.position, app.position + app.direction, app.galaxyOrigin);
+                }
 
                 // Make sure that we're drawing with the correct
                 // polygon mode
@@ -167,6 +196,16 @@ int main(int argc, const char** argv) {
                 // Next frame we draw to the other buffer
                 glfwSwapBuffers(window);
             }
+
+            if (g_recording) {
+                g_recording = nullptr;
+                app.recording = nullptr;
+                if (recording.save(options.recordFile)) {
+                    std::cout << "Recorded " << recording.size() << " frames to " << options.recordFile << std::endl;
+                } else {
+                    std::cerr << "Error: Could not write '" << options.recordFile << "'" << std::endl;
+                }
+            }
         } catch (std::exception e) {
             // Catch any exceptions that bubble up to here and print out
             // the message
@@ -281,6 +320,15 @@ extern "C" {
         ImGuiIO& io = ImGui::GetIO();
         if (io.WantCaptureKeyboard) return;
 
+        if (g_recording) {
+            InputRecording::Event event;
+            event.type = InputRecording::KEY;
+            event.code = key;
+            event.scancode = scancode;
+            event.action = action;
+            event.mods = mods;
+            g_recording->addEvent(event);
+        }
         app->onKey(key, scancode, action, mods);
     }
 
@@ -293,6 +341,14 @@ extern "C" {
         ImGuiIO& io = ImGui::GetIO();
         if (io.WantCaptureMouse) return;
 
+        if (g_recording) {
+            InputRecording::Event event;
+            event.type = InputRecording::MOUSE_BUTTON;
+            event.code = button;
+            event.action = action;
+            event.mods = mods;
+            g_recording->addEvent(event);
+        }
         app->onMouseButton(button, action, mods);
     }
 
@@ -303,6 +359,12 @@ extern "C" {
         ImGuiIO& io = ImGui::GetIO();
         if (io.WantCaptureMouse) return;
 
+        if (g_recording) {
+            InputRecording::Event event;
+            event.type = InputRecording::CURSOR_POS;
+            event.position = glm::vec2(xpos, ypos);
+            g_recording->addEvent(event);
+        }
         app->onCursorPos(xpos, ypos);
     }
 
@@ -315,6 +377,12 @@ extern "C" {
         ImGuiIO& io = ImGui::GetIO();
         if (io.WantCaptureMouse) return;
 
+        if (g_recording) {
+            InputRecording::Event event;
+            event.type = InputRecording::SCROLL;
+            event.position = glm::vec2(xoffset, yoffset);
+            g_recording->addEvent(event);
+        }
         app->onScroll(xoffset, yoffset);
     }
 
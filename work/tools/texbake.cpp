@@ -0,0 +1,62 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "cgra/texture.hpp"
+
+static void printUsage(const char *program) {
+	std::cout << "Usage: " << program << " [--no-mipmaps] <layer list> <output.ctex>\n"
+		<< "  The layer list has one image per line, optionally followed by an r g b tint.\n"
+		<< "  Every layer is scaled to the size of the first.\n";
+}
+
+/*
+* Decodes, tints and mipmaps a list of images into one file the app can upload without decoding
+*/
+int main(int argc, const char **argv) {
+	bool mipmaps = true;
+	std::string listFile, outFile;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h") {
+			printUsage(argv[0]);
+			return 0;
+		} else if (arg == "--no-mipmaps") {
+			mipmaps = false;
+		} else if (listFile.empty()) {
+			listFile = arg;
+		} else if (outFile.empty()) {
+			outFile = arg;
+		} else {
+			std::cerr << "Error: Unexpected argument '" << arg << "'" << std::endl;
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (outFile.empty()) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+	cgra::TextureLayers layers;
+	try {
+		layers = cgra::TextureLayers::build(cgra::TextureLayers::readList(listFile), mipmaps);
+	} catch (std::exception &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+	if (layers.empty()) {
+		std::cerr << "Error: No layers in '" << listFile << "'" << std::endl;
+		return 1;
+	}
+	if (!layers.save(outFile)) {
+		std::cerr << "Error: Could not write '" << outFile << "'" << std::endl;
+		return 1;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	std::cout << "Baked " << layers.layers << " layers of " << layers.width << "x" << layers.height
+		<< " with " << layers.levels.size() << " levels into " << outFile << " (" << seconds << "s)" << std::endl;
+	return 0;
+}